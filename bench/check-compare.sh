@@ -0,0 +1,68 @@
+#!/bin/bash
+# Regression run of the parallel comparison modes on a small tree.
+# Without MD5, the analyzers answer at once and the source lister floods the MQ
+# before the destination is listed: each run must still end and copy the whole
+# source, with files lists, with runs on disk (--max-memory) and with a job file.
+# Exits with 1 at the first run that times out, fails or leaves a different tree.
+#
+# Parameters (environment variables):
+#   RUNS: number of runs of each case
+#   FILES: number of files of the source
+#   MODES: values of --compare checked
+#   WORKDIR: directory where trees are written
+#   TIMEOUT: maximum duration of a run, in seconds
+
+set -u
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+ROOT_DIR=$(dirname "$BENCH_DIR")
+SYNC="$ROOT_DIR/LP25_sync"
+
+RUNS=${RUNS:-10}
+FILES=${FILES:-5}
+MODES=${MODES:-"bytes date-size"}
+WORKDIR=${WORKDIR:-/tmp/lp25-check}
+TIMEOUT=${TIMEOUT:-10}
+
+# check_case <name> <directory checked against the source> <sync options...>
+check_case() {
+    local name=$1 destination=$2
+    shift 2
+
+    for run in $(seq 1 "$RUNS"); do
+        rm -rf "$WORKDIR/dst" "$WORKDIR/dst2"
+        mkdir -p "$WORKDIR/dst" "$WORKDIR/dst2"
+        # The sync binary derives its IPC key from its own file, it must run from the project root
+        (cd "$ROOT_DIR" && timeout "$TIMEOUT" "$SYNC" "$@" >/dev/null 2>&1)
+        local status=$?
+        if [ "$status" != 0 ]; then
+            echo "$name: run $run exited with $status" >&2
+            exit 1
+        fi
+        if ! diff -r "$WORKDIR/src" "$destination" >/dev/null; then
+            echo "$name: run $run left a destination different from the source" >&2
+            exit 1
+        fi
+    done
+    echo "$name: $RUNS runs"
+}
+
+if [ ! -x "$SYNC" ]; then
+    echo "Build LP25_sync first (make)" >&2
+    exit 1
+fi
+
+rm -rf "$WORKDIR"
+mkdir -p "$WORKDIR/src"
+for i in $(seq 1 "$FILES"); do
+    echo "file $i" > "$WORKDIR/src/file-$i"
+done
+printf '%s %s\n%s %s\n' "$WORKDIR/src" "$WORKDIR/dst" "$WORKDIR/src" "$WORKDIR/dst2" > "$WORKDIR/jobs"
+
+for mode in $MODES; do
+    check_case "$mode" "$WORKDIR/dst" --compare="$mode" -s "$WORKDIR/src" -d "$WORKDIR/dst"
+    check_case "$mode-max-memory" "$WORKDIR/dst" --compare="$mode" --max-memory 1 -s "$WORKDIR/src" -d "$WORKDIR/dst"
+    check_case "$mode-job-file" "$WORKDIR/dst2" --compare="$mode" --job-file "$WORKDIR/jobs"
+done
+
+rm -rf "$WORKDIR"
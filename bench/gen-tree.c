@@ -0,0 +1,338 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+// Reproducible synthetic tree generator for the benchmarks (@see run-bench.sh)
+// Every name, size and content only depends on the parameters and the seed.
+
+#define PATH_SIZE 4096
+#define CHUNK_SIZE (64 << 10)
+
+typedef enum { SIZE_FIXED, SIZE_UNIFORM, SIZE_PARETO } size_distribution_t;
+
+typedef struct {
+    char root[PATH_SIZE];
+    uint32_t files_count;
+    uint32_t max_depth;
+    uint32_t fanout;
+    size_distribution_t distribution;
+    uint64_t min_size;
+    uint64_t max_size;
+    double pareto_alpha;
+    uint32_t sparse_percent;
+    uint32_t hardlinks_percent;
+    uint32_t churn_percent; // When not 0, an existing tree is modified instead of generated
+    uint64_t seed;
+} generator_configuration_t;
+
+/*!
+ * @brief next_random is a xorshift64* pseudo random generator
+ * @param state is a pointer to the generator state (must not be 0)
+ * @return the next pseudo random number
+ */
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dULL;
+}
+
+/*!
+ * @brief random_unit returns a pseudo random double in ]0, 1]
+ * @param state is a pointer to the generator state
+ * @return the random number
+ */
+static double random_unit(uint64_t *state) {
+    return ((next_random(state) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+/*!
+ * @brief draw_size draws a file size from the configured distribution
+ * @param config is a pointer to the generator configuration
+ * @param state is a pointer to the generator state
+ * @return the size of the file
+ */
+static uint64_t draw_size(generator_configuration_t *config, uint64_t *state) {
+    uint64_t size = config->min_size;
+    switch (config->distribution) {
+        case SIZE_FIXED:
+            break;
+
+        case SIZE_UNIFORM:
+            size = config->min_size + next_random(state) % (config->max_size - config->min_size + 1);
+            break;
+
+        case SIZE_PARETO:
+            // Heavy tailed: most files are small, a few are very large
+            size = (uint64_t) (config->min_size / pow(random_unit(state), 1.0 / config->pareto_alpha));
+            break;
+    }
+    return size > config->max_size ? config->max_size : size;
+}
+
+/*!
+ * @brief make_file_path draws the directory of a file and builds its path, creating directories
+ * @param config is a pointer to the generator configuration
+ * @param state is a pointer to the generator state
+ * @param index is the index of the file
+ * @param prefix is the prefix of the file name (f for files, h for hardlinks)
+ * @param path is filled with the path of the file
+ * @param create_dirs is true when missing directories must be created
+ * @return 0 in case of success, -1 else
+ */
+static int make_file_path(generator_configuration_t *config, uint64_t *state, uint32_t index, char *prefix, char *path, bool create_dirs) {
+    uint32_t depth = next_random(state) % (config->max_depth + 1);
+    int length = snprintf(path, PATH_SIZE, "%s", config->root);
+
+    for (uint32_t level = 0; level < depth; level++) {
+        length += snprintf(path + length, PATH_SIZE - length, "/d%02u", (unsigned) (next_random(state) % config->fanout));
+        if (create_dirs && mkdir(path, 0755) == -1 && errno != EEXIST) {
+            perror(path);
+            return -1;
+        }
+    }
+    snprintf(path + length, PATH_SIZE - length, "/%s%07u.dat", prefix, index);
+    return 0;
+}
+
+/*!
+ * @brief write_content writes pseudo random content into a file
+ * @param fd is the descriptor of the file
+ * @param size is the number of bytes to write
+ * @param content_seed is the seed of the content
+ * @return 0 in case of success, -1 else
+ */
+static int write_content(int fd, uint64_t size, uint64_t content_seed) {
+    static uint64_t chunk[CHUNK_SIZE / sizeof(uint64_t)];
+    uint64_t state = content_seed | 1;
+
+    while (size > 0) {
+        size_t chunk_size = size < CHUNK_SIZE ? size : CHUNK_SIZE;
+        for (size_t i = 0; i < (chunk_size + 7) / 8; i++) {
+            chunk[i] = next_random(&state);
+        }
+        if (write(fd, chunk, chunk_size) != (ssize_t) chunk_size) {
+            return -1;
+        }
+        size -= chunk_size;
+    }
+    return 0;
+}
+
+/*!
+ * @brief generate_tree creates the whole tree
+ * @param config is a pointer to the generator configuration
+ * @return 0 in case of success, -1 else
+ */
+static int generate_tree(generator_configuration_t *config) {
+    uint64_t state = config->seed | 1;
+    char path[PATH_SIZE];
+    char link_path[PATH_SIZE];
+    uint64_t total_size = 0;
+
+    if (mkdir(config->root, 0755) == -1 && errno != EEXIST) {
+        perror(config->root);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < config->files_count; i++) {
+        if (make_file_path(config, &state, i, "f", path, true) == -1) {
+            return -1;
+        }
+        uint64_t size = draw_size(config, &state);
+        bool sparse = next_random(&state) % 100 < config->sparse_percent;
+        bool hardlinked = next_random(&state) % 100 < config->hardlinks_percent;
+
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+            perror(path);
+            return -1;
+        }
+        // Sparse files only hold data in their first chunk, the rest is a hole
+        int result = sparse ? write_content(fd, size < CHUNK_SIZE ? size : CHUNK_SIZE, config->seed + i) : write_content(fd, size, config->seed + i);
+        if (result == 0 && sparse) {
+            result = ftruncate(fd, size);
+        }
+        close(fd);
+        if (result == -1) {
+            perror(path);
+            return -1;
+        }
+        total_size += size;
+
+        if (hardlinked) {
+            if (make_file_path(config, &state, i, "h", link_path, true) == -1 || link(path, link_path) == -1) {
+                perror(link_path);
+                return -1;
+            }
+        }
+    }
+
+    printf("{\"generated\":\"%s\",\"files\":%u,\"bytes\":%llu,\"seed\":%llu}\n", config->root, config->files_count,
+           (unsigned long long) total_size, (unsigned long long) config->seed);
+    return 0;
+}
+
+/*!
+ * @brief churn_tree modifies churn_percent of the files of a tree generated with the same parameters
+ * Modified files keep their size, get different content in their first chunk, and a new mtime.
+ * @param config is a pointer to the generator configuration
+ * @return 0 in case of success, -1 else
+ */
+static int churn_tree(generator_configuration_t *config) {
+    uint64_t state = config->seed | 1;
+    uint64_t churn_state = (config->seed ^ 0x5deece66dULL) | 1;
+    char path[PATH_SIZE];
+    uint32_t churned = 0;
+
+    for (uint32_t i = 0; i < config->files_count; i++) {
+        // Replay the generation draws to find the same names
+        make_file_path(config, &state, i, "f", path, false);
+        uint64_t size = draw_size(config, &state);
+        next_random(&state);
+        if (next_random(&state) % 100 < config->hardlinks_percent) {
+            char link_path[PATH_SIZE];
+            make_file_path(config, &state, i, "h", link_path, false);
+        }
+
+        if (next_random(&churn_state) % 100 >= config->churn_percent) {
+            continue;
+        }
+        int fd = open(path, O_WRONLY);
+        if (fd == -1) {
+            perror(path);
+            return -1;
+        }
+        int result = write_content(fd, size < CHUNK_SIZE ? size : CHUNK_SIZE, ~(config->seed + i));
+        close(fd);
+        if (result == -1 || utimes(path, NULL) == -1) {
+            perror(path);
+            return -1;
+        }
+        churned++;
+    }
+
+    printf("{\"churned\":\"%s\",\"files\":%u}\n", config->root, churned);
+    return 0;
+}
+
+/*!
+ * @brief display_help displays the generator usage
+ * @param my_name is the name of the binary file
+ */
+static void display_help(char *my_name) {
+    printf("%s [options] root_dir\n", my_name);
+    printf("Options: \t--files <count>\tnumber of files (default 1000)\n");
+    printf("         \t--depth <depth>\tmaximum directory depth (default 3)\n");
+    printf("         \t--fanout <count>\tsubdirectories per directory (default 8)\n");
+    printf("         \t--sizes <fixed|uniform|pareto>\tfiles size distribution (default pareto)\n");
+    printf("         \t--min-size <bytes> --max-size <bytes>\tfiles size bounds (default 1024 and 64 MiB)\n");
+    printf("         \t--sparse <percent>\tpercentage of sparse files (default 0)\n");
+    printf("         \t--hardlinks <percent>\tpercentage of files with an extra hardlink (default 0)\n");
+    printf("         \t--churn <percent>\tmodifies this percentage of the files of an existing tree\n");
+    printf("         \t--seed <seed>\tgenerator seed (default 25)\n");
+}
+
+/*!
+ * @brief main parses the generator options, then generates or churns the tree
+ * @param argc its number of arguments, including its own name
+ * @param argv the array of arguments
+ * @return 0 in case of success, -1 else
+ */
+int main(int argc, char *argv[]) {
+    generator_configuration_t config = {
+        .files_count = 1000, .max_depth = 3, .fanout = 8, .distribution = SIZE_PARETO,
+        .min_size = 1024, .max_size = 64 << 20, .pareto_alpha = 1.1, .seed = 25,
+    };
+    struct option long_opts[] = {
+        {.name="files",.has_arg=1,.flag=0,.val='f'},
+        {.name="depth",.has_arg=1,.flag=0,.val='d'},
+        {.name="fanout",.has_arg=1,.flag=0,.val='o'},
+        {.name="sizes",.has_arg=1,.flag=0,.val='z'},
+        {.name="min-size",.has_arg=1,.flag=0,.val='m'},
+        {.name="max-size",.has_arg=1,.flag=0,.val='M'},
+        {.name="sparse",.has_arg=1,.flag=0,.val='s'},
+        {.name="hardlinks",.has_arg=1,.flag=0,.val='l'},
+        {.name="churn",.has_arg=1,.flag=0,.val='c'},
+        {.name="seed",.has_arg=1,.flag=0,.val='S'},
+        {.name="help",.has_arg=0,.flag=0,.val='h'},
+        {.name=0,.has_arg=0,.flag=0,.val=0},
+    };
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "h", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case 'f':
+                config.files_count = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'd':
+                config.max_depth = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'o':
+                config.fanout = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'm':
+                config.min_size = strtoull(optarg, NULL, 10);
+                break;
+
+            case 'M':
+                config.max_size = strtoull(optarg, NULL, 10);
+                break;
+
+            case 's':
+                config.sparse_percent = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'l':
+                config.hardlinks_percent = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'c':
+                config.churn_percent = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'S':
+                config.seed = strtoull(optarg, NULL, 10);
+                break;
+
+            case 'z':
+                if (strcmp(optarg, "fixed") == 0) {
+                    config.distribution = SIZE_FIXED;
+                } else if (strcmp(optarg, "uniform") == 0) {
+                    config.distribution = SIZE_UNIFORM;
+                } else if (strcmp(optarg, "pareto") == 0) {
+                    config.distribution = SIZE_PARETO;
+                } else {
+                    display_help(argv[0]);
+                    return -1;
+                }
+                break;
+            case 'h':
+                display_help(argv[0]);
+                return 0;
+            default:
+                display_help(argv[0]);
+                return -1;
+        }
+    }
+
+    if (optind >= argc || config.fanout == 0 || config.min_size > config.max_size) {
+        display_help(argv[0]);
+        return -1;
+    }
+    snprintf(config.root, sizeof(config.root), "%s", argv[optind]);
+
+    return config.churn_percent > 0 ? churn_tree(&config) : generate_tree(&config);
+}
@@ -0,0 +1,763 @@
+#include <files-list.h>
+#include <messages.h>
+#include <utility.h>
+#include <sync.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/msg.h>
+
+// Microbenchmarks of the core primitives of LP25_sync, with a regression check against a baseline (@see make microbench)
+// Each primitive is timed at several sizes: entries of the list it works on, or distinct paths it goes through.
+// Allocations are counted by wrapping the allocator at link time (-Wl,--wrap in the Makefile): only the calls made
+// from the project code are seen, not the ones made inside the C library.
+
+#define MAX_COUNTS 16
+#define SOURCE_ROOT "/home/user/documents"
+#define DESTINATION_ROOT "/mnt/backup/documents"
+#define MESSAGES_POOL_SIZE 1024 // Distinct entries and paths sent by the messages benchmarks
+
+typedef struct {
+    uint64_t counts[MAX_COUNTS]; // Sizes at which each primitive is timed
+    size_t counts_count;
+    uint64_t ops; // Operations timed per repetition for the primitives whose cost depends on the list size
+    uint32_t repeat; // The fastest repetition is kept
+    uint64_t seed;
+    uint64_t max_memory; // Sizes needing more memory are skipped, in bytes
+    double threshold; // Percentage of regression against the baseline that fails the run
+    bool allocations_only; // Times are written as 0, for a baseline shared by all machines
+    char output[PATH_SIZE];
+} bench_configuration_t;
+
+typedef struct {
+    char **paths; // Relative paths, sorted and unique
+    size_t count;
+} paths_t;
+
+typedef struct {
+    uint64_t elapsed_ns;
+    uint64_t allocations;
+} measure_t;
+
+typedef struct {
+    char primitive[64];
+    uint64_t entries;
+    uint64_t ops;
+    double ns_per_op;
+    double allocs_per_op;
+} bench_result_t;
+
+// Runs one repetition of a benchmark on the paths, timing ops operations, and returns the number of operations done
+typedef int64_t (*bench_function_t)(paths_t *paths, uint64_t ops, uint64_t *state, measure_t *measure);
+
+typedef struct {
+    const char *name;
+    bench_function_t run;
+    size_t bytes_per_entry; // Memory used per entry, to skip the sizes above --max-memory
+    bool bounded_ops; // Operations are bounded by --ops (their cost grows with the size), else there is one per entry
+} primitive_t;
+
+static bool counting = false;
+static uint64_t allocations = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    if (counting) {
+        allocations++;
+    }
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    if (counting) {
+        allocations++;
+    }
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size) {
+    if (counting) {
+        allocations++;
+    }
+    return __real_realloc(pointer, size);
+}
+
+/*!
+ * @brief next_random is a xorshift64* pseudo random generator (as in gen-tree.c)
+ * @param state is a pointer to the generator state (must not be 0)
+ * @return the next pseudo random number
+ */
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dULL;
+}
+
+/*!
+ * @brief now_ns returns the time of a monotonic clock
+ * @return the time in nanoseconds
+ */
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*!
+ * @brief measure_begin starts timing and counting allocations
+ * @param measure is a pointer to the measure
+ */
+static void measure_begin(measure_t *measure) {
+    allocations = 0;
+    counting = true;
+    measure->elapsed_ns = now_ns();
+}
+
+/*!
+ * @brief measure_end stops timing and counting allocations
+ * @param measure is a pointer to the measure
+ */
+static void measure_end(measure_t *measure) {
+    measure->elapsed_ns = now_ns() - measure->elapsed_ns;
+    counting = false;
+    measure->allocations = allocations;
+}
+
+/*!
+ * @brief draw_word writes a pseudo random lowercase word
+ * @param state is a pointer to the generator state
+ * @param word receives the word
+ * @param min_length is the minimum length of the word
+ * @param max_length is the maximum length of the word
+ * @return the length of the word
+ */
+static int draw_word(uint64_t *state, char *word, int min_length, int max_length) {
+    static const char letters[] = "abcdefghijklmnopqrstuvwxyz0123456789_-";
+    int length = min_length + next_random(state) % (max_length - min_length + 1);
+    for (int i = 0; i < length; i++) {
+        // Mostly letters, a few digits and separators
+        word[i] = letters[next_random(state) % (i == 0 ? 26 : sizeof(letters) - 1)];
+    }
+    word[length] = '\0';
+    return length;
+}
+
+/*!
+ * @brief draw_path draws a relative path looking like the ones of a home or project tree
+ * Depths follow a geometric distribution, directory names and extensions are mostly taken from
+ * small vocabularies with a skewed distribution, file names are random words.
+ * @param state is a pointer to the generator state
+ * @param path receives the path
+ */
+static void draw_path(uint64_t *state, char *path) {
+    static const char *directories[] = {
+        "src", "include", "lib", "docs", "test", "build", "assets", "images", "photos", "2024",
+        "2023", "projects", "music", "videos", "data", "config", ".git", "objects", "node_modules", "vendor",
+    };
+    static const char *extensions[] = {".c", ".h", ".txt", ".jpg", ".json", ".md", ".o", ".png", ".pdf", "", ".mp3", ".tar.gz"};
+    const size_t directories_count = sizeof(directories) / sizeof(directories[0]);
+    const size_t extensions_count = sizeof(extensions) / sizeof(extensions[0]);
+    char word[32];
+    int length = 0;
+
+    int depth = 0;
+    while (depth < 12 && next_random(state) % 100 < 60) {
+        depth++;
+    }
+    for (int level = 0; level < depth; level++) {
+        if (next_random(state) % 100 < 70) {
+            double u = (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+            length += sprintf(path + length, "%s/", directories[(size_t) (directories_count * u * u * u)]);
+        } else {
+            draw_word(state, word, 3, 12);
+            length += sprintf(path + length, "%s/", word);
+        }
+    }
+    draw_word(state, word, 3, 20);
+    double u = (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+    sprintf(path + length, "%s%s", word, extensions[(size_t) (extensions_count * u * u)]);
+}
+
+/*!
+ * @brief compare_paths orders two paths of a table (qsort callback)
+ * @param lhd is a pointer to the first path
+ * @param rhd is a pointer to the second path
+ * @return the strcmp of the paths
+ */
+static int compare_paths(const void *lhd, const void *rhd) {
+    return strcmp(*(char**) lhd, *(char**) rhd);
+}
+
+/*!
+ * @brief make_paths draws count unique relative paths, sorted as files lists are
+ * @param paths is a pointer to the paths to fill
+ * @param count is the number of paths
+ * @param state is a pointer to the generator state
+ * @return 0 in case of success, -1 else
+ */
+static int make_paths(paths_t *paths, size_t count, uint64_t *state) {
+    char path[PATH_SIZE];
+    paths->paths = (char**) malloc(sizeof(char*) * (count + 1));
+    paths->count = 0;
+    if (paths->paths == NULL) {
+        return -1;
+    }
+    while (paths->count < count) {
+        while (paths->count < count) {
+            draw_path(state, path);
+            if ((paths->paths[paths->count] = strdup(path)) == NULL) {
+                return -1;
+            }
+            paths->count++;
+        }
+        // Duplicates are drawn again
+        qsort(paths->paths, paths->count, sizeof(char*), compare_paths);
+        size_t unique = 0;
+        for (size_t i = 0; i < paths->count; i++) {
+            if (unique > 0 && strcmp(paths->paths[unique - 1], paths->paths[i]) == 0) {
+                free(paths->paths[i]);
+            } else {
+                paths->paths[unique++] = paths->paths[i];
+            }
+        }
+        paths->count = unique;
+    }
+    return 0;
+}
+
+/*!
+ * @brief free_paths frees paths made by make_paths
+ * @param paths is a pointer to the paths
+ */
+static void free_paths(paths_t *paths) {
+    for (size_t i = 0; i < paths->count; i++) {
+        free(paths->paths[i]);
+    }
+    free(paths->paths);
+    paths->paths = NULL;
+    paths->count = 0;
+}
+
+/*!
+ * @brief make_entry allocates an entry for a path of a tree, with plausible properties
+ * @param root is the root of the tree
+ * @param relative_path is the path of the file from the root
+ * @param index is used to vary the properties of the entries
+ * @return the entry, NULL in case of error
+ */
+static files_list_entry_t *make_entry(char *root, char *relative_path, uint64_t index) {
+    files_list_entry_t *entry = (files_list_entry_t*) calloc(1, sizeof(files_list_entry_t));
+    if (entry == NULL || concat_path(entry->path_and_name, root, relative_path) == NULL) {
+        free(entry);
+        return NULL;
+    }
+    entry->entry_type = FICHIER;
+    entry->mode = 0100644;
+    entry->size = 4096 + index * 37;
+    entry->mtime.tv_sec = 1700000000 + index;
+    entry->mtime.tv_nsec = index * 1009 % 1000000000;
+    memset(entry->md5sum, (int) index, sizeof(entry->md5sum));
+    return entry;
+}
+
+/*!
+ * @brief build_list builds the files list of a tree with all the paths, in order
+ * @param list is a pointer to the list to fill
+ * @param root is the root of the tree
+ * @param paths is a pointer to the paths
+ * @return 0 in case of success, -1 else
+ */
+static int build_list(files_list_t *list, char *root, paths_t *paths) {
+    for (size_t i = 0; i < paths->count; i++) {
+        files_list_entry_t *entry = make_entry(root, paths->paths[i], i);
+        if (entry == NULL) {
+            return -1;
+        }
+        add_entry_to_tail(list, entry);
+    }
+    return 0;
+}
+
+/*!
+ * @brief bench_add_file_entry inserts new files, in random order, into an ordered list of all the paths
+ */
+static int64_t bench_add_file_entry(paths_t *paths, uint64_t ops, uint64_t *state, measure_t *measure) {
+    files_list_t list = {NULL, NULL};
+    char (*new_paths)[PATH_SIZE] = malloc(PATH_SIZE * ops);
+    int64_t result = -1;
+    if (new_paths != NULL && build_list(&list, DESTINATION_ROOT, paths) == 0) {
+        char relative_path[PATH_SIZE];
+        for (uint64_t i = 0; i < ops; i++) {
+            draw_path(state, relative_path);
+            new_paths[i][0] = '\0';
+            concat_path(new_paths[i], DESTINATION_ROOT, relative_path);
+        }
+        measure_begin(measure);
+        for (uint64_t i = 0; i < ops; i++) {
+            add_file_entry(&list, new_paths[i]);
+        }
+        measure_end(measure);
+        result = ops;
+    }
+    clear_files_list(&list);
+    free(new_paths);
+    return result;
+}
+
+/*!
+ * @brief bench_add_entry_to_tail appends all the entries of a tree to a list, as the lists are received from listers
+ */
+static int64_t bench_add_entry_to_tail(paths_t *paths, uint64_t ops, uint64_t *state, measure_t *measure) {
+    files_list_t list = {NULL, NULL};
+    files_list_entry_t **entries = (files_list_entry_t**) calloc(paths->count + 1, sizeof(files_list_entry_t*));
+    int64_t result = -1;
+    size_t made = 0;
+    while (entries != NULL && made < paths->count && (entries[made] = make_entry(SOURCE_ROOT, paths->paths[made], made)) != NULL) {
+        made++;
+    }
+    if (entries != NULL && made == paths->count) {
+        measure_begin(measure);
+        for (size_t i = 0; i < paths->count; i++) {
+            add_entry_to_tail(&list, entries[i]);
+        }
+        measure_end(measure);
+        result = paths->count;
+        clear_files_list(&list);
+    } else {
+        for (size_t i = 0; i < made; i++) {
+            free(entries[i]);
+        }
+    }
+    free(entries);
+    return result;
+}
+
+/*!
+ * @brief bench_find_entry_by_name looks source files up in the destination list, as the diff does
+ */
+static int64_t bench_find_entry_by_name(paths_t *paths, uint64_t ops, uint64_t *state, measure_t *measure) {
+    files_list_t list = {NULL, NULL};
+    char (*source_paths)[PATH_SIZE] = malloc(PATH_SIZE * ops);
+    int64_t result = -1;
+    if (source_paths != NULL && build_list(&list, DESTINATION_ROOT, paths) == 0) {
+        for (uint64_t i = 0; i < ops; i++) {
+            source_paths[i][0] = '\0';
+            concat_path(source_paths[i], SOURCE_ROOT, paths->paths[next_random(state) % paths->count]);
+        }
+        size_t start_of_src = strlen(SOURCE_ROOT);
+        size_t start_of_dest = strlen(DESTINATION_ROOT);
+        uint64_t found = 0;
+        measure_begin(measure);
+        for (uint64_t i = 0; i < ops; i++) {
+            found += (find_entry_by_name(&list, source_paths[i], start_of_src, start_of_dest) != NULL);
+        }
+        measure_end(measure);
+        if (found == ops) {
+            result = ops;
+        } else {
+            fprintf(stderr, "find_entry_by_name found %llu of %llu entries\n", (unsigned long long) found, (unsigned long long) ops);
+        }
+    }
+    clear_files_list(&list);
+    free(source_paths);
+    return result;
+}
+
+/*!
+ * @brief bench_concat_path builds the destination path of each source path
+ */
+static int64_t bench_concat_path(paths_t *paths, uint64_t ops, uint64_t *state, measure_t *measure) {
+    char destination_path[PATH_SIZE];
+    uint64_t failed = 0;
+    measure_begin(measure);
+    for (size_t i = 0; i < paths->count; i++) {
+        destination_path[0] = '\0';
+        failed += (concat_path(destination_path, DESTINATION_ROOT, paths->paths[i]) == NULL);
+    }
+    measure_end(measure);
+    return failed == 0 ? (int64_t) paths->count : -1;
+}
+
+/*!
+ * @brief bench_mismatch compares the entries of a source and a destination list, a tenth of them differing
+ */
+static int64_t bench_mismatch(paths_t *paths, uint64_t ops, uint64_t *state, measure_t *measure) {
+    files_list_t source_list = {NULL, NULL};
+    files_list_t destination_list = {NULL, NULL};
+    int64_t result = -1;
+    if (build_list(&source_list, SOURCE_ROOT, paths) == 0 && build_list(&destination_list, DESTINATION_ROOT, paths) == 0) {
+        for (files_list_entry_t *cursor = destination_list.head; cursor != NULL; cursor = cursor->next) {
+            if (next_random(state) % 10 == 0) {
+                cursor->md5sum[next_random(state) % sizeof(cursor->md5sum)] ^= 1;
+            }
+        }
+        uint64_t differ = 0;
+        measure_begin(measure);
+        files_list_entry_t *destination = destination_list.head;
+        for (files_list_entry_t *source = source_list.head; source != NULL; source = source->next) {
+            differ += mismatch(source, destination, true);
+            destination = destination->next;
+        }
+        measure_end(measure);
+        result = (differ <= paths->count) ? (int64_t) paths->count : -1;
+    }
+    clear_files_list(&source_list);
+    clear_files_list(&destination_list);
+    return result;
+}
+
+/*!
+ * @brief exchange_messages sends messages through a private queue, each followed by its reception
+ * @param paths is a pointer to the paths, giving the number of messages
+ * @param measure is a pointer to the measure
+ * @param kind selects the function sending the messages: 0 for send_file_entry, 1 for send_analyze_file_command,
+ * 2 for send_analyze_file_response, 3 for send_compare_files_command
+ * @return the number of messages exchanged, -1 in case of error
+ */
+static int64_t exchange_messages(paths_t *paths, measure_t *measure, int kind) {
+    size_t pool_size = paths->count < MESSAGES_POOL_SIZE ? paths->count : MESSAGES_POOL_SIZE;
+    files_list_entry_t **entries = (files_list_entry_t**) calloc(pool_size + 1, sizeof(files_list_entry_t*));
+    int msg_queue = msgget(IPC_PRIVATE, 0600 | IPC_CREAT);
+    int64_t result = -1;
+    size_t made = 0;
+    while (entries != NULL && made < pool_size && (entries[made] = make_entry(SOURCE_ROOT, paths->paths[made], made)) != NULL) {
+        made++;
+    }
+
+    if (msg_queue != -1 && made == pool_size) {
+        any_message_t message;
+        char destination_path[PATH_SIZE];
+        uint64_t failed = 0;
+        measure_begin(measure);
+        for (size_t i = 0; i < paths->count; i++) {
+            files_list_entry_t *entry = entries[i % pool_size];
+            int sent = -1;
+            switch (kind) {
+                case 0:
+                    sent = send_file_entry(msg_queue, MSG_TYPE_TO_MAIN, entry, COMMAND_CODE_SOURCE_FILE_ENTRY);
+                    break;
+                case 1:
+                    sent = send_analyze_file_command(msg_queue, MSG_TYPE_TO_ANALYZERS, MSG_TYPE_TO_MAIN, i, entry->path_and_name);
+                    break;
+                case 2:
+                    sent = send_analyze_file_response(msg_queue, MSG_TYPE_TO_MAIN, i, entry, 0);
+                    break;
+                default:
+                    destination_path[0] = '\0';
+                    concat_path(destination_path, DESTINATION_ROOT, entry->path_and_name + strlen(SOURCE_ROOT));
+                    sent = send_compare_files_command(msg_queue, MSG_TYPE_TO_ANALYZERS, i, entry->path_and_name, destination_path);
+                    break;
+            }
+            if (sent == -1 || msgrcv(msg_queue, &message, sizeof(any_message_t) - sizeof(long), 0, 0) == -1) {
+                failed++;
+            }
+        }
+        measure_end(measure);
+        result = failed == 0 ? (int64_t) paths->count : -1;
+    }
+
+    if (msg_queue != -1) {
+        msgctl(msg_queue, IPC_RMID, NULL);
+    }
+    for (size_t i = 0; i < made; i++) {
+        free(entries[i]);
+    }
+    free(entries);
+    return result;
+}
+
+static int64_t bench_send_file_entry(paths_t *paths, uint64_t ops, uint64_t *state, measure_t *measure) {
+    return exchange_messages(paths, measure, 0);
+}
+
+static int64_t bench_send_analyze_file_command(paths_t *paths, uint64_t ops, uint64_t *state, measure_t *measure) {
+    return exchange_messages(paths, measure, 1);
+}
+
+static int64_t bench_send_analyze_file_response(paths_t *paths, uint64_t ops, uint64_t *state, measure_t *measure) {
+    return exchange_messages(paths, measure, 2);
+}
+
+static int64_t bench_send_compare_files_command(paths_t *paths, uint64_t ops, uint64_t *state, measure_t *measure) {
+    return exchange_messages(paths, measure, 3);
+}
+
+static const primitive_t primitives[] = {
+    {"add_file_entry", bench_add_file_entry, sizeof(files_list_entry_t) + 128, true},
+    {"add_entry_to_tail", bench_add_entry_to_tail, sizeof(files_list_entry_t) + 128, false},
+    {"find_entry_by_name", bench_find_entry_by_name, sizeof(files_list_entry_t) + 128, true},
+    {"concat_path", bench_concat_path, 128, false},
+    {"mismatch", bench_mismatch, 2 * sizeof(files_list_entry_t) + 128, false},
+    {"send_file_entry", bench_send_file_entry, 128, false},
+    {"send_analyze_file_command", bench_send_analyze_file_command, 128, false},
+    {"send_analyze_file_response", bench_send_analyze_file_response, 128, false},
+    {"send_compare_files_command", bench_send_compare_files_command, 128, false},
+};
+
+/*!
+ * @brief load_baseline reads the results of a previous run (its output), after the results already loaded
+ * A result whose time is 0 (--allocations-only) only checks allocations.
+ * @param path is the path of the baseline
+ * @param results is a pointer to the table of results, to be freed by the caller
+ * @param results_count is a pointer to the number of results, updated
+ * @return 0 in case of success, -1 if the baseline cannot be read
+ */
+static int load_baseline(char *path, bench_result_t **results, int64_t *results_count) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    char line[512];
+    size_t count = *results_count;
+    size_t capacity = count;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        bench_result_t result;
+        unsigned long long entries, ops;
+        if (sscanf(line, "{\"primitive\":\"%63[^\"]\",\"entries\":%llu,\"ops\":%llu,\"ns_per_op\":%lf,\"allocs_per_op\":%lf}",
+                   result.primitive, &entries, &ops, &result.ns_per_op, &result.allocs_per_op) != 5) {
+            continue;
+        }
+        result.entries = entries;
+        result.ops = ops;
+        if (count == capacity) {
+            capacity = capacity < 64 ? 64 : capacity * 2;
+            bench_result_t *table = (bench_result_t*) realloc(*results, sizeof(bench_result_t) * capacity);
+            if (table == NULL) {
+                break;
+            }
+            *results = table;
+        }
+        (*results)[count++] = result;
+    }
+    fclose(file);
+    *results_count = count;
+    return 0;
+}
+
+/*!
+ * @brief check_regression compares a result with all the baseline results of the same primitive and size
+ * @param the_config is a pointer to the configuration
+ * @param result is a pointer to the result
+ * @param baseline is the table of the baseline results
+ * @param baseline_count is the number of baseline results
+ * @return true if the result is slower or allocates more than a baseline beyond the threshold, false else
+ */
+static bool check_regression(bench_configuration_t *the_config, bench_result_t *result, bench_result_t *baseline, int64_t baseline_count) {
+    bool regressed = false;
+    bool checked = false;
+    for (int64_t i = 0; i < baseline_count; i++) {
+        if (strcmp(baseline[i].primitive, result->primitive) != 0 || baseline[i].entries != result->entries) {
+            continue;
+        }
+        double limit = 1.0 + the_config->threshold / 100.0;
+        bool slower = baseline[i].ns_per_op > 0 && result->ns_per_op > baseline[i].ns_per_op * limit;
+        bool allocates_more = result->allocs_per_op > baseline[i].allocs_per_op * limit + 0.005;
+        if (slower || allocates_more) {
+            fprintf(stderr, "Regression of %s at %llu entries: %.1f ns/op and %.3f allocs/op, baseline %.1f ns/op and %.3f allocs/op\n",
+                    result->primitive, (unsigned long long) result->entries, result->ns_per_op, result->allocs_per_op,
+                    baseline[i].ns_per_op, baseline[i].allocs_per_op);
+        }
+        regressed = regressed || slower || allocates_more;
+        checked = true;
+    }
+    if (baseline_count > 0 && checked == false) {
+        fprintf(stderr, "%s at %llu entries is not in the baseline, it is not checked\n", result->primitive, (unsigned long long) result->entries);
+    }
+    return regressed;
+}
+
+/*!
+ * @brief parse_counts reads a comma separated list of sizes
+ * @param the_config is a pointer to the configuration to fill
+ * @param text is the list
+ * @return 0 in case of success, -1 else
+ */
+static int parse_counts(bench_configuration_t *the_config, char *text) {
+    the_config->counts_count = 0;
+    for (char *field = strtok(text, ","); field != NULL; field = strtok(NULL, ",")) {
+        uint64_t count = strtoull(field, NULL, 10);
+        if (count == 0 || the_config->counts_count == MAX_COUNTS) {
+            return -1;
+        }
+        the_config->counts[the_config->counts_count++] = count;
+    }
+    return the_config->counts_count > 0 ? 0 : -1;
+}
+
+/*!
+ * @brief display_help displays the microbenchmarks usage
+ * @param my_name is the name of the binary file
+ */
+static void display_help(char *my_name) {
+    printf("%s [options]\n", my_name);
+    printf("Options: \t--counts <n,n,...>\tsizes at which each primitive is timed (default 1000,10000,100000, up to 10000000)\n");
+    printf("         \t--ops <count>\toperations timed per size for add_file_entry and find_entry_by_name (default 1000)\n");
+    printf("         \t--repeat <count>\trepetitions of each measure, the fastest is kept (default 3)\n");
+    printf("         \t--max-memory <MB>\tsizes needing more memory are skipped (default 2048)\n");
+    printf("         \t--baseline <file>\tcompares the results with the output of a previous run (may be repeated)\n");
+    printf("         \t--threshold <percent>\tregression against the baseline that fails the run (default 10)\n");
+    printf("         \t--output <file>\twrites the results into file instead of stdout, one JSON object per line\n");
+    printf("         \t--allocations-only\twrites times as 0, so that a baseline of the output only checks allocations\n");
+    printf("         \t--seed <seed>\tgenerator seed of the paths (default 25)\n");
+}
+
+/*!
+ * @brief main times all the primitives at all sizes, then checks the results against the baseline
+ * @param argc its number of arguments, including its own name
+ * @param argv the array of arguments
+ * @return 0 in case of success, 1 when a primitive regressed, -1 in case of error
+ */
+int main(int argc, char *argv[]) {
+    bench_configuration_t config = {
+        .counts = {1000, 10000, 100000}, .counts_count = 3, .ops = 1000, .repeat = 3, .seed = 25,
+        .max_memory = 2048ULL << 20, .threshold = 10.0, .allocations_only = false, .output = "",
+    };
+    bench_result_t *baseline = NULL;
+    int64_t baseline_count = 0;
+    struct option long_opts[] = {
+        {.name="counts",.has_arg=1,.flag=0,.val='c'},
+        {.name="ops",.has_arg=1,.flag=0,.val='o'},
+        {.name="repeat",.has_arg=1,.flag=0,.val='r'},
+        {.name="max-memory",.has_arg=1,.flag=0,.val='m'},
+        {.name="baseline",.has_arg=1,.flag=0,.val='b'},
+        {.name="threshold",.has_arg=1,.flag=0,.val='t'},
+        {.name="output",.has_arg=1,.flag=0,.val='O'},
+        {.name="allocations-only",.has_arg=0,.flag=0,.val='A'},
+        {.name="seed",.has_arg=1,.flag=0,.val='S'},
+        {.name="help",.has_arg=0,.flag=0,.val='h'},
+        {.name=0,.has_arg=0,.flag=0,.val=0},
+    };
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "h", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case 'c':
+                if (parse_counts(&config, optarg) == -1) {
+                    display_help(argv[0]);
+                    free(baseline);
+                    return -1;
+                }
+                break;
+
+            case 'o':
+                config.ops = strtoull(optarg, NULL, 10);
+                break;
+
+            case 'r':
+                config.repeat = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'm':
+                config.max_memory = strtoull(optarg, NULL, 10) << 20;
+                break;
+
+            case 'b':
+                if (load_baseline(optarg, &baseline, &baseline_count) == -1) {
+                    fprintf(stderr, "Cannot read baseline %s\n", optarg);
+                    free(baseline);
+                    return -1;
+                }
+                break;
+
+            case 'A':
+                config.allocations_only = true;
+                break;
+
+            case 't':
+                config.threshold = strtod(optarg, NULL);
+                break;
+
+            case 'O':
+                snprintf(config.output, sizeof(config.output), "%s", optarg);
+                break;
+
+            case 'S':
+                config.seed = strtoull(optarg, NULL, 10);
+                break;
+
+            case 'h':
+                display_help(argv[0]);
+                free(baseline);
+                return 0;
+
+            default:
+                display_help(argv[0]);
+                free(baseline);
+                return -1;
+        }
+    }
+    if (config.ops == 0 || config.repeat == 0) {
+        display_help(argv[0]);
+        free(baseline);
+        return -1;
+    }
+    FILE *output = strlen(config.output) > 0 ? fopen(config.output, "w") : stdout;
+    if (output == NULL) {
+        fprintf(stderr, "Cannot write %s\n", config.output);
+        free(baseline);
+        return -1;
+    }
+
+    int status = 0;
+    for (size_t c = 0; c < config.counts_count && status != -1; c++) {
+        uint64_t count = config.counts[c];
+        size_t primitives_count = sizeof(primitives) / sizeof(primitives[0]);
+        uint64_t state = (config.seed + count) | 1;
+        paths_t paths;
+        if (make_paths(&paths, count, &state) == -1) {
+            fprintf(stderr, "Cannot make %llu paths\n", (unsigned long long) count);
+            status = -1;
+            break;
+        }
+
+        for (size_t p = 0; p < primitives_count; p++) {
+            const primitive_t *primitive = &primitives[p];
+            if (count * primitive->bytes_per_entry > config.max_memory) {
+                fprintf(stderr, "%s at %llu entries skipped: it needs more than --max-memory\n", primitive->name, (unsigned long long) count);
+                continue;
+            }
+            uint64_t ops = (primitive->bounded_ops == true && config.ops < count) ? config.ops : count;
+            measure_t best = {UINT64_MAX, 0};
+            int64_t done = 0;
+            for (uint32_t r = 0; r < config.repeat && done != -1; r++) {
+                measure_t measure;
+                done = primitive->run(&paths, ops, &state, &measure);
+                if (done > 0 && measure.elapsed_ns < best.elapsed_ns) {
+                    best = measure;
+                }
+            }
+            if (done <= 0) {
+                fprintf(stderr, "%s at %llu entries failed\n", primitive->name, (unsigned long long) count);
+                status = -1;
+                continue;
+            }
+
+            bench_result_t result = {.entries = count, .ops = done};
+            snprintf(result.primitive, sizeof(result.primitive), "%s", primitive->name);
+            result.ns_per_op = (double) best.elapsed_ns / done;
+            result.allocs_per_op = (double) best.allocations / done;
+            fprintf(output, "{\"primitive\":\"%s\",\"entries\":%llu,\"ops\":%llu,\"ns_per_op\":%.1f,\"allocs_per_op\":%.3f}\n",
+                    result.primitive, (unsigned long long) result.entries, (unsigned long long) result.ops,
+                    config.allocations_only == true ? 0.0 : result.ns_per_op, result.allocs_per_op);
+            fflush(output);
+            if (check_regression(&config, &result, baseline, baseline_count) == true && status == 0) {
+                status = 1;
+            }
+        }
+        free_paths(&paths);
+    }
+
+    if (output != stdout) {
+        fclose(output);
+    }
+    free(baseline);
+    return status;
+}
@@ -0,0 +1,96 @@
+#!/bin/bash
+# End-to-end benchmark of LP25_sync on reproducible synthetic trees.
+# Each mode is run on a freshly generated source, in three phases:
+#   initial: empty destination, everything is copied
+#   noop:    nothing changed since the initial run
+#   churn:   CHURN percent of the source files were modified
+# One JSON object per run is written to OUTPUT (stdout by default), embedding the
+# per phase report of the run (--stats) when it succeeded.
+#
+# Parameters (environment variables):
+#   FILES, DEPTH, FANOUT, SIZES, MIN_SIZE, MAX_SIZE, SPARSE, HARDLINKS, SEED: tree generation (@see gen-tree --help)
+#   CHURN: percentage of files modified before the churn phase
+#   PROCESSES: values of -n used for the parallel modes
+#   WORKDIR: directory where trees are generated
+#   TIMEOUT: maximum duration of a run, in seconds
+#   DROP_CACHES: when 1 (and root), page cache is dropped before each run
+
+set -u
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+ROOT_DIR=$(dirname "$BENCH_DIR")
+SYNC="$ROOT_DIR/LP25_sync"
+GEN="$BENCH_DIR/gen-tree"
+
+FILES=${FILES:-2000}
+DEPTH=${DEPTH:-3}
+FANOUT=${FANOUT:-6}
+SIZES=${SIZES:-pareto}
+MIN_SIZE=${MIN_SIZE:-1024}
+MAX_SIZE=${MAX_SIZE:-16777216}
+SPARSE=${SPARSE:-5}
+HARDLINKS=${HARDLINKS:-5}
+SEED=${SEED:-25}
+CHURN=${CHURN:-1}
+PROCESSES=${PROCESSES:-"4 6 10"}
+WORKDIR=${WORKDIR:-/tmp/lp25-bench}
+TIMEOUT=${TIMEOUT:-600}
+DROP_CACHES=${DROP_CACHES:-0}
+OUTPUT=${OUTPUT:-/dev/stdout}
+
+gen_args=(--files "$FILES" --depth "$DEPTH" --fanout "$FANOUT" --sizes "$SIZES" --min-size "$MIN_SIZE"
+          --max-size "$MAX_SIZE" --sparse "$SPARSE" --hardlinks "$HARDLINKS" --seed "$SEED")
+
+# run_phase <mode> <processes> <phase> <sync options...>
+run_phase() {
+    local mode=$1 processes=$2 phase=$3
+    shift 3
+
+    if [ "$DROP_CACHES" = 1 ]; then
+        sync
+        echo 3 > /proc/sys/vm/drop_caches 2>/dev/null
+    fi
+
+    local times status stats="null"
+    rm -f "$WORKDIR/stats.json"
+    # The sync binary derives its IPC key from its own file, it must run from the project root
+    times=$( { TIMEFORMAT='%R %U %S'; time (cd "$ROOT_DIR" && timeout "$TIMEOUT" "$SYNC" "$@" --stats "$WORKDIR/stats.json" -s "$WORKDIR/src" -d "$WORKDIR/dst" >/dev/null 2>&1); } 2>&1 )
+    status=$?
+    read -r wall user sys <<< "$times"
+    if [ "$status" = 0 ] && [ -s "$WORKDIR/stats.json" ]; then
+        stats=$(tr -d '\n' < "$WORKDIR/stats.json")
+    fi
+    printf '{"mode":"%s","processes":%s,"phase":"%s","files":%s,"seed":%s,"churn":%s,"wall_s":%s,"user_s":%s,"sys_s":%s,"status":%s,"stats":%s}\n' \
+        "$mode" "$processes" "$phase" "$FILES" "$SEED" "$CHURN" "$wall" "$user" "$sys" "$status" "$stats" >> "$OUTPUT"
+}
+
+# run_mode <mode> <processes> <sync options...>
+run_mode() {
+    local mode=$1 processes=$2
+    shift 2
+
+    rm -rf "$WORKDIR/src" "$WORKDIR/dst"
+    mkdir -p "$WORKDIR/dst"
+    "$GEN" "${gen_args[@]}" "$WORKDIR/src" > /dev/null || exit 1
+
+    run_phase "$mode" "$processes" initial "$@"
+    run_phase "$mode" "$processes" noop "$@"
+    "$GEN" "${gen_args[@]}" --churn "$CHURN" "$WORKDIR/src" > /dev/null || exit 1
+    run_phase "$mode" "$processes" churn "$@"
+}
+
+if [ ! -x "$SYNC" ] || [ ! -x "$GEN" ]; then
+    echo "Build LP25_sync and bench/gen-tree first (make bench)" >&2
+    exit 1
+fi
+
+mkdir -p "$WORKDIR"
+
+run_mode no-parallel 1 --no-parallel
+run_mode no-parallel-date-size 1 --no-parallel --date-size-only
+for n in $PROCESSES; do
+    run_mode parallel "$n" -n "$n"
+    run_mode parallel-date-size "$n" -n "$n" --date-size-only
+done
+
+rm -rf "$WORKDIR/src" "$WORKDIR/dst"
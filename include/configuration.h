@@ -2,15 +2,79 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <defines.h>
+
+typedef enum { COMPARE_MD5, COMPARE_DATE_SIZE, COMPARE_BYTES, COMPARE_SAMPLED } compare_mode_t;
+// PROGRESS_TTY refreshes one status line in place, PROGRESS_LINES prints one JSON object per report
+typedef enum { ANALYSIS_ORDER_PATH, ANALYSIS_ORDER_LARGEST_FIRST } analysis_order_t;
+// Physical order of reads for rotational or network storage: by inode number, or by first extent (FIEMAP)
+typedef enum { IO_ORDER_NONE, IO_ORDER_INODE, IO_ORDER_EXTENT } io_order_t;
+typedef enum { PROGRESS_NONE, PROGRESS_TTY, PROGRESS_LINES } progress_mode_t;
+// WATCH_AUTO uses fanotify when the process is allowed to, inotify else
+typedef enum { WATCH_NONE, WATCH_AUTO, WATCH_FANOTIFY, WATCH_INOTIFY } watch_mode_t;
+
+#define DEFAULT_SAMPLE_THRESHOLD (64 << 20)
+#define DEFAULT_SAMPLE_BLOCK_SIZE (128 << 10)
+#define DEFAULT_SAMPLE_BLOCKS_COUNT 16
+#define DEFAULT_PROGRESS_INTERVAL_MS 1000
+#define DEFAULT_MANIFEST_VERIFY_COUNT 32
+#define DEFAULT_WATCH_DELAY_MS 500
+#define DEFAULT_PARALLEL_JOBS 4
 
 typedef struct {
     char source[1024];
     char destination[1024];
+    char **extra_destinations; // Destinations after the first -d, written from the same reads of the source
+    uint32_t extra_destinations_count;
+    char remote_command[1024]; // Shell command running the destination side (--serve), -d then is a path on its side
+    char remote_socket[1024]; // Unix socket of a destination side started with --serve=<socket>
+    bool serve; // Runs the destination side of a remote synchronization
+    char serve_socket[1024]; // Unix socket the destination side listens to, empty for stdin and stdout
+    char job_file[1024]; // Pairs to synchronize instead of source and destination, empty when disabled
+    uint32_t parallel_jobs; // Jobs of the job file synchronized at the same time, over the same analyzers
     uint8_t processes_count;
+    bool auto_processes; // -n auto: the analyzers pool is sized from the CPUs and adapts during the run
+    analysis_order_t analysis_order; // Order in which listers send files to the analyzers
+    io_order_t io_order; // Order of analyses and copies, overrides analysis_order
     bool is_parallel;
     bool dry_run;
     bool uses_md5;
+    compare_mode_t compare_mode;
+    uint64_t sample_threshold; // Files from this size get a sampled digest (--compare=sampled)
+    uint32_t sample_block_size; // Size of the head, tail and evenly spaced sampled blocks
+    uint32_t sample_blocks_count; // Number of evenly spaced blocks between head and tail
+    bool share_digests; // Hardlinked inodes are hashed once per run
+    char stats_file[1024]; // Where to write the run statistics (JSON), empty when disabled
+    char trace_file[1024]; // Where to write the Chrome trace of the run, empty when disabled
+    uint64_t max_memory; // Bound of the memory used by the files lists, in bytes (0: lists are kept in memory)
+    char spill_dir[1024]; // Where sorted runs are written with max_memory, empty for $TMPDIR
+    char manifest_file[1024]; // Trusted manifest of the destination, empty when the destination is always listed
+    uint32_t manifest_verify_count; // Destination files checked against the manifest before it is trusted
+    char journal_file[1024]; // Journal of the copies, resumed by the next run after an interruption, empty when disabled
+    bool verify_copy; // Copies hash the data they write, checked against the digest of the analysis
+    uint64_t pack_threshold; // Files below this size are packed into the pack store of the destination (0: plain destination)
+    bool restore; // Extracts the files of the pack store given as source into the destination
+    char scan_state_file[1024]; // State of the previous scan of the source, empty when the source is always fully listed
+    bool trust_scan_state; // Files of unchanged directories keep their saved properties without being checked
+    char **filter_rules; // --exclude, --include and --exclude-from in command line order, prefixed as in filter.h
+    uint32_t filter_rules_count;
+    char filter_file[256]; // Name of the per directory rules files, empty when disabled
+    uint64_t min_file_size; // Size and age predicates, 0 when disabled (age in seconds)
+    uint64_t max_file_size;
+    uint64_t min_age;
+    uint64_t max_age;
+    uint64_t read_rate; // Limits of reads to hash or compare files and of copies, shared by all processes (0: unlimited)
+    uint64_t read_iops; // Bytes or operations per second
+    uint64_t copy_rate;
+    uint64_t copy_iops;
+    bool idle_io; // All processes get the idle I/O class
+    int nice_increment; // Added to the CPU nice value of all processes
+    watch_mode_t watch_mode; // Keeps synchronizing the changes of the source after the first synchronization
+    uint32_t watch_delay_ms; // Quiet time after a change before the changed paths are synchronized
+    progress_mode_t progress_mode;
+    uint32_t progress_interval_ms; // Time between two progress reports
     bool verbose;
+    bool snapshot;
 } configuration_t;
 
 void init_configuration(configuration_t *the_config);
@@ -1,3 +1,4 @@
 #pragma once
 
-#define PATH_SIZE 4096
\ No newline at end of file
+#define PATH_SIZE 4096
+#define MAX_PARALLEL_JOBS 16 // Jobs of a job file run at the same time (--parallel-jobs), each in its own slot
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define DEFAULT_DIGEST_CACHE_SLOTS (1 << 18)
+#define DIGEST_CACHE_MAX_PROBES 32
+
+#define DIGEST_SLOT_EMPTY 0
+#define DIGEST_SLOT_BUSY 1
+#define DIGEST_SLOT_READY 2
+
+typedef struct {
+    uint32_t state; // DIGEST_SLOT_*, only changed with atomic operations
+    dev_t device;
+    ino_t inode;
+    uint64_t size;
+    struct timespec mtime;
+    uint8_t md5sum[16];
+} digest_cache_slot_t;
+
+typedef struct {
+    uint32_t slots_count; // Power of 2
+    digest_cache_slot_t slots[];
+} digest_cache_t;
+
+digest_cache_t *create_digest_cache(uint32_t slots_count);
+void destroy_digest_cache(digest_cache_t *cache);
+bool digest_cache_lookup(digest_cache_t *cache, struct stat *file_stats, uint8_t *md5sum);
+void digest_cache_publish(digest_cache_t *cache, struct stat *file_stats, uint8_t *md5sum);
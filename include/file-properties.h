@@ -3,8 +3,25 @@
 #include <files-list.h>
 #include <stdbool.h>
 #include <configuration.h>
+#include <digest-cache.h>
 
-int get_file_stats(files_list_entry_t *entry);
+#define COMPARE_BUFFER_SIZE (1 << 20)
+#define HASH_BUFFER_SIZE (128 << 10)
+
+typedef struct {
+    bool use_md5; // Set to true when computing MD5sum for files
+    uint64_t sample_threshold; // Files from this size get a sampled MD5sum, 0 disables sampling
+    uint32_t sample_block_size;
+    uint32_t sample_blocks_count;
+    digest_cache_t *cache; // Digests of hardlinked inodes already hashed during the run, NULL if disabled
+} digest_options_t;
+
+void make_digest_options(configuration_t *the_config, digest_cache_t *cache, digest_options_t *options);
+bool has_whole_digest(configuration_t *the_config, files_list_entry_t *entry);
+bool digests_compatible(configuration_t *the_config, uint32_t compare_mode, uint64_t sample_threshold, uint32_t sample_block_size, uint32_t sample_blocks_count);
+int get_file_stats(files_list_entry_t *entry, digest_options_t *options);
 int compute_file_md5(files_list_entry_t *entry);
+int compute_file_sampled_md5(files_list_entry_t *entry, digest_options_t *options);
+int compare_files_content(char *lhd_path, char *rhd_path);
 bool directory_exists(char *path_to_dir);
 bool is_directory_writable(char *path_to_dir);
\ No newline at end of file
@@ -25,6 +25,8 @@ typedef struct {
 void clear_files_list(files_list_t *list);
 int add_file_entry(files_list_t *list, char *file_path);
 int add_entry_to_tail(files_list_t *list, files_list_entry_t *entry);
+files_list_entry_t **files_list_to_table(files_list_t *list, size_t *entries_count);
+int merge_files_lists(files_list_t *list, files_list_t *other);
 files_list_entry_t *find_entry_by_name(files_list_t *list, char *file_path, size_t start_of_src, size_t start_of_dest);
 void display_files_list(files_list_t *list);
 void display_files_list_reversed(files_list_t *list);
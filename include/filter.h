@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <defines.h>
+#include <configuration.h>
+
+// Rules of the configuration are prefixed by their origin (see set_configuration)
+#define FILTER_EXCLUDE_PREFIX '-' // --exclude <pattern>
+#define FILTER_INCLUDE_PREFIX '+' // --include <pattern>
+#define FILTER_FILE_PREFIX '@' // --exclude-from <file>
+
+#define FILTER_LINE_SIZE 1024
+
+// Patterns are classified once so that most of them are matched without the glob matcher
+typedef enum { FILTER_LITERAL, FILTER_SUFFIX, FILTER_PREFIX, FILTER_GLOB } filter_kind_t;
+
+typedef struct {
+    char *pattern; // Without its '!', leading and trailing '/', nor its '*' for FILTER_SUFFIX and FILTER_PREFIX
+    size_t length;
+    filter_kind_t kind;
+    bool include; // '!' pattern or --include: the match is kept
+    bool directories_only; // Trailing '/'
+    bool anchored; // The pattern has a '/': it matches the path from the directory of the rule, else any name
+} filter_rule_t;
+
+typedef struct {
+    filter_rule_t *rules;
+    size_t count;
+    size_t capacity;
+} filter_rules_t;
+
+// Rules of a directory being walked (from its rule file), relative to the root of the walk
+typedef struct {
+    size_t base_length; // Length of the relative path of the directory
+    filter_rules_t rules;
+} filter_scope_t;
+
+int filter_init(configuration_t *the_config);
+void filter_release(void);
+bool filter_begin_walk(char *target);
+void filter_end_walk(void);
+bool filter_enter_directory(char *path);
+void filter_leave_directory(void);
+bool filter_excludes_file(char *path, struct stat *file_stats);
+bool filter_excludes_path(char *path);
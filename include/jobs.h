@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <configuration.h>
+#include <processes.h>
+
+#define JOB_NAME_SIZE 64
+#define JOB_LINE_SIZE 4096
+#define JOB_MAX_FIELDS 16
+
+// One source/destination pair of a job file, with the options that may differ between jobs.
+// The other options of the command line apply to all jobs.
+typedef struct {
+    char name[JOB_NAME_SIZE];
+    char source[1024];
+    char destination[1024];
+    char stats_file[1024]; // Empty to use --stats suffixed by the job name
+    char manifest_file[1024]; // Empty to use --manifest (one manifest is only valid for one destination)
+    uint32_t max_analyzers; // Most files analyzed at the same time for the job, 0 for the whole pool
+    bool dry_run;
+    bool snapshot;
+} job_t;
+
+typedef struct {
+    job_t *jobs;
+    size_t count;
+} jobs_list_t;
+
+int load_jobs(char *path, jobs_list_t *jobs);
+void free_jobs(jobs_list_t *jobs);
+int run_jobs(configuration_t *the_config, process_context_t *p_context, jobs_list_t *jobs);
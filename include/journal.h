@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <defines.h>
+#include <files-list.h>
+#include <configuration.h>
+
+#define JOURNAL_MAGIC "LP25JRN1"
+#define JOURNAL_VERSION 1
+#define JOURNAL_CHECKPOINT_MIN_COPIES 4096 // Fewest completed copies between two compactions of the journal
+#define JOURNAL_PARTIAL_SUFFIX ".lp25-partial" // Copies are written under this name, then renamed
+
+// A journal file is a header and the plan (the files to copy, each a record followed by its relative path),
+// then the 8 bytes positions in the plan of the copies completed since, appended as they complete.
+// Checkpoints rewrite the journal with only the remaining plan, once half of it was completed (so that all checkpoints
+// together write the plan about twice, whatever its size). The journal is removed once the plan is done.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t entries_count;
+    char source[PATH_SIZE];
+    char destination[PATH_SIZE];
+} journal_header_t;
+
+typedef struct {
+    uint32_t path_length; // Relative path from the source, without NUL, following the record
+    uint32_t mode;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t size;
+} journal_record_t;
+
+typedef struct {
+    char path[PATH_SIZE];
+    int file; // Journal being appended to, -1 when closed
+    configuration_t *config;
+    files_list_entry_t **entries; // Plan of the run, in copy order
+    size_t entries_count;
+    bool *done;
+    uint64_t *positions; // Position of each remaining entry in the journal file
+    size_t done_since_checkpoint;
+    size_t remaining_at_checkpoint; // Copies in the plan written by the last checkpoint
+} journal_t;
+
+int journal_load(journal_t *journal, configuration_t *the_config, files_list_t *plan);
+int journal_begin(journal_t *journal, configuration_t *the_config, files_list_entry_t **entries, size_t entries_count);
+void journal_complete(journal_t *journal, size_t index);
+void journal_finish(journal_t *journal);
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <defines.h>
+#include <files-list.h>
+#include <configuration.h>
+
+#define MANIFEST_MAGIC "LP25MAN1"
+#define MANIFEST_VERSION 2
+
+// A manifest file is a header, a table of records sorted by relative path, then the paths of the records.
+// It is mapped as is by the next run, which finds destination entries by binary search.
+// The same format is the index of a pack store (see pack.h), whose records also locate the packed files.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t compare_mode; // Digests are only trusted when they were computed the same way
+    uint64_t sample_threshold;
+    uint32_t sample_block_size;
+    uint32_t sample_blocks_count;
+    uint64_t entries_count;
+    uint64_t paths_offset; // Offset of the paths in the file
+    uint64_t paths_size;
+    char root[PATH_SIZE]; // Directory described by the manifest
+} manifest_header_t;
+
+typedef struct {
+    uint64_t path_offset; // Offset of the path (without NUL) from paths_offset
+    uint32_t path_length;
+    uint32_t mode;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t size;
+    uint64_t pack_offset; // Offset of the file in its pack
+    uint32_t pack_id; // Pack holding the file, 0 when it is a regular file of the destination
+    uint8_t md5sum[16];
+} manifest_record_t;
+
+typedef struct {
+    void *data;
+    size_t length;
+    manifest_header_t *header;
+    manifest_record_t *records;
+    char *paths;
+} manifest_t;
+
+typedef struct {
+    FILE *file; // Temporary manifest, renamed on commit
+    FILE *paths;
+    uint64_t entries_count;
+    uint64_t paths_size;
+    char path[PATH_SIZE];
+    char temporary_path[PATH_SIZE];
+} manifest_writer_t;
+
+int manifest_open(manifest_t *manifest, char *path, configuration_t *the_config, char *root);
+bool manifest_verify(manifest_t *manifest, uint32_t samples_count);
+files_list_entry_t *manifest_find(manifest_t *manifest, char *relative_path, files_list_entry_t *entry);
+void manifest_get_entry(manifest_t *manifest, uint64_t index, files_list_entry_t *entry);
+int manifest_compare(manifest_t *manifest, uint64_t index, char *relative_path);
+void manifest_close(manifest_t *manifest);
+int manifest_writer_open(manifest_writer_t *writer, char *path);
+int manifest_writer_add(manifest_writer_t *writer, char *relative_path, files_list_entry_t *entry);
+int manifest_writer_add_packed(manifest_writer_t *writer, char *relative_path, files_list_entry_t *entry, uint32_t pack_id, uint64_t pack_offset);
+int manifest_writer_commit(manifest_writer_t *writer, configuration_t *the_config, char *root);
+void manifest_writer_abort(manifest_writer_t *writer);
@@ -12,12 +12,18 @@
 #define COMMAND_CODE_SOURCE_LIST_COMPLETE 0x22
 #define COMMAND_CODE_DESTINATION_FILE_ENTRY 0x03
 #define COMMAND_CODE_DESTINATION_LIST_COMPLETE 0x13
+#define COMMAND_CODE_SOURCE_LIST_RUN 0x32
+#define COMMAND_CODE_DESTINATION_LIST_RUN 0x23
+#define COMMAND_CODE_COMPARE_FILES 0x04
+#define COMMAND_CODE_FILES_COMPARED 0x14
 
 #define MSG_TYPE_TO_MAIN 1
 #define MSG_TYPE_TO_SOURCE_LISTER 2
 #define MSG_TYPE_TO_DESTINATION_LISTER 3
-#define MSG_TYPE_TO_SOURCE_ANALYZERS 4
-#define MSG_TYPE_TO_DESTINATION_ANALYZERS 5
+#define MSG_TYPE_TO_ANALYZERS 4 // Analyzers are shared by both listers (and main), see pool.h
+// Job runners (--job-file) have their own main and listers: slot n uses their types shifted by n strides (see message_type).
+// Analyzers are shared by all slots, and answer to the type of the requester.
+#define MSG_TYPE_JOB_STRIDE 4
 
 typedef struct {
     long mtype;
@@ -27,9 +33,23 @@ typedef struct {
 typedef struct {
     long mtype;
     char op_code; // Contains the analyze file opcode
-    files_list_entry_t payload;
+    int reply_to; // mtype of the requester
+    uint32_t entry_index; // Index of the entry in the requester's list, sent back in the response
+    char path[PATH_SIZE]; // Only the used part is sent
 } analyze_file_command_t;
 
+typedef struct {
+    long mtype;
+    char op_code; // Contains the file analyzed opcode
+    int8_t result; // Result of get_file_stats
+    uint32_t entry_index; // As received in the command
+    struct timespec mtime;
+    uint64_t size;
+    uint8_t md5sum[16];
+    file_type_t entry_type;
+    mode_t mode;
+} analyze_file_response_t;
+
 typedef struct {
     long mtype;
     char op_code; // Contains the analyze file opcode
@@ -43,20 +63,41 @@ typedef struct {
     char target[PATH_SIZE];
 } analyze_dir_command_t;
 
+typedef struct {
+    long mtype;
+    char op_code; // Contains the compare files opcode
+    int8_t result; // In responses: 0 when files are equal, 1 when they differ, -1 in case of error
+    int reply_to; // mtype of the requester
+    uint32_t pair_index; // Index of the pair in the requester's table
+    char paths[2 * PATH_SIZE]; // Source then destination paths, both NUL terminated (only the used part is sent)
+} compare_files_command_t;
+
 typedef union {
     simple_command_t simple_command;
     analyze_file_command_t analyze_file_command;
+    analyze_file_response_t analyze_file_response;
     analyze_dir_command_t analyze_dir_command;
     files_list_entry_transmit_t list_entry;
+    compare_files_command_t compare_files_command;
 } any_message_t;
 
-int send_analyze_dir_command(int msg_queue, int recipient, char *target_dir);
+int send_analyze_dir_command(int msg_queue, int recipient, char *target_dir, int flags);
 int send_file_entry(int msg_queue, int recipient, files_list_entry_t *file_entry, int cmd_code);
-int send_analyze_file_command(int msg_queue, int recipient, files_list_entry_t *file_entry);
-int send_analyze_file_response(int msg_queue, int recipient, files_list_entry_t *file_entry);
+int send_analyze_file_command(int msg_queue, int recipient, int reply_to, uint32_t entry_index, char *path);
+int send_analyze_file_response(int msg_queue, int recipient, uint32_t entry_index, files_list_entry_t *file_entry, int result);
+size_t analyze_file_exchange_size(char *path);
 int send_files_source_list_element(int msg_queue, int recipient, files_list_entry_t *file_entry);
 int send_files_destination_list_element(int msg_queue, int recipient, files_list_entry_t *file_entry);
 int send_source_list_end(int msg_queue, int recipient);
+int send_source_list_run(int msg_queue, int recipient, char *run_path);
+int send_destination_list_run(int msg_queue, int recipient, char *run_path);
 int send_destination_list_end(int msg_queue, int recipient);
+int send_compare_files_command(int msg_queue, int recipient, uint32_t pair_index, char *source_path, char *destination_path);
+int send_compare_files_response(int msg_queue, int recipient, uint32_t pair_index, int result);
+size_t compare_files_exchange_size(char *source_path, char *destination_path);
 int send_terminate_command(int msg_queue, int recipient);
-int send_terminate_confirm(int msg_queue, int recipient);
\ No newline at end of file
+int send_terminate_confirm(int msg_queue, int recipient);
+
+void message_set_job_slot(uint32_t slot);
+long message_type(long type);
+uint32_t message_job_slot(long type);
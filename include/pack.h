@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <defines.h>
+#include <files-list.h>
+#include <configuration.h>
+
+#define PACK_DIRECTORY ".lp25-pack" // Directory of the store in the destination
+#define PACK_INDEX_NAME "index"
+#define PACK_MAX_SIZE (1ULL << 30) // A new pack is started once the current one reaches this size
+
+// A pack store keeps the files smaller than --pack-threshold appended into a few large pack files, and larger
+// files as regular files of the destination. Its index is a manifest (see manifest.h) of all the files, whose
+// records give the pack and the offset of packed files. Packs are only appended to: the index is replaced once
+// the packs are synced, so that bytes appended by an interrupted run are never referenced.
+typedef struct {
+    char directory[PATH_SIZE];
+    int file; // Pack being appended to, -1 until a file is packed
+    uint32_t pack_id;
+    uint64_t pack_size;
+} pack_store_t;
+
+bool pack_synchronize(configuration_t *the_config, files_list_t *source_list);
+int pack_restore(configuration_t *the_config);
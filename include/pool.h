@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <defines.h>
+
+#define POOL_MAX_ANALYZERS 64
+#define POOL_ADJUST_PERIOD_MS 250
+// A file is worth this many bytes when measuring the analyzers' throughput (open, stat, small reads)
+#define POOL_FILE_COST_BYTES (64 << 10)
+// Above this share of I/O wait, adding analyzers only adds seeks
+#define POOL_IOWAIT_HIGH 0.5
+
+// Lives in an anonymous shared mapping. Requesters (listers, main) take a slot per request they send
+// to the analyzers, and give it back with the response.
+typedef struct {
+    uint32_t analyzers_count; // Number of forked analyzers, upper bound of active
+    uint32_t active; // Number of requests that may be processed at the same time
+    uint32_t in_flight; // Requests sent and not answered yet, by all requesters
+    uint32_t requesters; // Requesters currently sending requests, who share the active slots
+    uint32_t job_limits[MAX_PARALLEL_JOBS + 1]; // Most requests in flight for the job of each slot (--job-file), 0 when unlimited
+    uint32_t job_in_flight[MAX_PARALLEL_JOBS + 1]; // Requests in flight for the job of each slot
+    int64_t budget_bytes; // Room left in the message queue for requests and their responses
+    bool adaptive; // Whether active follows the measured throughput
+    bool saturated; // Whether a request waited for a slot since the last adjustment
+    uint64_t completed_work; // Work done by the analyzers (bytes, see POOL_FILE_COST_BYTES)
+    // Controller state, only used by the requester holding adjusting
+    uint32_t adjusting;
+    uint64_t last_adjust_ns;
+    uint64_t last_work;
+    double last_rate;
+    int32_t direction;
+    uint64_t last_iowait;
+    uint64_t last_cpu_total;
+} analyzers_pool_t;
+
+int pool_init(uint32_t analyzers_count, uint32_t initial_active, bool adaptive, size_t budget_bytes);
+void pool_release(void);
+uint32_t pool_available_cpus(void);
+void pool_join(void);
+void pool_leave(void);
+bool pool_try_acquire(uint32_t my_in_flight, size_t exchange_bytes);
+void pool_complete(size_t exchange_bytes, uint64_t file_size);
+void pool_wait(void);
+uint32_t pool_active(void);
+void pool_set_job(uint32_t slot, uint32_t limit);
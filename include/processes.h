@@ -5,36 +5,46 @@
 #include <sys/types.h>
 #include <files-list.h>
 #include <stdbool.h>
+#include <file-properties.h>
+#include <defines.h>
+#include <signal.h>
+
+// Sent to the forked processes when main dies without cleaning up (see make_process)
+#define PARENT_DEATH_SIGNAL SIGUSR1
 
 typedef struct {
     uint8_t processes_count;
     pid_t main_process_pid;
     pid_t source_lister_pid;
     pid_t destination_lister_pid;
-    pid_t *source_analyzers_pids;
-    pid_t *destination_analyzers_pids;
-    key_t shared_key;
-    int message_queue_id;
+    pid_t *analyzers_pids; // Terminated by a 0 PID
+    int message_queue_id; // Private queue of the run, inherited by the forked processes
+    digest_cache_t *digest_cache; // Shared by all processes, NULL when digest sharing is disabled
+    pid_t progress_reporter_pid; // 0 when progress is not reported
 } process_context_t;
 
 typedef struct {
     int my_recipient_id; // Id of analyzers' MQ topic
     int my_receiver_id; // Id of MQ topic to listen to
-    int analyzers_count; // Number of analyzers available
-    key_t mq_key;
+    int mq_id;
+    analysis_order_t analysis_order;
+    io_order_t io_order; // Overrides analysis_order when set
+    size_t batch_entries; // Entries per sorted run with --max-memory, 0 when lists are sent entry by entry
+    char spill_directory[PATH_SIZE]; // Where run files are written
 } lister_configuration_t;
 
 typedef struct {
-    int my_recipient_id; // Id of my lister
-    int my_receiver_id; // Id I must listen to
-    key_t mq_key;
-    bool use_md5; // Set to true when computing MD5sum for files
+    int my_receiver_id; // Id I must listen to (responses go to the requester, see analyze_file_command_t)
+    int mq_id;
+    digest_options_t digest_options; // How files are hashed
 } analyzer_configuration_t;
 
 typedef void (*process_loop_t)(void *);
 
 int prepare(configuration_t *the_config, process_context_t *p_context);
 int make_process(process_context_t *p_context, process_loop_t func, void *parameters);
+int make_listers(configuration_t *the_config, process_context_t *p_context);
+void terminate_listers(process_context_t *p_context);
 void lister_process_loop(void *parameters);
 void analyzer_process_loop(void *parameters);
 void clean_processes(configuration_t *the_config, process_context_t *p_context);
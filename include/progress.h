@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <configuration.h>
+
+typedef enum {
+    PROGRESS_PHASE_SCAN,
+    PROGRESS_PHASE_DIFF,
+    PROGRESS_PHASE_COPY,
+    PROGRESS_PHASE_DONE,
+    PROGRESS_PHASES_COUNT
+} progress_phase_t;
+
+typedef enum {
+    PROGRESS_FILES_DISCOVERED,
+    PROGRESS_FILES_ANALYZED,
+    PROGRESS_BYTES_ANALYZED,
+    PROGRESS_FILES_TO_COPY,
+    PROGRESS_BYTES_TO_COPY,
+    PROGRESS_FILES_COPIED,
+    PROGRESS_BYTES_COPIED,
+    PROGRESS_COUNTERS_COUNT
+} progress_counter_t;
+
+// Lives in an anonymous shared mapping: processes only add to the counters, the reporter only reads them
+typedef struct {
+    uint64_t counters[PROGRESS_COUNTERS_COUNT];
+    uint32_t phase;
+    uint32_t finished;
+    uint64_t start_ns;
+} progress_t;
+
+int progress_init(void);
+void progress_release(void);
+void progress_add(progress_counter_t counter, uint64_t value);
+void progress_set_phase(progress_phase_t phase);
+pid_t progress_start_reporter(progress_mode_t mode, uint32_t interval_ms);
+void progress_stop_reporter(pid_t reporter_pid);
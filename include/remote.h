@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <files-list.h>
+#include <configuration.h>
+#include <stream.h>
+
+#define REMOTE_MAGIC "LP25RMT1"
+#define REMOTE_VERSION 1
+#define REMOTE_DATA_SIZE (256 << 10) // File bytes per data frame
+#define REMOTE_ENTRY_FIXED_SIZE 45 // Encoded entry without its path, see encode_entry
+#define REMOTE_FLAG_VERIFY 0x01 // The remote side checks the received data against the digest of the file
+
+// A remote synchronization runs the destination side (lister, analyzers and writer) in another instance, started
+// with --serve and reached through a stream (see stream.h). The source side lists and analyzes the source while
+// the destination side lists and analyzes the destination, which is streamed back as entries. The files to copy
+// are then streamed out one after the other, without waiting: each is acknowledged in order by FILE_DONE.
+//   client                                       server
+//   HELLO (options, destination)         ->
+//                                        <-      READY or ERROR, then ENTRY... LIST_END
+//   FILE, DATA..., FILE_END or FILE_ABORT ->     (any number in flight)
+//                                        <-      FILE_DONE (one per FILE, in order)
+//   DONE                                 ->
+//                                        <-      SUMMARY
+typedef enum {
+    REMOTE_HELLO = 1,
+    REMOTE_READY,
+    REMOTE_ERROR,
+    REMOTE_ENTRY,
+    REMOTE_LIST_END,
+    REMOTE_FILE,
+    REMOTE_DATA,
+    REMOTE_FILE_END,
+    REMOTE_FILE_ABORT,
+    REMOTE_FILE_DONE,
+    REMOTE_DONE,
+    REMOTE_SUMMARY,
+} remote_frame_t;
+
+typedef struct {
+    stream_t stream;
+    pid_t command_pid; // Process running --remote-command, 0 with --remote-socket
+} remote_session_t;
+
+int remote_connect(remote_session_t *session, configuration_t *the_config);
+int remote_receive_list(remote_session_t *session, configuration_t *the_config, files_list_t *dest_list);
+bool remote_send_files(remote_session_t *session, configuration_t *the_config, files_list_entry_t **plan, size_t plan_count);
+int remote_close(remote_session_t *session);
+int remote_serve(configuration_t *the_config);
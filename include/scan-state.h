@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <defines.h>
+#include <files-list.h>
+#include <configuration.h>
+
+#define SCAN_STATE_MAGIC "LP25SCN1"
+#define SCAN_STATE_VERSION 1
+
+#define SCAN_CHILD_DIRECTORY 1 // The child is a directory, else a regular file
+#define SCAN_CHILD_KNOWN 2 // The properties of the file were analyzed
+
+// A scan state file is a header, the table of directories sorted by relative path, the table of their children
+// (the children of a directory are contiguous and sorted by name), then the names. It is mapped as is by the next run.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t compare_mode; // Digests are only reused when they were computed the same way
+    uint64_t sample_threshold;
+    uint32_t sample_block_size;
+    uint32_t sample_blocks_count;
+    uint64_t directories_count;
+    uint64_t children_count;
+    uint64_t names_offset; // Offset of the names in the file
+    uint64_t names_size;
+    char root[PATH_SIZE]; // Tree described by the state
+} scan_state_header_t;
+
+typedef struct {
+    uint64_t path_offset; // Path from the root (without NUL), empty for the root itself
+    uint32_t path_length;
+    uint32_t children_count;
+    uint64_t first_child;
+    uint64_t inode;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} scan_state_directory_t;
+
+typedef struct {
+    uint64_t name_offset;
+    uint32_t name_length;
+    uint32_t flags; // SCAN_CHILD_*
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t mode;
+    uint8_t md5sum[16];
+} scan_state_child_t;
+
+// Previous state, mapped read-only
+typedef struct {
+    void *data;
+    size_t length;
+    scan_state_header_t *header;
+    scan_state_directory_t *directories;
+    scan_state_child_t *children;
+    char *names;
+} scan_state_t;
+
+// Directories met by the current scan, saved once their files are analyzed
+typedef struct {
+    char *name;
+    uint32_t flags;
+    uint64_t inode;
+} scan_child_record_t;
+
+typedef struct {
+    char *path;
+    uint64_t inode;
+    struct timespec mtime;
+    scan_child_record_t *children;
+    size_t children_count;
+    size_t children_capacity;
+} scan_directory_record_t;
+
+int scan_state_init(configuration_t *the_config);
+void scan_state_release(void);
+bool scan_state_covers(char *target);
+void scan_state_list(files_list_t *list, files_list_t *known, char *target);
+bool scan_state_lookup(char *path, struct stat *file_stats, uint8_t *md5sum);
+int scan_state_save(files_list_t *list);
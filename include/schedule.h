@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <files-list.h>
+#include <configuration.h>
+
+// Files below this size are cheap to analyze and fill the gaps left by large ones
+#define SCHEDULE_SMALL_FILE_SIZE (1 << 20)
+// Share of the small files kept for the end of the schedule, when analyzers finish their last large file
+#define SCHEDULE_TAIL_SHARE 4
+
+int make_largest_first_order(files_list_entry_t **entries, size_t entries_count, size_t *order);
+int make_physical_order(files_list_entry_t **entries, size_t entries_count, io_order_t io_order, size_t *order);
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdbool.h>
+#include <files-list.h>
+#include <configuration.h>
+
+#define SNAPSHOT_NAME_FORMAT "%Y-%m-%d_%H%M%S" // UTC time of the run
+#define SNAPSHOT_NAME_LENGTH 17
+
+bool is_snapshot_name(char *name);
+int find_latest_snapshot(char *root, char *latest);
+int prepare_snapshot(configuration_t *the_config, char *previous, char *current);
+int link_entry_to_snapshot(files_list_entry_t *source_entry, configuration_t *the_config, char *previous, char *current);
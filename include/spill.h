@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <files-list.h>
+#include <configuration.h>
+
+// Maximum number of runs merged at once, main merges at most this many runs per side
+#define SPILL_MERGE_FANIN 64
+// Smallest batch sorted into a run, whatever the memory bound
+#define SPILL_MIN_BATCH_ENTRIES 64
+
+// Header of an entry in a run file, followed by path_length bytes of path (without NUL)
+typedef struct {
+    uint32_t path_length;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t size;
+    uint8_t md5sum[16];
+    uint32_t entry_type;
+    uint32_t mode;
+} spill_record_t;
+
+typedef struct {
+    char **paths; // Run files, each sorted by path
+    size_t count;
+} spill_runs_t;
+
+typedef struct {
+    FILE **files;
+    files_list_entry_t *heads; // Current entry of each run
+    bool *has_head;
+    size_t count;
+    size_t current; // Run whose head is the smallest, count when all runs are exhausted
+} spill_merger_t;
+
+// Fills the properties of the entries of a batch before it is sorted and written
+typedef void (*batch_analyzer_t)(files_list_t *batch, void *context);
+
+void spill_directory(configuration_t *the_config, char *directory);
+size_t spill_batch_entries(uint64_t memory_budget);
+int make_sorted_runs(char *target, size_t batch_entries, char *directory, batch_analyzer_t analyzer, void *context, spill_runs_t *runs);
+int spill_add_run(spill_runs_t *runs, char *path);
+void spill_free_runs(spill_runs_t *runs, bool remove_files);
+int spill_merger_open(spill_merger_t *merger, spill_runs_t *runs);
+files_list_entry_t *spill_merger_peek(spill_merger_t *merger);
+void spill_merger_next(spill_merger_t *merger);
+void spill_merger_close(spill_merger_t *merger);
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define STATS_HISTOGRAM_BUCKETS 32
+
+typedef enum {
+    STATS_PHASE_LISTING,
+    STATS_PHASE_ANALYSIS,
+    STATS_PHASE_TRANSFER,
+    STATS_PHASE_DIFF,
+    STATS_PHASE_COPY,
+    STATS_PHASES_COUNT
+} stats_phase_t;
+
+typedef enum {
+    STATS_FILES_LISTED,
+    STATS_FILES_ANALYZED,
+    STATS_BYTES_HASHED,
+    STATS_BYTES_COMPARED,
+    STATS_FILES_COPIED,
+    STATS_BYTES_COPIED,
+    STATS_IPC_MESSAGES_SENT,
+    STATS_IPC_MESSAGES_RECEIVED,
+    STATS_STAT_CALLS,
+    STATS_OPEN_CALLS,
+    STATS_READ_CALLS,
+    STATS_READDIR_CALLS,
+    STATS_DIRECTORIES_REUSED,
+    STATS_DIGESTS_REUSED,
+    STATS_FILES_EXCLUDED,
+    STATS_DIRECTORIES_EXCLUDED,
+    STATS_THROTTLE_WAIT_US,
+    STATS_COPY_BYTES_READ, // Bytes read from the source by copies, once for all destinations
+    STATS_COPIES_VERIFIED, // Copies whose written data matched the digest of the analysis (--verify-copy)
+    STATS_COPIES_MISMATCHED,
+    STATS_STREAM_BYTES_SENT, // Bytes exchanged with the remote side (--remote-command, --remote-socket, --serve)
+    STATS_STREAM_BYTES_RECEIVED,
+    STATS_COUNTERS_COUNT
+} stats_counter_t;
+
+typedef enum {
+    STATS_HISTOGRAM_HASH,
+    STATS_HISTOGRAM_COPY,
+    STATS_HISTOGRAMS_COUNT
+} stats_histogram_t;
+
+typedef struct {
+    uint64_t first_start_ns; // Earliest start of the phase in any process (CLOCK_MONOTONIC)
+    uint64_t last_end_ns; // Latest end of the phase in any process
+    uint64_t wall_ns; // Sum of the durations of the phase in all processes
+    uint64_t cpu_ns; // Sum of the CPU time spent in the phase by all processes
+} stats_phase_times_t;
+
+// Lives in an anonymous shared mapping, updated atomically by all processes
+typedef struct {
+    uint64_t run_start_ns;
+    stats_phase_times_t phases[STATS_PHASES_COUNT];
+    uint64_t counters[STATS_COUNTERS_COUNT];
+    uint64_t histograms[STATS_HISTOGRAMS_COUNT][STATS_HISTOGRAM_BUCKETS]; // Bucket i counts latencies below 2^i us
+} run_stats_t;
+
+typedef struct {
+    uint64_t start_ns;
+    uint64_t cpu_start_ns;
+} stats_timer_t;
+
+int stats_init(void);
+void stats_release(void);
+void stats_set_slot(uint32_t slot);
+bool stats_enabled(void);
+void stats_reset(void);
+uint64_t stats_now_ns(void);
+uint64_t stats_cpu_now_ns(void);
+void stats_phase_begin(stats_timer_t *timer);
+void stats_phase_end(stats_phase_t phase, stats_timer_t *timer);
+void stats_phase_cpu_end(stats_phase_t phase, stats_timer_t *timer);
+void stats_add(stats_counter_t counter, uint64_t value);
+void stats_record_latency(stats_histogram_t histogram, uint64_t duration_ns);
+int stats_write_report(char *path);
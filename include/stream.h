@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define STREAM_HEADER_SIZE 5 // Type (1 byte) then payload length (4 bytes, little endian)
+#define STREAM_MAX_PAYLOAD (1 << 20)
+#define STREAM_BUFFER_SIZE (STREAM_HEADER_SIZE + STREAM_MAX_PAYLOAD) // Initial size of the input buffer, size of the output buffer
+
+// A stream carries frames over a pipe or a stream socket, in both directions. Sent frames are buffered and
+// written in large writes. While a write would block, incoming bytes are read into the input buffer, so that
+// two peers sending to each other never wait for each other: requests can be pipelined without a window.
+typedef struct {
+    int input_fd;
+    int output_fd; // May be input_fd
+    uint8_t *input;
+    size_t input_start; // First byte not consumed yet
+    size_t input_end;
+    size_t input_capacity;
+    uint8_t *output;
+    size_t output_length;
+    size_t frame_start; // Header of the frame being built by stream_begin_frame
+    bool closed; // The peer closed its side
+} stream_t;
+
+int stream_open(stream_t *stream, int input_fd, int output_fd);
+void stream_close(stream_t *stream);
+uint8_t *stream_begin_frame(stream_t *stream, uint8_t type, uint32_t max_length);
+int stream_end_frame(stream_t *stream, uint32_t length);
+int stream_send(stream_t *stream, uint8_t type, const void *payload, uint32_t length);
+int stream_flush(stream_t *stream);
+int stream_receive(stream_t *stream, bool wait, uint8_t *type, uint8_t **payload, uint32_t *length);
+
+uint8_t *stream_put_u32(uint8_t *cursor, uint32_t value);
+uint8_t *stream_put_u64(uint8_t *cursor, uint64_t value);
+uint32_t stream_get_u32(uint8_t **cursor);
+uint64_t stream_get_u64(uint8_t **cursor);
@@ -4,13 +4,36 @@
 #include <files-list.h>
 #include <configuration.h>
 #include <processes.h>
+#include <file-properties.h>
 #include <dirent.h>
+#include <spill.h>
 
-void synchronize(configuration_t *the_config, process_context_t *p_context);
-void make_files_list(files_list_t *list, char *target_path);
+#define SENDFILE_MAX_SIZE 0x7ffff000 // Most bytes transferred by one sendfile call
+#define COPY_BUFFER_SIZE (1 << 20) // Bytes read from the source at once when a file is copied to several destinations or verified
+
+typedef struct {
+    files_list_entry_t *source;
+    files_list_entry_t *destination;
+    size_t entry_index; // Position of the source entry in the source list
+    bool differ; // Set by compare_pairs_content
+} entries_pair_t;
+
+// Called on each file of a tree by walk_tree, returns -1 to stop the walk
+typedef int (*walk_callback_t)(char *path, void *context);
+
+int synchronize(configuration_t *the_config, process_context_t *p_context);
+void synchronize_paths(configuration_t *the_config, process_context_t *p_context, char **relative_paths, size_t paths_count);
+void make_files_list(files_list_t *list, char *target_path, digest_options_t *digest_options, io_order_t io_order);
 bool mismatch(files_list_entry_t *lhd, files_list_entry_t *rhd, bool has_md5);
+void compare_pairs_content(entries_pair_t *pairs, size_t pairs_count, configuration_t *the_config, process_context_t *p_context);
 void make_files_lists_parallel(files_list_t *src_list, files_list_t *dst_list, configuration_t *the_config, int msg_queue);
-void copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t *the_config);
+void make_files_runs_parallel(spill_runs_t *src_runs, spill_runs_t *dst_runs, configuration_t *the_config, int msg_queue);
+int write_buffer(int file, char *buffer, size_t size);
+int64_t copy_file_data(int source_file, int destination_file, uint64_t size, uint8_t *digest);
+int check_copied_digest(files_list_entry_t *source_entry, configuration_t *the_config, uint8_t *digest, uint64_t bytes_copied, char *path);
+int copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t *the_config);
+int copy_entry_to_destinations(files_list_entry_t *source_entry, configuration_t *the_config, char **destinations, size_t destinations_count);
 void make_list(files_list_t *list, char *target);
+int walk_tree(char *target, walk_callback_t callback, void *context);
 DIR *open_dir(char *path);
 struct dirent *get_next_entry(DIR *dir);
\ No newline at end of file
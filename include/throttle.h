@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <configuration.h>
+
+#define THROTTLE_BURST_MS 50 // Operations allowed at once after an idle period, as a time of the rate
+#define THROTTLE_COPY_CHUNK (1 << 20) // Bytes sent per sendfile call when copies are limited
+
+// Ioprio values (linux/ioprio.h is not always installed)
+#define THROTTLE_IOPRIO_WHO_PROCESS 1
+#define THROTTLE_IOPRIO_CLASS_IDLE 3
+#define THROTTLE_IOPRIO_CLASS_SHIFT 13
+
+// Reads of files to hash or compare them, and copies to the destination, have their own limits
+typedef enum { THROTTLE_READ, THROTTLE_COPY, THROTTLE_CLASSES_COUNT } throttle_class_t;
+
+// A bucket is a virtual clock (GCRA): each operation moves it forward by its cost at the rate,
+// and the caller waits until the clock no longer runs ahead of the current time.
+typedef struct {
+    uint64_t rate; // Bytes or operations per second, 0 when unlimited
+    uint64_t next_ns; // Time at which all the reserved tokens are refilled (CLOCK_MONOTONIC)
+} throttle_bucket_t;
+
+// Lives in an anonymous shared mapping, so that the limits hold for all processes together
+typedef struct {
+    throttle_bucket_t bytes[THROTTLE_CLASSES_COUNT];
+    throttle_bucket_t operations[THROTTLE_CLASSES_COUNT];
+} throttle_t;
+
+int throttle_init(configuration_t *the_config);
+void throttle_release(void);
+bool throttle_limited(throttle_class_t io_class);
+void throttle_account(throttle_class_t io_class, uint64_t bytes);
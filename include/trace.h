@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TRACE_BUFFER_EVENTS (1 << 16)
+#define TRACE_NO_ARG -1
+
+typedef struct {
+    const char *name; // Static string, so that recording an event never copies
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    int64_t arg; // Optional value shown with the event, TRACE_NO_ARG if none
+} trace_event_t;
+
+int trace_init(char *path);
+void trace_process_start(const char *process_name);
+uint64_t trace_begin(void);
+void trace_end(const char *name, uint64_t start_ns, int64_t arg);
+void trace_flush(void);
+int trace_finish(void);
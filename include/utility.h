@@ -2,4 +2,5 @@
 
 #include <defines.h>
 
-char *concat_path(char *result, char *prefix, char *suffix);
\ No newline at end of file
+char *concat_path(char *result, char *prefix, char *suffix);
+int make_parent_directories(char *path);
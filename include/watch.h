@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <defines.h>
+#include <configuration.h>
+#include <processes.h>
+#include <sys/inotify.h>
+#include <sys/fanotify.h>
+
+#define WATCH_EVENTS_BUFFER_SIZE (64 << 10)
+#define WATCH_MAX_DELAY_FACTOR 10 // Changes wait at most this many quiet delays when events keep coming
+
+// Inotify watches directories one by one, fanotify watches the whole filesystem of the source
+#define WATCH_INOTIFY_MASK (IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW)
+#define WATCH_FANOTIFY_MASK (FAN_CLOSE_WRITE | FAN_MODIFY | FAN_ATTRIB | FAN_CREATE | FAN_MOVED_TO | FAN_ONDIR)
+
+// Paths changed since the last synchronization, relative to the source (e.g. "/dir/file")
+typedef struct {
+    char **paths;
+    size_t count;
+    size_t capacity;
+    bool rescan_all; // Events were lost, the whole source must be synchronized
+    uint64_t first_change_ns;
+} watch_changes_t;
+
+typedef struct {
+    watch_mode_t mode; // WATCH_FANOTIFY or WATCH_INOTIFY
+    int fd;
+    int mount_fd; // fanotify: directory of the source, to open the handles of the events
+    char root[PATH_SIZE]; // Absolute path of the source
+    char **directories; // inotify: relative path of the directory of each watch descriptor
+    size_t directories_capacity;
+    bool limit_reported; // inotify: the watches limit was reached
+} watcher_t;
+
+void watch_handle_signals(void);
+int watch_source(configuration_t *the_config, process_context_t *p_context);
@@ -4,8 +4,11 @@
 #include <getopt.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <pool.h>
+#include <filter.h>
 
-typedef enum {DATE_SIZE_ONLY, NO_PARALLEL} long_opt_values;
+typedef enum {DATE_SIZE_ONLY, NO_PARALLEL, SNAPSHOT = 0x100, COMPARE, SAMPLE_THRESHOLD, SAMPLE_BLOCK, SAMPLE_COUNT, NO_DIGEST_SHARING, STATS, TRACE, PROGRESS, PROGRESS_INTERVAL, ANALYSIS_ORDER, IO_ORDER, MAX_MEMORY, SPILL_DIR, MANIFEST, MANIFEST_VERIFY, SCAN_STATE, TRUST_SCAN_STATE, WATCH, WATCH_DELAY, EXCLUDE, INCLUDE, EXCLUDE_FROM, FILTER_FILE, MIN_SIZE, MAX_SIZE, MIN_AGE, MAX_AGE, READ_LIMIT, READ_IOPS, COPY_LIMIT, COPY_IOPS, IDLE_IO, NICE, JOB_FILE, PARALLEL_JOBS, PACK_THRESHOLD, RESTORE, JOURNAL, VERIFY_COPY, REMOTE_COMMAND, REMOTE_SOCKET, SERVE} long_opt_values;
 
 /*!
  * @brief function display_help displays a brief manual for the program usage
@@ -14,10 +17,53 @@ typedef enum {DATE_SIZE_ONLY, NO_PARALLEL} long_opt_values;
  */
 void display_help(char *my_name) {
     printf("%s [options] source_dir destination_dir\n", my_name);
-    printf("Options: \t-n <processes count>\tnumber of processes for file calculations\n");
+    printf("       %s [options] --job-file <file>\n", my_name);
+    printf("Options: \t-d <dir> may be repeated: the source is read once and written to all destinations\n");
+    printf("         \t-n <processes count|auto>\tnumber of processes for file calculations (auto: sized from the available CPUs and adapted during the run)\n");
     printf("         \t-h display help (this text)\n");
+    printf("         \t--remote-command <command> runs the destination side with a shell command (e.g. ssh host LP25_sync --serve),\n");
+    printf("         \t                 -d then is a path on the remote host, only the stream goes through the command\n");
+    printf("         \t--remote-socket <path> connects to the destination side started with --serve=<path>\n");
+    printf("         \t--serve[=<socket>] runs the destination side of remote synchronizations, on stdin and stdout or on a Unix socket\n");
+    printf("         \t--job-file <file> synchronizes the pairs of file, one per line: source destination [name=<name>] [max-analyzers=<count>]\n");
+    printf("         \t                 [stats=<file>] [manifest=<file>] [dry-run] [snapshot], all jobs share the same analyzers\n");
+    printf("         \t--parallel-jobs <count> jobs of the job file synchronized at the same time (default %d, at most %d)\n", DEFAULT_PARALLEL_JOBS, MAX_PARALLEL_JOBS);
+    printf("         \t--analysis-order=<largest-first|path> order in which files are analyzed in parallel mode (default largest-first)\n");
+    printf("         \t--io-order=<inode|extent> reads and copies files by inode number or physical position, for rotational or network storage\n");
+    printf("         \t--max-memory <MB> bounds the memory of files lists: they are sorted into runs on disk and merged while diffing\n");
+    printf("         \t--spill-dir <dir> directory of the runs written with --max-memory (default $TMPDIR or /tmp)\n");
+    printf("         \t--manifest <file> trusts the manifest written by the previous run instead of listing the destination, then rewrites it\n");
+    printf("         \t--manifest-verify <count> number of destination files checked against the manifest before trusting it, 0 to disable (default %d)\n", DEFAULT_MANIFEST_VERIFY_COUNT);
+    printf("         \t--journal <file> records the copies to do and the completed ones, so that an interrupted run is resumed by the next one\n");
+    printf("         \t--verify-copy hashes the data of each copy as it is written and checks it against the digest of the analysis\n");
+    printf("         \t--pack-threshold <bytes> appends smaller files into the pack files of a store in the destination, with an index of all files\n");
+    printf("         \t--restore extracts all files of the pack store given as source into the destination\n");
+    printf("         \t--scan-state <file> lists the source incrementally: directories unchanged since the previous run are not read again\n");
+    printf("         \t--trust-scan-state takes the files of unchanged directories from the scan state without checking them\n");
+    printf("         \t--exclude <pattern> skips files and directories matching a gitignore-style pattern (repeatable, the last matching rule wins)\n");
+    printf("         \t--include <pattern> keeps files and directories matching a pattern, despite a previous --exclude\n");
+    printf("         \t--exclude-from <file> reads gitignore-style patterns from file\n");
+    printf("         \t--filter-file <name> reads more patterns from the files with this name in the directories of the source\n");
+    printf("         \t--min-size <bytes>, --max-size <bytes> skip smaller or larger files\n");
+    printf("         \t--min-age <seconds>, --max-age <seconds> skip files modified more recently or longer ago\n");
+    printf("         \t--read-limit <MB/s>, --read-iops <count> limit the reads to hash or compare files, over all processes\n");
+    printf("         \t--copy-limit <MB/s>, --copy-iops <count> limit the copies to the destination\n");
+    printf("         \t--idle-io runs all processes in the idle I/O scheduling class\n");
+    printf("         \t--nice <increment> lowers the CPU priority of all processes\n");
+    printf("         \t--watch[=fanotify|inotify] keeps running and synchronizes the changes of the source (fanotify when allowed, inotify else)\n");
+    printf("         \t--watch-delay <ms> quiet time after a change before changed paths are synchronized (default %d)\n", DEFAULT_WATCH_DELAY_MS);
     printf("         \t--date_size_only disables MD5 calculation for files\n");
+    printf("         \t--compare=<md5|date-size|bytes|sampled> selects how files with the same date and size are compared (default md5)\n");
+    printf("         \t--sample-threshold <bytes> smallest file size hashed by sampling with --compare=sampled (default %d)\n", DEFAULT_SAMPLE_THRESHOLD);
+    printf("         \t--sample-block <KB> size of the first, last and evenly spaced sampled blocks (default %d)\n", DEFAULT_SAMPLE_BLOCK_SIZE >> 10);
+    printf("         \t--sample-count <count> number of evenly spaced sampled blocks (default %d)\n", DEFAULT_SAMPLE_BLOCKS_COUNT);
+    printf("         \t--no-digest-sharing hashes hardlinked files once per name instead of once per inode\n");
+    printf("         \t--stats <file> writes per phase timings and counters of the run as JSON into file (- for stdout)\n");
+    printf("         \t--trace <file> records a timeline of all processes into file (Chrome trace-event format)\n");
+    printf("         \t--progress[=tty|lines] reports progress, throughput and ETA on stderr (tty when stderr is a terminal, JSON lines else)\n");
+    printf("         \t--progress-interval <ms> time between two progress reports (default %d)\n", DEFAULT_PROGRESS_INTERVAL_MS);
     printf("         \t--no-parallel disables parallel computing (cancels values of option -n)\n");
+    printf("         \t--snapshot writes a new dated snapshot into the destination, hardlinking unchanged files from the previous one\n");
 }
 
 /*!
@@ -28,10 +74,105 @@ void init_configuration(configuration_t *the_config) {
     the_config->is_parallel = true;
     the_config->dry_run = false;
     the_config->processes_count = 4; //valeur à changer car non nulle
+    the_config->auto_processes = false;
+    the_config->analysis_order = ANALYSIS_ORDER_LARGEST_FIRST;
+    the_config->io_order = IO_ORDER_NONE;
+    the_config->max_memory = 0;
+    strcpy(the_config->spill_dir, "");
+    strcpy(the_config->manifest_file, "");
+    the_config->manifest_verify_count = DEFAULT_MANIFEST_VERIFY_COUNT;
+    strcpy(the_config->journal_file, "");
+    the_config->verify_copy = false;
+    the_config->pack_threshold = 0;
+    the_config->restore = false;
+    strcpy(the_config->scan_state_file, "");
+    the_config->trust_scan_state = false;
     the_config->uses_md5 = true;
+    the_config->compare_mode = COMPARE_MD5;
+    the_config->sample_threshold = DEFAULT_SAMPLE_THRESHOLD;
+    the_config->sample_block_size = DEFAULT_SAMPLE_BLOCK_SIZE;
+    the_config->sample_blocks_count = DEFAULT_SAMPLE_BLOCKS_COUNT;
+    the_config->share_digests = true;
+    strcpy(the_config->stats_file, "");
+    strcpy(the_config->trace_file, "");
+    the_config->filter_rules = NULL;
+    the_config->filter_rules_count = 0;
+    strcpy(the_config->filter_file, "");
+    the_config->min_file_size = 0;
+    the_config->max_file_size = 0;
+    the_config->min_age = 0;
+    the_config->max_age = 0;
+    the_config->read_rate = 0;
+    the_config->read_iops = 0;
+    the_config->copy_rate = 0;
+    the_config->copy_iops = 0;
+    the_config->idle_io = false;
+    the_config->nice_increment = 0;
+    the_config->watch_mode = WATCH_NONE;
+    the_config->watch_delay_ms = DEFAULT_WATCH_DELAY_MS;
+    the_config->progress_mode = PROGRESS_NONE;
+    the_config->progress_interval_ms = DEFAULT_PROGRESS_INTERVAL_MS;
     the_config->verbose = false;
+    the_config->snapshot = false;
     strcpy(the_config->source, "");
     strcpy(the_config->destination, "");
+    the_config->extra_destinations = NULL;
+    the_config->extra_destinations_count = 0;
+    strcpy(the_config->job_file, "");
+    the_config->parallel_jobs = DEFAULT_PARALLEL_JOBS;
+    strcpy(the_config->remote_command, "");
+    strcpy(the_config->remote_socket, "");
+    the_config->serve = false;
+    strcpy(the_config->serve_socket, "");
+}
+
+/*!
+ * @brief add_destination sets the destination, or appends another one when -d is repeated
+ * @param the_config is a pointer to the configuration
+ * @param path is the destination
+ * @return 0 when the destination was added, -1 else
+ */
+static int add_destination(configuration_t *the_config, char *path) {
+    if (strlen(path) >= sizeof(the_config->destination)) {
+        fprintf(stderr, "Destination %s is too long\n", path);
+        return -1;
+    }
+    if (strlen(the_config->destination) == 0) {
+        strcpy(the_config->destination, path);
+        return 0;
+    }
+    char **destinations = (char**) realloc(the_config->extra_destinations, sizeof(char*) * (the_config->extra_destinations_count + 1));
+    char *destination = strdup(path);
+    if (destinations == NULL || destination == NULL) {
+        free(destination);
+        fprintf(stderr, "Error allocating destinations\n");
+        return -1;
+    }
+    destinations[the_config->extra_destinations_count++] = destination;
+    the_config->extra_destinations = destinations;
+    return 0;
+}
+
+/*!
+ * @brief add_filter_rule appends a filter rule to the configuration, in command line order
+ * @param the_config is a pointer to the configuration
+ * @param prefix tells the origin of the rule (see filter.h)
+ * @param text is the pattern or the rules file
+ * @return 0 when the rule was added, -1 else
+ */
+static int add_filter_rule(configuration_t *the_config, char prefix, char *text) {
+    char **rules = (char**) realloc(the_config->filter_rules, sizeof(char*) * (the_config->filter_rules_count + 1));
+    char *rule = (char*) malloc(strlen(text) + 2);
+    if (rules == NULL || rule == NULL) {
+        free(rule);
+        fprintf(stderr, "Error allocating filter rules\n");
+        return -1;
+    }
+    rule[0] = prefix;
+    strcpy(rule + 1, text);
+    rules[the_config->filter_rules_count++] = rule;
+    the_config->filter_rules = rules;
+    return 0;
 }
 
 /*!
@@ -51,13 +192,56 @@ int set_configuration(configuration_t *the_config, int argc, char *argv[]) {
         {.name="source",.has_arg=1,.flag=0,.val='s'},
 		{.name="destination",.has_arg=1,.flag=0,.val='d'},
         {.name="help",.has_arg=0,.flag=0,.val='h'},
+        {.name="snapshot",.has_arg=0,.flag=0,.val=SNAPSHOT},
+        {.name="compare",.has_arg=1,.flag=0,.val=COMPARE},
+        {.name="sample-threshold",.has_arg=1,.flag=0,.val=SAMPLE_THRESHOLD},
+        {.name="sample-block",.has_arg=1,.flag=0,.val=SAMPLE_BLOCK},
+        {.name="sample-count",.has_arg=1,.flag=0,.val=SAMPLE_COUNT},
+        {.name="no-digest-sharing",.has_arg=0,.flag=0,.val=NO_DIGEST_SHARING},
+        {.name="stats",.has_arg=1,.flag=0,.val=STATS},
+        {.name="trace",.has_arg=1,.flag=0,.val=TRACE},
+        {.name="progress",.has_arg=2,.flag=0,.val=PROGRESS},
+        {.name="progress-interval",.has_arg=1,.flag=0,.val=PROGRESS_INTERVAL},
+        {.name="analysis-order",.has_arg=1,.flag=0,.val=ANALYSIS_ORDER},
+        {.name="io-order",.has_arg=1,.flag=0,.val=IO_ORDER},
+        {.name="max-memory",.has_arg=1,.flag=0,.val=MAX_MEMORY},
+        {.name="spill-dir",.has_arg=1,.flag=0,.val=SPILL_DIR},
+        {.name="manifest",.has_arg=1,.flag=0,.val=MANIFEST},
+        {.name="manifest-verify",.has_arg=1,.flag=0,.val=MANIFEST_VERIFY},
+        {.name="scan-state",.has_arg=1,.flag=0,.val=SCAN_STATE},
+        {.name="trust-scan-state",.has_arg=0,.flag=0,.val=TRUST_SCAN_STATE},
+        {.name="exclude",.has_arg=1,.flag=0,.val=EXCLUDE},
+        {.name="include",.has_arg=1,.flag=0,.val=INCLUDE},
+        {.name="exclude-from",.has_arg=1,.flag=0,.val=EXCLUDE_FROM},
+        {.name="filter-file",.has_arg=1,.flag=0,.val=FILTER_FILE},
+        {.name="min-size",.has_arg=1,.flag=0,.val=MIN_SIZE},
+        {.name="max-size",.has_arg=1,.flag=0,.val=MAX_SIZE},
+        {.name="min-age",.has_arg=1,.flag=0,.val=MIN_AGE},
+        {.name="max-age",.has_arg=1,.flag=0,.val=MAX_AGE},
+        {.name="read-limit",.has_arg=1,.flag=0,.val=READ_LIMIT},
+        {.name="read-iops",.has_arg=1,.flag=0,.val=READ_IOPS},
+        {.name="copy-limit",.has_arg=1,.flag=0,.val=COPY_LIMIT},
+        {.name="copy-iops",.has_arg=1,.flag=0,.val=COPY_IOPS},
+        {.name="idle-io",.has_arg=0,.flag=0,.val=IDLE_IO},
+        {.name="nice",.has_arg=1,.flag=0,.val=NICE},
+        {.name="journal",.has_arg=1,.flag=0,.val=JOURNAL},
+        {.name="verify-copy",.has_arg=0,.flag=0,.val=VERIFY_COPY},
+        {.name="pack-threshold",.has_arg=1,.flag=0,.val=PACK_THRESHOLD},
+        {.name="restore",.has_arg=0,.flag=0,.val=RESTORE},
+        {.name="remote-command",.has_arg=1,.flag=0,.val=REMOTE_COMMAND},
+        {.name="remote-socket",.has_arg=1,.flag=0,.val=REMOTE_SOCKET},
+        {.name="serve",.has_arg=2,.flag=0,.val=SERVE},
+        {.name="job-file",.has_arg=1,.flag=0,.val=JOB_FILE},
+        {.name="parallel-jobs",.has_arg=1,.flag=0,.val=PARALLEL_JOBS},
+        {.name="watch",.has_arg=2,.flag=0,.val=WATCH},
+        {.name="watch-delay",.has_arg=1,.flag=0,.val=WATCH_DELAY},
 		{.name=0,.has_arg=0,.flag=0,.val=0},
 	};
     
 	while ((opt = getopt_long(argc, argv, "s:d:n:vh", long_opts, NULL)) != -1) {
 		switch (opt) {
 			case 'o':
-                the_config->uses_md5 = false;
+                the_config->compare_mode = COMPARE_DATE_SIZE;
 			    break;
 				
 			case 'p':
@@ -73,16 +257,21 @@ int set_configuration(configuration_t *the_config, int argc, char *argv[]) {
 			    break;
 				
 			case 'd':
-                strcpy(the_config->destination, optarg);
+                if (add_destination(the_config, optarg) == -1) {
+                    return -1;
+                }
 			    break;
 
             case 'n':
-                the_config->processes_count = atoi(optarg);
-                if (the_config->processes_count < 4) {
-                    the_config->processes_count = 4;
+                // Analyzers are shared by both listers, so any count from 3 (2 listers and 1 analyzer) works
+                if (strcmp(optarg, "auto") == 0) {
+                    the_config->auto_processes = true;
+                    break;
                 }
-                if (the_config->processes_count%2 == 1) {
-                    the_config->processes_count--;
+                the_config->auto_processes = false;
+                the_config->processes_count = atoi(optarg) > POOL_MAX_ANALYZERS + 2 ? POOL_MAX_ANALYZERS + 2 : atoi(optarg);
+                if (the_config->processes_count < 3) {
+                    the_config->processes_count = 3;
                 }
                 break;
 
@@ -90,6 +279,282 @@ int set_configuration(configuration_t *the_config, int argc, char *argv[]) {
                 the_config->verbose = true;
                 break;            
 
+            case SNAPSHOT:
+                the_config->snapshot = true;
+                break;
+
+            case COMPARE:
+                if (strcmp(optarg, "md5") == 0) {
+                    the_config->compare_mode = COMPARE_MD5;
+                } else if (strcmp(optarg, "date-size") == 0) {
+                    the_config->compare_mode = COMPARE_DATE_SIZE;
+                } else if (strcmp(optarg, "bytes") == 0) {
+                    the_config->compare_mode = COMPARE_BYTES;
+                } else if (strcmp(optarg, "sampled") == 0) {
+                    the_config->compare_mode = COMPARE_SAMPLED;
+                } else {
+                    fprintf(stderr, "Unknown comparison mode %s\n", optarg);
+                    display_help(argv[0]);
+                    return -1;
+                }
+                break;
+
+            case SAMPLE_THRESHOLD:
+                the_config->sample_threshold = strtoull(optarg, NULL, 10);
+                break;
+
+            case SAMPLE_BLOCK:
+                the_config->sample_block_size = atoi(optarg) << 10;
+                if (the_config->sample_block_size == 0) {
+                    the_config->sample_block_size = DEFAULT_SAMPLE_BLOCK_SIZE;
+                }
+                break;
+
+            case SAMPLE_COUNT:
+                the_config->sample_blocks_count = atoi(optarg);
+                break;
+
+            case NO_DIGEST_SHARING:
+                the_config->share_digests = false;
+                break;
+
+            case STATS:
+                if (strlen(optarg) >= sizeof(the_config->stats_file)) {
+                    fprintf(stderr, "Statistics file name is too long\n");
+                    return -1;
+                }
+                strcpy(the_config->stats_file, optarg);
+                break;
+
+            case TRACE:
+                if (strlen(optarg) >= sizeof(the_config->trace_file)) {
+                    fprintf(stderr, "Trace file name is too long\n");
+                    return -1;
+                }
+                strcpy(the_config->trace_file, optarg);
+                break;
+
+            case PROGRESS:
+                if (optarg == NULL) {
+                    the_config->progress_mode = isatty(STDERR_FILENO) ? PROGRESS_TTY : PROGRESS_LINES;
+                } else if (strcmp(optarg, "tty") == 0) {
+                    the_config->progress_mode = PROGRESS_TTY;
+                } else if (strcmp(optarg, "lines") == 0) {
+                    the_config->progress_mode = PROGRESS_LINES;
+                } else {
+                    fprintf(stderr, "Unknown progress mode %s\n", optarg);
+                    display_help(argv[0]);
+                    return -1;
+                }
+                break;
+
+            case ANALYSIS_ORDER:
+                if (strcmp(optarg, "largest-first") == 0) {
+                    the_config->analysis_order = ANALYSIS_ORDER_LARGEST_FIRST;
+                } else if (strcmp(optarg, "path") == 0) {
+                    the_config->analysis_order = ANALYSIS_ORDER_PATH;
+                } else {
+                    fprintf(stderr, "Unknown analysis order %s\n", optarg);
+                    display_help(argv[0]);
+                    return -1;
+                }
+                break;
+
+            case IO_ORDER:
+                if (strcmp(optarg, "inode") == 0) {
+                    the_config->io_order = IO_ORDER_INODE;
+                } else if (strcmp(optarg, "extent") == 0) {
+                    the_config->io_order = IO_ORDER_EXTENT;
+                } else {
+                    fprintf(stderr, "Unknown I/O order %s\n", optarg);
+                    display_help(argv[0]);
+                    return -1;
+                }
+                break;
+
+            case MAX_MEMORY:
+                the_config->max_memory = strtoull(optarg, NULL, 10) << 20;
+                break;
+
+            case SPILL_DIR:
+                if (strlen(optarg) >= sizeof(the_config->spill_dir)) {
+                    fprintf(stderr, "Spill directory name is too long\n");
+                    return -1;
+                }
+                strcpy(the_config->spill_dir, optarg);
+                break;
+
+            case MANIFEST:
+                if (strlen(optarg) >= sizeof(the_config->manifest_file)) {
+                    fprintf(stderr, "Manifest file name is too long\n");
+                    return -1;
+                }
+                strcpy(the_config->manifest_file, optarg);
+                break;
+
+            case MANIFEST_VERIFY:
+                the_config->manifest_verify_count = strtoul(optarg, NULL, 10);
+                break;
+
+            case SCAN_STATE:
+                if (strlen(optarg) >= sizeof(the_config->scan_state_file)) {
+                    fprintf(stderr, "Scan state file name is too long\n");
+                    return -1;
+                }
+                strcpy(the_config->scan_state_file, optarg);
+                break;
+
+            case TRUST_SCAN_STATE:
+                the_config->trust_scan_state = true;
+                break;
+
+            case EXCLUDE:
+            case INCLUDE:
+            case EXCLUDE_FROM:
+                if (add_filter_rule(the_config, opt == EXCLUDE ? FILTER_EXCLUDE_PREFIX : opt == INCLUDE ? FILTER_INCLUDE_PREFIX : FILTER_FILE_PREFIX, optarg) == -1) {
+                    return -1;
+                }
+                break;
+
+            case FILTER_FILE:
+                if (strlen(optarg) >= sizeof(the_config->filter_file) || strchr(optarg, '/') != NULL) {
+                    fprintf(stderr, "Invalid filter file name %s\n", optarg);
+                    return -1;
+                }
+                strcpy(the_config->filter_file, optarg);
+                break;
+
+            case MIN_SIZE:
+                the_config->min_file_size = strtoull(optarg, NULL, 10);
+                break;
+
+            case MAX_SIZE:
+                the_config->max_file_size = strtoull(optarg, NULL, 10);
+                break;
+
+            case MIN_AGE:
+                the_config->min_age = strtoull(optarg, NULL, 10);
+                break;
+
+            case MAX_AGE:
+                the_config->max_age = strtoull(optarg, NULL, 10);
+                break;
+
+            case READ_LIMIT:
+                the_config->read_rate = (uint64_t) (strtod(optarg, NULL) * (1 << 20));
+                break;
+
+            case READ_IOPS:
+                the_config->read_iops = strtoull(optarg, NULL, 10);
+                break;
+
+            case COPY_LIMIT:
+                the_config->copy_rate = (uint64_t) (strtod(optarg, NULL) * (1 << 20));
+                break;
+
+            case COPY_IOPS:
+                the_config->copy_iops = strtoull(optarg, NULL, 10);
+                break;
+
+            case IDLE_IO:
+                the_config->idle_io = true;
+                break;
+
+            case NICE:
+                the_config->nice_increment = atoi(optarg);
+                break;
+
+            case JOURNAL:
+                if (strlen(optarg) >= sizeof(the_config->journal_file)) {
+                    fprintf(stderr, "Journal file name is too long\n");
+                    return -1;
+                }
+                strcpy(the_config->journal_file, optarg);
+                break;
+
+            case VERIFY_COPY:
+                the_config->verify_copy = true;
+                break;
+
+            case PACK_THRESHOLD:
+                the_config->pack_threshold = strtoull(optarg, NULL, 10);
+                break;
+
+            case RESTORE:
+                the_config->restore = true;
+                break;
+
+            case REMOTE_COMMAND:
+                if (strlen(optarg) >= sizeof(the_config->remote_command)) {
+                    fprintf(stderr, "Remote command is too long\n");
+                    return -1;
+                }
+                strcpy(the_config->remote_command, optarg);
+                break;
+
+            case REMOTE_SOCKET:
+                if (strlen(optarg) >= sizeof(the_config->remote_socket)) {
+                    fprintf(stderr, "Remote socket path is too long\n");
+                    return -1;
+                }
+                strcpy(the_config->remote_socket, optarg);
+                break;
+
+            case SERVE:
+                the_config->serve = true;
+                if (optarg != NULL) {
+                    if (strlen(optarg) >= sizeof(the_config->serve_socket)) {
+                        fprintf(stderr, "Socket path is too long\n");
+                        return -1;
+                    }
+                    strcpy(the_config->serve_socket, optarg);
+                }
+                break;
+
+            case JOB_FILE:
+                if (strlen(optarg) >= sizeof(the_config->job_file)) {
+                    fprintf(stderr, "Job file name is too long\n");
+                    return -1;
+                }
+                strcpy(the_config->job_file, optarg);
+                break;
+
+            case PARALLEL_JOBS:
+                the_config->parallel_jobs = atoi(optarg);
+                if (the_config->parallel_jobs == 0 || the_config->parallel_jobs > MAX_PARALLEL_JOBS) {
+                    fprintf(stderr, "--parallel-jobs must be between 1 and %d\n", MAX_PARALLEL_JOBS);
+                    return -1;
+                }
+                break;
+
+            case WATCH:
+                if (optarg == NULL) {
+                    the_config->watch_mode = WATCH_AUTO;
+                } else if (strcmp(optarg, "fanotify") == 0) {
+                    the_config->watch_mode = WATCH_FANOTIFY;
+                } else if (strcmp(optarg, "inotify") == 0) {
+                    the_config->watch_mode = WATCH_INOTIFY;
+                } else {
+                    fprintf(stderr, "Unknown watch mode %s\n", optarg);
+                    display_help(argv[0]);
+                    return -1;
+                }
+                break;
+
+            case WATCH_DELAY:
+                the_config->watch_delay_ms = atoi(optarg);
+                if (the_config->watch_delay_ms == 0) {
+                    the_config->watch_delay_ms = DEFAULT_WATCH_DELAY_MS;
+                }
+                break;
+
+            case PROGRESS_INTERVAL:
+                the_config->progress_interval_ms = atoi(optarg);
+                if (the_config->progress_interval_ms == 0) {
+                    the_config->progress_interval_ms = DEFAULT_PROGRESS_INTERVAL_MS;
+                }
+                break;
+
             case 'h':
                 display_help(argv[0]);
                 exit(EXIT_SUCCESS);
@@ -101,10 +566,85 @@ int set_configuration(configuration_t *the_config, int argc, char *argv[]) {
         }
 	}
 
+    // MD5 sums (full or sampled) are only computed by analyzers when they are used for comparison
+    the_config->uses_md5 = (the_config->compare_mode == COMPARE_MD5 || the_config->compare_mode == COMPARE_SAMPLED);
+
+    // Copies are checked against the MD5 sums of the analysis
+    if (the_config->verify_copy == true && (the_config->uses_md5 == false || the_config->restore == true)) {
+        fprintf(stderr, "--verify-copy needs --compare=md5 or --compare=sampled, and cannot be used with --restore\n");
+        return -1;
+    }
+
+    // The destination side gets its destination and comparison mode from each client
+    if (the_config->serve == true) {
+        if (strlen(the_config->source) > 0 || strlen(the_config->destination) > 0 || strlen(the_config->job_file) > 0
+            || strlen(the_config->remote_command) > 0 || strlen(the_config->remote_socket) > 0) {
+            fprintf(stderr, "--serve cannot be used with -s, -d, --job-file, --remote-command or --remote-socket\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    // Jobs bring their own sources and destinations. A scan state and a watch only follow one source.
+    if (strlen(the_config->job_file) > 0) {
+        if (strlen(the_config->source) > 0 || strlen(the_config->destination) > 0
+            || strlen(the_config->scan_state_file) > 0 || the_config->watch_mode != WATCH_NONE || the_config->restore == true
+            || strlen(the_config->journal_file) > 0 || strlen(the_config->remote_command) > 0 || strlen(the_config->remote_socket) > 0) {
+            fprintf(stderr, "--job-file cannot be used with -s, -d, --scan-state, --watch, --restore, --journal, --remote-command or --remote-socket\n");
+            return -1;
+        }
+        return 0;
+    }
+
     if (strcmp(the_config->source, "") == 0 || strcmp(the_config->destination, "") == 0) {
         display_help(argv[0]);
         return -1;
     }
 
+    // The remote side only lists, analyzes and writes one plain destination
+    if (strlen(the_config->remote_command) > 0 || strlen(the_config->remote_socket) > 0) {
+        if (strlen(the_config->remote_command) > 0 && strlen(the_config->remote_socket) > 0) {
+            fprintf(stderr, "--remote-command and --remote-socket cannot be used together\n");
+            return -1;
+        }
+        if (the_config->snapshot == true || strlen(the_config->manifest_file) > 0 || the_config->max_memory > 0
+            || the_config->watch_mode != WATCH_NONE || the_config->pack_threshold > 0 || strlen(the_config->journal_file) > 0
+            || the_config->extra_destinations_count > 0 || the_config->restore == true || the_config->compare_mode == COMPARE_BYTES) {
+            fprintf(stderr, "A remote destination cannot be used with --snapshot, --manifest, --max-memory, --watch, --pack-threshold, --journal, "
+                    "several destinations, --restore or --compare=bytes\n");
+            return -1;
+        }
+    }
+
+    // Each snapshot and each manifest describe one complete synchronization
+    if (the_config->watch_mode != WATCH_NONE && (the_config->snapshot == true || strlen(the_config->manifest_file) > 0)) {
+        fprintf(stderr, "--watch cannot be used with --snapshot or --manifest\n");
+        return -1;
+    }
+
+    // A journal plans plain copies from a complete diff, written at once to one destination
+    if (strlen(the_config->journal_file) > 0
+        && (the_config->snapshot == true || strlen(the_config->manifest_file) > 0 || the_config->max_memory > 0 || the_config->watch_mode != WATCH_NONE
+            || the_config->pack_threshold > 0 || the_config->extra_destinations_count > 0 || the_config->restore == true)) {
+        fprintf(stderr, "--journal cannot be used with --snapshot, --manifest, --max-memory, --watch, --pack-threshold, several destinations or --restore\n");
+        return -1;
+    }
+
+    // The pack index replaces the destination list and the manifest, and the packed files cannot be compared bytewise
+    if (the_config->pack_threshold > 0
+        && (the_config->snapshot == true || strlen(the_config->manifest_file) > 0 || the_config->max_memory > 0
+            || the_config->watch_mode != WATCH_NONE || the_config->compare_mode == COMPARE_BYTES || the_config->restore == true)) {
+        fprintf(stderr, "--pack-threshold cannot be used with --snapshot, --manifest, --max-memory, --watch, --compare=bytes or --restore\n");
+        return -1;
+    }
+
+    // Other destinations only get plain synchronizations, from one listing of the source
+    if (the_config->extra_destinations_count > 0
+        && (the_config->snapshot == true || strlen(the_config->manifest_file) > 0 || the_config->max_memory > 0
+            || the_config->watch_mode != WATCH_NONE || the_config->pack_threshold > 0 || the_config->restore == true)) {
+        fprintf(stderr, "Several destinations cannot be used with --snapshot, --manifest, --max-memory, --watch, --pack-threshold or --restore\n");
+        return -1;
+    }
+
 	return 0;
 }
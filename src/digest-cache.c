@@ -0,0 +1,124 @@
+#include <digest-cache.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/mman.h>
+
+/*!
+ * @brief create_digest_cache creates a digest table in an anonymous shared mapping
+ * The table is created before forking analyzers, so that all of them (and the main process) share it.
+ * @param slots_count is the number of slots of the table, rounded up to a power of 2
+ * @return a pointer to the table, NULL in case of error
+ */
+digest_cache_t *create_digest_cache(uint32_t slots_count) {
+    uint32_t rounded_count = 1;
+    while (rounded_count < slots_count && rounded_count < (1u << 31)) {
+        rounded_count <<= 1;
+    }
+
+    size_t size = sizeof(digest_cache_t) + sizeof(digest_cache_slot_t) * rounded_count;
+    digest_cache_t *cache = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (cache == MAP_FAILED) {
+        fprintf(stderr, "Error creating digest table\n");
+        return NULL;
+    }
+
+    // Anonymous mappings are zero filled, i.e. all slots are DIGEST_SLOT_EMPTY
+    cache->slots_count = rounded_count;
+    return cache;
+}
+
+/*!
+ * @brief destroy_digest_cache releases a digest table
+ * @param cache is a pointer to the table (may be NULL)
+ */
+void destroy_digest_cache(digest_cache_t *cache) {
+    if (cache != NULL) {
+        munmap(cache, sizeof(digest_cache_t) + sizeof(digest_cache_slot_t) * cache->slots_count);
+    }
+}
+
+/*!
+ * @brief hash_inode computes the position of an inode in the table
+ * @param file_stats is a pointer to the stats of the file
+ * @return a hash of the device and inode numbers
+ */
+static uint64_t hash_inode(struct stat *file_stats) {
+    uint64_t hash = (uint64_t) file_stats->st_ino * 0x9e3779b97f4a7c15ULL ^ (uint64_t) file_stats->st_dev;
+    hash ^= hash >> 31;
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    return hash ^ (hash >> 29);
+}
+
+/*!
+ * @brief slot_matches tells if a ready slot holds the digest of a file
+ * The key is (device, inode, size, mtime), so that a file modified since it was hashed is not matched.
+ * @param slot is a pointer to the slot
+ * @param file_stats is a pointer to the stats of the file
+ * @return true if the slot is the file's one, false else
+ */
+static bool slot_matches(digest_cache_slot_t *slot, struct stat *file_stats) {
+    return slot->device == file_stats->st_dev && slot->inode == file_stats->st_ino
+        && slot->size == (uint64_t) file_stats->st_size
+        && slot->mtime.tv_sec == file_stats->st_mtim.tv_sec && slot->mtime.tv_nsec == file_stats->st_mtim.tv_nsec;
+}
+
+/*!
+ * @brief digest_cache_lookup looks for the digest of an inode already hashed during this run
+ * @param cache is a pointer to the table (lookup always fails if NULL)
+ * @param file_stats is a pointer to the stats of the file
+ * @param md5sum is filled with the digest when found
+ * @return true if the digest was found, false else
+ */
+bool digest_cache_lookup(digest_cache_t *cache, struct stat *file_stats, uint8_t *md5sum) {
+    if (cache == NULL) {
+        return false;
+    }
+
+    uint64_t position = hash_inode(file_stats);
+    for (int probe = 0; probe < DIGEST_CACHE_MAX_PROBES; probe++) {
+        digest_cache_slot_t *slot = &cache->slots[(position + probe) & (cache->slots_count - 1)];
+        uint32_t state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+        if (state == DIGEST_SLOT_EMPTY) {
+            return false;
+        }
+        // A busy slot is being filled by another process, its key can't be read yet
+        if (state == DIGEST_SLOT_READY && slot_matches(slot, file_stats)) {
+            memcpy(md5sum, slot->md5sum, sizeof(slot->md5sum));
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * @brief digest_cache_publish stores the digest of an inode in the table
+ * Slots are claimed with a compare and swap, filled, then marked ready, so that no lock is needed.
+ * When no slot is available in the probing window, the digest is simply not stored.
+ * @param cache is a pointer to the table (nothing is done if NULL)
+ * @param file_stats is a pointer to the stats of the hashed file
+ * @param md5sum is the digest of the file
+ */
+void digest_cache_publish(digest_cache_t *cache, struct stat *file_stats, uint8_t *md5sum) {
+    if (cache == NULL) {
+        return;
+    }
+
+    uint64_t position = hash_inode(file_stats);
+    for (int probe = 0; probe < DIGEST_CACHE_MAX_PROBES; probe++) {
+        digest_cache_slot_t *slot = &cache->slots[(position + probe) & (cache->slots_count - 1)];
+        uint32_t expected = DIGEST_SLOT_EMPTY;
+        if (__atomic_compare_exchange_n(&slot->state, &expected, DIGEST_SLOT_BUSY, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            slot->device = file_stats->st_dev;
+            slot->inode = file_stats->st_ino;
+            slot->size = file_stats->st_size;
+            slot->mtime = file_stats->st_mtim;
+            memcpy(slot->md5sum, md5sum, sizeof(slot->md5sum));
+            __atomic_store_n(&slot->state, DIGEST_SLOT_READY, __ATOMIC_RELEASE);
+            return;
+        }
+        if (expected == DIGEST_SLOT_READY && slot_matches(slot, file_stats)) {
+            // Another process hashed the same inode concurrently
+            return;
+        }
+    }
+}
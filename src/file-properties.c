@@ -11,10 +11,70 @@
 #include <stdio.h>
 #include <utility.h>
 #include <openssl/md5.h>
+#include <stdlib.h>
+#include <stats.h>
+#include <throttle.h>
+#include <progress.h>
+#include <scan-state.h>
+
+/*!
+ * @brief make_digest_options builds the digest options used by analyzers from the program configuration
+ * @param the_config is a pointer to the configuration
+ * @param cache is a pointer to the run's digest table (may be NULL)
+ * @param options is a pointer to the options to fill
+ */
+void make_digest_options(configuration_t *the_config, digest_cache_t *cache, digest_options_t *options) {
+    options->use_md5 = the_config->uses_md5;
+    options->cache = cache;
+    options->sample_threshold = 0;
+    options->sample_block_size = the_config->sample_block_size;
+    options->sample_blocks_count = the_config->sample_blocks_count;
+
+    // Sampling is pointless when the samples would cover the whole file
+    if (the_config->compare_mode == COMPARE_SAMPLED) {
+        uint64_t sampled_size = (uint64_t) the_config->sample_block_size * (the_config->sample_blocks_count + 2);
+        options->sample_threshold = the_config->sample_threshold > sampled_size ? the_config->sample_threshold : sampled_size + 1;
+    }
+}
+
+/*!
+ * @brief has_whole_digest tells if the analysis gives an entry the MD5 sum of its whole content
+ * @param the_config is a pointer to the configuration
+ * @param entry is a pointer to the entry
+ * @return true if the MD5 sum of the entry covers all its bytes, false when it is sampled or not computed
+ */
+bool has_whole_digest(configuration_t *the_config, files_list_entry_t *entry) {
+    digest_options_t options;
+    make_digest_options(the_config, NULL, &options);
+    return options.use_md5 == true && (options.sample_threshold == 0 || entry->size < options.sample_threshold);
+}
+
+/*!
+ * @brief digests_compatible tells if digests saved by a previous run may be compared to the ones of this run
+ * @param the_config is a pointer to the configuration of this run
+ * @param compare_mode is the comparison mode of the previous run
+ * @param sample_threshold is the sampling threshold of the previous run
+ * @param sample_block_size is the size of the sampled blocks of the previous run
+ * @param sample_blocks_count is the number of sampled blocks of the previous run
+ * @return true if the digests were computed the same way or are not used, false else
+ */
+bool digests_compatible(configuration_t *the_config, uint32_t compare_mode, uint64_t sample_threshold, uint32_t sample_block_size, uint32_t sample_blocks_count) {
+    if (the_config->uses_md5 == false) {
+        return true;
+    }
+    if (compare_mode != the_config->compare_mode) {
+        return false;
+    }
+    return the_config->compare_mode != COMPARE_SAMPLED
+           || (sample_threshold == the_config->sample_threshold
+               && sample_block_size == the_config->sample_block_size
+               && sample_blocks_count == the_config->sample_blocks_count);
+}
 
 /*!
  * @brief get_file_stats gets all of the required information for a file (inc. directories)
  * @param the files list entry
+ * @param options tells if and how the MD5 sum must be computed, when disabled the sum is zeroed
  * You must get:
  * - for files:
  *   - mode (permissions)
@@ -27,10 +87,11 @@
  *   - entry type (DOSSIER)
  * @return -1 in case of error, 0 else
  */
-int get_file_stats(files_list_entry_t *entry) {
+int get_file_stats(files_list_entry_t *entry, digest_options_t *options) {
 
     struct stat file_stats;
 
+    stats_add(STATS_STAT_CALLS, 1);
     if (stat(entry->path_and_name, &file_stats) == -1){
         return -1;
     }
@@ -41,11 +102,38 @@ int get_file_stats(files_list_entry_t *entry) {
         entry->mtime.tv_nsec = file_stats.st_mtim.tv_nsec;
 	    entry->mtime.tv_sec = file_stats.st_mtim.tv_sec;
         entry->size = file_stats.st_size;
-        
-        if (compute_file_md5(entry) != 0) {
+
+        stats_add(STATS_FILES_ANALYZED, 1);
+        progress_add(PROGRESS_FILES_ANALYZED, 1);
+        progress_add(PROGRESS_BYTES_ANALYZED, entry->size);
+
+        // Only inodes with several names can be met twice during a run
+        bool shared_inode = options->use_md5 == true && file_stats.st_nlink > 1;
+        uint64_t start_ns = stats_enabled() ? stats_now_ns() : 0;
+
+        if (options->use_md5 == false) {
+            memset(entry->md5sum, 0, sizeof(entry->md5sum));
+        } else if (shared_inode && digest_cache_lookup(options->cache, &file_stats, entry->md5sum)) {
+            return 0;
+        } else if (scan_state_lookup(entry->path_and_name, &file_stats, entry->md5sum)) {
+            // Unchanged since the previous run (--scan-state)
+            return 0;
+        } else if (options->sample_threshold > 0 && entry->size >= options->sample_threshold) {
+            if (compute_file_sampled_md5(entry, options) != 0) {
+                fprintf(stderr, "Error computing sampled MD5: %s\n", entry->path_and_name);
+                return -1;
+            }
+        } else if (compute_file_md5(entry) != 0) {
             fprintf(stderr, "Error computing MD5: %s\n", entry->path_and_name);
             return -1;
-            }
+        }
+
+        if (shared_inode) {
+            digest_cache_publish(options->cache, &file_stats, entry->md5sum);
+        }
+        if (options->use_md5 == true && stats_enabled()) {
+            stats_record_latency(STATS_HISTOGRAM_HASH, stats_now_ns() - start_ns);
+        }
             
     }else if (S_ISDIR(file_stats.st_mode)){
         entry->entry_type = DOSSIER;
@@ -84,14 +172,25 @@ int compute_file_md5(files_list_entry_t *entry) {
 
     EVP_DigestInit_ex(mdContext, md, NULL);
 
-    const size_t bufferSize = 4096;
-    unsigned char buffer[bufferSize];
+    // Reads are large enough for the read operations limit (--read-iops) to count actual disk requests
+    const size_t bufferSize = HASH_BUFFER_SIZE;
+    unsigned char *buffer = malloc(bufferSize);
     size_t bytesRead;
+    if (buffer == NULL) {
+        fclose(file);
+        EVP_MD_CTX_free(mdContext);
+        return -1;
+    }
 
+    stats_add(STATS_OPEN_CALLS, 1);
     while ((bytesRead = fread(buffer, 1, bufferSize, file)) != 0) {
         EVP_DigestUpdate(mdContext, buffer, bytesRead);
+        stats_add(STATS_READ_CALLS, 1);
+        stats_add(STATS_BYTES_HASHED, bytesRead);
+        throttle_account(THROTTLE_READ, bytesRead);
     }
 
+    free(buffer);
     if (ferror(file) != 0) {
         perror("Error reading file for MD5 computation");
         fclose(file);
@@ -108,6 +207,165 @@ int compute_file_md5(files_list_entry_t *entry) {
     return 0;
 }
 
+/*!
+ * @brief compute_file_sampled_md5 computes the MD5 sum of a deterministic sample of a file
+ * The sample is made of the first and last blocks of the file and of evenly spaced blocks in between,
+ * all of sample_block_size bytes. The file size is hashed too. Both sides use the same options, so the
+ * sums are comparable by mismatch as full MD5 sums are.
+ * @param entry is the pointer to the files list entry, whose size must already be set
+ * @param options is a pointer to the digest options
+ * @return -1 in case of error, 0 else
+ */
+int compute_file_sampled_md5(files_list_entry_t *entry, digest_options_t *options) {
+    int fd = open(entry->path_and_name, O_RDONLY);
+    if (fd == -1) {
+        perror("Error opening file for sampled MD5 computation");
+        return -1;
+    }
+
+    uint8_t *buffer = malloc(options->sample_block_size);
+    EVP_MD_CTX *md_context = EVP_MD_CTX_new();
+    if (buffer == NULL || md_context == NULL) {
+        free(buffer);
+        EVP_MD_CTX_free(md_context);
+        close(fd);
+        return -1;
+    }
+
+    stats_add(STATS_OPEN_CALLS, 1);
+    EVP_DigestInit_ex(md_context, EVP_md5(), NULL);
+    EVP_DigestUpdate(md_context, &entry->size, sizeof(entry->size));
+
+    // Blocks 0 and blocks_count + 1 are the head and the tail, the others are evenly spaced
+    uint64_t last_offset = entry->size - options->sample_block_size;
+    int result = 0;
+    for (uint64_t i = 0; i < options->sample_blocks_count + 2 && result == 0; i++) {
+        off_t offset = last_offset * i / (options->sample_blocks_count + 1);
+        ssize_t bytes_read = pread(fd, buffer, options->sample_block_size, offset);
+        if (bytes_read == -1) {
+            perror("Error reading file for sampled MD5 computation");
+            result = -1;
+        } else {
+            EVP_DigestUpdate(md_context, buffer, bytes_read);
+            stats_add(STATS_READ_CALLS, 1);
+            stats_add(STATS_BYTES_HASHED, bytes_read);
+            throttle_account(THROTTLE_READ, bytes_read);
+        }
+    }
+
+    if (result == 0) {
+        EVP_DigestFinal_ex(md_context, entry->md5sum, NULL);
+    }
+
+    free(buffer);
+    EVP_MD_CTX_free(md_context);
+    close(fd);
+    return result;
+}
+
+/*!
+ * @brief read_block reads a block from a file, retrying on short reads
+ * @param fd is the file descriptor to read from
+ * @param buffer is the buffer to fill
+ * @param size is the size of the block to read
+ * @return the number of bytes read (less than size only at the end of the file), -1 in case of error
+ */
+static ssize_t read_block(int fd, uint8_t *buffer, size_t size) {
+    size_t total = 0;
+    while (total < size) {
+        ssize_t bytes_read = read(fd, buffer + total, size - total);
+        if (bytes_read == -1) {
+            return -1;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+        total += bytes_read;
+    }
+    return total;
+}
+
+/*!
+ * @brief compare_descriptors compares the content of two opened files, block by block
+ * @param lhd_fd is the descriptor of the first file
+ * @param rhd_fd is the descriptor of the second file
+ * @return 0 if both files have the same content, 1 if they differ, -1 in case of error
+ */
+static int compare_descriptors(int lhd_fd, int rhd_fd) {
+    struct stat lhd_stats, rhd_stats;
+
+    if (fstat(lhd_fd, &lhd_stats) == -1 || fstat(rhd_fd, &rhd_stats) == -1) {
+        return -1;
+    }
+    if (lhd_stats.st_size != rhd_stats.st_size) {
+        return 1;
+    }
+
+    uint8_t *lhd_buffer = malloc(COMPARE_BUFFER_SIZE);
+    uint8_t *rhd_buffer = malloc(COMPARE_BUFFER_SIZE);
+    if (lhd_buffer == NULL || rhd_buffer == NULL) {
+        free(lhd_buffer);
+        free(rhd_buffer);
+        return -1;
+    }
+
+    posix_fadvise(lhd_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(rhd_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    int result = 0;
+    ssize_t lhd_read, rhd_read;
+    do {
+        lhd_read = read_block(lhd_fd, lhd_buffer, COMPARE_BUFFER_SIZE);
+        rhd_read = read_block(rhd_fd, rhd_buffer, COMPARE_BUFFER_SIZE);
+        if (lhd_read == -1 || rhd_read == -1) {
+            perror("Error reading files for comparison");
+            result = -1;
+        } else if (lhd_read != rhd_read || memcmp(lhd_buffer, rhd_buffer, lhd_read) != 0) {
+            result = 1;
+        }
+        if (result != -1) {
+            stats_add(STATS_READ_CALLS, 2);
+            stats_add(STATS_BYTES_COMPARED, lhd_read + rhd_read);
+            throttle_account(THROTTLE_READ, lhd_read);
+            throttle_account(THROTTLE_READ, rhd_read);
+        }
+    }
+    while (result == 0 && lhd_read > 0);
+
+    free(lhd_buffer);
+    free(rhd_buffer);
+    return result;
+}
+
+/*!
+ * @brief compare_files_content compares the content of two files, reading them in lockstep
+ * Reading stops at the first differing block, and files are not read at all when their sizes differ.
+ * @param lhd_path is the path to the first file (source)
+ * @param rhd_path is the path to the second file (destination)
+ * @return 0 if both files have the same content, 1 if they differ, -1 in case of error
+ */
+int compare_files_content(char *lhd_path, char *rhd_path) {
+    int lhd_fd = open(lhd_path, O_RDONLY);
+    if (lhd_fd == -1) {
+        fprintf(stderr, "Error opening %s for comparison\n", lhd_path);
+        return -1;
+    }
+
+    int rhd_fd = open(rhd_path, O_RDONLY);
+    if (rhd_fd == -1) {
+        fprintf(stderr, "Error opening %s for comparison\n", rhd_path);
+        close(lhd_fd);
+        return -1;
+    }
+
+    stats_add(STATS_OPEN_CALLS, 2);
+    int result = compare_descriptors(lhd_fd, rhd_fd);
+
+    close(lhd_fd);
+    close(rhd_fd);
+    return result;
+}
+
 
 /*!
  * @brief directory_exists tests the existence of a directory
@@ -100,6 +100,79 @@ int add_entry_to_tail(files_list_t *list, files_list_entry_t *entry) {
     return 0;
 }
 
+/*!
+ * @brief files_list_to_table makes a table of the entries of a list, in the list order
+ * @param list is a pointer to the list
+ * @param entries_count is where the number of entries is written
+ * @return the table (to be freed by the caller, the entries still belong to the list), NULL in case of error
+ */
+files_list_entry_t **files_list_to_table(files_list_t *list, size_t *entries_count) {
+    *entries_count = 0;
+    for (files_list_entry_t *p_entry = list->head; p_entry != NULL; p_entry = p_entry->next) {
+        (*entries_count)++;
+    }
+
+    files_list_entry_t **entries = (files_list_entry_t**) malloc(sizeof(files_list_entry_t*) * (*entries_count + 1));
+    if (entries == NULL) {
+        return NULL;
+    }
+    size_t i = 0;
+    for (files_list_entry_t *p_entry = list->head; p_entry != NULL; p_entry = p_entry->next) {
+        entries[i++] = p_entry;
+    }
+    return entries;
+}
+
+/*!
+ * @brief compare_entries_paths orders two entries of a table by path (qsort callback)
+ * @param lhd is a pointer to the first entry pointer
+ * @param rhd is a pointer to the second entry pointer
+ * @return the strcmp of the paths
+ */
+static int compare_entries_paths(const void *lhd, const void *rhd) {
+    return strcmp((*(files_list_entry_t**) lhd)->path_and_name, (*(files_list_entry_t**) rhd)->path_and_name);
+}
+
+/*!
+ * @brief merge_files_lists moves all entries of a list into an ordered list, keeping it ordered (strcmp)
+ * @param list is a pointer to the ordered list that receives the entries
+ * @param other is a pointer to the list whose entries are moved, in any order, which is emptied
+ * @return 0 in case of success, -1 else (other is then left unchanged)
+ */
+int merge_files_lists(files_list_t *list, files_list_t *other) {
+    size_t entries_count;
+    files_list_entry_t **entries = files_list_to_table(other, &entries_count);
+    if (entries == NULL) {
+        return -1;
+    }
+    qsort(entries, entries_count, sizeof(files_list_entry_t*), compare_entries_paths);
+
+    files_list_entry_t *p_entry = list->head;
+    for (size_t i = 0; i < entries_count; i++) {
+        files_list_entry_t *new_entry = entries[i];
+        while (p_entry != NULL && strcmp(p_entry->path_and_name, new_entry->path_and_name) < 0) {
+            p_entry = p_entry->next;
+        }
+        if (p_entry == NULL) {
+            add_entry_to_tail(list, new_entry);
+        } else {
+            new_entry->next = p_entry;
+            new_entry->prev = p_entry->prev;
+            if (p_entry->prev == NULL) {
+                list->head = new_entry;
+            } else {
+                p_entry->prev->next = new_entry;
+            }
+            p_entry->prev = new_entry;
+        }
+    }
+
+    other->head = NULL;
+    other->tail = NULL;
+    free(entries);
+    return 0;
+}
+
 /*!
  *  @brief find_entry_by_name looks up for a file in a list
  *  The function uses the ordering of the entries to interrupt its search
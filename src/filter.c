@@ -0,0 +1,547 @@
+#include <filter.h>
+#include <stats.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+
+// Rules are compiled before forking, so that both listers apply the same rules.
+// Each process walks one tree at a time, so the scopes of the walk are a single stack.
+static bool enabled = false;
+static configuration_t settings;
+static filter_rules_t global_rules = {NULL, 0, 0};
+static filter_scope_t *scopes = NULL;
+static size_t scopes_count = 0;
+static size_t scopes_capacity = 0;
+static char root[PATH_SIZE]; // Paths are matched relative to the root of the tree being walked
+static size_t root_length = 0;
+static time_t walk_time = 0; // Reference of the age predicates
+
+/*!
+ * @brief has_wildcard tells if a pattern needs the glob matcher
+ * @param pattern is the pattern
+ * @param length is the number of characters to check
+ * @return true if the pattern has a wildcard or an escaped character
+ */
+static bool has_wildcard(char *pattern, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (pattern[i] == '*' || pattern[i] == '?' || pattern[i] == '[' || pattern[i] == '\\') {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * @brief add_rule compiles a gitignore-style line and adds it to rules
+ * @param rules is a pointer to the rules
+ * @param line is the line (blank lines and # comments are ignored)
+ * @param include tells if the pattern keeps what it matches (--include), '!' inverts it
+ * @return 0 when the line was compiled, -1 else
+ */
+static int add_rule(filter_rules_t *rules, char *line, bool include) {
+    char pattern[FILTER_LINE_SIZE];
+    size_t length = strlen(line);
+    while (length > 0 && isspace((unsigned char) line[length - 1])) {
+        length--;
+    }
+    if (length == 0 || line[0] == '#') {
+        return 0;
+    }
+    if (line[0] == '!') {
+        include = !include;
+        line++;
+        length--;
+    } else if (line[0] == '\\' && (line[1] == '!' || line[1] == '#')) {
+        line++;
+        length--;
+    }
+    if (length >= sizeof(pattern)) {
+        fprintf(stderr, "Filter pattern %s is too long\n", line);
+        return -1;
+    }
+    memcpy(pattern, line, length);
+    pattern[length] = '\0';
+
+    filter_rule_t rule;
+    rule.include = include;
+    rule.directories_only = false;
+    if (length > 0 && pattern[length - 1] == '/') {
+        rule.directories_only = true;
+        pattern[--length] = '\0';
+    }
+    rule.anchored = (strchr(pattern, '/') != NULL);
+    char *start = pattern;
+    while (*start == '/') {
+        start++;
+        length--;
+    }
+    if (length == 0) {
+        return 0;
+    }
+
+    if (has_wildcard(start, length) == false) {
+        rule.kind = FILTER_LITERAL;
+    } else if (rule.anchored == false && start[0] == '*' && has_wildcard(start + 1, length - 1) == false) {
+        rule.kind = FILTER_SUFFIX;
+        start++;
+        length--;
+    } else if (rule.anchored == false && start[length - 1] == '*' && has_wildcard(start, length - 1) == false) {
+        rule.kind = FILTER_PREFIX;
+        start[--length] = '\0';
+    } else {
+        rule.kind = FILTER_GLOB;
+    }
+    rule.pattern = strdup(start);
+    rule.length = length;
+    if (rule.pattern == NULL) {
+        return -1;
+    }
+
+    if (rules->count == rules->capacity) {
+        size_t capacity = rules->capacity == 0 ? 16 : rules->capacity * 2;
+        filter_rule_t *table = (filter_rule_t*) realloc(rules->rules, sizeof(filter_rule_t) * capacity);
+        if (table == NULL) {
+            free(rule.pattern);
+            return -1;
+        }
+        rules->rules = table;
+        rules->capacity = capacity;
+    }
+    rules->rules[rules->count++] = rule;
+    return 0;
+}
+
+/*!
+ * @brief load_rules adds the rules of a file, one gitignore-style pattern per line
+ * @param rules is a pointer to the rules
+ * @param path is the path of the rules file
+ * @param must_exist tells if a missing file is an error (--exclude-from) or not (per directory rules file)
+ * @return 0 when the rules were loaded, -1 else
+ */
+static int load_rules(filter_rules_t *rules, char *path, bool must_exist) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        if (must_exist == false && errno == ENOENT) {
+            return 0;
+        }
+        fprintf(stderr, "Error opening filter rules %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    stats_add(STATS_OPEN_CALLS, 1);
+
+    char line[FILTER_LINE_SIZE];
+    int result = 0;
+    while (result == 0 && fgets(line, sizeof(line), file) != NULL) {
+        result = add_rule(rules, line, false);
+    }
+    fclose(file);
+    return result;
+}
+
+/*!
+ * @brief clear_rules frees compiled rules
+ * @param rules is a pointer to the rules
+ */
+static void clear_rules(filter_rules_t *rules) {
+    for (size_t i = 0; i < rules->count; i++) {
+        free(rules->rules[i].pattern);
+    }
+    free(rules->rules);
+    rules->rules = NULL;
+    rules->count = 0;
+    rules->capacity = 0;
+}
+
+/*!
+ * @brief glob_match matches a text against a glob pattern
+ * '*' and '?' do not match '/', "**" matches across directories (followed by '/', it matches zero or more directories).
+ * @param pattern is the pattern
+ * @param text is the text
+ * @return true if the whole text matches
+ */
+static bool glob_match(const char *pattern, const char *text) {
+    while (*pattern != '\0') {
+        if (pattern[0] == '*' && pattern[1] == '*') {
+            pattern += 2;
+            if (*pattern == '\0') {
+                return true;
+            }
+            if (*pattern == '/') {
+                pattern++;
+                if (glob_match(pattern, text)) {
+                    return true;
+                }
+                for (; *text != '\0'; text++) {
+                    if (*text == '/' && glob_match(pattern, text + 1)) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+            for (;; text++) {
+                if (glob_match(pattern, text)) {
+                    return true;
+                }
+                if (*text == '\0') {
+                    return false;
+                }
+            }
+        }
+        if (*pattern == '*') {
+            pattern++;
+            for (;; text++) {
+                if (glob_match(pattern, text)) {
+                    return true;
+                }
+                if (*text == '\0' || *text == '/') {
+                    return false;
+                }
+            }
+        }
+        if (*text == '\0') {
+            return false;
+        }
+
+        if (*pattern == '?') {
+            if (*text == '/') {
+                return false;
+            }
+        } else if (*pattern == '[' && strchr(pattern + 1, ']') != NULL) {
+            const char *cursor = pattern + 1;
+            bool negated = (*cursor == '!' || *cursor == '^');
+            if (negated) {
+                cursor++;
+            }
+            bool matched = false;
+            // A ']' right after '[' is part of the class
+            do {
+                if (cursor[1] == '-' && cursor[2] != ']' && cursor[2] != '\0') {
+                    matched = matched || (*text >= cursor[0] && *text <= cursor[2]);
+                    cursor += 3;
+                } else {
+                    matched = matched || (*text == *cursor);
+                    cursor++;
+                }
+            } while (*cursor != ']' && *cursor != '\0');
+            if (matched == negated || *text == '/' || *cursor == '\0') {
+                return false;
+            }
+            pattern = cursor;
+        } else {
+            if (*pattern == '\\' && pattern[1] != '\0') {
+                pattern++;
+            }
+            if (*pattern != *text) {
+                return false;
+            }
+        }
+        pattern++;
+        text++;
+    }
+    return *text == '\0';
+}
+
+/*!
+ * @brief rule_matches tells if a rule matches a path
+ * @param rule is a pointer to the rule
+ * @param path is the path from the directory of the rule
+ * @param name is the last component of the path
+ * @param is_directory tells if the path is a directory
+ * @return true if the rule matches
+ */
+static bool rule_matches(filter_rule_t *rule, char *path, char *name, bool is_directory) {
+    if (rule->directories_only == true && is_directory == false) {
+        return false;
+    }
+    char *text = rule->anchored == true ? path : name;
+    size_t length;
+    switch (rule->kind) {
+        case FILTER_LITERAL:
+            return strcmp(text, rule->pattern) == 0;
+        case FILTER_SUFFIX:
+            length = strlen(text);
+            return length >= rule->length && memcmp(text + length - rule->length, rule->pattern, rule->length) == 0;
+        case FILTER_PREFIX:
+            return strncmp(text, rule->pattern, rule->length) == 0;
+        default:
+            return glob_match(rule->pattern, text);
+    }
+}
+
+/*!
+ * @brief decide finds the last rule of a set matching a path
+ * @param rules is a pointer to the rules
+ * @param path is the path from the directory of the rules
+ * @param name is the last component of the path
+ * @param is_directory tells if the path is a directory
+ * @param excluded receives the decision of the matching rule
+ * @return true if a rule matched
+ */
+static bool decide(filter_rules_t *rules, char *path, char *name, bool is_directory, bool *excluded) {
+    for (size_t i = rules->count; i > 0; i--) {
+        if (rule_matches(&rules->rules[i - 1], path, name, is_directory)) {
+            *excluded = !rules->rules[i - 1].include;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * @brief is_excluded applies the rules to a path: rules files of the deepest directories first, then the global rules,
+ * and the last matching rule of a set wins (as in gitignore)
+ * @param relative_path is the path from the root of the walk (without leading '/')
+ * @param is_directory tells if the path is a directory
+ * @return true if the path is excluded
+ */
+static bool is_excluded(char *relative_path, bool is_directory) {
+    char *slash = strrchr(relative_path, '/');
+    char *name = slash == NULL ? relative_path : slash + 1;
+    bool excluded = false;
+    for (size_t i = scopes_count; i > 0; i--) {
+        size_t base_length = scopes[i - 1].base_length;
+        if (decide(&scopes[i - 1].rules, relative_path + base_length + (base_length > 0 ? 1 : 0), name, is_directory, &excluded)) {
+            return excluded;
+        }
+    }
+    decide(&global_rules, relative_path, name, is_directory, &excluded);
+    return excluded;
+}
+
+/*!
+ * @brief get_relative_path gets the path from the root of the walk
+ * @param path is a path inside the walked tree
+ * @return a pointer into path, without leading '/'
+ */
+static char *get_relative_path(char *path) {
+    char *relative_path = path + (strlen(path) < root_length ? strlen(path) : root_length);
+    while (*relative_path == '/') {
+        relative_path++;
+    }
+    return relative_path;
+}
+
+/*!
+ * @brief push_scope enters a directory of the walk, loading its rules file
+ * Rules files are read from the source, so that the destination is filtered as the source is.
+ * @param relative_path is the path of the directory from the root of the walk
+ * @param base_length is the length of relative_path
+ */
+static void push_scope(char *relative_path, size_t base_length) {
+    if (scopes_count == scopes_capacity) {
+        size_t capacity = scopes_capacity == 0 ? 32 : scopes_capacity * 2;
+        filter_scope_t *table = (filter_scope_t*) realloc(scopes, sizeof(filter_scope_t) * capacity);
+        if (table == NULL) {
+            fprintf(stderr, "Error allocating filter scopes\n");
+            exit(EXIT_FAILURE);
+        }
+        scopes = table;
+        scopes_capacity = capacity;
+    }
+    filter_scope_t *scope = &scopes[scopes_count++];
+    scope->base_length = base_length;
+    scope->rules.rules = NULL;
+    scope->rules.count = 0;
+    scope->rules.capacity = 0;
+
+    if (strlen(settings.filter_file) > 0) {
+        // With --job-file, the processes do not know the source of a job: each tree has its own rules files
+        char *rules_tree = strlen(settings.source) > 0 ? settings.source : root;
+        char rules_path[PATH_SIZE];
+        if (snprintf(rules_path, sizeof(rules_path), "%s/%.*s/%s", rules_tree, (int) base_length, relative_path, settings.filter_file) < (int) sizeof(rules_path)) {
+            load_rules(&scope->rules, rules_path, false);
+        }
+    }
+}
+
+/*!
+ * @brief is_inside tells if a path is a root or inside it
+ * @param path is the path
+ * @param tree is the root
+ * @return true if path is inside tree
+ */
+static bool is_inside(char *path, char *tree) {
+    size_t length = strlen(tree);
+    return length > 0 && strncmp(path, tree, length) == 0 && (path[length] == '\0' || path[length] == '/' || tree[length - 1] == '/');
+}
+
+/*!
+ * @brief filter_init compiles the rules of the configuration (--exclude, --include, --exclude-from)
+ * Must be called before forking, the rules are then shared by all processes.
+ * @param the_config is a pointer to the configuration
+ * @return 0 when the rules are ready, -1 else
+ */
+int filter_init(configuration_t *the_config) {
+    settings = *the_config;
+    enabled = (the_config->filter_rules_count > 0 || strlen(the_config->filter_file) > 0 || the_config->min_file_size > 0
+               || the_config->max_file_size > 0 || the_config->min_age > 0 || the_config->max_age > 0);
+
+    for (uint32_t i = 0; i < the_config->filter_rules_count; i++) {
+        char *rule = the_config->filter_rules[i];
+        int result;
+        if (rule[0] == FILTER_FILE_PREFIX) {
+            result = load_rules(&global_rules, rule + 1, true);
+        } else {
+            result = add_rule(&global_rules, rule + 1, rule[0] == FILTER_INCLUDE_PREFIX);
+        }
+        if (result == -1) {
+            filter_release();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief filter_release frees the rules
+ */
+void filter_release(void) {
+    filter_end_walk();
+    clear_rules(&global_rules);
+    free(scopes);
+    scopes = NULL;
+    scopes_capacity = 0;
+    enabled = false;
+}
+
+/*!
+ * @brief filter_begin_walk prepares the filtering of a tree walk
+ * Paths are matched from the root of the source or the destination, also when the walk starts deeper (--watch).
+ * Snapshots are trees of their own.
+ * @param target is the directory where the walk starts
+ * @return true if the target can be walked, false if it is excluded (nothing is to be done then)
+ */
+bool filter_begin_walk(char *target) {
+    if (enabled == false) {
+        return true;
+    }
+    filter_end_walk();
+    char *tree = target;
+    if (is_inside(target, settings.source)) {
+        tree = settings.source;
+    } else if (settings.snapshot == false && is_inside(target, settings.destination)) {
+        tree = settings.destination;
+    }
+    strcpy(root, tree);
+    root_length = strlen(root);
+    walk_time = time(NULL);
+
+    // Directories between the root and the target are checked and their rules loaded
+    push_scope("", 0);
+    char relative_path[PATH_SIZE];
+    strcpy(relative_path, get_relative_path(target));
+    size_t length = strlen(relative_path);
+    while (length > 0 && relative_path[length - 1] == '/') {
+        relative_path[--length] = '\0';
+    }
+    for (size_t i = 0; i <= length; i++) {
+        if (i == length || relative_path[i] == '/') {
+            char separator = relative_path[i];
+            relative_path[i] = '\0';
+            if (i > 0 && is_excluded(relative_path, true)) {
+                filter_end_walk();
+                return false;
+            }
+            if (i > 0) {
+                push_scope(relative_path, i);
+            }
+            relative_path[i] = separator;
+        }
+    }
+    return true;
+}
+
+/*!
+ * @brief filter_end_walk forgets the rules files of the walk
+ */
+void filter_end_walk(void) {
+    while (scopes_count > 0) {
+        filter_leave_directory();
+    }
+}
+
+/*!
+ * @brief filter_enter_directory tells if a directory met by the walk must be walked, and loads its rules file
+ * Excluded directories are never opened.
+ * @param path is the path of the directory
+ * @return true if the directory is walked (filter_leave_directory must then be called after it), false else
+ */
+bool filter_enter_directory(char *path) {
+    if (enabled == false) {
+        return true;
+    }
+    char *relative_path = get_relative_path(path);
+    if (is_excluded(relative_path, true)) {
+        stats_add(STATS_DIRECTORIES_EXCLUDED, 1);
+        return false;
+    }
+    push_scope(relative_path, strlen(relative_path));
+    return true;
+}
+
+/*!
+ * @brief filter_leave_directory forgets the rules file of the last entered directory
+ */
+void filter_leave_directory(void) {
+    if (scopes_count > 0) {
+        scopes_count--;
+        clear_rules(&scopes[scopes_count].rules);
+    }
+}
+
+/*!
+ * @brief filter_excludes_file tells if a file met by the walk is excluded, by its path, size or age
+ * @param path is the path of the file
+ * @param file_stats is a pointer to the stats of the file, NULL to get them when a size or age predicate needs them
+ * @return true if the file is excluded
+ */
+bool filter_excludes_file(char *path, struct stat *file_stats) {
+    if (enabled == false) {
+        return false;
+    }
+    bool excluded = is_excluded(get_relative_path(path), false);
+
+    if (excluded == false && (settings.min_file_size > 0 || settings.max_file_size > 0 || settings.min_age > 0 || settings.max_age > 0)) {
+        struct stat own_stats;
+        if (file_stats == NULL) {
+            stats_add(STATS_STAT_CALLS, 1);
+            file_stats = lstat(path, &own_stats) == 0 ? &own_stats : NULL;
+        }
+        if (file_stats != NULL) {
+            uint64_t size = file_stats->st_size;
+            int64_t age = (int64_t) walk_time - (int64_t) file_stats->st_mtim.tv_sec;
+            excluded = (size < settings.min_file_size || (settings.max_file_size > 0 && size > settings.max_file_size)
+                        || (settings.min_age > 0 && age < (int64_t) settings.min_age) || (settings.max_age > 0 && age > (int64_t) settings.max_age));
+        }
+    }
+    if (excluded == true) {
+        stats_add(STATS_FILES_EXCLUDED, 1);
+    }
+    return excluded;
+}
+
+/*!
+ * @brief filter_excludes_path tells if a single file is excluded, checking all its parent directories
+ * @param path is the path of the file
+ * @return true if the file is excluded
+ */
+bool filter_excludes_path(char *path) {
+    if (enabled == false) {
+        return false;
+    }
+    char parent[PATH_SIZE];
+    strcpy(parent, path);
+    char *slash = strrchr(parent, '/');
+    if (slash != NULL) {
+        *slash = '\0';
+    }
+    if (filter_begin_walk(parent) == false) {
+        return true;
+    }
+    bool excluded = filter_excludes_file(path, NULL);
+    filter_end_walk();
+    return excluded;
+}
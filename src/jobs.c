@@ -0,0 +1,336 @@
+#include <jobs.h>
+#include <sync.h>
+#include <pool.h>
+#include <file-properties.h>
+#include <processes.h>
+#include <messages.h>
+#include <stats.h>
+#include <trace.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+// Shared by main and the job runners, mapped before the runners are forked
+typedef struct {
+    size_t next_job; // First job not taken yet
+    int statuses[]; // Status of each job, -1 until it is synchronized
+} jobs_board_t;
+
+typedef struct {
+    configuration_t *config;
+    process_context_t *p_context;
+    jobs_list_t *jobs;
+    jobs_board_t *board;
+    uint32_t slot; // Job slot of the runner, 0 for main
+} job_runner_t;
+
+/*!
+ * @brief split_fields splits a job line into whitespace separated fields, "..." quoting fields with spaces
+ * The line is modified in place.
+ * @param line is the line
+ * @param fields receives pointers to the fields
+ * @return the number of fields, -1 when there are too many or a quote is not closed
+ */
+static int split_fields(char *line, char *fields[JOB_MAX_FIELDS]) {
+    int count = 0;
+    char *cursor = line;
+    while (true) {
+        while (isspace((unsigned char) *cursor)) {
+            cursor++;
+        }
+        if (*cursor == '\0' || *cursor == '#') {
+            return count;
+        }
+        if (count == JOB_MAX_FIELDS) {
+            return -1;
+        }
+        if (*cursor == '"') {
+            fields[count++] = ++cursor;
+            cursor = strchr(cursor, '"');
+            if (cursor == NULL) {
+                return -1;
+            }
+        } else {
+            fields[count++] = cursor;
+            while (*cursor != '\0' && !isspace((unsigned char) *cursor)) {
+                cursor++;
+            }
+            if (*cursor == '\0') {
+                return count;
+            }
+        }
+        *cursor++ = '\0';
+    }
+}
+
+/*!
+ * @brief copy_field copies a field into a fixed size string
+ * @param destination is the string
+ * @param size is the size of the string
+ * @param field is the field
+ * @return 0 in case of success, -1 if the field is too long
+ */
+static int copy_field(char *destination, size_t size, char *field) {
+    if (strlen(field) >= size) {
+        return -1;
+    }
+    strcpy(destination, field);
+    return 0;
+}
+
+/*!
+ * @brief parse_job makes a job from the fields of its line: source, destination, then options
+ * Options are name=<name>, max-analyzers=<count>, stats=<file>, manifest=<file>, dry-run and snapshot.
+ * @param job is a pointer to the job to fill
+ * @param fields is the table of fields
+ * @param count is the number of fields
+ * @param index is the position of the job in the file, used in its default name
+ * @return 0 in case of success, -1 else
+ */
+static int parse_job(job_t *job, char *fields[JOB_MAX_FIELDS], int count, size_t index) {
+    memset(job, 0, sizeof(job_t));
+    snprintf(job->name, sizeof(job->name), "job%zu", index + 1);
+    if (count < 2 || copy_field(job->source, sizeof(job->source), fields[0]) == -1
+        || copy_field(job->destination, sizeof(job->destination), fields[1]) == -1) {
+        return -1;
+    }
+
+    for (int i = 2; i < count; i++) {
+        char *value = strchr(fields[i], '=');
+        if (value != NULL) {
+            *value++ = '\0';
+        }
+        int result = 0;
+        if (strcmp(fields[i], "dry-run") == 0 && value == NULL) {
+            job->dry_run = true;
+        } else if (strcmp(fields[i], "snapshot") == 0 && value == NULL) {
+            job->snapshot = true;
+        } else if (value == NULL) {
+            result = -1;
+        } else if (strcmp(fields[i], "name") == 0) {
+            result = copy_field(job->name, sizeof(job->name), value);
+        } else if (strcmp(fields[i], "max-analyzers") == 0) {
+            job->max_analyzers = strtoul(value, NULL, 10);
+        } else if (strcmp(fields[i], "stats") == 0) {
+            result = copy_field(job->stats_file, sizeof(job->stats_file), value);
+        } else if (strcmp(fields[i], "manifest") == 0) {
+            result = copy_field(job->manifest_file, sizeof(job->manifest_file), value);
+        } else {
+            result = -1;
+        }
+        if (result == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief load_jobs reads a job file, one job per line: source destination [options]
+ * Blank lines and lines starting with # are ignored.
+ * @param path is the path of the job file
+ * @param jobs is a pointer to the list of jobs to fill
+ * @return 0 when all jobs were read, -1 else
+ */
+int load_jobs(char *path, jobs_list_t *jobs) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Error opening job file %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    char line[JOB_LINE_SIZE];
+    char *fields[JOB_MAX_FIELDS];
+    size_t capacity = 0;
+    size_t line_number = 0;
+    int result = 0;
+    jobs->jobs = NULL;
+    jobs->count = 0;
+
+    while (result == 0 && fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        int count = split_fields(line, fields);
+        if (count == 0) {
+            continue;
+        }
+        if (jobs->count == capacity) {
+            capacity = capacity == 0 ? 16 : capacity * 2;
+            job_t *table = (job_t*) realloc(jobs->jobs, sizeof(job_t) * capacity);
+            if (table == NULL) {
+                result = -1;
+                break;
+            }
+            jobs->jobs = table;
+        }
+        if (count == -1 || parse_job(&jobs->jobs[jobs->count], fields, count, jobs->count) == -1) {
+            fprintf(stderr, "Invalid job at line %zu of %s\n", line_number, path);
+            result = -1;
+        } else {
+            jobs->count++;
+        }
+    }
+    fclose(file);
+
+    if (result == 0 && jobs->count == 0) {
+        fprintf(stderr, "Job file %s has no job\n", path);
+        result = -1;
+    }
+    if (result == -1) {
+        free_jobs(jobs);
+    }
+    return result;
+}
+
+/*!
+ * @brief free_jobs frees a list of jobs
+ * @param jobs is a pointer to the list
+ */
+void free_jobs(jobs_list_t *jobs) {
+    free(jobs->jobs);
+    jobs->jobs = NULL;
+    jobs->count = 0;
+}
+
+/*!
+ * @brief run_job synchronizes one job, with the limit of the job on the analyzers of its slot
+ * @param the_config is a pointer to the configuration of the command line
+ * @param p_context is a pointer to the processes context of the caller (main or a job runner)
+ * @param job is a pointer to the job
+ * @param slot is the job slot of the caller
+ * @return 0 if the job was synchronized, -1 else
+ */
+static int run_job(configuration_t *the_config, process_context_t *p_context, job_t *job, uint32_t slot) {
+    configuration_t job_config = *the_config;
+    strcpy(job_config.source, job->source);
+    strcpy(job_config.destination, job->destination);
+    job_config.dry_run = (the_config->dry_run == true || job->dry_run == true);
+    job_config.snapshot = (the_config->snapshot == true || job->snapshot == true);
+    if (strlen(job->manifest_file) > 0) {
+        strcpy(job_config.manifest_file, job->manifest_file);
+    }
+    if (strlen(job->stats_file) > 0) {
+        strcpy(job_config.stats_file, job->stats_file);
+    } else if (strlen(the_config->stats_file) > 0 && strcmp(the_config->stats_file, "-") != 0) {
+        if (snprintf(job_config.stats_file, sizeof(job_config.stats_file), "%s.%s", the_config->stats_file, job->name) >= (int) sizeof(job_config.stats_file)) {
+            strcpy(job_config.stats_file, "");
+        }
+    }
+
+    int status = -1;
+    if (!directory_exists(job_config.source) || !directory_exists(job_config.destination)) {
+        fprintf(stderr, "Job %s: either source or destination directory do not exist\n", job->name);
+    } else if (!is_directory_writable(job_config.destination)) {
+        fprintf(stderr, "Job %s: destination directory %s is not writable\n", job->name, job_config.destination);
+    } else {
+        pool_set_job(slot, job->max_analyzers);
+        status = synchronize(&job_config, p_context);
+    }
+    printf("Job %s: %s\n", job->name, status == 0 ? "synchronized" : "failed");
+    fflush(stdout);
+    return status;
+}
+
+/*!
+ * @brief take_jobs synchronizes the jobs not taken yet by other runners, one after the other
+ * @param runner is a pointer to the runner
+ * @param p_context is a pointer to the processes context of the runner
+ */
+static void take_jobs(job_runner_t *runner, process_context_t *p_context) {
+    size_t index;
+    while ((index = __atomic_fetch_add(&runner->board->next_job, 1, __ATOMIC_RELAXED)) < runner->jobs->count) {
+        runner->board->statuses[index] = run_job(runner->config, p_context, &runner->jobs->jobs[index], runner->slot);
+    }
+}
+
+/*!
+ * @brief job_runner_loop is the job runner process function (@see make_process)
+ * A runner has its own listers, which use the message types of its slot, and shares the analyzers of main.
+ * @param parameters is a pointer to its parameters, to be cast to a job_runner_t
+ */
+static void job_runner_loop(void *parameters) {
+    job_runner_t *runner = (job_runner_t*) parameters;
+    process_context_t runner_context = *runner->p_context;
+    runner_context.main_process_pid = getpid();
+    runner_context.processes_count = 0;
+    runner_context.source_lister_pid = 0;
+    runner_context.destination_lister_pid = 0;
+
+    trace_process_start("job runner");
+    message_set_job_slot(runner->slot);
+    stats_set_slot(runner->slot);
+    pool_set_job(runner->slot, 0);
+    if (runner->config->is_parallel == true && make_listers(runner->config, &runner_context) == -1) {
+        fprintf(stderr, "Error creating the listers of job runner %u\n", runner->slot);
+        terminate_listers(&runner_context);
+        exit(EXIT_FAILURE);
+    }
+    take_jobs(runner, &runner_context);
+    terminate_listers(&runner_context);
+    trace_flush();
+    exit(EXIT_SUCCESS);
+}
+
+/*!
+ * @brief run_jobs synchronizes all the jobs, with the processes prepared once for all of them
+ * Up to --parallel-jobs runners take the jobs one after the other, each in its own slot: runners have their own
+ * listers, and share the analyzers of main, so that a big job uses the analyzers left by the small ones. Each job
+ * gets its own statistics and its own status, and at most its max-analyzers requests in flight.
+ * @param the_config is a pointer to the configuration of the command line
+ * @param p_context is a pointer to the processes context
+ * @param jobs is a pointer to the list of jobs
+ * @return 0 if all jobs were synchronized, -1 else
+ */
+int run_jobs(configuration_t *the_config, process_context_t *p_context, jobs_list_t *jobs) {
+    size_t board_size = sizeof(jobs_board_t) + sizeof(int) * jobs->count;
+    jobs_board_t *board = mmap(NULL, board_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (board == MAP_FAILED) {
+        fprintf(stderr, "Error creating the jobs board\n");
+        return -1;
+    }
+    board->next_job = 0;
+    for (size_t i = 0; i < jobs->count; i++) {
+        board->statuses[i] = -1;
+    }
+
+    job_runner_t runner = {.config = the_config, .p_context = p_context, .jobs = jobs, .board = board, .slot = 0};
+    uint32_t runners_count = the_config->parallel_jobs < jobs->count ? the_config->parallel_jobs : jobs->count;
+    pid_t runners_pids[MAX_PARALLEL_JOBS];
+    uint32_t runners_made = 0;
+    if (runners_count > 1) {
+        for (uint32_t i = 0; i < runners_count; i++) {
+            runner.slot = i + 1;
+            runners_pids[runners_made] = make_process(p_context, job_runner_loop, &runner);
+            if (runners_pids[runners_made] == -1) {
+                fprintf(stderr, "Error creating job runner %u\n", runner.slot);
+                break;
+            }
+            runners_made++;
+        }
+        for (uint32_t i = 0; i < runners_made; i++) {
+            waitpid(runners_pids[i], NULL, 0);
+            p_context->processes_count--;
+        }
+    }
+    // One job at a time, or jobs left by runners that could not be made: main runs them with its own listers
+    runner.slot = 0;
+    take_jobs(&runner, p_context);
+    pool_set_job(0, 0);
+
+    size_t failed = 0;
+    for (size_t i = 0; i < jobs->count; i++) {
+        if (board->statuses[i] != 0) {
+            failed++;
+        }
+    }
+    munmap(board, board_size);
+    if (failed > 0) {
+        fprintf(stderr, "%zu of %zu jobs failed\n", failed, jobs->count);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,280 @@
+#include <journal.h>
+#include <utility.h>
+#include <stats.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*!
+ * @brief write_plan writes the remaining plan into a new journal, which replaces the previous one
+ * The journal is synced before it is renamed, so that a crash leaves either journal, never a torn one.
+ * @param journal is a pointer to the journal, whose file is reopened for appending
+ * @return 0 in case of success, -1 else (the journal is then closed)
+ */
+static int write_plan(journal_t *journal) {
+    char temporary_path[PATH_SIZE];
+    if (journal->file != -1) {
+        close(journal->file);
+        journal->file = -1;
+    }
+    if (snprintf(temporary_path, sizeof(temporary_path), "%s.XXXXXX", journal->path) >= (int) sizeof(temporary_path)) {
+        fprintf(stderr, "Journal path %s is too long\n", journal->path);
+        return -1;
+    }
+    int fd = mkstemp(temporary_path);
+    FILE *file = fd == -1 ? NULL : fdopen(fd, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Error creating journal %s\n", temporary_path);
+        if (fd != -1) {
+            close(fd);
+            unlink(temporary_path);
+        }
+        return -1;
+    }
+
+    journal_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+    header.version = JOURNAL_VERSION;
+    strcpy(header.source, journal->config->source);
+    strcpy(header.destination, journal->config->destination);
+    for (size_t i = 0; i < journal->entries_count; i++) {
+        if (journal->done[i] == false) {
+            journal->positions[i] = header.entries_count++;
+        }
+    }
+
+    size_t source_root_length = strlen(journal->config->source);
+    bool failed = (fwrite(&header, sizeof(header), 1, file) != 1);
+    for (size_t i = 0; failed == false && i < journal->entries_count; i++) {
+        if (journal->done[i] == true) {
+            continue;
+        }
+        files_list_entry_t *entry = journal->entries[i];
+        journal_record_t record = {
+            .path_length = strlen(entry->path_and_name + source_root_length), .mode = entry->mode,
+            .mtime_sec = entry->mtime.tv_sec, .mtime_nsec = entry->mtime.tv_nsec, .size = entry->size
+        };
+        failed = (fwrite(&record, sizeof(record), 1, file) != 1
+                  || fwrite(entry->path_and_name + source_root_length, 1, record.path_length, file) != record.path_length);
+    }
+    if (failed == true || fflush(file) != 0 || fsync(fileno(file)) != 0) {
+        fprintf(stderr, "Error writing journal %s\n", temporary_path);
+        fclose(file);
+        unlink(temporary_path);
+        return -1;
+    }
+    fclose(file);
+    if (rename(temporary_path, journal->path) == -1) {
+        fprintf(stderr, "Error replacing journal %s\n", journal->path);
+        unlink(temporary_path);
+        return -1;
+    }
+
+    journal->file = open(journal->path, O_WRONLY | O_APPEND);
+    if (journal->file == -1) {
+        fprintf(stderr, "Error opening journal %s\n", journal->path);
+        return -1;
+    }
+    journal->done_since_checkpoint = 0;
+    journal->remaining_at_checkpoint = header.entries_count;
+    return 0;
+}
+
+/*!
+ * @brief read_plan reads the plan of a journal and the positions of its completed copies
+ * @param file is the journal
+ * @param the_config is a pointer to the configuration
+ * @param plan is a pointer to the list receiving the remaining copies, whose source still exists
+ * @return the number of copies already completed, -1 if the journal is invalid
+ */
+static int64_t read_plan(FILE *file, configuration_t *the_config, files_list_t *plan) {
+    journal_header_t header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0
+        || header.version != JOURNAL_VERSION || memchr(header.source, '\0', sizeof(header.source)) == NULL
+        || memchr(header.destination, '\0', sizeof(header.destination)) == NULL) {
+        return -1;
+    }
+    if (strcmp(header.source, the_config->source) != 0 || strcmp(header.destination, the_config->destination) != 0) {
+        fprintf(stderr, "Journal is for %s and %s, it is ignored\n", header.source, header.destination);
+        return -1;
+    }
+
+    files_list_entry_t **entries = (files_list_entry_t**) calloc(header.entries_count + 1, sizeof(files_list_entry_t*));
+    if (entries == NULL) {
+        return -1;
+    }
+    char relative_path[PATH_SIZE];
+    bool valid = true;
+    for (uint64_t i = 0; valid == true && i < header.entries_count; i++) {
+        journal_record_t record;
+        if (fread(&record, sizeof(record), 1, file) != 1 || record.path_length >= sizeof(relative_path)
+            || fread(relative_path, 1, record.path_length, file) != record.path_length) {
+            valid = false;
+            break;
+        }
+        relative_path[record.path_length] = '\0';
+        entries[i] = (files_list_entry_t*) calloc(1, sizeof(files_list_entry_t));
+        if (entries[i] == NULL || concat_path(entries[i]->path_and_name, the_config->source, relative_path) == NULL) {
+            valid = false;
+            break;
+        }
+        entries[i]->entry_type = FICHIER;
+        entries[i]->mode = record.mode;
+        entries[i]->mtime.tv_sec = record.mtime_sec;
+        entries[i]->mtime.tv_nsec = record.mtime_nsec;
+        entries[i]->size = record.size;
+    }
+
+    // Completed copies, a torn last position is ignored
+    int64_t completed = 0;
+    uint64_t position;
+    while (valid == true && fread(&position, sizeof(position), 1, file) == 1) {
+        if (position < header.entries_count && entries[position] != NULL) {
+            free(entries[position]);
+            entries[position] = NULL;
+            completed++;
+        }
+    }
+
+    // The remaining copies use the current properties of their source: it may have changed since the plan
+    for (uint64_t i = 0; i < header.entries_count; i++) {
+        struct stat source_stats;
+        if (entries[i] == NULL) {
+            continue;
+        }
+        stats_add(STATS_STAT_CALLS, 1);
+        if (valid == true && lstat(entries[i]->path_and_name, &source_stats) == 0 && S_ISREG(source_stats.st_mode)) {
+            entries[i]->mode = source_stats.st_mode;
+            entries[i]->mtime = source_stats.st_mtim;
+            entries[i]->size = source_stats.st_size;
+            add_entry_to_tail(plan, entries[i]);
+            continue;
+        }
+        // The copy of a file removed since the plan may have been interrupted
+        char partial_path[PATH_SIZE] = "";
+        if (concat_path(partial_path, the_config->destination, entries[i]->path_and_name + strlen(the_config->source)) != NULL
+            && strlen(partial_path) + strlen(JOURNAL_PARTIAL_SUFFIX) < sizeof(partial_path)) {
+            strcat(partial_path, JOURNAL_PARTIAL_SUFFIX);
+            unlink(partial_path);
+        }
+        free(entries[i]);
+    }
+    free(entries);
+    return valid == true ? completed : -1;
+}
+
+/*!
+ * @brief journal_load reads the journal left by an interrupted run (--journal)
+ * @param journal is a pointer to the journal
+ * @param the_config is a pointer to the configuration
+ * @param plan is a pointer to the list receiving the copies that remain to be done
+ * @return 1 when the run must resume the plan, 0 when there is no journal to resume
+ */
+int journal_load(journal_t *journal, configuration_t *the_config, files_list_t *plan) {
+    memset(journal, 0, sizeof(journal_t));
+    journal->file = -1;
+    journal->config = the_config;
+    strcpy(journal->path, the_config->journal_file);
+
+    FILE *file = fopen(journal->path, "r");
+    if (file == NULL) {
+        if (errno != ENOENT) {
+            fprintf(stderr, "Error opening journal %s\n", journal->path);
+        }
+        return 0;
+    }
+    int64_t completed = read_plan(file, the_config, plan);
+    fclose(file);
+    if (completed == -1) {
+        fprintf(stderr, "Journal %s cannot be resumed, synchronizing from scratch\n", journal->path);
+        clear_files_list(plan);
+        return 0;
+    }
+    if (the_config->verbose == true) {
+        printf("Resuming journal %s: %lld copies were completed\n", journal->path, (long long) completed);
+    }
+    return 1;
+}
+
+/*!
+ * @brief journal_begin records the plan of the copies of a run, before they start
+ * @param journal is a pointer to the journal, loaded by journal_load
+ * @param the_config is a pointer to the configuration
+ * @param entries is the table of the files to copy, which must live until journal_finish
+ * @param entries_count is the number of files to copy
+ * @return 0 in case of success, -1 else (the run goes on without journal)
+ */
+int journal_begin(journal_t *journal, configuration_t *the_config, files_list_entry_t **entries, size_t entries_count) {
+    journal->config = the_config;
+    journal->entries = entries;
+    journal->entries_count = entries_count;
+    journal->done = (bool*) calloc(entries_count + 1, sizeof(bool));
+    journal->positions = (uint64_t*) calloc(entries_count + 1, sizeof(uint64_t));
+    if (journal->done == NULL || journal->positions == NULL || write_plan(journal) == -1) {
+        free(journal->done);
+        free(journal->positions);
+        journal->done = NULL;
+        journal->positions = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief journal_complete records a completed copy, and compacts the journal once half of its plan is completed
+ * When the journal cannot be written, it is closed: the run goes on without recording its copies.
+ * @param journal is a pointer to the journal
+ * @param index is the position of the copy in the table of journal_begin
+ */
+void journal_complete(journal_t *journal, size_t index) {
+    if (journal->done == NULL || index >= journal->entries_count) {
+        return;
+    }
+    journal->done[index] = true;
+    if (journal->file == -1) {
+        return;
+    }
+    if (write(journal->file, &journal->positions[index], sizeof(uint64_t)) != sizeof(uint64_t)) {
+        fprintf(stderr, "Error writing journal %s, copies are no longer recorded\n", journal->path);
+        close(journal->file);
+        journal->file = -1;
+        return;
+    }
+    journal->done_since_checkpoint++;
+    if (journal->done_since_checkpoint >= JOURNAL_CHECKPOINT_MIN_COPIES
+        && journal->done_since_checkpoint >= journal->remaining_at_checkpoint / 2) {
+        write_plan(journal);
+    }
+}
+
+/*!
+ * @brief journal_finish removes the journal when all copies were completed, or compacts it for the next run
+ * @param journal is a pointer to the journal
+ */
+void journal_finish(journal_t *journal) {
+    if (journal->done == NULL) {
+        return;
+    }
+    bool all_done = true;
+    for (size_t i = 0; all_done == true && i < journal->entries_count; i++) {
+        all_done = journal->done[i];
+    }
+    if (all_done == true) {
+        unlink(journal->path);
+    } else {
+        write_plan(journal);
+    }
+    if (journal->file != -1) {
+        close(journal->file);
+        journal->file = -1;
+    }
+    free(journal->done);
+    free(journal->positions);
+    journal->done = NULL;
+    journal->positions = NULL;
+}
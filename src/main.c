@@ -1,10 +1,16 @@
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include <sync.h>
 #include <configuration.h>
 #include <file-properties.h>
 #include <processes.h>
 #include <unistd.h>
+#include <trace.h>
+#include <watch.h>
+#include <jobs.h>
+#include <pack.h>
+#include <remote.h>
 
 /*!
  * @brief main function, calling all the mechanics of the program
@@ -25,29 +31,69 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
-    // Check directories
-    if (!directory_exists(my_config.source) || !directory_exists(my_config.destination)) {
+    // The destination side of a remote synchronization checks its own destination, per session
+    if (my_config.serve == true) {
+        return remote_serve(&my_config);
+    }
+
+    // Check directories (jobs are checked one by one when they run, a remote destination by the remote side)
+    jobs_list_t jobs = {NULL, 0};
+    bool is_remote = (strlen(my_config.remote_command) > 0 || strlen(my_config.remote_socket) > 0);
+    if (strlen(my_config.job_file) > 0) {
+        if (load_jobs(my_config.job_file, &jobs) == -1) {
+            return -1;
+        }
+    } else if (is_remote == true) {
+        if (!directory_exists(my_config.source)) {
+            fprintf(stderr, "Source directory %s does not exist\nAborting\n", my_config.source);
+            return -1;
+        }
+    } else if (!directory_exists(my_config.source) || !directory_exists(my_config.destination)) {
         fprintf(stderr, "Either source or destination directory do not exist\nAborting\n");
         return -1;
-    }
     // Is destination writable?
-    if (!is_directory_writable(my_config.destination)) {
+    } else if (!is_directory_writable(my_config.destination)) {
         fprintf(stderr, "Destination directory %s is not writable\n", my_config.destination);
         return -1;
     }
+    for (uint32_t i = 0; i < my_config.extra_destinations_count; i++) {
+        if (!directory_exists(my_config.extra_destinations[i]) || !is_directory_writable(my_config.extra_destinations[i])) {
+            fprintf(stderr, "Destination directory %s does not exist or is not writable\n", my_config.extra_destinations[i]);
+            return -1;
+        }
+    }
     
 
-    // Prepare (fork, MQ) if parallel
+    // Restoring a pack store only reads its index and packs
+    if (my_config.restore == true) {
+        return pack_restore(&my_config);
+    }
+
+    // Prepare (fork, MQ) if parallel, once for all jobs
     process_context_t processes_context;
     if (prepare(&my_config, &processes_context) != 0) {
+        free_jobs(&jobs);
         return -1;
     }
     
-    // Run synchronize:
-    synchronize(&my_config, &processes_context);
+    // Run synchronize, then keep synchronizing the changes of the source in watch mode
+    int status = 0;
+    if (jobs.count > 0) {
+        status = run_jobs(&my_config, &processes_context, &jobs);
+    } else {
+        if (my_config.watch_mode != WATCH_NONE) {
+            watch_handle_signals();
+        }
+        status = synchronize(&my_config, &processes_context);
+        if (my_config.watch_mode != WATCH_NONE) {
+            watch_source(&my_config, &processes_context);
+        }
+    }
 
     // Clean resources
     clean_processes(&my_config, &processes_context);
+    trace_finish();
+    free_jobs(&jobs);
 
-    return 0;
+    return status;
 }
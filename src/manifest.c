@@ -0,0 +1,376 @@
+#include <manifest.h>
+#include <utility.h>
+#include <file-properties.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*!
+ * @brief manifest_open maps a manifest to use it as the destination list
+ * @param manifest is a pointer to the manifest to fill
+ * @param path is the path of the manifest file
+ * @param the_config is a pointer to the configuration, NULL not to check how the digests were computed
+ * @param root is the directory the manifest must describe, NULL not to check it
+ * @return 0 in case of success, -1 when the manifest is missing or cannot be used (the destination must then be listed)
+ */
+int manifest_open(manifest_t *manifest, char *path, configuration_t *the_config, char *root) {
+    memset(manifest, 0, sizeof(manifest_t));
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            fprintf(stderr, "Error opening manifest %s\n", path);
+        }
+        return -1;
+    }
+    struct stat manifest_stats;
+    if (fstat(fd, &manifest_stats) == -1 || manifest_stats.st_size < (off_t) sizeof(manifest_header_t)) {
+        fprintf(stderr, "Manifest %s is truncated, listing the destination\n", path);
+        close(fd);
+        return -1;
+    }
+    manifest->length = manifest_stats.st_size;
+    manifest->data = mmap(NULL, manifest->length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (manifest->data == MAP_FAILED) {
+        manifest->data = NULL;
+        fprintf(stderr, "Error mapping manifest %s\n", path);
+        return -1;
+    }
+
+    manifest_header_t *header = manifest->data;
+    uint64_t records_end = sizeof(manifest_header_t) + header->entries_count * sizeof(manifest_record_t);
+    if (memcmp(header->magic, MANIFEST_MAGIC, sizeof(header->magic)) != 0 || header->version != MANIFEST_VERSION
+        || header->entries_count > manifest->length / sizeof(manifest_record_t)
+        || header->paths_offset < records_end || header->paths_offset > manifest->length
+        || header->paths_size != manifest->length - header->paths_offset
+        || memchr(header->root, '\0', sizeof(header->root)) == NULL) {
+        fprintf(stderr, "Manifest %s is invalid, listing the destination\n", path);
+        manifest_close(manifest);
+        return -1;
+    }
+    manifest->header = header;
+    manifest->records = (manifest_record_t*) ((char*) manifest->data + sizeof(manifest_header_t));
+    manifest->paths = (char*) manifest->data + header->paths_offset;
+
+    // Offsets are compared without additions, which a corrupted file could make wrap around
+    for (uint64_t i = 0; i < header->entries_count; i++) {
+        if (manifest->records[i].path_offset > header->paths_size
+            || manifest->records[i].path_length > header->paths_size - manifest->records[i].path_offset) {
+            fprintf(stderr, "Manifest %s is invalid, listing the destination\n", path);
+            manifest_close(manifest);
+            return -1;
+        }
+    }
+
+    if (root != NULL && strcmp(header->root, root) != 0) {
+        fprintf(stderr, "Manifest %s describes %s, listing the destination\n", path, header->root);
+        manifest_close(manifest);
+        return -1;
+    }
+    if (the_config != NULL && digests_compatible(the_config, header->compare_mode, header->sample_threshold, header->sample_block_size, header->sample_blocks_count) == false) {
+        fprintf(stderr, "Manifest %s was written with other digests, listing the destination\n", path);
+        manifest_close(manifest);
+        return -1;
+    }
+
+    madvise(manifest->data, manifest->length, MADV_RANDOM);
+    return 0;
+}
+
+/*!
+ * @brief fill_entry fills a files list entry from a record of a manifest
+ * @param manifest is a pointer to the manifest
+ * @param record is a pointer to the record
+ * @param entry is a pointer to the entry to fill
+ */
+static void fill_entry(manifest_t *manifest, manifest_record_t *record, files_list_entry_t *entry) {
+    size_t root_length = strlen(manifest->header->root);
+    size_t path_length = record->path_length;
+    if (root_length + path_length >= sizeof(entry->path_and_name)) {
+        path_length = sizeof(entry->path_and_name) - root_length - 1;
+    }
+    memcpy(entry->path_and_name, manifest->header->root, root_length);
+    memcpy(entry->path_and_name + root_length, manifest->paths + record->path_offset, path_length);
+    entry->path_and_name[root_length + path_length] = '\0';
+    entry->mtime.tv_sec = record->mtime_sec;
+    entry->mtime.tv_nsec = record->mtime_nsec;
+    entry->size = record->size;
+    memcpy(entry->md5sum, record->md5sum, sizeof(entry->md5sum));
+    entry->entry_type = FICHIER;
+    entry->mode = record->mode;
+    entry->next = NULL;
+    entry->prev = NULL;
+}
+
+/*!
+ * @brief manifest_verify compares a sample of the manifest to the destination, to detect changes made by other tools
+ * Sampled files are evenly spaced from a random start, and only their size, mtime and mode are checked.
+ * @param manifest is a pointer to the manifest
+ * @param samples_count is the number of files to check, 0 disables the verification
+ * @return true if the sample matches the destination, false else
+ */
+bool manifest_verify(manifest_t *manifest, uint32_t samples_count) {
+    uint64_t entries_count = manifest->header->entries_count;
+    if (samples_count == 0 || entries_count == 0) {
+        return true;
+    }
+    uint64_t step = entries_count > samples_count ? entries_count / samples_count : 1;
+    srandom(time(NULL) ^ getpid());
+
+    files_list_entry_t *entry = malloc(sizeof(files_list_entry_t));
+    if (entry == NULL) {
+        return false;
+    }
+    bool matches = true;
+    for (uint64_t i = random() % step; matches == true && i < entries_count; i += step) {
+        struct stat file_stats;
+        fill_entry(manifest, &manifest->records[i], entry);
+        if (lstat(entry->path_and_name, &file_stats) == -1 || (uint64_t) file_stats.st_size != entry->size
+            || file_stats.st_mtim.tv_sec != entry->mtime.tv_sec || file_stats.st_mtim.tv_nsec != entry->mtime.tv_nsec
+            || file_stats.st_mode != entry->mode) {
+            fprintf(stderr, "Destination file %s changed since the manifest was written, listing the destination\n", entry->path_and_name);
+            matches = false;
+        }
+    }
+    free(entry);
+    return matches;
+}
+
+/*!
+ * @brief compare_record compares a relative path to the path of a record, as strcmp does
+ * @param manifest is a pointer to the manifest
+ * @param record is a pointer to the record
+ * @param relative_path is the path to compare
+ * @return a negative value, 0 or a positive value when relative_path is before, equal or after the record path
+ */
+static int compare_record(manifest_t *manifest, manifest_record_t *record, char *relative_path) {
+    int order = strncmp(relative_path, manifest->paths + record->path_offset, record->path_length);
+    if (order != 0) {
+        return order;
+    }
+    return relative_path[record->path_length] == '\0' ? 0 : 1;
+}
+
+/*!
+ * @brief manifest_find looks for a file in a manifest (binary search)
+ * @param manifest is a pointer to the manifest
+ * @param relative_path is the path of the file from the root of the destination
+ * @param entry is a pointer to the entry filled with the file found
+ * @return entry when the file was found, NULL else
+ */
+files_list_entry_t *manifest_find(manifest_t *manifest, char *relative_path, files_list_entry_t *entry) {
+    uint64_t low = 0;
+    uint64_t high = manifest->header->entries_count;
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        int order = compare_record(manifest, &manifest->records[middle], relative_path);
+        if (order == 0) {
+            fill_entry(manifest, &manifest->records[middle], entry);
+            return entry;
+        }
+        if (order < 0) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+    return NULL;
+}
+
+/*!
+ * @brief manifest_get_entry gets the file of a record, for walks of the manifest in path order
+ * @param manifest is a pointer to the manifest
+ * @param index is the position of the record
+ * @param entry is a pointer to the entry to fill
+ */
+void manifest_get_entry(manifest_t *manifest, uint64_t index, files_list_entry_t *entry) {
+    fill_entry(manifest, &manifest->records[index], entry);
+}
+
+/*!
+ * @brief manifest_compare compares a relative path to the path of a record, as strcmp does
+ * @param manifest is a pointer to the manifest
+ * @param index is the position of the record
+ * @param relative_path is the path to compare
+ * @return a negative value, 0 or a positive value when relative_path is before, equal or after the record path
+ */
+int manifest_compare(manifest_t *manifest, uint64_t index, char *relative_path) {
+    return compare_record(manifest, &manifest->records[index], relative_path);
+}
+
+/*!
+ * @brief manifest_close unmaps a manifest
+ * @param manifest is a pointer to the manifest
+ */
+void manifest_close(manifest_t *manifest) {
+    if (manifest->data != NULL) {
+        munmap(manifest->data, manifest->length);
+    }
+    memset(manifest, 0, sizeof(manifest_t));
+}
+
+/*!
+ * @brief manifest_writer_open starts writing a new manifest
+ * It is written into a temporary file, which replaces the manifest on commit.
+ * @param writer is a pointer to the writer
+ * @param path is the path of the manifest
+ * @return 0 in case of success, -1 else
+ */
+int manifest_writer_open(manifest_writer_t *writer, char *path) {
+    memset(writer, 0, sizeof(manifest_writer_t));
+    if (snprintf(writer->temporary_path, PATH_SIZE, "%s.XXXXXX", path) >= PATH_SIZE) {
+        fprintf(stderr, "Manifest path %s is too long\n", path);
+        return -1;
+    }
+    strcpy(writer->path, path);
+
+    int fd = mkstemp(writer->temporary_path);
+    if (fd == -1) {
+        fprintf(stderr, "Error creating manifest %s\n", writer->temporary_path);
+        return -1;
+    }
+    writer->file = fdopen(fd, "w");
+    writer->paths = tmpfile();
+    if (writer->file == NULL || writer->paths == NULL) {
+        fprintf(stderr, "Error creating manifest %s\n", writer->temporary_path);
+        if (writer->file == NULL) {
+            close(fd);
+        }
+        manifest_writer_abort(writer);
+        return -1;
+    }
+
+    // The header is written on commit, when the counts are known
+    manifest_header_t header;
+    memset(&header, 0, sizeof(header));
+    if (fwrite(&header, sizeof(header), 1, writer->file) != 1) {
+        manifest_writer_abort(writer);
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief manifest_writer_add adds a file to a manifest
+ * Files must be added in relative path order (strcmp).
+ * @param writer is a pointer to the writer
+ * @param relative_path is the path of the file from the root of the destination
+ * @param entry is a pointer to the entry of the file
+ * @return 0 in case of success, -1 else
+ */
+int manifest_writer_add(manifest_writer_t *writer, char *relative_path, files_list_entry_t *entry) {
+    return manifest_writer_add_packed(writer, relative_path, entry, 0, 0);
+}
+
+/*!
+ * @brief manifest_writer_add_packed adds a file to the index of a pack store, with its location
+ * Files must be added in relative path order (strcmp).
+ * @param writer is a pointer to the writer
+ * @param relative_path is the path of the file from the root of the destination
+ * @param entry is a pointer to the entry of the file
+ * @param pack_id is the pack holding the file, 0 for a regular file
+ * @param pack_offset is the offset of the file in its pack
+ * @return 0 in case of success, -1 else
+ */
+int manifest_writer_add_packed(manifest_writer_t *writer, char *relative_path, files_list_entry_t *entry, uint32_t pack_id, uint64_t pack_offset) {
+    manifest_record_t record;
+    memset(&record, 0, sizeof(record));
+    record.path_offset = writer->paths_size;
+    record.path_length = strlen(relative_path);
+    record.mode = entry->mode;
+    record.mtime_sec = entry->mtime.tv_sec;
+    record.mtime_nsec = entry->mtime.tv_nsec;
+    record.size = entry->size;
+    record.pack_offset = pack_offset;
+    record.pack_id = pack_id;
+    memcpy(record.md5sum, entry->md5sum, sizeof(record.md5sum));
+
+    if (fwrite(&record, sizeof(record), 1, writer->file) != 1 || fwrite(relative_path, 1, record.path_length, writer->paths) != record.path_length) {
+        return -1;
+    }
+    writer->entries_count++;
+    writer->paths_size += record.path_length;
+    return 0;
+}
+
+/*!
+ * @brief manifest_writer_commit completes a manifest and replaces the previous one
+ * @param writer is a pointer to the writer, which is closed
+ * @param the_config is a pointer to the configuration of the run
+ * @param root is the directory described by the manifest
+ * @return 0 in case of success, -1 else (the previous manifest is then kept)
+ */
+int manifest_writer_commit(manifest_writer_t *writer, configuration_t *the_config, char *root) {
+    manifest_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MANIFEST_MAGIC, sizeof(header.magic));
+    header.version = MANIFEST_VERSION;
+    header.compare_mode = the_config->compare_mode;
+    header.sample_threshold = the_config->sample_threshold;
+    header.sample_block_size = the_config->sample_block_size;
+    header.sample_blocks_count = the_config->sample_blocks_count;
+    header.entries_count = writer->entries_count;
+    header.paths_offset = sizeof(manifest_header_t) + writer->entries_count * sizeof(manifest_record_t);
+    header.paths_size = writer->paths_size;
+    if (strlen(root) >= sizeof(header.root)) {
+        manifest_writer_abort(writer);
+        return -1;
+    }
+    strcpy(header.root, root);
+
+    char buffer[65536];
+    size_t read_size;
+    int result = 0;
+    rewind(writer->paths);
+    while (result == 0 && (read_size = fread(buffer, 1, sizeof(buffer), writer->paths)) > 0) {
+        if (fwrite(buffer, 1, read_size, writer->file) != read_size) {
+            result = -1;
+        }
+    }
+    if (result == 0 && (ferror(writer->paths) || fseek(writer->file, 0, SEEK_SET) != 0
+                        || fwrite(&header, sizeof(header), 1, writer->file) != 1
+                        || fflush(writer->file) != 0 || fsync(fileno(writer->file)) != 0)) {
+        result = -1;
+    }
+    if (result == -1) {
+        fprintf(stderr, "Error writing manifest %s\n", writer->temporary_path);
+        manifest_writer_abort(writer);
+        return -1;
+    }
+
+    fclose(writer->paths);
+    fclose(writer->file);
+    writer->paths = NULL;
+    writer->file = NULL;
+    if (rename(writer->temporary_path, writer->path) == -1) {
+        fprintf(stderr, "Error replacing manifest %s\n", writer->path);
+        unlink(writer->temporary_path);
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief manifest_writer_abort drops a manifest being written
+ * @param writer is a pointer to the writer
+ */
+void manifest_writer_abort(manifest_writer_t *writer) {
+    if (writer->paths != NULL) {
+        fclose(writer->paths);
+        writer->paths = NULL;
+    }
+    if (writer->file != NULL) {
+        fclose(writer->file);
+        writer->file = NULL;
+    }
+    if (strlen(writer->temporary_path) > 0) {
+        unlink(writer->temporary_path);
+        strcpy(writer->temporary_path, "");
+    }
+}
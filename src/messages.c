@@ -1,9 +1,70 @@
 #include <messages.h>
 #include <sys/msg.h>
 #include <string.h>
+#include <stddef.h>
+#include <stats.h>
+#include <trace.h>
 
 // Functions in this file are required for inter processes communication
 
+// Job slot of the process (see MSG_TYPE_JOB_STRIDE), inherited by the listers a job runner forks
+static uint32_t job_slot = 0;
+
+/*!
+ * @brief message_set_job_slot sets the job slot whose types the process uses
+ * @param slot is the slot, 0 outside of the job runners
+ */
+void message_set_job_slot(uint32_t slot) {
+    job_slot = slot;
+}
+
+/*!
+ * @brief message_type gets the type of main or of a lister for the job slot of the process
+ * @param type is one of the MSG_TYPE_TO_* types
+ * @return the type to use (analyzers keep their type, they serve all slots)
+ */
+long message_type(long type) {
+    return type == MSG_TYPE_TO_ANALYZERS ? type : type + MSG_TYPE_JOB_STRIDE * (long) job_slot;
+}
+
+/*!
+ * @brief message_job_slot gets the job slot of a type, e.g. to know for which job an analyzer works
+ * @param type is a type given by message_type
+ * @return the slot
+ */
+uint32_t message_job_slot(long type) {
+    return type < 1 ? 0 : (uint32_t) ((type - 1) / MSG_TYPE_JOB_STRIDE);
+}
+
+/*!
+ * @brief send_message_flags sends a message with msgsnd flags and counts it in the run statistics
+ * @param msg_queue the MQ identifier through which to send the message
+ * @param message is a pointer to the message, starting with its mtype
+ * @param size is the size of the message, without its mtype
+ * @param flags are the msgsnd flags
+ * @return the result of the msgsnd function
+ */
+static int send_message_flags(int msg_queue, void *message, size_t size, int flags) {
+    uint64_t trace_start = trace_begin();
+    int result = msgsnd(msg_queue, message, size, flags);
+    trace_end("msgsnd", trace_start, TRACE_NO_ARG);
+    if (result == 0) {
+        stats_add(STATS_IPC_MESSAGES_SENT, 1);
+    }
+    return result;
+}
+
+/*!
+ * @brief send_message sends a message, waiting for room in the MQ, and counts it in the run statistics
+ * @param msg_queue the MQ identifier through which to send the message
+ * @param message is a pointer to the message, starting with its mtype
+ * @param size is the size of the message, without its mtype
+ * @return the result of the msgsnd function
+ */
+static int send_message(int msg_queue, void *message, size_t size) {
+    return send_message_flags(msg_queue, message, size, 0);
+}
+
 /*!
  * @brief send_file_entry sends a file entry, with a given command code
  * @param msg_queue the MQ identifier through which to send the entry
@@ -20,7 +81,7 @@ int send_file_entry(int msg_queue, int recipient, files_list_entry_t *file_entry
     message.list_entry.payload = *file_entry;
     message.list_entry.reply_to = msg_queue;
 
-    return msgsnd(msg_queue, &message, sizeof(files_list_entry_transmit_t) - sizeof(long), 0);
+    return send_message(msg_queue, &message, sizeof(files_list_entry_transmit_t) - sizeof(long));
 }
 
 /*!
@@ -28,40 +89,70 @@ int send_file_entry(int msg_queue, int recipient, files_list_entry_t *file_entry
  * @param msg_queue is the id of the MQ used to send the command
  * @param recipient is the recipient of the message (mtype)
  * @param target_dir is a string containing the path to the directory to analyze
+ * @param flags are the msgsnd flags, IPC_NOWAIT not to wait for room in the MQ
  * @return the result of msgsnd
  */
-int send_analyze_dir_command(int msg_queue, int recipient, char *target_dir) {
+int send_analyze_dir_command(int msg_queue, int recipient, char *target_dir, int flags) {
     analyze_dir_command_t message;
     message.mtype = recipient;
     strcpy(message.target, target_dir);
     message.op_code = COMMAND_CODE_ANALYZE_DIR;
-    return msgsnd(msg_queue, &message, sizeof(analyze_dir_command_t) - sizeof(long), 0);
+    return send_message_flags(msg_queue, &message, sizeof(analyze_dir_command_t) - sizeof(long), flags);
 }
 
-// The 3 following functions are one-liners
-
 /*!
- * @brief send_analyze_file_command sends a file entry to be analyzed
- * @param msg_queue the MQ identifier through which to send the entry
+ * @brief send_analyze_file_command sends the path of a file to be analyzed
+ * @param msg_queue the MQ identifier through which to send the command
  * @param recipient is the id of the recipient (as specified by mtype)
- * @param file_entry is a pointer to the entry to send (must be copied)
- * @return the result of the send_file_entry function
- * Calls send_file_entry function
+ * @param reply_to is the mtype the response must be sent to
+ * @param entry_index is the index of the entry in the requester's list, sent back in the response
+ * @param path is the path of the file (only its used part is sent)
+ * @return the result of msgsnd
  */
-int send_analyze_file_command(int msg_queue, int recipient, files_list_entry_t *file_entry) {
-    return send_file_entry(msg_queue, recipient, file_entry, COMMAND_CODE_ANALYZE_FILE);
+int send_analyze_file_command(int msg_queue, int recipient, int reply_to, uint32_t entry_index, char *path) {
+    analyze_file_command_t message;
+    size_t path_length = strlen(path) + 1;
+
+    message.mtype = recipient;
+    message.op_code = COMMAND_CODE_ANALYZE_FILE;
+    message.reply_to = reply_to;
+    message.entry_index = entry_index;
+    memcpy(message.path, path, path_length);
+
+    return send_message(msg_queue, &message, offsetof(analyze_file_command_t, path) + path_length - sizeof(long));
 }
 
 /*!
- * @brief send_analyze_file_response sends a file entry after analyze
- * @param msg_queue the MQ identifier through which to send the entry
+ * @brief send_analyze_file_response sends the properties of an analyzed file, without its path
+ * @param msg_queue the MQ identifier through which to send the response
  * @param recipient is the id of the recipient (as specified by mtype)
- * @param file_entry is a pointer to the entry to send (must be copied)
- * @return the result of the send_file_entry function
- * Calls send_file_entry function
+ * @param entry_index is the index received in the command
+ * @param file_entry is a pointer to the analyzed entry
+ * @param result is the result of the analysis (get_file_stats)
+ * @return the result of msgsnd
+ */
+int send_analyze_file_response(int msg_queue, int recipient, uint32_t entry_index, files_list_entry_t *file_entry, int result) {
+    analyze_file_response_t message;
+    message.mtype = recipient;
+    message.op_code = COMMAND_CODE_FILE_ANALYZED;
+    message.result = result;
+    message.entry_index = entry_index;
+    message.mtime = file_entry->mtime;
+    message.size = file_entry->size;
+    memcpy(message.md5sum, file_entry->md5sum, sizeof(message.md5sum));
+    message.entry_type = file_entry->entry_type;
+    message.mode = file_entry->mode;
+
+    return send_message(msg_queue, &message, sizeof(analyze_file_response_t) - sizeof(long));
+}
+
+/*!
+ * @brief analyze_file_exchange_size computes the room an analyze request and its response take in the MQ
+ * @param path is the path of the file to analyze
+ * @return the size of both messages, as counted by the MQ
  */
-int send_analyze_file_response(int msg_queue, int recipient, files_list_entry_t *file_entry) {
-    return send_file_entry(msg_queue, recipient, file_entry, COMMAND_CODE_FILE_ANALYZED);
+size_t analyze_file_exchange_size(char *path) {
+    return offsetof(analyze_file_command_t, path) + strlen(path) + 1 - sizeof(long) + sizeof(analyze_file_response_t) - sizeof(long);
 }
 
 /*!
@@ -92,7 +183,7 @@ int send_source_list_end(int msg_queue, int recipient) {
     message.list_entry.op_code = COMMAND_CODE_SOURCE_LIST_COMPLETE;
     message.list_entry.reply_to = msg_queue;
 
-    return msgsnd(msg_queue, &message, sizeof(files_list_entry_transmit_t) - sizeof(long), 0);
+    return send_message(msg_queue, &message, sizeof(files_list_entry_transmit_t) - sizeof(long));
 }
 
 int send_destination_list_end(int msg_queue, int recipient) {
@@ -101,7 +192,93 @@ int send_destination_list_end(int msg_queue, int recipient) {
     message.list_entry.op_code = COMMAND_CODE_DESTINATION_LIST_COMPLETE;
     message.list_entry.reply_to = msg_queue;
 
-    return msgsnd(msg_queue, &message, sizeof(files_list_entry_transmit_t) - sizeof(long), 0);
+    return send_message(msg_queue, &message, sizeof(files_list_entry_transmit_t) - sizeof(long));
+}
+
+/*!
+ * @brief send_list_run sends the path of a run file holding a sorted part of a list (--max-memory)
+ * @param msg_queue is the id of the MQ used to send the message
+ * @param recipient is the destination of the message
+ * @param op_code tells which list the run belongs to
+ * @param run_path is the path of the run file (only its used part is sent)
+ * @return the result of msgsnd
+ */
+static int send_list_run(int msg_queue, int recipient, char op_code, char *run_path) {
+    analyze_dir_command_t message;
+    size_t path_length = strlen(run_path) + 1;
+
+    message.mtype = recipient;
+    message.op_code = op_code;
+    memcpy(message.target, run_path, path_length);
+    return send_message(msg_queue, &message, offsetof(analyze_dir_command_t, target) + path_length - sizeof(long));
+}
+
+int send_source_list_run(int msg_queue, int recipient, char *run_path) {
+    return send_list_run(msg_queue, recipient, COMMAND_CODE_SOURCE_LIST_RUN, run_path);
+}
+
+int send_destination_list_run(int msg_queue, int recipient, char *run_path) {
+    return send_list_run(msg_queue, recipient, COMMAND_CODE_DESTINATION_LIST_RUN, run_path);
+}
+
+/*!
+ * @brief send_compare_files_command asks an analyzer to compare the content of a source file and its destination counterpart
+ * The response goes to main, in the job slot of the caller.
+ * @param msg_queue is the id of the MQ used to send the command
+ * @param recipient is the recipient of the message (mtype)
+ * @param pair_index is the index of the pair, sent back in the response
+ * @param source_path is the path to the source file
+ * @param destination_path is the path to the destination file
+ * @return the result of msgsnd
+ * Only the used part of the paths buffer is sent.
+ */
+int send_compare_files_command(int msg_queue, int recipient, uint32_t pair_index, char *source_path, char *destination_path) {
+    compare_files_command_t message;
+    size_t source_length = strlen(source_path) + 1;
+    size_t destination_length = strlen(destination_path) + 1;
+
+    if (source_length + destination_length > sizeof(message.paths)) {
+        return -1;
+    }
+
+    message.mtype = recipient;
+    message.op_code = COMMAND_CODE_COMPARE_FILES;
+    message.result = 0;
+    message.reply_to = message_type(MSG_TYPE_TO_MAIN);
+    message.pair_index = pair_index;
+    memcpy(message.paths, source_path, source_length);
+    memcpy(message.paths + source_length, destination_path, destination_length);
+
+    return send_message(msg_queue, &message, offsetof(compare_files_command_t, paths) + source_length + destination_length - sizeof(long));
+}
+
+/*!
+ * @brief send_compare_files_response sends the result of a files comparison
+ * @param msg_queue is the id of the MQ used to send the response
+ * @param recipient is the recipient of the message (mtype)
+ * @param pair_index is the index of the compared pair, as received in the command
+ * @param result is the result of compare_files_content
+ * @return the result of msgsnd
+ */
+int send_compare_files_response(int msg_queue, int recipient, uint32_t pair_index, int result) {
+    compare_files_command_t message;
+    message.mtype = recipient;
+    message.op_code = COMMAND_CODE_FILES_COMPARED;
+    message.result = result;
+    message.reply_to = recipient;
+    message.pair_index = pair_index;
+
+    return send_message(msg_queue, &message, offsetof(compare_files_command_t, paths) - sizeof(long));
+}
+
+/*!
+ * @brief compare_files_exchange_size computes the room a compare request and its response take in the MQ
+ * @param source_path is the path to the source file
+ * @param destination_path is the path to the destination file
+ * @return the size of both messages, as counted by the MQ
+ */
+size_t compare_files_exchange_size(char *source_path, char *destination_path) {
+    return 2 * (offsetof(compare_files_command_t, paths) - sizeof(long)) + strlen(source_path) + strlen(destination_path) + 2;
 }
 
 /*!
@@ -115,7 +292,7 @@ int send_terminate_command(int msg_queue, int recipient) {
     message.simple_command.mtype = recipient;
     message.simple_command.message = COMMAND_CODE_TERMINATE;
 
-    return msgsnd(msg_queue, &message, sizeof(simple_command_t) - sizeof(long), 0);
+    return send_message(msg_queue, &message, sizeof(simple_command_t) - sizeof(long));
 }
 
 /*!
@@ -129,5 +306,5 @@ int send_terminate_confirm(int msg_queue, int recipient) {
     message.simple_command.mtype = recipient;
     message.simple_command.message = COMMAND_CODE_TERMINATE_OK;
 
-    return msgsnd(msg_queue, &message, sizeof(simple_command_t) - sizeof(long), 0);
+    return send_message(msg_queue, &message, sizeof(simple_command_t) - sizeof(long));
 }
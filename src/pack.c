@@ -0,0 +1,436 @@
+#include <pack.h>
+#include <manifest.h>
+#include <sync.h>
+#include <utility.h>
+#include <file-properties.h>
+#include <stats.h>
+#include <trace.h>
+#include <progress.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+/*!
+ * @brief open_pack opens a pack to append files to it
+ * @param store is a pointer to the store
+ * @param pack_id is the pack to open
+ * @return 0 in case of success, -1 else
+ */
+static int open_pack(pack_store_t *store, uint32_t pack_id) {
+    char pack_path[PATH_SIZE];
+    if (snprintf(pack_path, sizeof(pack_path), "%s/pack-%06u", store->directory, pack_id) >= (int) sizeof(pack_path)) {
+        fprintf(stderr, "Pack path in %s is too long\n", store->directory);
+        return -1;
+    }
+    int file = open(pack_path, O_WRONLY | O_CREAT, 0644);
+    if (file == -1) {
+        fprintf(stderr, "Error opening pack %s: %s\n", pack_path, strerror(errno));
+        return -1;
+    }
+    off_t pack_size = lseek(file, 0, SEEK_END);
+    if (pack_size == -1) {
+        fprintf(stderr, "Error opening pack %s: %s\n", pack_path, strerror(errno));
+        close(file);
+        return -1;
+    }
+    stats_add(STATS_OPEN_CALLS, 1);
+    store->file = file;
+    store->pack_id = pack_id;
+    store->pack_size = pack_size;
+    return 0;
+}
+
+/*!
+ * @brief close_pack syncs and closes the pack being appended to
+ * @param store is a pointer to the store
+ * @return 0 in case of success, -1 when the pack could not be synced (its new files must not be indexed)
+ */
+static int close_pack(pack_store_t *store) {
+    if (store->file == -1) {
+        return 0;
+    }
+    int result = fsync(store->file);
+    if (result == -1) {
+        fprintf(stderr, "Error syncing pack %06u: %s\n", store->pack_id, strerror(errno));
+    }
+    close(store->file);
+    store->file = -1;
+    return result;
+}
+
+/*!
+ * @brief pack_append appends a source file to the current pack, starting a new pack when it is full
+ * A failed append is truncated away, so that the pack only grows by whole files.
+ * @param the_config is a pointer to the configuration
+ * @param store is a pointer to the store
+ * @param source_entry is the source file
+ * @param pack_id receives the pack holding the file
+ * @param pack_offset receives the offset of the file in the pack
+ * @return 0 in case of success, -1 else (including a source whose size changed since it was analyzed)
+ */
+static int pack_append(configuration_t *the_config, pack_store_t *store, files_list_entry_t *source_entry, uint32_t *pack_id, uint64_t *pack_offset) {
+    if (store->file != -1 && store->pack_size >= PACK_MAX_SIZE) {
+        if (close_pack(store) == -1) {
+            return -1;
+        }
+        store->pack_id++;
+    }
+    if (store->file == -1 && open_pack(store, store->pack_id) == -1) {
+        return -1;
+    }
+
+    uint64_t start_ns = stats_now_ns();
+    uint64_t trace_start = trace_begin();
+    int source_file = open(source_entry->path_and_name, O_RDONLY);
+    if (source_file == -1) {
+        fprintf(stderr, "Error opening source file %s\n", source_entry->path_and_name);
+        return -1;
+    }
+    stats_add(STATS_OPEN_CALLS, 1);
+
+    // With --verify-copy, the appended data is hashed and checked against the analysis, whose digest goes into the index
+    uint8_t digest[sizeof(source_entry->md5sum)];
+    int64_t bytes_copied = copy_file_data(source_file, store->file, source_entry->size, the_config->verify_copy == true ? digest : NULL);
+    int result = 0;
+    if (bytes_copied == -1 || (uint64_t) bytes_copied != source_entry->size) {
+        fprintf(stderr, "Error packing file %s\n", source_entry->path_and_name);
+        result = -1;
+    } else if (the_config->verify_copy == true) {
+        result = check_copied_digest(source_entry, the_config, digest, bytes_copied, store->directory);
+    }
+    close(source_file);
+
+    if (result == -1) {
+        if (ftruncate(store->file, store->pack_size) == -1 || lseek(store->file, store->pack_size, SEEK_SET) == -1) {
+            // The pack cannot be trusted to end where the store expects: the next files go to a new pack
+            close(store->file);
+            store->file = -1;
+            store->pack_id++;
+        }
+        return -1;
+    }
+
+    *pack_id = store->pack_id;
+    *pack_offset = store->pack_size;
+    store->pack_size += bytes_copied;
+    stats_add(STATS_FILES_COPIED, 1);
+    stats_add(STATS_BYTES_COPIED, bytes_copied);
+    progress_add(PROGRESS_FILES_COPIED, 1);
+    progress_add(PROGRESS_BYTES_COPIED, bytes_copied);
+    stats_record_latency(STATS_HISTOGRAM_COPY, stats_now_ns() - start_ns);
+    trace_end("pack_file", trace_start, bytes_copied);
+    return 0;
+}
+
+/*!
+ * @brief regular_file_matches tells if a regular file of the destination still is as the index describes it
+ * @param path is the path of the file
+ * @param entry is the entry of the index
+ * @return true if the file has the size and mtime of the entry, false else
+ */
+static bool regular_file_matches(char *path, files_list_entry_t *entry) {
+    struct stat file_stats;
+    stats_add(STATS_STAT_CALLS, 1);
+    return lstat(path, &file_stats) == 0 && S_ISREG(file_stats.st_mode) && (uint64_t) file_stats.st_size == entry->size
+           && file_stats.st_mtim.tv_sec == entry->mtime.tv_sec && file_stats.st_mtim.tv_nsec == entry->mtime.tv_nsec;
+}
+
+/*!
+ * @brief store_entry stores a source file that differs from the store, packed or as a regular file
+ * @param the_config is a pointer to the configuration
+ * @param store is a pointer to the store
+ * @param source_entry is the source file
+ * @param destination_path is the path of the file as a regular file of the destination
+ * @param was_regular tells if the previous version of the file is a regular file of the destination
+ * @param pack_id receives the pack holding the file, 0 for a regular file
+ * @param pack_offset receives the offset of the file in the pack
+ * @return 0 in case of success, -1 else
+ */
+static int store_entry(configuration_t *the_config, pack_store_t *store, files_list_entry_t *source_entry, char *destination_path,
+                       bool was_regular, uint32_t *pack_id, uint64_t *pack_offset) {
+    *pack_id = 0;
+    *pack_offset = 0;
+    if (source_entry->size >= the_config->pack_threshold) {
+        return copy_entry_to_destination(source_entry, the_config);
+    }
+
+    if (the_config->dry_run == true) {
+        printf("%s packed into %s.\n", source_entry->path_and_name, store->directory);
+        return 0;
+    }
+    if (pack_append(the_config, store, source_entry, pack_id, pack_offset) == -1) {
+        return -1;
+    }
+    if (the_config->verbose == true) {
+        printf("%s packed into pack %06u.\n", source_entry->path_and_name, *pack_id);
+    }
+    // A file that got smaller than the threshold leaves the destination, its content now is in the pack
+    if (was_regular == true && unlink(destination_path) == -1 && errno != ENOENT) {
+        fprintf(stderr, "Error removing %s, now packed\n", destination_path);
+    }
+    return 0;
+}
+
+/*!
+ * @brief pack_synchronize synchronizes the source into the pack store of the destination (--pack-threshold)
+ * The index is walked with the source list, both in path order, as the destination list: files missing from
+ * the index or whose properties differ are stored again, the others keep their location. Files of the index
+ * missing from the source are kept, as files of a plain destination are never removed.
+ * @param the_config is a pointer to the configuration
+ * @param source_list is a pointer to the analyzed source list, in path order
+ * @return true if the source was synchronized, false else
+ */
+bool pack_synchronize(configuration_t *the_config, files_list_t *source_list) {
+    pack_store_t store = {.file = -1, .pack_id = 1, .pack_size = 0};
+    char index_path[PATH_SIZE];
+    if (snprintf(store.directory, sizeof(store.directory), "%s/%s", the_config->destination, PACK_DIRECTORY) >= (int) sizeof(store.directory)
+        || snprintf(index_path, sizeof(index_path), "%s/%s", store.directory, PACK_INDEX_NAME) >= (int) sizeof(index_path)) {
+        fprintf(stderr, "Destination path %s is too long\n", the_config->destination);
+        return false;
+    }
+    if (the_config->dry_run == false && mkdir(store.directory, 0755) == -1 && errno != EEXIST) {
+        fprintf(stderr, "Error creating pack store %s: %s\n", store.directory, strerror(errno));
+        return false;
+    }
+
+    // Without an index, the store is empty. An index that cannot be read is not replaced, to keep its packs reachable.
+    manifest_t index;
+    uint64_t index_count = 0;
+    bool has_md5 = the_config->uses_md5;
+    if (manifest_open(&index, index_path, NULL, NULL) == 0) {
+        index_count = index.header->entries_count;
+        has_md5 = has_md5 && digests_compatible(the_config, index.header->compare_mode, index.header->sample_threshold,
+                                                index.header->sample_block_size, index.header->sample_blocks_count);
+        for (uint64_t i = 0; i < index_count; i++) {
+            if (index.records[i].pack_id > store.pack_id) {
+                store.pack_id = index.records[i].pack_id;
+            }
+        }
+    } else if (access(index_path, F_OK) == 0) {
+        fprintf(stderr, "Pack index %s cannot be used, the store is left as is\n", index_path);
+        return false;
+    }
+
+    manifest_writer_t writer;
+    bool writes_index = (the_config->dry_run == false);
+    if (writes_index == true && manifest_writer_open(&writer, index_path) == -1) {
+        manifest_close(&index);
+        return false;
+    }
+
+    // The diff and the copies are interleaved: the diff phase includes the copy phase
+    progress_set_phase(PROGRESS_PHASE_COPY);
+    stats_timer_t timer;
+    stats_phase_begin(&timer);
+    uint64_t trace_start = trace_begin();
+    size_t source_root_length = strlen(the_config->source);
+    size_t index_root_length = 0;
+    if (index.data != NULL) {
+        index_root_length = strlen(index.header->root);
+    }
+    files_list_entry_t *src_entry = source_list->head;
+    files_list_entry_t *index_entry = (files_list_entry_t*) malloc(sizeof(files_list_entry_t));
+    char destination_path[PATH_SIZE];
+    uint64_t i = 0;
+    bool synchronized = true;
+
+    while (src_entry != NULL || i < index_count) {
+        char *relative_path = src_entry != NULL ? src_entry->path_and_name + source_root_length : NULL;
+        int order = src_entry == NULL ? 1 : (i == index_count ? -1 : manifest_compare(&index, i, relative_path));
+        manifest_record_t *record = NULL;
+        if (order >= 0) {
+            record = &index.records[i];
+            manifest_get_entry(&index, i, index_entry);
+            i++;
+        }
+        // Files of the index that left the source keep their record
+        if (order > 0) {
+            if (writes_index == true
+                && manifest_writer_add_packed(&writer, index_entry->path_and_name + index_root_length, index_entry, record->pack_id, record->pack_offset) == -1) {
+                writes_index = false;
+                synchronized = false;
+            }
+            continue;
+        }
+
+        destination_path[0] = '\0';
+        concat_path(destination_path, the_config->destination, relative_path);
+        uint32_t pack_id = record != NULL ? record->pack_id : 0;
+        uint64_t pack_offset = record != NULL ? record->pack_offset : 0;
+        files_list_entry_t *stored_entry = src_entry;
+        bool differ = (record == NULL || mismatch(src_entry, index_entry, has_md5) == true
+                       || (record->pack_id == 0 && regular_file_matches(destination_path, index_entry) == false));
+        if (differ == true) {
+            progress_add(PROGRESS_FILES_TO_COPY, 1);
+            progress_add(PROGRESS_BYTES_TO_COPY, src_entry->size);
+            if (store_entry(the_config, &store, src_entry, destination_path, record != NULL && record->pack_id == 0, &pack_id, &pack_offset) == -1) {
+                // The previous version of the file, if any, stays indexed
+                synchronized = false;
+                stored_entry = record != NULL ? index_entry : NULL;
+                pack_id = record != NULL ? record->pack_id : 0;
+                pack_offset = record != NULL ? record->pack_offset : 0;
+            }
+        }
+        if (writes_index == true && stored_entry != NULL
+            && manifest_writer_add_packed(&writer, relative_path, stored_entry, pack_id, pack_offset) == -1) {
+            writes_index = false;
+            synchronized = false;
+        }
+        src_entry = src_entry->next;
+    }
+    trace_end("pack", trace_start, index_count);
+    stats_phase_end(STATS_PHASE_DIFF, &timer);
+
+    // Packed files are only indexed once they are on disk
+    if (close_pack(&store) == -1) {
+        synchronized = false;
+        if (writes_index == true) {
+            manifest_writer_abort(&writer);
+        }
+    } else if (writes_index == true) {
+        if (manifest_writer_commit(&writer, the_config, the_config->destination) == -1) {
+            synchronized = false;
+        }
+    } else if (the_config->dry_run == false) {
+        fprintf(stderr, "Error writing pack index %s\n", index_path);
+        manifest_writer_abort(&writer);
+    }
+
+    free(index_entry);
+    manifest_close(&index);
+    return synchronized;
+}
+
+/*!
+ * @brief restore_packed_file extracts a packed file
+ * @param pack_file is the pack holding the file
+ * @param entry is the entry of the file, whose properties are restored
+ * @param pack_offset is the offset of the file in the pack
+ * @param output_path is the path of the extracted file
+ * @return 0 in case of success, -1 else
+ */
+static int restore_packed_file(int pack_file, files_list_entry_t *entry, uint64_t pack_offset, char *output_path) {
+    if (make_parent_directories(output_path) == -1) {
+        fprintf(stderr, "Error creating parent directories of %s\n", output_path);
+        return -1;
+    }
+    int output_file = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, entry->mode);
+    if (output_file == -1) {
+        fprintf(stderr, "Error opening %s: %s\n", output_path, strerror(errno));
+        return -1;
+    }
+
+    off_t offset = pack_offset;
+    uint64_t end = pack_offset + entry->size;
+    int result = 0;
+    while ((uint64_t) offset < end) {
+        uint64_t remaining = end - offset;
+        ssize_t bytes_sent = sendfile(output_file, pack_file, &offset, remaining < SENDFILE_MAX_SIZE ? remaining : SENDFILE_MAX_SIZE);
+        if (bytes_sent == -1 || bytes_sent == 0) {
+            fprintf(stderr, "Error extracting %s, its pack is truncated or unreadable\n", output_path);
+            result = -1;
+            break;
+        }
+    }
+    close(output_file);
+    if (result == -1) {
+        return -1;
+    }
+
+    struct timespec new_time[2];
+    new_time[0].tv_nsec = UTIME_NOW;
+    new_time[0].tv_sec = UTIME_NOW;
+    new_time[1] = entry->mtime;
+    if (utimensat(AT_FDCWD, output_path, new_time, 0) != 0) {
+        fprintf(stderr, "Error setting the modification time of %s\n", output_path);
+        result = -1;
+    }
+    chmod(output_path, entry->mode);
+    return result;
+}
+
+/*!
+ * @brief pack_restore extracts all the files of a pack store (--restore)
+ * The store is the source and the files are written into the destination, as they were in the synchronized source.
+ * @param the_config is a pointer to the configuration
+ * @return 0 if all files were restored, -1 else
+ */
+int pack_restore(configuration_t *the_config) {
+    char index_path[PATH_SIZE];
+    if (snprintf(index_path, sizeof(index_path), "%s/%s/%s", the_config->source, PACK_DIRECTORY, PACK_INDEX_NAME) >= (int) sizeof(index_path)) {
+        fprintf(stderr, "Source path %s is too long\n", the_config->source);
+        return -1;
+    }
+    manifest_t index;
+    if (manifest_open(&index, index_path, NULL, NULL) == -1) {
+        fprintf(stderr, "%s is not a pack store\n", the_config->source);
+        return -1;
+    }
+
+    // Regular files are copied from the store, as if it were the source
+    configuration_t restore_config = *the_config;
+    files_list_entry_t *entry = (files_list_entry_t*) malloc(sizeof(files_list_entry_t));
+    size_t root_length = strlen(index.header->root);
+    char relative_path[PATH_SIZE];
+    char output_path[PATH_SIZE];
+    int pack_file = -1;
+    uint32_t open_pack_id = 0;
+    int result = 0;
+
+    for (uint64_t i = 0; i < index.header->entries_count; i++) {
+        manifest_record_t *record = &index.records[i];
+        manifest_get_entry(&index, i, entry);
+        strcpy(relative_path, entry->path_and_name + root_length);
+        output_path[0] = '\0';
+        if (concat_path(output_path, the_config->destination, relative_path) == NULL) {
+            fprintf(stderr, "Path %s is too long\n", relative_path);
+            result = -1;
+            continue;
+        }
+        if (the_config->dry_run == true) {
+            printf("%s restored to %s.\n", relative_path, output_path);
+            continue;
+        }
+
+        if (record->pack_id == 0) {
+            entry->path_and_name[0] = '\0';
+            if (concat_path(entry->path_and_name, the_config->source, relative_path) == NULL
+                || copy_entry_to_destination(entry, &restore_config) == -1) {
+                result = -1;
+            }
+            continue;
+        }
+
+        if (pack_file == -1 || open_pack_id != record->pack_id) {
+            char pack_path[PATH_SIZE];
+            if (pack_file != -1) {
+                close(pack_file);
+            }
+            pack_file = -1;
+            if (snprintf(pack_path, sizeof(pack_path), "%s/%s/pack-%06u", the_config->source, PACK_DIRECTORY, record->pack_id) < (int) sizeof(pack_path)) {
+                pack_file = open(pack_path, O_RDONLY);
+            }
+            open_pack_id = record->pack_id;
+            if (pack_file == -1) {
+                fprintf(stderr, "Error opening pack %s: %s\n", pack_path, strerror(errno));
+            }
+        }
+        if (pack_file == -1 || restore_packed_file(pack_file, entry, record->pack_offset, output_path) == -1) {
+            result = -1;
+        } else if (the_config->verbose == true) {
+            printf("%s restored to %s.\n", relative_path, output_path);
+        }
+    }
+
+    if (pack_file != -1) {
+        close(pack_file);
+    }
+    free(entry);
+    manifest_close(&index);
+    return result;
+}
@@ -0,0 +1,311 @@
+#define _GNU_SOURCE
+#include <pool.h>
+#include <stats.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Analyzers pool shared by all processes, NULL in no-parallel mode.
+// The mapping is created before forking, so every process inherits the pointer.
+static analyzers_pool_t *pool = NULL;
+// Job slot of the process (--job-file), whose requests count against the limit of its job
+static uint32_t job_slot = 0;
+
+/*!
+ * @brief pool_init maps the shared state of the analyzers pool
+ * Must be called before the processes are forked.
+ * @param analyzers_count is the number of analyzers
+ * @param initial_active is the number of requests processed at the same time when the run starts
+ * @param adaptive tells if the number of active analyzers follows the measured throughput
+ * @param budget_bytes is the room of the message queue that requests and their responses may use
+ * @return 0 in case of success, -1 else
+ */
+int pool_init(uint32_t analyzers_count, uint32_t initial_active, bool adaptive, size_t budget_bytes) {
+    if (pool != NULL) {
+        return 0;
+    }
+    pool = mmap(NULL, sizeof(analyzers_pool_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (pool == MAP_FAILED) {
+        pool = NULL;
+        fprintf(stderr, "Error creating analyzers pool\n");
+        return -1;
+    }
+    memset(pool, 0, sizeof(analyzers_pool_t));
+    pool->analyzers_count = analyzers_count;
+    pool->active = initial_active < 1 ? 1 : (initial_active > analyzers_count ? analyzers_count : initial_active);
+    pool->budget_bytes = budget_bytes;
+    pool->adaptive = adaptive;
+    pool->direction = 1;
+    return 0;
+}
+
+/*!
+ * @brief pool_release unmaps the shared state of the analyzers pool
+ */
+void pool_release(void) {
+    if (pool != NULL) {
+        munmap(pool, sizeof(analyzers_pool_t));
+        pool = NULL;
+    }
+}
+
+/*!
+ * @brief read_cgroup_cpu_limit reads the CPU quota of the cgroup of the process (v2, then v1)
+ * @return the number of CPUs allowed by the quota, rounded up, 0 if there is no quota
+ */
+static uint32_t read_cgroup_cpu_limit(void) {
+    long long quota = -1, period = 0;
+    char quota_text[32];
+
+    FILE *cpu_max = fopen("/sys/fs/cgroup/cpu.max", "r");
+    if (cpu_max != NULL) {
+        if (fscanf(cpu_max, "%31s %lld", quota_text, &period) == 2 && strcmp(quota_text, "max") != 0) {
+            quota = atoll(quota_text);
+        }
+        fclose(cpu_max);
+    } else {
+        FILE *quota_file = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r");
+        FILE *period_file = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r");
+        if (quota_file == NULL || period_file == NULL || fscanf(quota_file, "%lld", &quota) != 1 || fscanf(period_file, "%lld", &period) != 1) {
+            quota = -1;
+        }
+        if (quota_file != NULL) {
+            fclose(quota_file);
+        }
+        if (period_file != NULL) {
+            fclose(period_file);
+        }
+    }
+
+    if (quota <= 0 || period <= 0) {
+        return 0;
+    }
+    return (quota + period - 1) / period;
+}
+
+/*!
+ * @brief pool_available_cpus counts the CPUs the process may use: its affinity, limited by its cgroup quota
+ * @return the number of usable CPUs, at least 1
+ */
+uint32_t pool_available_cpus(void) {
+    cpu_set_t cpus;
+    long count;
+
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0) {
+        count = CPU_COUNT(&cpus);
+    } else {
+        count = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+    uint32_t limit = read_cgroup_cpu_limit();
+    if (limit > 0 && count > limit) {
+        count = limit;
+    }
+    return count < 1 ? 1 : count;
+}
+
+/*!
+ * @brief pool_join registers a requester, which then gets a share of the active slots
+ */
+void pool_join(void) {
+    if (pool != NULL) {
+        __atomic_fetch_add(&pool->requesters, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/*!
+ * @brief pool_leave unregisters a requester, its share of the slots goes to the remaining ones
+ */
+void pool_leave(void) {
+    if (pool != NULL) {
+        __atomic_fetch_sub(&pool->requesters, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/*!
+ * @brief pool_try_acquire takes a slot to send a request to the analyzers
+ * @param my_in_flight is the number of requests of the caller waiting for their response
+ * @param exchange_bytes is the size of the request and its response in the message queue
+ * @return true if the request may be sent, false if the caller must first receive a response (or wait)
+ */
+bool pool_try_acquire(uint32_t my_in_flight, size_t exchange_bytes) {
+    if (pool == NULL) {
+        return true;
+    }
+
+    // The limit of a job is not a lack of analyzers: the controller must not grow the pool for it
+    uint32_t job_limit = __atomic_load_n(&pool->job_limits[job_slot], __ATOMIC_RELAXED);
+    uint32_t job_in_flight = __atomic_load_n(&pool->job_in_flight[job_slot], __ATOMIC_RELAXED);
+    do {
+        if (job_limit > 0 && job_in_flight >= job_limit) {
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&pool->job_in_flight[job_slot], &job_in_flight, job_in_flight + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    uint32_t active = __atomic_load_n(&pool->active, __ATOMIC_RELAXED);
+    uint32_t requesters = __atomic_load_n(&pool->requesters, __ATOMIC_RELAXED);
+    uint32_t share = requesters > 1 ? (active + requesters - 1) / requesters : active;
+    if (my_in_flight >= share) {
+        __atomic_store_n(&pool->saturated, true, __ATOMIC_RELAXED);
+        __atomic_fetch_sub(&pool->job_in_flight[job_slot], 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    uint32_t in_flight = __atomic_load_n(&pool->in_flight, __ATOMIC_RELAXED);
+    do {
+        if (in_flight >= active) {
+            __atomic_store_n(&pool->saturated, true, __ATOMIC_RELAXED);
+            __atomic_fetch_sub(&pool->job_in_flight[job_slot], 1, __ATOMIC_RELAXED);
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&pool->in_flight, &in_flight, in_flight + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    // Requests and responses must always fit in the queue, else analyzers and requesters block each other.
+    // A request larger than the whole budget is still sent when nothing else is in flight.
+    int64_t left = __atomic_sub_fetch(&pool->budget_bytes, (int64_t) exchange_bytes, __ATOMIC_RELAXED);
+    if (left < 0 && in_flight > 0) {
+        __atomic_fetch_add(&pool->budget_bytes, (int64_t) exchange_bytes, __ATOMIC_RELAXED);
+        __atomic_fetch_sub(&pool->in_flight, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_sub(&pool->job_in_flight[job_slot], 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * @brief read_cpu_times reads the system wide I/O wait and total CPU times
+ * @param iowait is where the I/O wait time is written
+ * @param total is where the total time is written
+ * @return 0 in case of success, -1 else
+ */
+static int read_cpu_times(uint64_t *iowait, uint64_t *total) {
+    unsigned long long times[8] = {0};
+    FILE *stat_file = fopen("/proc/stat", "r");
+    if (stat_file == NULL) {
+        return -1;
+    }
+    int read_count = fscanf(stat_file, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+                            &times[0], &times[1], &times[2], &times[3], &times[4], &times[5], &times[6], &times[7]);
+    fclose(stat_file);
+    if (read_count < 5) {
+        return -1;
+    }
+
+    *iowait = times[4];
+    *total = 0;
+    for (int i = 0; i < 8; i++) {
+        *total += times[i];
+    }
+    return 0;
+}
+
+/*!
+ * @brief adjust_active moves the number of active analyzers by one, hill climbing on the measured throughput
+ * It only moves when requests waited for slots (else the throughput is bound by the requesters), and shrinks
+ * the pool when most of the CPU time is spent waiting for I/O without throughput gain.
+ * Only one requester adjusts at a time, at most every POOL_ADJUST_PERIOD_MS.
+ */
+static void adjust_active(void) {
+    uint64_t now_ns = stats_now_ns();
+    if (now_ns - __atomic_load_n(&pool->last_adjust_ns, __ATOMIC_RELAXED) < POOL_ADJUST_PERIOD_MS * 1000000ULL) {
+        return;
+    }
+    uint32_t unlocked = 0;
+    if (!__atomic_compare_exchange_n(&pool->adjusting, &unlocked, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    if (pool->last_adjust_ns == 0) {
+        // First call: only take the references
+        pool->last_work = __atomic_load_n(&pool->completed_work, __ATOMIC_RELAXED);
+        read_cpu_times(&pool->last_iowait, &pool->last_cpu_total);
+    } else if (now_ns - pool->last_adjust_ns >= POOL_ADJUST_PERIOD_MS * 1000000ULL) {
+        uint64_t work = __atomic_load_n(&pool->completed_work, __ATOMIC_RELAXED);
+        double rate = (work - pool->last_work) / ((now_ns - pool->last_adjust_ns) / 1e9);
+        double iowait_share = 0;
+        uint64_t iowait, cpu_total;
+        if (read_cpu_times(&iowait, &cpu_total) == 0) {
+            if (cpu_total > pool->last_cpu_total) {
+                iowait_share = (double) (iowait - pool->last_iowait) / (cpu_total - pool->last_cpu_total);
+            }
+            pool->last_iowait = iowait;
+            pool->last_cpu_total = cpu_total;
+        }
+
+        if (__atomic_exchange_n(&pool->saturated, false, __ATOMIC_RELAXED) == true) {
+            bool improved = rate > pool->last_rate * 1.05;
+            if (iowait_share > POOL_IOWAIT_HIGH && !improved) {
+                pool->direction = -1;
+            } else if (rate < pool->last_rate * 0.95) {
+                pool->direction = -pool->direction;
+            }
+
+            int64_t active = (int64_t) pool->active + pool->direction;
+            if (active < 1 || active > pool->analyzers_count) {
+                pool->direction = -pool->direction;
+            } else {
+                __atomic_store_n(&pool->active, (uint32_t) active, __ATOMIC_RELAXED);
+            }
+        }
+        pool->last_rate = rate;
+        pool->last_work = work;
+    }
+
+    __atomic_store_n(&pool->last_adjust_ns, now_ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&pool->adjusting, 0, __ATOMIC_RELEASE);
+}
+
+/*!
+ * @brief pool_complete gives back the slot of an answered request
+ * @param exchange_bytes is the size given to pool_try_acquire
+ * @param file_size is the size of the analyzed file, used to measure the throughput
+ */
+void pool_complete(size_t exchange_bytes, uint64_t file_size) {
+    if (pool == NULL) {
+        return;
+    }
+    __atomic_fetch_add(&pool->budget_bytes, (int64_t) exchange_bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&pool->in_flight, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&pool->job_in_flight[job_slot], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&pool->completed_work, file_size + POOL_FILE_COST_BYTES, __ATOMIC_RELAXED);
+    if (pool->adaptive == true) {
+        adjust_active();
+    }
+}
+
+/*!
+ * @brief pool_wait waits a little for slots to be freed by other requesters
+ * Used when the caller has no request in flight, hence no response to wait for.
+ */
+void pool_wait(void) {
+    struct timespec delay = {.tv_sec = 0, .tv_nsec = 1000000L};
+    nanosleep(&delay, NULL);
+}
+
+/*!
+ * @brief pool_active gets the number of requests currently processed at the same time
+ * @return the number of active slots, 0 in no-parallel mode
+ */
+uint32_t pool_active(void) {
+    return pool == NULL ? 0 : __atomic_load_n(&pool->active, __ATOMIC_RELAXED);
+}
+
+/*!
+ * @brief pool_set_job sets the job slot of the process and bounds the requests in flight of its job (--job-file)
+ * The listers of a job runner inherit its slot. Jobs running at the same time share the active analyzers, within their limits.
+ * @param slot is the job slot, 0 outside of the job runners
+ * @param limit is the most requests in flight for the job, 0 to use all the active analyzers
+ */
+void pool_set_job(uint32_t slot, uint32_t limit) {
+    if (slot > MAX_PARALLEL_JOBS) {
+        return;
+    }
+    job_slot = slot;
+    if (pool != NULL) {
+        __atomic_store_n(&pool->job_limits[slot], limit, __ATOMIC_RELAXED);
+    }
+}
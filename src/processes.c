@@ -8,6 +8,51 @@
 #include <sync.h>
 #include <string.h>
 #include <errno.h>
+#include <stats.h>
+#include <trace.h>
+#include <progress.h>
+#include <pool.h>
+#include <schedule.h>
+#include <spill.h>
+#include <scan-state.h>
+#include <filter.h>
+#include <throttle.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+// Queue of the run, removed by the signal handlers when the run dies without cleaning up
+static int orphan_queue_id = -1;
+
+/*!
+ * @brief remove_queue_and_die removes the queue of the run, then dies of the received signal
+ * Installed in main for fatal signals, and in the other processes for the death of main (see make_process).
+ * @param signal_number is the received signal
+ */
+static void remove_queue_and_die(int signal_number) {
+    msgctl(orphan_queue_id, IPC_RMID, NULL);
+    signal(signal_number, SIG_DFL);
+    raise(signal_number);
+    _exit(EXIT_FAILURE);
+}
+
+/*!
+ * @brief handle_fatal_signals removes the queue when main is interrupted or terminated
+ * In watch mode, these signals stop the watch and the queue is removed by clean_processes (see watch.c).
+ * @param the_config is a pointer to the configuration
+ * @param queue_id is the id of the queue of the run
+ */
+static void handle_fatal_signals(configuration_t *the_config, int queue_id) {
+    orphan_queue_id = queue_id;
+    if (the_config->watch_mode != WATCH_NONE) {
+        return;
+    }
+    struct sigaction action = {.sa_handler = remove_queue_and_die};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGHUP, &action, NULL);
+}
 
 /*!
  * @brief prepare prepares (only when parallel is enabled) the processes used for the synchronization.
@@ -16,83 +61,151 @@
  * @return 0 if all went good, -1 else
  */
 int prepare(configuration_t *the_config, process_context_t *p_context) {
-    if (the_config != NULL && the_config->is_parallel == true) {
-        p_context->shared_key = ftok("LP25_sync", 25);
-        if (p_context->shared_key == -1) {
-            fprintf(stderr, "Error with mqkey\n");
+    if (the_config == NULL || p_context == NULL) {
+        return -1;
+    }
+
+    // Statistics and the digest table are mapped before forking so that all processes share them
+    if (strlen(the_config->stats_file) > 0 && stats_init() == -1) {
+        return -1;
+    }
+    if (strlen(the_config->trace_file) > 0 && trace_init(the_config->trace_file) == -1) {
+        return -1;
+    }
+    if (throttle_init(the_config) == -1) {
+        return -1;
+    }
+
+    // In watch mode, interruptions are handled by main, which then terminates the other processes (see watch.c)
+    struct sigaction ignore_action = {.sa_handler = SIG_IGN};
+    struct sigaction interrupt_action;
+    struct sigaction terminate_action;
+    if (the_config->watch_mode != WATCH_NONE) {
+        sigemptyset(&ignore_action.sa_mask);
+        sigaction(SIGINT, &ignore_action, &interrupt_action);
+        sigaction(SIGTERM, &ignore_action, &terminate_action);
+    }
+
+    p_context->progress_reporter_pid = 0;
+    if (the_config->progress_mode != PROGRESS_NONE) {
+        if (progress_init() == -1) {
             return -1;
         }
-        p_context->message_queue_id = msgget(p_context->shared_key, 0666 | IPC_CREAT);
+        p_context->progress_reporter_pid = progress_start_reporter(the_config->progress_mode, the_config->progress_interval_ms);
+        if (p_context->progress_reporter_pid == -1) {
+            p_context->progress_reporter_pid = 0;
+            progress_release();
+        }
+    }
+
+    p_context->digest_cache = NULL;
+    if (the_config->uses_md5 == true && the_config->share_digests == true) {
+        p_context->digest_cache = create_digest_cache(DEFAULT_DIGEST_CACHE_SLOTS);
+    }
+    scan_state_init(the_config);
+    if (filter_init(the_config) == -1) {
+        return -1;
+    }
+
+    if (the_config->is_parallel == true) {
+        // Each run has its own queue, known by id by the processes it forks, so that runs never share messages
+        p_context->message_queue_id = msgget(IPC_PRIVATE, 0600 | IPC_CREAT);
         if (p_context->message_queue_id == -1) {
             fprintf(stderr, "Error while creating msgqueue\n");
             return -1;
         }
+        handle_fatal_signals(the_config, p_context->message_queue_id);
+
+        // Analyzers are shared by both listers. In auto mode, there are enough of them to cover I/O bound runs,
+        // but only as many as CPUs are active at first (see pool.h)
+        uint32_t analyzers_count = the_config->processes_count - 2;
+        uint32_t initial_active = analyzers_count;
+        if (the_config->auto_processes == true) {
+            uint32_t cpus = pool_available_cpus();
+            analyzers_count = 2 * cpus > POOL_MAX_ANALYZERS ? POOL_MAX_ANALYZERS : 2 * cpus;
+            initial_active = cpus;
+            the_config->processes_count = analyzers_count + 2;
+        }
+
+        // Requests in flight and their responses may use half of the queue, the other half is left to the lists sent to main
+        struct msqid_ds queue_state;
+        size_t budget_bytes = 8192;
+        if (msgctl(p_context->message_queue_id, IPC_STAT, &queue_state) == 0) {
+            budget_bytes = queue_state.msg_qbytes / 2;
+        }
+        if (pool_init(analyzers_count, initial_active, the_config->auto_processes, budget_bytes) == -1) {
+            return -1;
+        }
 
         p_context->processes_count = 0;
         p_context->main_process_pid = getpid();
         p_context->source_lister_pid = 0;
         p_context->destination_lister_pid = 0;
-        p_context->source_analyzers_pids = (pid_t*) malloc(sizeof(pid_t)*(the_config->processes_count-2)/2);
-        p_context->destination_analyzers_pids = (pid_t*) malloc(sizeof(pid_t)*(the_config->processes_count-2)/2);
-        for (int i=0; i<(the_config->processes_count-2)/2; i++) {
-            p_context->source_analyzers_pids[i] = 0;
-            p_context->destination_analyzers_pids[i] = 0;
-        }
+        // PIDs table is terminated by a 0 PID (@see clean_processes)
+        p_context->analyzers_pids = (pid_t*) calloc(analyzers_count + 1, sizeof(pid_t));
 
-
-        lister_configuration_t src_lister_parameters;
-        src_lister_parameters.analyzers_count = (the_config->processes_count-2)/2;
-        src_lister_parameters.my_recipient_id = MSG_TYPE_TO_SOURCE_ANALYZERS;
-        src_lister_parameters.my_receiver_id = MSG_TYPE_TO_SOURCE_LISTER;
-        src_lister_parameters.mq_key = p_context->shared_key;
-        p_context->source_lister_pid = make_process(p_context, lister_process_loop, &src_lister_parameters);
-        if (p_context->source_lister_pid == -1) {
-            p_context->source_lister_pid = 0;
+        if (make_listers(the_config, p_context) == -1) {
             clean_processes(the_config, p_context);
             return -1;
         }
 
-        lister_configuration_t dst_lister_parameters;
-        dst_lister_parameters.analyzers_count = (the_config->processes_count-2)/2;
-        dst_lister_parameters.my_recipient_id = MSG_TYPE_TO_DESTINATION_ANALYZERS;
-        dst_lister_parameters.my_receiver_id = MSG_TYPE_TO_DESTINATION_LISTER;
-        dst_lister_parameters.mq_key = p_context->shared_key;
-        p_context->destination_lister_pid = make_process(p_context, lister_process_loop, &dst_lister_parameters);
-        if (p_context->destination_lister_pid == -1) {
-            p_context->destination_lister_pid = 0;
-            clean_processes(the_config, p_context);
-            return -1;
-        }
-
-        analyzer_configuration_t src_analyser_parameters;
-        src_analyser_parameters.my_recipient_id = MSG_TYPE_TO_SOURCE_LISTER;
-        src_analyser_parameters.my_receiver_id = MSG_TYPE_TO_SOURCE_ANALYZERS;
-        src_analyser_parameters.mq_key = p_context->shared_key;
-        src_analyser_parameters.use_md5 = the_config->uses_md5;   
-        for (int i=0; i<(the_config->processes_count-2)/2; i++) {
-            p_context->source_analyzers_pids[i] = make_process(p_context, analyzer_process_loop, &src_analyser_parameters);
-            if (p_context->source_analyzers_pids[i] == -1) {
-                p_context->source_analyzers_pids[i] = 0;
+        analyzer_configuration_t analyser_parameters;
+        analyser_parameters.my_receiver_id = MSG_TYPE_TO_ANALYZERS;
+        analyser_parameters.mq_id = p_context->message_queue_id;
+        make_digest_options(the_config, p_context->digest_cache, &analyser_parameters.digest_options);
+        for (uint32_t i = 0; i < analyzers_count; i++) {
+            p_context->analyzers_pids[i] = make_process(p_context, analyzer_process_loop, &analyser_parameters);
+            if (p_context->analyzers_pids[i] == -1) {
+                p_context->analyzers_pids[i] = 0;
                 clean_processes(the_config, p_context);
                 return -1;
             }
         }
+    }
 
-        analyzer_configuration_t dst_analyser_parameters;
-        dst_analyser_parameters.my_recipient_id = MSG_TYPE_TO_DESTINATION_LISTER;
-        dst_analyser_parameters.my_receiver_id = MSG_TYPE_TO_DESTINATION_ANALYZERS;
-        dst_analyser_parameters.mq_key = p_context->shared_key;
-        dst_analyser_parameters.use_md5 = the_config->uses_md5;   
-        for (int i=0; i<(the_config->processes_count-2)/2; i++) {
-            p_context->destination_analyzers_pids[i] = make_process(p_context, analyzer_process_loop, &dst_analyser_parameters);
-            if (p_context->destination_analyzers_pids[i] == -1) {
-                p_context->destination_analyzers_pids[i] = 0;
-                clean_processes(the_config, p_context);
-                return -1;
-            }
-        }
+    if (the_config->watch_mode != WATCH_NONE) {
+        sigaction(SIGINT, &interrupt_action, NULL);
+        sigaction(SIGTERM, &terminate_action, NULL);
+    }
+    return 0;
+}
+
+/*!
+ * @brief make_listers forks the source and destination listers, which use the types of the job slot of the caller
+ * Called by prepare, and by each job runner of --job-file (see jobs.c).
+ * @param the_config is a pointer to the program configuration
+ * @param p_context is a pointer to the processes context, whose listers PIDs are set
+ * @return 0 in case of success, -1 else (the listers made are left in p_context)
+ */
+int make_listers(configuration_t *the_config, process_context_t *p_context) {
+    lister_configuration_t src_lister_parameters;
+    src_lister_parameters.my_recipient_id = MSG_TYPE_TO_ANALYZERS;
+    src_lister_parameters.my_receiver_id = message_type(MSG_TYPE_TO_SOURCE_LISTER);
+    src_lister_parameters.mq_id = p_context->message_queue_id;
+    src_lister_parameters.analysis_order = the_config->analysis_order;
+    src_lister_parameters.io_order = the_config->io_order;
+    // With --max-memory, both listers share the bound (the lists of main are on disk)
+    src_lister_parameters.batch_entries = the_config->max_memory > 0 ? spill_batch_entries(the_config->max_memory / 2) : 0;
+    spill_directory(the_config, src_lister_parameters.spill_directory);
+    p_context->source_lister_pid = make_process(p_context, lister_process_loop, &src_lister_parameters);
+    if (p_context->source_lister_pid == -1) {
+        p_context->source_lister_pid = 0;
+        return -1;
     }
 
+    lister_configuration_t dst_lister_parameters;
+    dst_lister_parameters.my_recipient_id = MSG_TYPE_TO_ANALYZERS;
+    dst_lister_parameters.my_receiver_id = message_type(MSG_TYPE_TO_DESTINATION_LISTER);
+    dst_lister_parameters.mq_id = p_context->message_queue_id;
+    dst_lister_parameters.analysis_order = the_config->analysis_order;
+    dst_lister_parameters.io_order = the_config->io_order;
+    dst_lister_parameters.batch_entries = src_lister_parameters.batch_entries;
+    spill_directory(the_config, dst_lister_parameters.spill_directory);
+    p_context->destination_lister_pid = make_process(p_context, lister_process_loop, &dst_lister_parameters);
+    if (p_context->destination_lister_pid == -1) {
+        p_context->destination_lister_pid = 0;
+        return -1;
+    }
     return 0;
 }
 
@@ -107,6 +220,13 @@ int make_process(process_context_t *p_context, process_loop_t func, void *parame
     pid_t pid = fork();
 
     if (pid == 0) {
+        // When main dies before it could terminate us (crash, SIGKILL), the first process to know removes the queue
+        struct sigaction action = {.sa_handler = remove_queue_and_die};
+        sigemptyset(&action.sa_mask);
+        sigaction(PARENT_DEATH_SIGNAL, &action, NULL);
+        if (prctl(PR_SET_PDEATHSIG, PARENT_DEATH_SIGNAL) == -1 || getppid() != p_context->main_process_pid) {
+            remove_queue_and_die(PARENT_DEATH_SIGNAL);
+        }
         func(parameters);
         exit(EXIT_FAILURE);
     }
@@ -118,6 +238,126 @@ int make_process(process_context_t *p_context, process_loop_t func, void *parame
     }
 }
 
+/*!
+ * @brief analyze_list has the analyzers fill the properties of all entries of a list
+ * @param mq_id is the id of the MQ
+ * @param config is a pointer to the lister configuration
+ * @param list is a pointer to the list whose entries are analyzed
+ */
+static void analyze_list(int mq_id, lister_configuration_t *config, files_list_t *list) {
+    size_t entries_count;
+    files_list_entry_t **entries = files_list_to_table(list, &entries_count);
+
+    // Requests follow the schedule, responses are stored in path order through their index
+    size_t *order = (size_t*) malloc(sizeof(size_t) * (entries_count + 1));
+    if (config->io_order != IO_ORDER_NONE) {
+        make_physical_order(entries, entries_count, config->io_order, order);
+    } else if (config->analysis_order == ANALYSIS_ORDER_LARGEST_FIRST) {
+        make_largest_first_order(entries, entries_count, order);
+    } else {
+        for (size_t i = 0; i < entries_count; i++) {
+            order[i] = i;
+        }
+    }
+
+    any_message_t message;
+    size_t next_entry = 0;
+    size_t analyzed_count = 0;
+    uint32_t in_flight = 0;
+    uint64_t trace_start;
+
+    pool_join();
+    while (analyzed_count < entries_count) {
+        while (next_entry < entries_count && pool_try_acquire(in_flight, analyze_file_exchange_size(entries[order[next_entry]]->path_and_name))) {
+            send_analyze_file_command(mq_id, config->my_recipient_id, config->my_receiver_id, order[next_entry], entries[order[next_entry]]->path_and_name);
+            next_entry++;
+            in_flight++;
+        }
+
+        if (in_flight == 0) {
+            // All slots are used by the other requesters
+            pool_wait();
+            continue;
+        }
+
+        trace_start = trace_begin();
+        if (msgrcv(mq_id, &message, sizeof(any_message_t) - sizeof(long), config->my_receiver_id, 0) == -1) {
+            continue;
+        }
+        trace_end("wait_analysis", trace_start, TRACE_NO_ARG);
+        stats_add(STATS_IPC_MESSAGES_RECEIVED, 1);
+        analyze_file_response_t *response = &message.analyze_file_response;
+        if (response->op_code != COMMAND_CODE_FILE_ANALYZED || response->entry_index >= entries_count) {
+            continue;
+        }
+
+        files_list_entry_t *entry = entries[response->entry_index];
+        entry->mtime = response->mtime;
+        entry->size = response->size;
+        memcpy(entry->md5sum, response->md5sum, sizeof(entry->md5sum));
+        entry->entry_type = response->entry_type;
+        entry->mode = response->mode;
+        pool_complete(analyze_file_exchange_size(entry->path_and_name), entry->size);
+        in_flight--;
+        analyzed_count++;
+    }
+    pool_leave();
+
+    free(order);
+    free(entries);
+}
+
+typedef struct {
+    int mq_id;
+    lister_configuration_t *config;
+} lister_batch_context_t;
+
+/*!
+ * @brief analyze_batch has the analyzers fill the properties of the entries of a batch (batch_analyzer_t)
+ * @param batch is a pointer to the batch
+ * @param context is a pointer to a lister_batch_context_t
+ */
+static void analyze_batch(files_list_t *batch, void *context) {
+    lister_batch_context_t *batch_context = context;
+    analyze_list(batch_context->mq_id, batch_context->config, batch);
+}
+
+/*!
+ * @brief send_runs lists and analyzes a tree into sorted run files, and sends their paths to main (--max-memory)
+ * Main removes the run files once merged.
+ * @param mq_id is the id of the MQ
+ * @param config is a pointer to the lister configuration
+ * @param target is the root of the tree
+ */
+static void send_runs(int mq_id, lister_configuration_t *config, char *target) {
+    lister_batch_context_t batch_context = {.mq_id = mq_id, .config = config};
+    spill_runs_t runs = {NULL, 0};
+    stats_timer_t timer;
+
+    // Listing and analysis are interleaved, by batches
+    stats_phase_begin(&timer);
+    if (make_sorted_runs(target, config->batch_entries, config->spill_directory, analyze_batch, &batch_context, &runs) == -1) {
+        fprintf(stderr, "Error listing %s into runs\n", target);
+    }
+    stats_phase_end(STATS_PHASE_ANALYSIS, &timer);
+
+    stats_phase_begin(&timer);
+    for (size_t i = 0; i < runs.count; i++) {
+        if (config->my_receiver_id == message_type(MSG_TYPE_TO_SOURCE_LISTER)) {
+            send_source_list_run(mq_id, message_type(MSG_TYPE_TO_MAIN), runs.paths[i]);
+        } else {
+            send_destination_list_run(mq_id, message_type(MSG_TYPE_TO_MAIN), runs.paths[i]);
+        }
+    }
+    if (config->my_receiver_id == message_type(MSG_TYPE_TO_SOURCE_LISTER)) {
+        send_source_list_end(mq_id, message_type(MSG_TYPE_TO_MAIN));
+    } else {
+        send_destination_list_end(mq_id, message_type(MSG_TYPE_TO_MAIN));
+    }
+    stats_phase_end(STATS_PHASE_TRANSFER, &timer);
+    spill_free_runs(&runs, false);
+}
+
 /*!
  * @brief lister_process_loop is the lister process function (@see make_process)
  * @param parameters is a pointer to its parameters, to be cast to a lister_configuration_t
@@ -131,56 +371,77 @@ void lister_process_loop(void *parameters) {
     list.tail = NULL;
 
     files_list_entry_t *p_entry;
-    files_list_entry_t *p_entry_analysed;
-    int working_analyser = 0;
+    stats_timer_t timer;
 
-    int mq_id = msgget(config->mq_key, 0666);
+    int mq_id = config->mq_id;
+    uint64_t trace_start;
+
+    trace_process_start(config->my_receiver_id == message_type(MSG_TYPE_TO_SOURCE_LISTER) ? "source lister" : "destination lister");
 
     do {
+        trace_start = trace_begin();
         if (msgrcv(mq_id, &message, sizeof(any_message_t) - sizeof(long), config->my_receiver_id, 0) != -1) {
-            if (message.analyze_file_command.op_code == COMMAND_CODE_ANALYZE_DIR) {
+            trace_end("wait_command", trace_start, TRACE_NO_ARG);
+            stats_add(STATS_IPC_MESSAGES_RECEIVED, 1);
+            if (message.analyze_file_command.op_code == COMMAND_CODE_ANALYZE_DIR && config->batch_entries > 0) {
+                send_runs(mq_id, config, message.analyze_dir_command.target);
+            } else if (message.analyze_file_command.op_code == COMMAND_CODE_ANALYZE_DIR) {
                 //list file of the target directory
-                make_list(&list, message.analyze_dir_command.target);
-                
-                // analyse each file
-                p_entry = list.head;
-                p_entry_analysed = list.head;
-                while (p_entry != NULL) {
-                    while (p_entry != NULL && working_analyser < config->analyzers_count) {
-                        send_analyze_file_command(mq_id, config->my_recipient_id, p_entry);
-                        p_entry = p_entry->next;
-                        working_analyser++;
-                    }
-                    while (working_analyser > 0) {
-                        msgrcv(mq_id, &message, sizeof(any_message_t) - sizeof(long), config->my_receiver_id, 0);
-                        memcpy(p_entry_analysed, &message.analyze_file_command.payload, sizeof(files_list_entry_t));
-                        p_entry_analysed = p_entry_analysed->next;
-                        working_analyser--;
+                clear_files_list(&list);
+                files_list_t known = {NULL, NULL};
+                bool incremental = scan_state_covers(message.analyze_dir_command.target);
+                stats_phase_begin(&timer);
+                trace_start = trace_begin();
+                if (incremental == true) {
+                    scan_state_list(&list, &known, message.analyze_dir_command.target);
+                } else {
+                    make_list(&list, message.analyze_dir_command.target);
+                }
+                trace_end("list_tree", trace_start, TRACE_NO_ARG);
+                stats_phase_end(STATS_PHASE_LISTING, &timer);
+
+                // analyse each file: requests are sent as long as the pool gives slots, and each response
+                // is stored into the entry whose index it carries, whatever the order in which they come
+                stats_phase_begin(&timer);
+                analyze_list(mq_id, config, &list);
+                if (incremental == true) {
+                    // Files taken from the scan state were not analyzed
+                    if (merge_files_lists(&list, &known) == -1) {
+                        fprintf(stderr, "Error merging the files of the scan state\n");
+                        clear_files_list(&known);
                     }
+                    scan_state_save(&list);
                 }
+                stats_phase_end(STATS_PHASE_ANALYSIS, &timer);
 
                 // send each entry to main
+                stats_phase_begin(&timer);
+                trace_start = trace_begin();
                 p_entry = list.head;
                 while (p_entry != NULL) {
-                    if (config->my_receiver_id == MSG_TYPE_TO_SOURCE_LISTER) {
-                        send_files_source_list_element(mq_id, MSG_TYPE_TO_MAIN, p_entry);
+                    if (config->my_receiver_id == message_type(MSG_TYPE_TO_SOURCE_LISTER)) {
+                        send_files_source_list_element(mq_id, message_type(MSG_TYPE_TO_MAIN), p_entry);
                     } else {
-                        send_files_destination_list_element(mq_id, MSG_TYPE_TO_MAIN, p_entry);
+                        send_files_destination_list_element(mq_id, message_type(MSG_TYPE_TO_MAIN), p_entry);
                     }
                     
                     p_entry = p_entry->next;
                 }
-                if (config->my_receiver_id == MSG_TYPE_TO_SOURCE_LISTER) {
-                    send_source_list_end(mq_id, MSG_TYPE_TO_MAIN);
+                if (config->my_receiver_id == message_type(MSG_TYPE_TO_SOURCE_LISTER)) {
+                    send_source_list_end(mq_id, message_type(MSG_TYPE_TO_MAIN));
                 } else {
-                    send_destination_list_end(mq_id, MSG_TYPE_TO_MAIN);
+                    send_destination_list_end(mq_id, message_type(MSG_TYPE_TO_MAIN));
                 }
+                trace_end("send_list", trace_start, TRACE_NO_ARG);
+                stats_phase_end(STATS_PHASE_TRANSFER, &timer);
             }
         }
     }
     while (message.simple_command.message != COMMAND_CODE_TERMINATE);
 
-    send_terminate_confirm(mq_id, MSG_TYPE_TO_MAIN);
+    // Main merges the traces once all processes confirmed their termination
+    trace_flush();
+    send_terminate_confirm(mq_id, message_type(MSG_TYPE_TO_MAIN));
 
     exit(EXIT_SUCCESS);
 }
@@ -192,83 +453,122 @@ void lister_process_loop(void *parameters) {
 void analyzer_process_loop(void *parameters) {
     analyzer_configuration_t* config = (analyzer_configuration_t*) parameters;
     any_message_t message;
+    stats_timer_t timer;
+
+    int mq_id = config->mq_id;
+    uint64_t trace_start;
 
-    int mq_id = msgget(config->mq_key, 0666);
+    files_list_entry_t entry;
+
+    trace_process_start("analyzer");
 
     do {
+        trace_start = trace_begin();
         if (msgrcv(mq_id, &message, sizeof(any_message_t) - sizeof(long), config->my_receiver_id, 0) != -1) {
+            trace_end("wait_command", trace_start, TRACE_NO_ARG);
+            stats_add(STATS_IPC_MESSAGES_RECEIVED, 1);
             if (message.analyze_file_command.op_code == COMMAND_CODE_ANALYZE_FILE) {
-                get_file_stats(&message.analyze_file_command.payload);
-                send_analyze_file_response(mq_id, config->my_recipient_id, &message.analyze_file_command.payload);
+                // Analyzers' work is part of the analysis phase, timed by the lister, and of the job of the lister
+                stats_set_slot(message_job_slot(message.analyze_file_command.reply_to));
+                stats_phase_begin(&timer);
+                trace_start = trace_begin();
+                memset(&entry, 0, sizeof(entry));
+                strcpy(entry.path_and_name, message.analyze_file_command.path);
+                int result = get_file_stats(&entry, &config->digest_options);
+                trace_end("analyze_file", trace_start, entry.size);
+                stats_phase_cpu_end(STATS_PHASE_ANALYSIS, &timer);
+                send_analyze_file_response(mq_id, message.analyze_file_command.reply_to, message.analyze_file_command.entry_index, &entry, result);
+            } else if (message.compare_files_command.op_code == COMMAND_CODE_COMPARE_FILES) {
+                char *source_path = message.compare_files_command.paths;
+                char *destination_path = source_path + strlen(source_path) + 1;
+                stats_set_slot(message_job_slot(message.compare_files_command.reply_to));
+                stats_phase_begin(&timer);
+                trace_start = trace_begin();
+                int result = compare_files_content(source_path, destination_path);
+                trace_end("compare_files", trace_start, TRACE_NO_ARG);
+                stats_phase_cpu_end(STATS_PHASE_DIFF, &timer);
+                send_compare_files_response(mq_id, message.compare_files_command.reply_to, message.compare_files_command.pair_index, result);
             }
         }
     }
     while (message.simple_command.message != COMMAND_CODE_TERMINATE);
 
+    trace_flush();
     send_terminate_confirm(mq_id, MSG_TYPE_TO_MAIN);
 
     exit(EXIT_SUCCESS);
 }
 
 /*!
- * @brief clean_processes cleans the processes by sending them a terminate command and waiting to the confirmation
- * @param the_config is a pointer to the program configuration
+ * @brief terminate_listers terminates the listers made by make_listers, and waits for their confirmation and their end
+ * A lister still alive when its parent exits (a job runner) would take it for a crash and remove the queue.
  * @param p_context is a pointer to the processes context
  */
-void clean_processes(configuration_t *the_config, process_context_t *p_context) {
-    if (the_config == NULL || p_context == NULL) {
-        fprintf(stderr, "Invalid pointers provided to clean_processes function.\n");
-        return;
-    }
-
-    if (the_config->is_parallel == false) {
-        return;
-    }
-
+void terminate_listers(process_context_t *p_context) {
     any_message_t message;
 
     if (p_context->source_lister_pid != 0) {
-        send_terminate_command(p_context->message_queue_id, MSG_TYPE_TO_SOURCE_LISTER);
-        msgrcv(p_context->message_queue_id, &message, sizeof(any_message_t) - sizeof(long), MSG_TYPE_TO_MAIN, 0);
+        send_terminate_command(p_context->message_queue_id, message_type(MSG_TYPE_TO_SOURCE_LISTER));
+        msgrcv(p_context->message_queue_id, &message, sizeof(any_message_t) - sizeof(long), message_type(MSG_TYPE_TO_MAIN), 0);
         if (message.simple_command.message != COMMAND_CODE_TERMINATE_OK) {
             fprintf(stderr, "Error : Unable to terminate process with pid %d\n", p_context->source_lister_pid);
         }
+        waitpid(p_context->source_lister_pid, NULL, 0);
+        p_context->source_lister_pid = 0;
         p_context->processes_count--;
     }
 
     if (p_context->destination_lister_pid != 0) {
-        send_terminate_command(p_context->message_queue_id, MSG_TYPE_TO_DESTINATION_LISTER);
-        msgrcv(p_context->message_queue_id, &message, sizeof(any_message_t) - sizeof(long), MSG_TYPE_TO_MAIN, 0);
+        send_terminate_command(p_context->message_queue_id, message_type(MSG_TYPE_TO_DESTINATION_LISTER));
+        msgrcv(p_context->message_queue_id, &message, sizeof(any_message_t) - sizeof(long), message_type(MSG_TYPE_TO_MAIN), 0);
         if (message.simple_command.message != COMMAND_CODE_TERMINATE_OK) {
             fprintf(stderr, "Error : Unable to terminate process with pid %d\n", p_context->destination_lister_pid);
         }
+        waitpid(p_context->destination_lister_pid, NULL, 0);
+        p_context->destination_lister_pid = 0;
         p_context->processes_count--;
     }
-    
-    int i = 0;
-    while (p_context->source_analyzers_pids[i] != 0) {
-        send_terminate_command(p_context->message_queue_id, MSG_TYPE_TO_SOURCE_ANALYZERS);
-        msgrcv(p_context->message_queue_id, &message, sizeof(any_message_t) - sizeof(long), MSG_TYPE_TO_MAIN, 0);
-        if (message.simple_command.message != COMMAND_CODE_TERMINATE_OK) {
-            fprintf(stderr, "Error : Unable to terminate process with pid %d\n", p_context->source_analyzers_pids[i]);
-        }
-        p_context->processes_count--;
-        i++;
+}
+
+/*!
+ * @brief clean_processes cleans the processes by sending them a terminate command and waiting to the confirmation
+ * @param the_config is a pointer to the program configuration
+ * @param p_context is a pointer to the processes context
+ */
+void clean_processes(configuration_t *the_config, process_context_t *p_context) {
+    if (the_config == NULL || p_context == NULL) {
+        fprintf(stderr, "Invalid pointers provided to clean_processes function.\n");
+        return;
     }
 
-    i = 0;
-    while (p_context->destination_analyzers_pids[i] != 0) {
-        send_terminate_command(p_context->message_queue_id, MSG_TYPE_TO_DESTINATION_ANALYZERS);
+    progress_stop_reporter(p_context->progress_reporter_pid);
+    p_context->progress_reporter_pid = 0;
+    progress_release();
+    destroy_digest_cache(p_context->digest_cache);
+    p_context->digest_cache = NULL;
+    scan_state_release();
+    filter_release();
+    stats_release();
+    throttle_release();
+
+    if (the_config->is_parallel == false) {
+        return;
+    }
+
+    any_message_t message;
+
+    terminate_listers(p_context);
+    for (int i = 0; p_context->analyzers_pids[i] != 0; i++) {
+        send_terminate_command(p_context->message_queue_id, MSG_TYPE_TO_ANALYZERS);
         msgrcv(p_context->message_queue_id, &message, sizeof(any_message_t) - sizeof(long), MSG_TYPE_TO_MAIN, 0);
         if (message.simple_command.message != COMMAND_CODE_TERMINATE_OK) {
-            fprintf(stderr, "Error : Unable to terminate process with pid %d\n", p_context->destination_analyzers_pids[i]);
+            fprintf(stderr, "Error : Unable to terminate process with pid %d\n", p_context->analyzers_pids[i]);
         }
         p_context->processes_count--;
-        i++;
     }
-    
-    free(p_context->source_analyzers_pids);
-    free(p_context->destination_analyzers_pids);
+
+    free(p_context->analyzers_pids);
+    pool_release();
 
     if (p_context->processes_count != 0) {
         fprintf(stderr, "Error : Not all processes are terminate\n");
@@ -0,0 +1,233 @@
+#include <progress.h>
+#include <stats.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+// Progress counters shared by all processes, NULL when progress reporting is disabled.
+// The mapping is created before forking, so every process inherits the pointer.
+static progress_t *progress = NULL;
+
+static const char *phases_names[PROGRESS_PHASES_COUNT] = {"scan", "diff", "copy", "done"};
+static const char *counters_names[PROGRESS_COUNTERS_COUNT] = {
+    "files_discovered", "files_analyzed", "bytes_analyzed", "files_to_copy", "bytes_to_copy", "files_copied", "bytes_copied",
+};
+
+// Weight of the last interval in the smoothed throughput
+#define PROGRESS_RATE_SMOOTHING 0.3
+// Granularity of the reporter's sleep
+#define PROGRESS_SLICE_MS 50
+
+/*!
+ * @brief progress_init maps the shared progress counters
+ * Must be called before the processes are forked.
+ * @return 0 in case of success, -1 else
+ */
+int progress_init(void) {
+    if (progress != NULL) {
+        return 0;
+    }
+    progress = mmap(NULL, sizeof(progress_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (progress == MAP_FAILED) {
+        progress = NULL;
+        fprintf(stderr, "Error creating progress counters\n");
+        return -1;
+    }
+    memset(progress, 0, sizeof(progress_t));
+    progress->start_ns = stats_now_ns();
+    return 0;
+}
+
+/*!
+ * @brief progress_release unmaps the shared progress counters
+ */
+void progress_release(void) {
+    if (progress != NULL) {
+        munmap(progress, sizeof(progress_t));
+        progress = NULL;
+    }
+}
+
+/*!
+ * @brief progress_add increments a progress counter
+ * @param counter is the counter to increment
+ * @param value is the increment
+ */
+void progress_add(progress_counter_t counter, uint64_t value) {
+    if (progress != NULL) {
+        __atomic_fetch_add(&progress->counters[counter], value, __ATOMIC_RELAXED);
+    }
+}
+
+/*!
+ * @brief progress_set_phase tells the reporter which phase the synchronization is in
+ * @param phase is the new phase
+ */
+void progress_set_phase(progress_phase_t phase) {
+    if (progress != NULL) {
+        __atomic_store_n(&progress->phase, phase, __ATOMIC_RELAXED);
+    }
+}
+
+/*!
+ * @brief format_bytes writes a size with a binary unit
+ * @param bytes is the size
+ * @param buffer is where the size is written
+ * @param size is the size of buffer
+ */
+static void format_bytes(double bytes, char *buffer, size_t size) {
+    const char *units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    int unit = 0;
+    while (bytes >= 1024 && unit < 4) {
+        bytes /= 1024;
+        unit++;
+    }
+    snprintf(buffer, size, unit == 0 ? "%.0f %s" : "%.1f %s", bytes, units[unit]);
+}
+
+/*!
+ * @brief report_progress prints one progress report
+ * @param mode tells how the report is printed
+ * @param counters is a snapshot of the counters
+ * @param phase is the current phase
+ * @param elapsed_s is the time since the start of the run
+ * @param rate is the smoothed throughput of the phase (files per second while scanning, bytes per second while copying)
+ */
+static void report_progress(progress_mode_t mode, uint64_t *counters, progress_phase_t phase, double elapsed_s, double rate) {
+    // The ETA is only known while scanning (files left to analyze) and copying (bytes left to copy)
+    double eta_s = -1;
+    if (phase == PROGRESS_PHASE_SCAN && rate > 0 && counters[PROGRESS_FILES_DISCOVERED] >= counters[PROGRESS_FILES_ANALYZED]) {
+        eta_s = (counters[PROGRESS_FILES_DISCOVERED] - counters[PROGRESS_FILES_ANALYZED]) / rate;
+    } else if (phase == PROGRESS_PHASE_COPY && rate > 0 && counters[PROGRESS_BYTES_TO_COPY] >= counters[PROGRESS_BYTES_COPIED]) {
+        eta_s = (counters[PROGRESS_BYTES_TO_COPY] - counters[PROGRESS_BYTES_COPIED]) / rate;
+    }
+
+    if (mode == PROGRESS_LINES) {
+        fprintf(stderr, "{\"elapsed_s\": %.3f, \"phase\": \"%s\"", elapsed_s, phases_names[phase]);
+        for (int counter = 0; counter < PROGRESS_COUNTERS_COUNT; counter++) {
+            fprintf(stderr, ", \"%s\": %llu", counters_names[counter], (unsigned long long) counters[counter]);
+        }
+        fprintf(stderr, ", \"%s\": %.1f", phase == PROGRESS_PHASE_COPY ? "bytes_per_s" : "files_per_s", rate);
+        if (eta_s >= 0) {
+            fprintf(stderr, ", \"eta_s\": %.0f}\n", eta_s);
+        } else {
+            fprintf(stderr, ", \"eta_s\": null}\n");
+        }
+        return;
+    }
+
+    char analyzed[32], to_copy[32], copied[32], throughput[32], eta[32] = "--:--";
+    format_bytes(counters[PROGRESS_BYTES_ANALYZED], analyzed, sizeof(analyzed));
+    format_bytes(counters[PROGRESS_BYTES_TO_COPY], to_copy, sizeof(to_copy));
+    format_bytes(counters[PROGRESS_BYTES_COPIED], copied, sizeof(copied));
+    if (phase == PROGRESS_PHASE_COPY) {
+        format_bytes(rate, throughput, sizeof(throughput));
+        strcat(throughput, "/s");
+    } else {
+        snprintf(throughput, sizeof(throughput), "%.0f files/s", rate);
+    }
+    if (eta_s >= 0) {
+        snprintf(eta, sizeof(eta), "%02llu:%02llu", (unsigned long long) eta_s / 60, (unsigned long long) eta_s % 60);
+    }
+
+    // \r and erase to the end of line so that the status line is refreshed in place
+    fprintf(stderr, "\r[%s %02d:%02d] found %llu | analyzed %llu (%s) | copied %llu/%llu (%s/%s) | %s | ETA %s\033[K",
+            phases_names[phase], (int) elapsed_s / 60, (int) elapsed_s % 60,
+            (unsigned long long) counters[PROGRESS_FILES_DISCOVERED], (unsigned long long) counters[PROGRESS_FILES_ANALYZED], analyzed,
+            (unsigned long long) counters[PROGRESS_FILES_COPIED], (unsigned long long) counters[PROGRESS_FILES_TO_COPY], copied, to_copy,
+            throughput, eta);
+    if (phase == PROGRESS_PHASE_DONE) {
+        fputc('\n', stderr);
+    }
+}
+
+/*!
+ * @brief reporter_loop periodically reports the progress until the run is finished
+ * @param mode tells how reports are printed
+ * @param interval_ms is the time between two reports
+ */
+static void reporter_loop(progress_mode_t mode, uint32_t interval_ms) {
+    pid_t parent_pid = getppid();
+    struct timespec slice = {.tv_sec = 0, .tv_nsec = PROGRESS_SLICE_MS * 1000000L};
+    uint64_t counters[PROGRESS_COUNTERS_COUNT] = {0};
+    uint64_t previous_files = 0, previous_bytes = 0, previous_ns = progress->start_ns;
+    progress_phase_t previous_phase = PROGRESS_PHASE_SCAN;
+    double rate = 0;
+    bool finished = false;
+
+    while (finished == false) {
+        // Sleep by slices so that the last report is not delayed by a whole interval
+        for (uint32_t slept_ms = 0; slept_ms < interval_ms && finished == false; slept_ms += PROGRESS_SLICE_MS) {
+            nanosleep(&slice, NULL);
+            // Stop with the main process, even if it could not ask us to
+            finished = __atomic_load_n(&progress->finished, __ATOMIC_ACQUIRE) != 0 || getppid() != parent_pid;
+        }
+
+        progress_phase_t phase = __atomic_load_n(&progress->phase, __ATOMIC_RELAXED);
+        for (int counter = 0; counter < PROGRESS_COUNTERS_COUNT; counter++) {
+            counters[counter] = __atomic_load_n(&progress->counters[counter], __ATOMIC_RELAXED);
+        }
+        uint64_t now_ns = stats_now_ns();
+        double interval_s = (now_ns - previous_ns) / 1e9;
+
+        // Throughput over the last interval, smoothed so that the ETA does not jump at each report
+        if (phase != previous_phase) {
+            rate = 0;
+        }
+        if (interval_s > 0) {
+            double instant_rate = phase == PROGRESS_PHASE_COPY
+                ? (counters[PROGRESS_BYTES_COPIED] - previous_bytes) / interval_s
+                : (counters[PROGRESS_FILES_ANALYZED] - previous_files) / interval_s;
+            rate = rate == 0 ? instant_rate : PROGRESS_RATE_SMOOTHING * instant_rate + (1 - PROGRESS_RATE_SMOOTHING) * rate;
+        }
+
+        report_progress(mode, counters, phase, (now_ns - progress->start_ns) / 1e9, rate);
+        previous_files = counters[PROGRESS_FILES_ANALYZED];
+        previous_bytes = counters[PROGRESS_BYTES_COPIED];
+        previous_ns = now_ns;
+        previous_phase = phase;
+    }
+}
+
+/*!
+ * @brief progress_start_reporter forks the process printing the progress reports
+ * The reporter only reads the shared counters, it never uses the message queue.
+ * @param mode tells how reports are printed
+ * @param interval_ms is the time between two reports
+ * @return the PID of the reporter, 0 if progress reporting is disabled, -1 in case of error
+ */
+pid_t progress_start_reporter(progress_mode_t mode, uint32_t interval_ms) {
+    if (progress == NULL || mode == PROGRESS_NONE) {
+        return 0;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0) {
+        reporter_loop(mode, interval_ms);
+        fflush(stderr);
+        _exit(EXIT_SUCCESS);
+    }
+    if (pid == -1) {
+        fprintf(stderr, "Error starting progress reporter\n");
+    }
+    return pid;
+}
+
+/*!
+ * @brief progress_stop_reporter asks the reporter for a last report and waits for it
+ * @param reporter_pid is the PID returned by progress_start_reporter
+ */
+void progress_stop_reporter(pid_t reporter_pid) {
+    if (progress == NULL || reporter_pid <= 0) {
+        return;
+    }
+    progress_set_phase(PROGRESS_PHASE_DONE);
+    __atomic_store_n(&progress->finished, 1, __ATOMIC_RELEASE);
+    waitpid(reporter_pid, NULL, 0);
+}
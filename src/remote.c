@@ -0,0 +1,777 @@
+#include <remote.h>
+#include <sync.h>
+#include <processes.h>
+#include <file-properties.h>
+#include <journal.h>
+#include <utility.h>
+#include <stats.h>
+#include <trace.h>
+#include <progress.h>
+#include <throttle.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <openssl/evp.h>
+
+/*!
+ * @brief ignore_broken_pipes keeps the process alive when the peer closes the stream: writes then fail with EPIPE
+ */
+static void ignore_broken_pipes(void) {
+    struct sigaction action = {.sa_handler = SIG_IGN};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPIPE, &action, NULL);
+}
+
+/*!
+ * @brief encode_entry sends an entry as an ENTRY or FILE frame
+ * Layout: size (8), mtime seconds (8), mtime nanoseconds (4), mode (4), flags (1), MD5 (16), path length (4), path.
+ * @param stream is a pointer to the stream
+ * @param type is the type of the frame
+ * @param entry is the entry
+ * @param relative_path is the path of the entry from the root of its tree
+ * @param flags are the REMOTE_FLAG_* of the file
+ * @return 0 in case of success, -1 else
+ */
+static int encode_entry(stream_t *stream, uint8_t type, files_list_entry_t *entry, char *relative_path, uint8_t flags) {
+    uint32_t path_length = strlen(relative_path);
+    uint8_t *frame = stream_begin_frame(stream, type, REMOTE_ENTRY_FIXED_SIZE + path_length);
+    if (frame == NULL) {
+        return -1;
+    }
+    uint8_t *cursor = stream_put_u64(frame, entry->size);
+    cursor = stream_put_u64(cursor, entry->mtime.tv_sec);
+    cursor = stream_put_u32(cursor, entry->mtime.tv_nsec);
+    cursor = stream_put_u32(cursor, entry->mode);
+    *cursor++ = flags;
+    memcpy(cursor, entry->md5sum, sizeof(entry->md5sum));
+    cursor = stream_put_u32(cursor + sizeof(entry->md5sum), path_length);
+    memcpy(cursor, relative_path, path_length);
+    return stream_end_frame(stream, REMOTE_ENTRY_FIXED_SIZE + path_length);
+}
+
+/*!
+ * @brief decode_entry reads an entry sent by encode_entry
+ * @param payload is the payload of the frame
+ * @param length is the length of the payload
+ * @param entry receives the properties of the entry (its path is not set)
+ * @param relative_path receives the path of the entry from the root of its tree
+ * @param flags receives the REMOTE_FLAG_* of the file
+ * @return 0 in case of success, -1 if the frame is invalid
+ */
+static int decode_entry(uint8_t *payload, uint32_t length, files_list_entry_t *entry, char *relative_path, uint8_t *flags) {
+    if (length < REMOTE_ENTRY_FIXED_SIZE) {
+        return -1;
+    }
+    uint8_t *cursor = payload;
+    entry->size = stream_get_u64(&cursor);
+    entry->mtime.tv_sec = stream_get_u64(&cursor);
+    entry->mtime.tv_nsec = stream_get_u32(&cursor);
+    entry->mode = stream_get_u32(&cursor);
+    entry->entry_type = FICHIER;
+    *flags = *cursor++;
+    memcpy(entry->md5sum, cursor, sizeof(entry->md5sum));
+    cursor += sizeof(entry->md5sum);
+    uint32_t path_length = stream_get_u32(&cursor);
+    if (path_length != length - REMOTE_ENTRY_FIXED_SIZE || path_length >= PATH_SIZE) {
+        return -1;
+    }
+    memcpy(relative_path, cursor, path_length);
+    relative_path[path_length] = '\0';
+    return 0;
+}
+
+/*!
+ * @brief remote_connect starts or reaches the destination side and sends it the synchronization options
+ * With --remote-command, the command runs through /bin/sh with its stdin and stdout on a socketpair.
+ * @param session is a pointer to the session to open
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else
+ */
+int remote_connect(remote_session_t *session, configuration_t *the_config) {
+    int fd = -1;
+    session->command_pid = 0;
+    ignore_broken_pipes();
+
+    if (strlen(the_config->remote_command) > 0) {
+        int sockets[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == -1) {
+            fprintf(stderr, "Error creating the stream of the remote command: %s\n", strerror(errno));
+            return -1;
+        }
+        session->command_pid = fork();
+        if (session->command_pid == -1) {
+            fprintf(stderr, "Error starting the remote command: %s\n", strerror(errno));
+            close(sockets[0]);
+            close(sockets[1]);
+            return -1;
+        }
+        if (session->command_pid == 0) {
+            close(sockets[0]);
+            dup2(sockets[1], STDIN_FILENO);
+            dup2(sockets[1], STDOUT_FILENO);
+            if (sockets[1] > STDOUT_FILENO) {
+                close(sockets[1]);
+            }
+            execl("/bin/sh", "sh", "-c", the_config->remote_command, (char*) NULL);
+            _exit(127);
+        }
+        close(sockets[1]);
+        fd = sockets[0];
+    } else {
+        struct sockaddr_un address = {.sun_family = AF_UNIX};
+        if (strlen(the_config->remote_socket) >= sizeof(address.sun_path)) {
+            fprintf(stderr, "Socket path %s is too long\n", the_config->remote_socket);
+            return -1;
+        }
+        strcpy(address.sun_path, the_config->remote_socket);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd == -1 || connect(fd, (struct sockaddr*) &address, sizeof(address)) == -1) {
+            fprintf(stderr, "Error connecting to %s: %s\n", the_config->remote_socket, strerror(errno));
+            if (fd != -1) {
+                close(fd);
+            }
+            return -1;
+        }
+    }
+    if (stream_open(&session->stream, fd, fd) == -1) {
+        close(fd);
+        remote_close(session);
+        return -1;
+    }
+
+    // Layout: magic (8), version (4), compare mode (4), sample threshold (8), sample block size (4),
+    // sample blocks count (4), destination length (4), destination
+    uint32_t path_length = strlen(the_config->destination);
+    uint8_t *frame = stream_begin_frame(&session->stream, REMOTE_HELLO, 36 + path_length);
+    if (frame == NULL) {
+        remote_close(session);
+        return -1;
+    }
+    memcpy(frame, REMOTE_MAGIC, 8);
+    uint8_t *cursor = stream_put_u32(frame + 8, REMOTE_VERSION);
+    cursor = stream_put_u32(cursor, the_config->compare_mode);
+    cursor = stream_put_u64(cursor, the_config->sample_threshold);
+    cursor = stream_put_u32(cursor, the_config->sample_block_size);
+    cursor = stream_put_u32(cursor, the_config->sample_blocks_count);
+    cursor = stream_put_u32(cursor, path_length);
+    memcpy(cursor, the_config->destination, path_length);
+    stream_end_frame(&session->stream, 36 + path_length);
+
+    // The destination side lists its tree while the source is listed here
+    if (stream_flush(&session->stream) == -1) {
+        fprintf(stderr, "Error sending options to the remote side\n");
+        remote_close(session);
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief remote_receive_list receives the analyzed list of the remote destination
+ * Entries get the path they would have in a local destination list, so that they are diffed the same way.
+ * @param session is a pointer to the session
+ * @param the_config is a pointer to the configuration
+ * @param dest_list is a pointer to the destination list to fill
+ * @return 0 in case of success, -1 else
+ */
+int remote_receive_list(remote_session_t *session, configuration_t *the_config, files_list_t *dest_list) {
+    uint64_t trace_start = trace_begin();
+    uint8_t type;
+    uint8_t *payload;
+    uint32_t length;
+    char relative_path[PATH_SIZE];
+    uint8_t flags;
+
+    while (stream_receive(&session->stream, true, &type, &payload, &length) == 1) {
+        if (type == REMOTE_READY) {
+            continue;
+        }
+        if (type == REMOTE_ERROR) {
+            fprintf(stderr, "Remote side: %.*s\n", (int) length, (char*) payload);
+            return -1;
+        }
+        if (type == REMOTE_LIST_END) {
+            trace_end("receive_remote_list", trace_start, TRACE_NO_ARG);
+            return 0;
+        }
+        files_list_entry_t *entry = (files_list_entry_t*) calloc(1, sizeof(files_list_entry_t));
+        if (type != REMOTE_ENTRY || entry == NULL || decode_entry(payload, length, entry, relative_path, &flags) == -1
+            || strlen(the_config->destination) + strlen(relative_path) >= sizeof(entry->path_and_name)) {
+            fprintf(stderr, "Invalid list received from the remote side\n");
+            free(entry);
+            return -1;
+        }
+        strcpy(entry->path_and_name, the_config->destination);
+        strcat(entry->path_and_name, relative_path);
+        add_entry_to_tail(dest_list, entry);
+    }
+    fprintf(stderr, "Remote side closed the stream\n");
+    return -1;
+}
+
+/*!
+ * @brief send_file streams a source file to the remote side: a FILE frame, its data, then FILE_END
+ * When the source cannot be read whole (or does not match its analysis with --verify-copy), FILE_ABORT
+ * ends the file instead, and the remote side drops it.
+ * @param session is a pointer to the session
+ * @param the_config is a pointer to the configuration
+ * @param entry is the source entry
+ * @return 0 when the file was sent (or aborted), 1 when the source could not be opened, -1 when the stream failed
+ */
+static int send_file(remote_session_t *session, configuration_t *the_config, files_list_entry_t *entry) {
+    stream_t *stream = &session->stream;
+    char *relative_path = entry->path_and_name + strlen(the_config->source);
+    int source_file = open(entry->path_and_name, O_RDONLY);
+    if (source_file == -1) {
+        fprintf(stderr, "Error opening source file %s\n", entry->path_and_name);
+        return 1;
+    }
+    stats_add(STATS_OPEN_CALLS, 1);
+    uint64_t trace_start = trace_begin();
+
+    // With --verify-copy, both sides hash the data: here against the analysis, there against what was written
+    EVP_MD_CTX *context = NULL;
+    uint8_t flags = 0;
+    if (the_config->verify_copy == true) {
+        context = EVP_MD_CTX_new();
+        if (context == NULL || EVP_DigestInit_ex(context, EVP_md5(), NULL) != 1) {
+            EVP_MD_CTX_free(context);
+            close(source_file);
+            return 1;
+        }
+        if (has_whole_digest(the_config, entry) == true) {
+            flags |= REMOTE_FLAG_VERIFY;
+        }
+    }
+    if (encode_entry(stream, REMOTE_FILE, entry, relative_path, flags) == -1) {
+        EVP_MD_CTX_free(context);
+        close(source_file);
+        return -1;
+    }
+
+    uint64_t bytes_sent = 0;
+    bool complete = true;
+    while (bytes_sent < entry->size) {
+        uint64_t remaining = entry->size - bytes_sent;
+        uint32_t chunk_size = remaining < REMOTE_DATA_SIZE ? remaining : REMOTE_DATA_SIZE;
+        // The data is read straight into the output buffer of the stream
+        uint8_t *data = stream_begin_frame(stream, REMOTE_DATA, chunk_size);
+        if (data == NULL) {
+            EVP_MD_CTX_free(context);
+            close(source_file);
+            return -1;
+        }
+        ssize_t bytes_read = read(source_file, data, chunk_size);
+        if (bytes_read == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            // Read error, or the source got shorter since it was analyzed
+            complete = false;
+            break;
+        }
+        stream_end_frame(stream, bytes_read);
+        if (context != NULL) {
+            EVP_DigestUpdate(context, data, bytes_read);
+        }
+        bytes_sent += bytes_read;
+        stats_add(STATS_COPY_BYTES_READ, bytes_read);
+        throttle_account(THROTTLE_COPY, bytes_read);
+    }
+    close(source_file);
+
+    if (context != NULL) {
+        uint8_t digest[sizeof(entry->md5sum)];
+        EVP_DigestFinal_ex(context, digest, NULL);
+        EVP_MD_CTX_free(context);
+        if (complete == true && check_copied_digest(entry, the_config, digest, bytes_sent, relative_path) == -1) {
+            complete = false;
+        }
+    }
+    if (complete == false) {
+        fprintf(stderr, "Error reading source file %s, it is not sent\n", entry->path_and_name);
+    }
+    trace_end("stream_file", trace_start, bytes_sent);
+    return stream_send(stream, complete == true ? REMOTE_FILE_END : REMOTE_FILE_ABORT, NULL, 0);
+}
+
+/*!
+ * @brief receive_acknowledgments handles the FILE_DONE frames of the files sent
+ * @param session is a pointer to the session
+ * @param the_config is a pointer to the configuration
+ * @param plan is the table of the files to copy
+ * @param sent is the table of the positions in plan of the files sent, in order
+ * @param sent_count is the number of files sent
+ * @param acknowledged is a pointer to the number of files acknowledged, updated
+ * @param wait tells if all files sent must be acknowledged, else only the acknowledgments already received are handled
+ * @return the number of files the remote side failed to write, -1 when the stream failed
+ */
+static int64_t receive_acknowledgments(remote_session_t *session, configuration_t *the_config, files_list_entry_t **plan, size_t *sent,
+                                       size_t sent_count, size_t *acknowledged, bool wait) {
+    uint8_t type;
+    uint8_t *payload;
+    uint32_t length;
+    int64_t failed = 0;
+    while (*acknowledged < sent_count) {
+        int received = stream_receive(&session->stream, wait, &type, &payload, &length);
+        if (received == 0) {
+            break;
+        }
+        if (received == -1 || type != REMOTE_FILE_DONE || length != 1) {
+            fprintf(stderr, "Remote side stopped acknowledging files\n");
+            return -1;
+        }
+        files_list_entry_t *entry = plan[sent[(*acknowledged)++]];
+        if (payload[0] != 0) {
+            fprintf(stderr, "Remote side failed to write %s\n", entry->path_and_name + strlen(the_config->source));
+            failed++;
+            continue;
+        }
+        stats_add(STATS_FILES_COPIED, 1);
+        stats_add(STATS_BYTES_COPIED, entry->size);
+        progress_add(PROGRESS_FILES_COPIED, 1);
+        progress_add(PROGRESS_BYTES_COPIED, entry->size);
+        if (the_config->verbose == true) {
+            printf("%s copied to %s%s.\n", entry->path_and_name, the_config->destination, entry->path_and_name + strlen(the_config->source));
+        }
+    }
+    return failed;
+}
+
+/*!
+ * @brief remote_send_files streams the files to copy to the remote side
+ * Files are sent back to back: acknowledgments are handled as they arrive, and all are waited for at the end.
+ * @param session is a pointer to the session
+ * @param the_config is a pointer to the configuration
+ * @param plan is the table of the files to copy, in copy order
+ * @param plan_count is the number of files to copy
+ * @return true if all files were written by the remote side, false else
+ */
+bool remote_send_files(remote_session_t *session, configuration_t *the_config, files_list_entry_t **plan, size_t plan_count) {
+    size_t *sent = (size_t*) malloc(sizeof(size_t) * (plan_count + 1));
+    size_t sent_count = 0;
+    size_t acknowledged = 0;
+    bool synchronized = (sent != NULL);
+    bool stream_failed = (sent == NULL);
+
+    for (size_t i = 0; i < plan_count && stream_failed == false; i++) {
+        if (the_config->dry_run == true) {
+            printf("%s copied to %s%s.\n", plan[i]->path_and_name, the_config->destination, plan[i]->path_and_name + strlen(the_config->source));
+            continue;
+        }
+        int result = send_file(session, the_config, plan[i]);
+        if (result == 1) {
+            synchronized = false;
+            continue;
+        }
+        if (result == 0) {
+            sent[sent_count++] = i;
+        }
+        int64_t failed = (result == -1) ? -1 : receive_acknowledgments(session, the_config, plan, sent, sent_count, &acknowledged, false);
+        if (failed != 0) {
+            synchronized = false;
+            stream_failed = (failed == -1);
+        }
+    }
+    if (stream_failed == false && receive_acknowledgments(session, the_config, plan, sent, sent_count, &acknowledged, true) != 0) {
+        synchronized = false;
+    }
+    if (stream_failed == true) {
+        fprintf(stderr, "Stream to the remote side failed\n");
+        synchronized = false;
+    }
+    free(sent);
+    return synchronized;
+}
+
+/*!
+ * @brief remote_close ends a session: the remote side is told that no more files come, then the stream is closed
+ * @param session is a pointer to the session
+ * @return 0 if the remote side ended the session without error, -1 else
+ */
+int remote_close(remote_session_t *session) {
+    int result = -1;
+    uint8_t type;
+    uint8_t *payload;
+    uint32_t length;
+    if (session->stream.input != NULL) {
+        if (stream_send(&session->stream, REMOTE_DONE, NULL, 0) == 0
+            && stream_receive(&session->stream, true, &type, &payload, &length) == 1 && type == REMOTE_SUMMARY && length == 24) {
+            uint8_t *cursor = payload + 16;
+            result = stream_get_u64(&cursor) == 0 ? 0 : -1;
+        }
+        stream_close(&session->stream);
+    }
+    if (session->command_pid > 0) {
+        int status;
+        waitpid(session->command_pid, &status, 0);
+        session->command_pid = 0;
+    }
+    return result;
+}
+
+typedef struct {
+    configuration_t *config;
+    int file; // File being received, -1 if none
+    files_list_entry_t entry; // Properties of the file being received, path_and_name is its final path
+    char partial_path[PATH_SIZE]; // Where it is written until it is complete
+    bool failed; // The file cannot be written, its data is still received
+    EVP_MD_CTX *context; // Hash of the received data when the file is checked (REMOTE_FLAG_VERIFY)
+    uint64_t bytes_received;
+    uint64_t files_written;
+    uint64_t bytes_written;
+    uint64_t files_failed;
+} receiver_t;
+
+/*!
+ * @brief is_path_confined tells if a relative path received from the client stays in the destination
+ * @param path is the path
+ * @return true if no component of the path is .., false else
+ */
+static bool is_path_confined(char *path) {
+    char *component = path;
+    while (*component != '\0') {
+        size_t length = strcspn(component, "/");
+        if (length == 2 && strncmp(component, "..", 2) == 0) {
+            return false;
+        }
+        component += length;
+        while (*component == '/') {
+            component++;
+        }
+    }
+    return strlen(path) > 0;
+}
+
+/*!
+ * @brief drop_file gives up the file being received
+ * @param receiver is a pointer to the receiver
+ */
+static void drop_file(receiver_t *receiver) {
+    if (receiver->file != -1) {
+        close(receiver->file);
+        unlink(receiver->partial_path);
+        receiver->file = -1;
+    }
+    if (receiver->context != NULL) {
+        EVP_MD_CTX_free(receiver->context);
+        receiver->context = NULL;
+    }
+}
+
+/*!
+ * @brief begin_file starts receiving a file (FILE frame), into a partial file of the destination
+ * @param receiver is a pointer to the receiver
+ * @param payload is the payload of the frame
+ * @param length is the length of the payload
+ * @return 0 in case of success, -1 if the frame is invalid (the data of the file is then ignored)
+ */
+static int begin_file(receiver_t *receiver, uint8_t *payload, uint32_t length) {
+    char relative_path[PATH_SIZE];
+    uint8_t flags;
+    drop_file(receiver);
+    memset(&receiver->entry, 0, sizeof(files_list_entry_t));
+    receiver->failed = true;
+    receiver->bytes_received = 0;
+    if (decode_entry(payload, length, &receiver->entry, relative_path, &flags) == -1 || is_path_confined(relative_path) == false
+        || concat_path(receiver->entry.path_and_name, receiver->config->destination, relative_path) == NULL
+        || snprintf(receiver->partial_path, sizeof(receiver->partial_path), "%s%s", receiver->entry.path_and_name, JOURNAL_PARTIAL_SUFFIX) >= (int) sizeof(receiver->partial_path)) {
+        fprintf(stderr, "Invalid file received\n");
+        return -1;
+    }
+    if (make_parent_directories(receiver->partial_path) == -1) {
+        fprintf(stderr, "Error creating parent directories of %s\n", receiver->entry.path_and_name);
+        return -1;
+    }
+    receiver->file = open(receiver->partial_path, O_WRONLY | O_CREAT | O_TRUNC, receiver->entry.mode);
+    if (receiver->file == -1) {
+        fprintf(stderr, "Error opening destination file %s\n", receiver->partial_path);
+        return -1;
+    }
+    stats_add(STATS_OPEN_CALLS, 1);
+    if ((flags & REMOTE_FLAG_VERIFY) != 0) {
+        receiver->context = EVP_MD_CTX_new();
+        if (receiver->context == NULL || EVP_DigestInit_ex(receiver->context, EVP_md5(), NULL) != 1) {
+            drop_file(receiver);
+            return -1;
+        }
+    }
+    receiver->failed = false;
+    return 0;
+}
+
+/*!
+ * @brief end_file completes the file being received (FILE_END frame): it gets its mode and mtime, then its name
+ * @param receiver is a pointer to the receiver
+ * @return 0 when the file was written whole, -1 else
+ */
+static int end_file(receiver_t *receiver) {
+    files_list_entry_t *entry = &receiver->entry;
+    if (receiver->failed == true || receiver->file == -1 || receiver->bytes_received != entry->size) {
+        drop_file(receiver);
+        return -1;
+    }
+    if (receiver->context != NULL) {
+        uint8_t digest[sizeof(entry->md5sum)];
+        EVP_DigestFinal_ex(receiver->context, digest, NULL);
+        if (memcmp(digest, entry->md5sum, sizeof(digest)) != 0) {
+            fprintf(stderr, "Data received for %s does not match its digest\n", entry->path_and_name);
+            drop_file(receiver);
+            return -1;
+        }
+        stats_add(STATS_COPIES_VERIFIED, 1);
+    }
+    struct timespec new_time[2] = {{.tv_sec = UTIME_NOW, .tv_nsec = UTIME_NOW}, entry->mtime};
+    if (futimens(receiver->file, new_time) != 0 || fchmod(receiver->file, entry->mode) != 0 || rename(receiver->partial_path, entry->path_and_name) == -1) {
+        fprintf(stderr, "Error completing %s\n", entry->path_and_name);
+        drop_file(receiver);
+        return -1;
+    }
+    close(receiver->file);
+    receiver->file = -1;
+    drop_file(receiver);
+    receiver->files_written++;
+    receiver->bytes_written += entry->size;
+    stats_add(STATS_FILES_COPIED, 1);
+    stats_add(STATS_BYTES_COPIED, entry->size);
+    if (receiver->config->verbose == true) {
+        fprintf(stderr, "%s received.\n", entry->path_and_name);
+    }
+    return 0;
+}
+
+/*!
+ * @brief receive_files writes the files streamed by the client, until it has no more (DONE frame)
+ * @param stream is a pointer to the stream
+ * @param receiver is a pointer to the receiver
+ * @return 0 when the client ended the session, -1 when the stream failed
+ */
+static int receive_files(stream_t *stream, receiver_t *receiver) {
+    uint8_t type;
+    uint8_t *payload;
+    uint32_t length;
+    while (stream_receive(stream, true, &type, &payload, &length) == 1) {
+        uint8_t status = 1;
+        switch (type) {
+            case REMOTE_FILE:
+                begin_file(receiver, payload, length);
+                continue;
+
+            case REMOTE_DATA:
+                if (receiver->failed == false && receiver->file != -1) {
+                    if (write_buffer(receiver->file, (char*) payload, length) == -1) {
+                        fprintf(stderr, "Error writing %s\n", receiver->partial_path);
+                        receiver->failed = true;
+                    } else if (receiver->context != NULL) {
+                        EVP_DigestUpdate(receiver->context, payload, length);
+                    }
+                }
+                receiver->bytes_received += length;
+                continue;
+
+            case REMOTE_FILE_END:
+                status = (end_file(receiver) == 0) ? 0 : 1;
+                break;
+
+            case REMOTE_FILE_ABORT:
+                drop_file(receiver);
+                break;
+
+            case REMOTE_DONE:
+                return 0;
+
+            default:
+                fprintf(stderr, "Unexpected frame %u received\n", type);
+                return -1;
+        }
+        if (status != 0) {
+            receiver->files_failed++;
+        }
+        // Acknowledgments are buffered, and sent with the next flush of the stream
+        if (stream_send(stream, REMOTE_FILE_DONE, &status, 1) == -1) {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+/*!
+ * @brief send_error sends an error message to the client, which then ends the session
+ * @param stream is a pointer to the stream
+ * @param message is the message
+ */
+static void send_error(stream_t *stream, char *message) {
+    fprintf(stderr, "%s\n", message);
+    stream_send(stream, REMOTE_ERROR, message, strlen(message));
+    stream_flush(stream);
+}
+
+/*!
+ * @brief serve_session serves one client: its destination is listed and analyzed, then the files it sends are written
+ * @param base_config is a pointer to the configuration of the server
+ * @param input_fd is the descriptor the client is read from
+ * @param output_fd is the descriptor the client is written to
+ * @return 0 when the session ended without error, -1 else
+ */
+static int serve_session(configuration_t *base_config, int input_fd, int output_fd) {
+    stream_t stream;
+    if (stream_open(&stream, input_fd, output_fd) == -1) {
+        return -1;
+    }
+
+    uint8_t type;
+    uint8_t *payload;
+    uint32_t length;
+    char message[PATH_SIZE + 128];
+    if (stream_receive(&stream, true, &type, &payload, &length) != 1 || type != REMOTE_HELLO || length < 36
+        || memcmp(payload, REMOTE_MAGIC, 8) != 0) {
+        send_error(&stream, "Invalid session start");
+        stream_close(&stream);
+        return -1;
+    }
+    uint8_t *cursor = payload + 8;
+    uint32_t version = stream_get_u32(&cursor);
+    configuration_t config = *base_config;
+    config.compare_mode = stream_get_u32(&cursor);
+    config.sample_threshold = stream_get_u64(&cursor);
+    config.sample_block_size = stream_get_u32(&cursor);
+    config.sample_blocks_count = stream_get_u32(&cursor);
+    uint32_t path_length = stream_get_u32(&cursor);
+    if (version != REMOTE_VERSION || path_length != length - 36 || path_length >= sizeof(config.destination)
+        || (config.compare_mode != COMPARE_MD5 && config.compare_mode != COMPARE_DATE_SIZE && config.compare_mode != COMPARE_SAMPLED)) {
+        send_error(&stream, "Unsupported session options");
+        stream_close(&stream);
+        return -1;
+    }
+    memcpy(config.destination, cursor, path_length);
+    config.destination[path_length] = '\0';
+    strcpy(config.source, "");
+    config.uses_md5 = (config.compare_mode == COMPARE_MD5 || config.compare_mode == COMPARE_SAMPLED);
+    if (!directory_exists(config.destination) || !is_directory_writable(config.destination)) {
+        snprintf(message, sizeof(message), "Destination directory %s does not exist or is not writable", config.destination);
+        send_error(&stream, message);
+        stream_close(&stream);
+        return -1;
+    }
+    stream_send(&stream, REMOTE_READY, NULL, 0);
+    stream_flush(&stream);
+
+    // The destination is listed and analyzed here, by the processes of the session
+    process_context_t p_context;
+    files_list_t dest_list = {NULL, NULL};
+    files_list_t unused_list = {NULL, NULL};
+    stats_reset();
+    if (prepare(&config, &p_context) != 0) {
+        send_error(&stream, "Error preparing the processes of the remote side");
+        stream_close(&stream);
+        return -1;
+    }
+    if (config.is_parallel == true) {
+        make_files_lists_parallel(&unused_list, &dest_list, &config, p_context.message_queue_id);
+    } else {
+        digest_options_t digest_options;
+        make_digest_options(&config, p_context.digest_cache, &digest_options);
+        make_files_list(&dest_list, config.destination, &digest_options, config.io_order);
+    }
+
+    int result = 0;
+    uint64_t entries_count = 0;
+    size_t root_length = strlen(config.destination);
+    for (files_list_entry_t *cursor = dest_list.head; cursor != NULL && result == 0; cursor = cursor->next) {
+        if (cursor->entry_type == FICHIER) {
+            result = encode_entry(&stream, REMOTE_ENTRY, cursor, cursor->path_and_name + root_length, 0);
+            entries_count++;
+        }
+    }
+    clear_files_list(&dest_list);
+    uint8_t count[8];
+    stream_put_u64(count, entries_count);
+    if (result == 0) {
+        result = stream_send(&stream, REMOTE_LIST_END, count, sizeof(count));
+    }
+
+    receiver_t receiver = {.config = &config, .file = -1};
+    if (result == 0) {
+        result = receive_files(&stream, &receiver);
+    }
+    drop_file(&receiver);
+    if (result == 0) {
+        uint8_t summary[24];
+        cursor = stream_put_u64(summary, receiver.files_written);
+        cursor = stream_put_u64(cursor, receiver.bytes_written);
+        stream_put_u64(cursor, receiver.files_failed);
+        if (stream_send(&stream, REMOTE_SUMMARY, summary, sizeof(summary)) == -1 || stream_flush(&stream) == -1) {
+            result = -1;
+        }
+    } else {
+        fprintf(stderr, "Session with %s ended without completing\n", config.destination);
+    }
+
+    if (strlen(config.stats_file) > 0) {
+        stats_write_report(config.stats_file);
+    }
+    clean_processes(&config, &p_context);
+    stream_close(&stream);
+    return (result == 0 && receiver.files_failed == 0) ? 0 : -1;
+}
+
+/*!
+ * @brief remote_serve runs the destination side of remote synchronizations (--serve)
+ * Without socket, one session is served on stdin and stdout, as when started by --remote-command. With a socket,
+ * sessions are served one after the other, until the process is interrupted.
+ * @param the_config is a pointer to the configuration
+ * @return 0 when the session ended without error, -1 else
+ */
+int remote_serve(configuration_t *the_config) {
+    ignore_broken_pipes();
+    if (strlen(the_config->serve_socket) == 0) {
+        // stdout carries the stream: anything printed goes to stderr instead
+        int output_fd = dup(STDOUT_FILENO);
+        if (output_fd == -1 || dup2(STDERR_FILENO, STDOUT_FILENO) == -1) {
+            fprintf(stderr, "Error redirecting stdout\n");
+            return -1;
+        }
+        return serve_session(the_config, STDIN_FILENO, output_fd);
+    }
+
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(the_config->serve_socket) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long\n", the_config->serve_socket);
+        return -1;
+    }
+    strcpy(address.sun_path, the_config->serve_socket);
+    struct stat socket_stats;
+    if (lstat(the_config->serve_socket, &socket_stats) == 0 && S_ISSOCK(socket_stats.st_mode)) {
+        unlink(the_config->serve_socket);
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener == -1 || bind(listener, (struct sockaddr*) &address, sizeof(address)) == -1 || listen(listener, 4) == -1) {
+        fprintf(stderr, "Error listening to %s: %s\n", the_config->serve_socket, strerror(errno));
+        if (listener != -1) {
+            close(listener);
+        }
+        return -1;
+    }
+    while (true) {
+        int connection = accept(listener, NULL, NULL);
+        if (connection == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Error accepting on %s: %s\n", the_config->serve_socket, strerror(errno));
+            break;
+        }
+        serve_session(the_config, connection, connection);
+    }
+    close(listener);
+    unlink(the_config->serve_socket);
+    return -1;
+}
@@ -0,0 +1,701 @@
+#include <scan-state.h>
+#include <filter.h>
+#include <file-properties.h>
+#include <utility.h>
+#include <sync.h>
+#include <stats.h>
+#include <trace.h>
+#include <progress.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// The state is loaded before forking, so the source lister and the analyzers inherit it.
+// Only the process that lists the source records and saves the new state.
+static bool enabled = false;
+static bool trust_files = false; // Files of unchanged directories are not analyzed again (--trust-scan-state)
+static bool digests_usable = false; // Saved digests were computed as this run computes them
+static configuration_t settings;
+static scan_state_t previous = {NULL, 0, NULL, NULL, NULL, NULL};
+
+static scan_directory_record_t *directories = NULL;
+static size_t directories_count = 0;
+static size_t directories_capacity = 0;
+static bool record_failed = false;
+
+/*!
+ * @brief open_previous maps the state saved by the previous run
+ * @return 0 in case of success, -1 when there is no usable state (the whole tree is then read)
+ */
+static int open_previous(void) {
+    char *path = settings.scan_state_file;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            fprintf(stderr, "Error opening scan state %s\n", path);
+        }
+        return -1;
+    }
+    struct stat state_stats;
+    if (fstat(fd, &state_stats) == -1 || state_stats.st_size < (off_t) sizeof(scan_state_header_t)) {
+        fprintf(stderr, "Scan state %s is truncated, scanning the whole tree\n", path);
+        close(fd);
+        return -1;
+    }
+    previous.length = state_stats.st_size;
+    previous.data = mmap(NULL, previous.length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (previous.data == MAP_FAILED) {
+        previous.data = NULL;
+        fprintf(stderr, "Error mapping scan state %s\n", path);
+        return -1;
+    }
+
+    scan_state_header_t *header = previous.data;
+    bool valid = memcmp(header->magic, SCAN_STATE_MAGIC, sizeof(header->magic)) == 0 && header->version == SCAN_STATE_VERSION
+                 && header->directories_count <= previous.length / sizeof(scan_state_directory_t)
+                 && header->children_count <= previous.length / sizeof(scan_state_child_t)
+                 && header->names_offset >= sizeof(scan_state_header_t) + header->directories_count * sizeof(scan_state_directory_t)
+                                            + header->children_count * sizeof(scan_state_child_t)
+                 && header->names_offset + header->names_size == previous.length
+                 && memchr(header->root, '\0', sizeof(header->root)) != NULL;
+    if (valid == true) {
+        previous.header = header;
+        previous.directories = (scan_state_directory_t*) ((char*) previous.data + sizeof(scan_state_header_t));
+        previous.children = (scan_state_child_t*) (previous.directories + header->directories_count);
+        previous.names = (char*) previous.data + header->names_offset;
+        for (uint64_t i = 0; valid == true && i < header->directories_count; i++) {
+            scan_state_directory_t *directory = &previous.directories[i];
+            valid = directory->path_offset + directory->path_length <= header->names_size
+                    && directory->first_child + directory->children_count <= header->children_count;
+        }
+        for (uint64_t i = 0; valid == true && i < header->children_count; i++) {
+            scan_state_child_t *child = &previous.children[i];
+            valid = child->name_offset + child->name_length <= header->names_size && child->name_length < PATH_SIZE;
+        }
+    }
+    if (valid == false) {
+        fprintf(stderr, "Scan state %s is invalid, scanning the whole tree\n", path);
+        munmap(previous.data, previous.length);
+        memset(&previous, 0, sizeof(previous));
+        return -1;
+    }
+
+    if (strcmp(header->root, settings.source) != 0) {
+        fprintf(stderr, "Scan state %s describes %s, scanning the whole tree\n", path, header->root);
+        munmap(previous.data, previous.length);
+        memset(&previous, 0, sizeof(previous));
+        return -1;
+    }
+    digests_usable = digests_compatible(&settings, header->compare_mode, header->sample_threshold, header->sample_block_size, header->sample_blocks_count);
+    return 0;
+}
+
+/*!
+ * @brief scan_state_init loads the state of the previous scan of the source (--scan-state)
+ * Must be called before the processes are forked.
+ * @param the_config is a pointer to the configuration
+ * @return 0 (a missing or unusable state only means that the whole tree is read)
+ */
+int scan_state_init(configuration_t *the_config) {
+    if (strlen(the_config->scan_state_file) == 0) {
+        return 0;
+    }
+    if (the_config->max_memory > 0) {
+        fprintf(stderr, "--scan-state is ignored with --max-memory\n");
+        return 0;
+    }
+    settings = *the_config;
+    trust_files = the_config->trust_scan_state;
+    enabled = true;
+    open_previous();
+    return 0;
+}
+
+/*!
+ * @brief free_records frees the directories recorded by the current scan
+ */
+static void free_records(void) {
+    for (size_t i = 0; i < directories_count; i++) {
+        for (size_t j = 0; j < directories[i].children_count; j++) {
+            free(directories[i].children[j].name);
+        }
+        free(directories[i].children);
+        free(directories[i].path);
+    }
+    free(directories);
+    directories = NULL;
+    directories_count = 0;
+    directories_capacity = 0;
+    record_failed = false;
+}
+
+/*!
+ * @brief scan_state_release unmaps the previous state and frees the current one
+ */
+void scan_state_release(void) {
+    if (previous.data != NULL) {
+        munmap(previous.data, previous.length);
+    }
+    memset(&previous, 0, sizeof(previous));
+    free_records();
+    enabled = false;
+}
+
+/*!
+ * @brief scan_state_covers tells if a tree is listed incrementally
+ * @param target is the root of the tree
+ * @return true if target is the source and --scan-state is set, false else
+ */
+bool scan_state_covers(char *target) {
+    return enabled == true && strcmp(target, settings.source) == 0;
+}
+
+/*!
+ * @brief compare_names compares two names that are not NUL terminated, as strcmp does
+ * @param lhd is the first name
+ * @param lhd_length is the length of the first name
+ * @param rhd is the second name
+ * @param rhd_length is the length of the second name
+ * @return a negative value, 0 or a positive value when lhd is before, equal or after rhd
+ */
+static int compare_names(char *lhd, size_t lhd_length, char *rhd, size_t rhd_length) {
+    int order = memcmp(lhd, rhd, lhd_length < rhd_length ? lhd_length : rhd_length);
+    if (order != 0) {
+        return order;
+    }
+    return (lhd_length > rhd_length) - (lhd_length < rhd_length);
+}
+
+/*!
+ * @brief find_directory looks for a directory in the previous state (binary search)
+ * @param relative_path is the path of the directory from the root
+ * @param length is the length of relative_path
+ * @return a pointer to the saved directory, NULL if there is none
+ */
+static scan_state_directory_t *find_directory(char *relative_path, size_t length) {
+    if (previous.data == NULL) {
+        return NULL;
+    }
+    uint64_t low = 0;
+    uint64_t high = previous.header->directories_count;
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        scan_state_directory_t *directory = &previous.directories[middle];
+        int order = compare_names(relative_path, length, previous.names + directory->path_offset, directory->path_length);
+        if (order == 0) {
+            return directory;
+        }
+        if (order < 0) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+    return NULL;
+}
+
+/*!
+ * @brief find_child looks for a child of a saved directory (binary search)
+ * @param directory is a pointer to the saved directory
+ * @param name is the name of the child
+ * @return a pointer to the saved child, NULL if there is none
+ */
+static scan_state_child_t *find_child(scan_state_directory_t *directory, char *name) {
+    uint64_t low = directory->first_child;
+    uint64_t high = directory->first_child + directory->children_count;
+    size_t length = strlen(name);
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        scan_state_child_t *child = &previous.children[middle];
+        int order = compare_names(name, length, previous.names + child->name_offset, child->name_length);
+        if (order == 0) {
+            return child;
+        }
+        if (order < 0) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+    return NULL;
+}
+
+/*!
+ * @brief record_directory records a directory met by the current scan
+ * @param relative_path is the path of the directory from the root
+ * @param directory_stats is a pointer to the stats of the directory
+ * @return the index of the record, directories_count in case of error
+ */
+static size_t record_directory(char *relative_path, struct stat *directory_stats) {
+    if (directories_count == directories_capacity) {
+        size_t capacity = directories_capacity == 0 ? 64 : 2 * directories_capacity;
+        scan_directory_record_t *records = realloc(directories, sizeof(scan_directory_record_t) * capacity);
+        if (records == NULL) {
+            record_failed = true;
+            return directories_count;
+        }
+        directories = records;
+        directories_capacity = capacity;
+    }
+    scan_directory_record_t *record = &directories[directories_count];
+    memset(record, 0, sizeof(scan_directory_record_t));
+    record->path = strdup(relative_path);
+    if (record->path == NULL) {
+        record_failed = true;
+        return directories_count;
+    }
+    record->inode = directory_stats->st_ino;
+    record->mtime = directory_stats->st_mtim;
+    return directories_count++;
+}
+
+/*!
+ * @brief record_child records a child of a directory met by the current scan
+ * @param directory is the index of the directory record
+ * @param name is the name of the child
+ * @param flags tells if the child is a directory (SCAN_CHILD_DIRECTORY)
+ * @param inode is the inode of the child
+ */
+static void record_child(size_t directory, char *name, uint32_t flags, uint64_t inode) {
+    if (directory >= directories_count) {
+        return;
+    }
+    scan_directory_record_t *record = &directories[directory];
+    if (record->children_count == record->children_capacity) {
+        size_t capacity = record->children_capacity == 0 ? 16 : 2 * record->children_capacity;
+        scan_child_record_t *children = realloc(record->children, sizeof(scan_child_record_t) * capacity);
+        if (children == NULL) {
+            record_failed = true;
+            return;
+        }
+        record->children = children;
+        record->children_capacity = capacity;
+    }
+    scan_child_record_t *child = &record->children[record->children_count];
+    child->name = strdup(name);
+    if (child->name == NULL) {
+        record_failed = true;
+        return;
+    }
+    child->flags = flags & SCAN_CHILD_DIRECTORY;
+    child->inode = inode;
+    record->children_count++;
+}
+
+/*!
+ * @brief add_file adds a file met by the scan to the list of files to analyze, or to the list of known files
+ * Both lists are filled in scan order, they are ordered afterwards (@see merge_files_lists).
+ * @param path is the path of the file
+ * @param saved is a pointer to the file in the previous state when its directory is unchanged, NULL else
+ * @param list is a pointer to the list of files to analyze
+ * @param known is a pointer to the list of files whose properties come from the previous state
+ */
+static void add_file(char *path, scan_state_child_t *saved, files_list_t *list, files_list_t *known) {
+    stats_add(STATS_FILES_LISTED, 1);
+    progress_add(PROGRESS_FILES_DISCOVERED, 1);
+
+    files_list_entry_t *entry = (files_list_entry_t*) malloc(sizeof(files_list_entry_t));
+    if (entry == NULL) {
+        return;
+    }
+    strcpy(entry->path_and_name, path);
+    if (saved == NULL || trust_files == false || digests_usable == false || (saved->flags & SCAN_CHILD_KNOWN) == 0) {
+        entry->mtime.tv_sec = 0;
+        entry->mtime.tv_nsec = 0;
+        add_entry_to_tail(list, entry);
+        return;
+    }
+
+    entry->mtime.tv_sec = saved->mtime_sec;
+    entry->mtime.tv_nsec = saved->mtime_nsec;
+    entry->size = saved->size;
+    memcpy(entry->md5sum, saved->md5sum, sizeof(entry->md5sum));
+    entry->entry_type = FICHIER;
+    entry->mode = saved->mode;
+    add_entry_to_tail(known, entry);
+    stats_add(STATS_DIGESTS_REUSED, 1);
+    progress_add(PROGRESS_FILES_ANALYZED, 1);
+    progress_add(PROGRESS_BYTES_ANALYZED, entry->size);
+}
+
+static void scan_directory(char *path, files_list_t *list, files_list_t *known);
+
+/*!
+ * @brief reuse_directory lists an unchanged directory from the previous state, without reading it
+ * @param path is the path of the directory
+ * @param saved is a pointer to the directory in the previous state
+ * @param directory is the index of the record of the directory
+ * @param list is a pointer to the list of files to analyze
+ * @param known is a pointer to the list of files whose properties come from the previous state
+ */
+static void reuse_directory(char *path, scan_state_directory_t *saved, size_t directory, files_list_t *list, files_list_t *known) {
+    char name[PATH_SIZE];
+    char child_path[PATH_SIZE] = "";
+
+    stats_add(STATS_DIRECTORIES_REUSED, 1);
+    for (uint64_t i = 0; i < saved->children_count; i++) {
+        scan_state_child_t *child = &previous.children[saved->first_child + i];
+        memcpy(name, previous.names + child->name_offset, child->name_length);
+        name[child->name_length] = '\0';
+        if (concat_path(child_path, path, name) != NULL) {
+            // All children are recorded, the filters only decide what is listed
+            record_child(directory, name, child->flags, child->inode);
+            if ((child->flags & SCAN_CHILD_DIRECTORY) != 0) {
+                if (filter_enter_directory(child_path) == true) {
+                    scan_directory(child_path, list, known);
+                    filter_leave_directory();
+                }
+            } else {
+                // Size and age predicates use the saved properties when there are some
+                struct stat saved_stats;
+                saved_stats.st_size = child->size;
+                saved_stats.st_mtim.tv_sec = child->mtime_sec;
+                saved_stats.st_mtim.tv_nsec = child->mtime_nsec;
+                if (filter_excludes_file(child_path, (child->flags & SCAN_CHILD_KNOWN) != 0 ? &saved_stats : NULL) == false) {
+                    add_file(child_path, child, list, known);
+                }
+            }
+        }
+        strcpy(child_path, "");
+    }
+}
+
+/*!
+ * @brief read_directory lists a new or changed directory (@see walk_tree)
+ * @param path is the path of the directory
+ * @param directory is the index of the record of the directory
+ * @param list is a pointer to the list of files to analyze
+ * @param known is a pointer to the list of files whose properties come from the previous state
+ */
+static void read_directory(char *path, size_t directory, files_list_t *list, files_list_t *known) {
+    uint64_t trace_start = trace_begin();
+    DIR *dir = open_dir(path);
+    if (!dir) {
+        fprintf(stderr, "Error opening directory\n");
+        return;
+    }
+
+    struct dirent *dp;
+    char child_path[PATH_SIZE] = "";
+
+    while ((dp = readdir(dir)) != NULL) {
+        stats_add(STATS_READDIR_CALLS, 1);
+        if (dp->d_type == DT_REG) {
+            if (concat_path(child_path, path, dp->d_name) != NULL) {
+                record_child(directory, dp->d_name, 0, dp->d_ino);
+                if (filter_excludes_file(child_path, NULL) == false) {
+                    add_file(child_path, NULL, list, known);
+                }
+            }
+        } else if (dp->d_type == DT_DIR && strcmp(dp->d_name, ".") != 0 && strcmp(dp->d_name, "..") != 0) {
+            if (concat_path(child_path, path, dp->d_name) != NULL) {
+                record_child(directory, dp->d_name, SCAN_CHILD_DIRECTORY, dp->d_ino);
+                if (filter_enter_directory(child_path) == true) {
+                    scan_directory(child_path, list, known);
+                    filter_leave_directory();
+                }
+            }
+        }
+        strcpy(child_path, "");
+    }
+
+    closedir(dir);
+    trace_end("read_dir", trace_start, TRACE_NO_ARG);
+}
+
+/*!
+ * @brief scan_directory lists a directory, from the previous state when its inode and mtime are unchanged
+ * A directory mtime changes when entries are added, removed or renamed, not when its files are modified.
+ * @param path is the path of the directory
+ * @param list is a pointer to the list of files to analyze
+ * @param known is a pointer to the list of files whose properties come from the previous state
+ */
+static void scan_directory(char *path, files_list_t *list, files_list_t *known) {
+    struct stat directory_stats;
+
+    stats_add(STATS_STAT_CALLS, 1);
+    if (stat(path, &directory_stats) == -1) {
+        fprintf(stderr, "Error opening directory\n");
+        return;
+    }
+
+    char *relative_path = path + strlen(settings.source);
+    size_t directory = record_directory(relative_path, &directory_stats);
+    scan_state_directory_t *saved = find_directory(relative_path, strlen(relative_path));
+    if (saved != NULL && saved->inode == directory_stats.st_ino
+        && saved->mtime_sec == directory_stats.st_mtim.tv_sec && saved->mtime_nsec == directory_stats.st_mtim.tv_nsec) {
+        reuse_directory(path, saved, directory, list, known);
+    } else {
+        read_directory(path, directory, list, known);
+    }
+}
+
+/*!
+ * @brief scan_state_list lists the source incrementally and records its new state
+ * @param list is a pointer to the list that receives the files to analyze
+ * @param known is a pointer to the list that receives the files whose properties come from the previous state
+ * (only with --trust-scan-state), to be merged into list once it is analyzed (@see merge_files_lists)
+ * @param target is the root of the tree
+ */
+void scan_state_list(files_list_t *list, files_list_t *known, char *target) {
+    files_list_t listed = {NULL, NULL};
+
+    free_records();
+    if (filter_begin_walk(target) == true) {
+        scan_directory(target, &listed, known);
+        filter_end_walk();
+    }
+
+    // Files are gathered in scan order and sorted once, rather than inserted in order one by one
+    if (merge_files_lists(list, &listed) == -1) {
+        fprintf(stderr, "Error sorting the files of %s\n", target);
+        clear_files_list(&listed);
+    }
+}
+
+/*!
+ * @brief scan_state_lookup gets the saved digest of a file whose stats are unchanged since the previous run
+ * Called by get_file_stats in any process, for any file.
+ * @param path is the path of the file
+ * @param file_stats is a pointer to the current stats of the file
+ * @param md5sum is where the digest is written
+ * @return true if the digest was found, false if the file must be hashed
+ */
+bool scan_state_lookup(char *path, struct stat *file_stats, uint8_t *md5sum) {
+    if (enabled == false || previous.data == NULL || digests_usable == false) {
+        return false;
+    }
+    size_t root_length = strlen(previous.header->root);
+    if (strncmp(path, previous.header->root, root_length) != 0) {
+        return false;
+    }
+
+    char *relative_path = path + root_length;
+    char *slash = strrchr(relative_path, '/');
+    char *name = slash == NULL ? relative_path : slash + 1;
+    scan_state_directory_t *directory = find_directory(relative_path, slash == NULL ? 0 : slash - relative_path);
+    if (directory == NULL) {
+        return false;
+    }
+    scan_state_child_t *child = find_child(directory, name);
+    if (child == NULL || child->flags != SCAN_CHILD_KNOWN || child->inode != file_stats->st_ino
+        || child->size != (uint64_t) file_stats->st_size || child->mode != file_stats->st_mode
+        || child->mtime_sec != file_stats->st_mtim.tv_sec || child->mtime_nsec != file_stats->st_mtim.tv_nsec) {
+        return false;
+    }
+    memcpy(md5sum, child->md5sum, sizeof(child->md5sum));
+    stats_add(STATS_DIGESTS_REUSED, 1);
+    return true;
+}
+
+/*!
+ * @brief compare_directories orders directory records by path (qsort callback)
+ * @param lhd is a pointer to the first record
+ * @param rhd is a pointer to the second record
+ * @return the strcmp of the paths
+ */
+static int compare_directories(const void *lhd, const void *rhd) {
+    return strcmp(((scan_directory_record_t*) lhd)->path, ((scan_directory_record_t*) rhd)->path);
+}
+
+/*!
+ * @brief compare_children orders child records by name (qsort callback)
+ * @param lhd is a pointer to the first record
+ * @param rhd is a pointer to the second record
+ * @return the strcmp of the names
+ */
+static int compare_children(const void *lhd, const void *rhd) {
+    return strcmp(((scan_child_record_t*) lhd)->name, ((scan_child_record_t*) rhd)->name);
+}
+
+/*!
+ * @brief find_entry looks for a file in a table of entries in path order (binary search)
+ * @param entries is the table of entries
+ * @param entries_count is the number of entries
+ * @param path is the path of the file
+ * @return a pointer to the entry, NULL if there is none
+ */
+static files_list_entry_t *find_entry(files_list_entry_t **entries, size_t entries_count, char *path) {
+    size_t low = 0;
+    size_t high = entries_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        int order = strcmp(path, entries[middle]->path_and_name);
+        if (order == 0) {
+            return entries[middle];
+        }
+        if (order < 0) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+    return NULL;
+}
+
+/*!
+ * @brief write_state writes the recorded directories and the properties of their files into a state file
+ * @param state is the state file, opened for writing
+ * @param entries is the table of the analyzed entries, in path order
+ * @param entries_count is the number of entries
+ * @return 0 in case of success, -1 else
+ */
+static int write_state(FILE *state, files_list_entry_t **entries, size_t entries_count) {
+    scan_state_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SCAN_STATE_MAGIC, sizeof(header.magic));
+    header.version = SCAN_STATE_VERSION;
+    header.compare_mode = settings.compare_mode;
+    header.sample_threshold = settings.sample_threshold;
+    header.sample_block_size = settings.sample_block_size;
+    header.sample_blocks_count = settings.sample_blocks_count;
+    header.directories_count = directories_count;
+    strcpy(header.root, settings.source);
+
+    // Names are the paths of the directories, then the names of their children, in the tables order
+    uint64_t paths_size = 0;
+    for (size_t i = 0; i < directories_count; i++) {
+        paths_size += strlen(directories[i].path);
+        header.children_count += directories[i].children_count;
+        header.names_size += strlen(directories[i].path);
+        for (size_t j = 0; j < directories[i].children_count; j++) {
+            header.names_size += strlen(directories[i].children[j].name);
+        }
+    }
+    header.names_offset = sizeof(header) + directories_count * sizeof(scan_state_directory_t) + header.children_count * sizeof(scan_state_child_t);
+    if (fwrite(&header, sizeof(header), 1, state) != 1) {
+        return -1;
+    }
+
+    uint64_t name_offset = 0;
+    uint64_t first_child = 0;
+    for (size_t i = 0; i < directories_count; i++) {
+        scan_state_directory_t directory;
+        memset(&directory, 0, sizeof(directory));
+        directory.path_offset = name_offset;
+        directory.path_length = strlen(directories[i].path);
+        directory.children_count = directories[i].children_count;
+        directory.first_child = first_child;
+        directory.inode = directories[i].inode;
+        directory.mtime_sec = directories[i].mtime.tv_sec;
+        directory.mtime_nsec = directories[i].mtime.tv_nsec;
+        name_offset += directory.path_length;
+        first_child += directory.children_count;
+        if (fwrite(&directory, sizeof(directory), 1, state) != 1) {
+            return -1;
+        }
+    }
+
+    char directory_path[PATH_SIZE];
+    char file_path[PATH_SIZE];
+    name_offset = paths_size;
+    for (size_t i = 0; i < directories_count; i++) {
+        snprintf(directory_path, PATH_SIZE, "%s%s", settings.source, directories[i].path);
+        for (size_t j = 0; j < directories[i].children_count; j++) {
+            scan_child_record_t *record = &directories[i].children[j];
+            scan_state_child_t child;
+            memset(&child, 0, sizeof(child));
+            child.name_offset = name_offset;
+            child.name_length = strlen(record->name);
+            child.flags = record->flags;
+            child.inode = record->inode;
+            name_offset += child.name_length;
+
+            strcpy(file_path, "");
+            files_list_entry_t *entry = NULL;
+            if ((record->flags & SCAN_CHILD_DIRECTORY) == 0 && concat_path(file_path, directory_path, record->name) != NULL) {
+                entry = find_entry(entries, entries_count, file_path);
+            }
+            if (entry != NULL && entry->entry_type == FICHIER && S_ISREG(entry->mode)) {
+                child.flags |= SCAN_CHILD_KNOWN;
+                child.size = entry->size;
+                child.mtime_sec = entry->mtime.tv_sec;
+                child.mtime_nsec = entry->mtime.tv_nsec;
+                child.mode = entry->mode;
+                memcpy(child.md5sum, entry->md5sum, sizeof(child.md5sum));
+            }
+            if (fwrite(&child, sizeof(child), 1, state) != 1) {
+                return -1;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < directories_count; i++) {
+        size_t length = strlen(directories[i].path);
+        if (fwrite(directories[i].path, 1, length, state) != length) {
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < directories_count; i++) {
+        for (size_t j = 0; j < directories[i].children_count; j++) {
+            size_t length = strlen(directories[i].children[j].name);
+            if (fwrite(directories[i].children[j].name, 1, length, state) != length) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief scan_state_save saves the state of the current scan for the next run
+ * The state is written into a temporary file, which replaces the previous state.
+ * @param list is a pointer to the analyzed list of the source, in path order
+ * @return 0 in case of success, -1 else
+ */
+int scan_state_save(files_list_t *list) {
+    if (enabled == false || record_failed == true) {
+        return -1;
+    }
+
+    uint64_t trace_start = trace_begin();
+    qsort(directories, directories_count, sizeof(scan_directory_record_t), compare_directories);
+    for (size_t i = 0; i < directories_count; i++) {
+        qsort(directories[i].children, directories[i].children_count, sizeof(scan_child_record_t), compare_children);
+    }
+
+    size_t entries_count;
+    files_list_entry_t **entries = files_list_to_table(list, &entries_count);
+    if (entries == NULL) {
+        return -1;
+    }
+
+    char temporary_path[PATH_SIZE];
+    if (snprintf(temporary_path, PATH_SIZE, "%s.XXXXXX", settings.scan_state_file) >= PATH_SIZE) {
+        free(entries);
+        return -1;
+    }
+    int fd = mkstemp(temporary_path);
+    FILE *state = fd == -1 ? NULL : fdopen(fd, "w");
+    if (state == NULL) {
+        fprintf(stderr, "Error creating scan state %s\n", temporary_path);
+        if (fd != -1) {
+            close(fd);
+            unlink(temporary_path);
+        }
+        free(entries);
+        return -1;
+    }
+
+    int result = write_state(state, entries, entries_count);
+    free(entries);
+    if (result == 0 && (fflush(state) != 0 || fsync(fileno(state)) != 0)) {
+        result = -1;
+    }
+    fclose(state);
+    if (result == 0 && rename(temporary_path, settings.scan_state_file) == -1) {
+        result = -1;
+    }
+    if (result == -1) {
+        fprintf(stderr, "Error writing scan state %s\n", settings.scan_state_file);
+        unlink(temporary_path);
+    }
+    trace_end("save_scan_state", trace_start, directories_count);
+    return result;
+}
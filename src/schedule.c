@@ -0,0 +1,193 @@
+#include <schedule.h>
+#include <stats.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+
+typedef struct {
+    uint64_t size;
+    size_t index;
+} schedule_item_t;
+
+typedef struct {
+    uint64_t primary; // Device (inode order), or 1 for files without a mapped extent (extent order)
+    uint64_t secondary; // Inode number or physical offset of the first extent
+    size_t index;
+} physical_item_t;
+
+/*!
+ * @brief compare_sizes_descending orders schedule items from the largest to the smallest (qsort callback)
+ * Equal sizes keep the path order, so that the schedule is stable.
+ * @param lhd is a pointer to the first item
+ * @param rhd is a pointer to the second item
+ * @return a negative value if lhd comes first, a positive value else
+ */
+static int compare_sizes_descending(const void *lhd, const void *rhd) {
+    const schedule_item_t *left = lhd;
+    const schedule_item_t *right = rhd;
+    if (left->size != right->size) {
+        return left->size > right->size ? -1 : 1;
+    }
+    return left->index < right->index ? -1 : 1;
+}
+
+/*!
+ * @brief make_largest_first_order computes the order in which files are sent to the analyzers
+ * Large files go first, from the largest (longest processing time first), so that none of them is left alone
+ * at the end of the analysis. Most small files are interleaved between them to keep the analyzers busy while
+ * large files are read; the last ones are kept to fill the tail.
+ * Sizes are hints from a stat by the lister: files may change before they are analyzed.
+ * @param entries is the table of the entries to analyze, in path order
+ * @param entries_count is the number of entries
+ * @param order is where the indexes of the entries are written, in scheduling order
+ * @return 0 in case of success, -1 else (order is then the path order)
+ */
+int make_largest_first_order(files_list_entry_t **entries, size_t entries_count, size_t *order) {
+    for (size_t i = 0; i < entries_count; i++) {
+        order[i] = i;
+    }
+
+    schedule_item_t *large = malloc(sizeof(schedule_item_t) * (entries_count + 1));
+    size_t *small = malloc(sizeof(size_t) * (entries_count + 1));
+    if (large == NULL || small == NULL) {
+        free(large);
+        free(small);
+        return -1;
+    }
+
+    size_t large_count = 0, small_count = 0;
+    struct stat file_stats;
+    for (size_t i = 0; i < entries_count; i++) {
+        stats_add(STATS_STAT_CALLS, 1);
+        uint64_t size = stat(entries[i]->path_and_name, &file_stats) == 0 ? (uint64_t) file_stats.st_size : 0;
+        if (size >= SCHEDULE_SMALL_FILE_SIZE) {
+            large[large_count].size = size;
+            large[large_count].index = i;
+            large_count++;
+        } else {
+            small[small_count++] = i;
+        }
+    }
+
+    if (large_count > 0) {
+        qsort(large, large_count, sizeof(schedule_item_t), compare_sizes_descending);
+
+        size_t interleaved_count = small_count - small_count / SCHEDULE_TAIL_SHARE;
+        size_t small_per_large = (interleaved_count + large_count - 1) / large_count;
+        size_t next_small = 0, position = 0;
+        for (size_t i = 0; i < large_count; i++) {
+            order[position++] = large[i].index;
+            for (size_t j = 0; j < small_per_large && next_small < interleaved_count; j++) {
+                order[position++] = small[next_small++];
+            }
+        }
+        while (next_small < small_count) {
+            order[position++] = small[next_small++];
+        }
+    }
+
+    free(large);
+    free(small);
+    return 0;
+}
+
+/*!
+ * @brief compare_physical_positions orders items by their physical position (qsort callback)
+ * @param lhd is a pointer to the first item
+ * @param rhd is a pointer to the second item
+ * @return a negative value if lhd comes first, a positive value else
+ */
+static int compare_physical_positions(const void *lhd, const void *rhd) {
+    const physical_item_t *left = lhd;
+    const physical_item_t *right = rhd;
+    if (left->primary != right->primary) {
+        return left->primary < right->primary ? -1 : 1;
+    }
+    if (left->secondary != right->secondary) {
+        return left->secondary < right->secondary ? -1 : 1;
+    }
+    return left->index < right->index ? -1 : 1;
+}
+
+/*!
+ * @brief get_first_extent gets the physical offset of the first extent of a file
+ * @param path is the path of the file
+ * @param physical is where the offset is written
+ * @return 0 in case of success, -1 if the file has no mapped extent or FIEMAP is not supported
+ */
+static int get_first_extent(char *path, uint64_t *physical) {
+    struct {
+        struct fiemap map;
+        struct fiemap_extent extents[1];
+    } request;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    stats_add(STATS_OPEN_CALLS, 1);
+
+    memset(&request, 0, sizeof(request));
+    request.map.fm_start = 0;
+    request.map.fm_length = FIEMAP_MAX_OFFSET;
+    request.map.fm_extent_count = 1;
+    int result = ioctl(fd, FS_IOC_FIEMAP, &request.map);
+    close(fd);
+
+    if (result == -1 || request.map.fm_mapped_extents == 0) {
+        return -1;
+    }
+    *physical = request.extents[0].fe_physical;
+    return 0;
+}
+
+/*!
+ * @brief make_physical_order computes an order of the files following their position on the storage
+ * Reading files in this order avoids most seeks on rotational media. With IO_ORDER_EXTENT, files whose
+ * extents cannot be mapped (empty or inline files, FIEMAP not supported) come last, by inode number.
+ * @param entries is the table of the entries, in path order
+ * @param entries_count is the number of entries
+ * @param io_order tells which position is used (inode number or first extent)
+ * @param order is where the indexes of the entries are written, in physical order
+ * @return 0 in case of success, -1 else (order is then the path order)
+ */
+int make_physical_order(files_list_entry_t **entries, size_t entries_count, io_order_t io_order, size_t *order) {
+    for (size_t i = 0; i < entries_count; i++) {
+        order[i] = i;
+    }
+
+    physical_item_t *items = malloc(sizeof(physical_item_t) * (entries_count + 1));
+    if (items == NULL) {
+        return -1;
+    }
+
+    struct stat file_stats;
+    for (size_t i = 0; i < entries_count; i++) {
+        items[i].index = i;
+        items[i].primary = 0;
+        items[i].secondary = 0;
+        stats_add(STATS_STAT_CALLS, 1);
+        if (stat(entries[i]->path_and_name, &file_stats) == -1) {
+            continue;
+        }
+        if (io_order == IO_ORDER_EXTENT && get_first_extent(entries[i]->path_and_name, &items[i].secondary) == 0) {
+            items[i].primary = 0;
+        } else {
+            items[i].primary = io_order == IO_ORDER_EXTENT ? 1 : file_stats.st_dev;
+            items[i].secondary = file_stats.st_ino;
+        }
+    }
+
+    qsort(items, entries_count, sizeof(physical_item_t), compare_physical_positions);
+    for (size_t i = 0; i < entries_count; i++) {
+        order[i] = items[i].index;
+    }
+
+    free(items);
+    return 0;
+}
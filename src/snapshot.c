@@ -0,0 +1,196 @@
+#include <snapshot.h>
+#include <defines.h>
+#include <utility.h>
+#include <sync.h>
+#include <dirent.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*!
+ * @brief is_snapshot_name tells if a directory name was produced by prepare_snapshot
+ * Snapshot names follow SNAPSHOT_NAME_FORMAT, optionally followed by _<n> when several runs happen in the same second
+ * @param name is the name of the directory (without its path)
+ * @return true if the name is a snapshot name, false else
+ */
+bool is_snapshot_name(char *name) {
+    // Template of a snapshot name, 'd' stands for any digit
+    const char *template = "dddd-dd-dd_dddddd";
+
+    if (name == NULL || strlen(name) < SNAPSHOT_NAME_LENGTH) {
+        return false;
+    }
+
+    for (int i = 0; i < SNAPSHOT_NAME_LENGTH; i++) {
+        if (template[i] == 'd' ? !isdigit((unsigned char) name[i]) : name[i] != template[i]) {
+            return false;
+        }
+    }
+
+    if (name[SNAPSHOT_NAME_LENGTH] == '\0') {
+        return true;
+    }
+    if (name[SNAPSHOT_NAME_LENGTH] != '_' || name[SNAPSHOT_NAME_LENGTH + 1] == '\0') {
+        return false;
+    }
+    for (char *cursor = name + SNAPSHOT_NAME_LENGTH + 1; *cursor != '\0'; cursor++) {
+        if (!isdigit((unsigned char) *cursor)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*!
+ * @brief compare_snapshot_names orders two snapshot names by date, then by their collision suffix
+ * Dates have a fixed width and compare as strings, suffixes compare as numbers (_10 comes after _2).
+ * @param name_a is the first snapshot name (@see is_snapshot_name)
+ * @param name_b is the second snapshot name
+ * @return a negative value if name_a is older than name_b, a positive value if it is more recent, 0 if they are equal
+ */
+static int compare_snapshot_names(char *name_a, char *name_b) {
+    int date_order = strncmp(name_a, name_b, SNAPSHOT_NAME_LENGTH);
+    if (date_order != 0) {
+        return date_order;
+    }
+    // A name without suffix is the first one of its second
+    unsigned long long suffix_a = name_a[SNAPSHOT_NAME_LENGTH] == '\0' ? 0 : strtoull(name_a + SNAPSHOT_NAME_LENGTH + 1, NULL, 10);
+    unsigned long long suffix_b = name_b[SNAPSHOT_NAME_LENGTH] == '\0' ? 0 : strtoull(name_b + SNAPSHOT_NAME_LENGTH + 1, NULL, 10);
+    return suffix_a < suffix_b ? -1 : (suffix_a > suffix_b ? 1 : 0);
+}
+
+/*!
+ * @brief find_latest_snapshot looks for the most recent snapshot in a snapshots root directory
+ * As snapshot names start with their UTC date, the most recent one is the greatest name (@see compare_snapshot_names)
+ * @param root is the directory containing the snapshots (i.e. the destination)
+ * @param latest is filled with the full path of the latest snapshot, or an empty string when there is none
+ * @return 0 when a snapshot was found, -1 else
+ */
+int find_latest_snapshot(char *root, char *latest) {
+    char latest_name[PATH_SIZE] = "";
+
+    strcpy(latest, "");
+
+    DIR *dir = opendir(root);
+    if (dir == NULL) {
+        return -1;
+    }
+
+    struct dirent *dp;
+    while ((dp = readdir(dir)) != NULL) {
+        if (dp->d_type == DT_DIR && is_snapshot_name(dp->d_name)) {
+            if (strlen(latest_name) == 0 || compare_snapshot_names(dp->d_name, latest_name) > 0) {
+                strcpy(latest_name, dp->d_name);
+            }
+        }
+    }
+    closedir(dir);
+
+    if (strlen(latest_name) == 0 || concat_path(latest, root, latest_name) == NULL) {
+        strcpy(latest, "");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*!
+ * @brief prepare_snapshot finds the previous snapshot and creates the directory of the new one
+ * @param the_config is a pointer to the configuration, whose destination is the snapshots root
+ * @param previous is filled with the path to the previous snapshot (empty string if this is the first one)
+ * @param current is filled with the path to the new snapshot
+ * @return 0 in case of success, -1 else
+ * In dry run mode, the new snapshot directory is not created.
+ */
+int prepare_snapshot(configuration_t *the_config, char *previous, char *current) {
+    char name[SNAPSHOT_NAME_LENGTH + 1];
+    time_t now = time(NULL);
+    struct tm now_tm;
+
+    find_latest_snapshot(the_config->destination, previous);
+
+    // UTC dates never go backwards, as local ones do when daylight saving time ends
+    gmtime_r(&now, &now_tm);
+    strftime(name, sizeof(name), SNAPSHOT_NAME_FORMAT, &now_tm);
+
+    strcpy(current, "");
+    if (concat_path(current, the_config->destination, name) == NULL) {
+        return -1;
+    }
+
+    // Two runs in the same second get suffixed names
+    for (int suffix = 1; access(current, F_OK) == 0; suffix++) {
+        char suffixed_name[SNAPSHOT_NAME_LENGTH + 16];
+        snprintf(suffixed_name, sizeof(suffixed_name), "%s_%d", name, suffix);
+        strcpy(current, "");
+        if (concat_path(current, the_config->destination, suffixed_name) == NULL) {
+            return -1;
+        }
+    }
+
+    if (strlen(current) >= sizeof(the_config->destination)) {
+        fprintf(stderr, "Snapshot path %s is too long\n", current);
+        return -1;
+    }
+
+    if (the_config->verbose == true || the_config->dry_run == true) {
+        printf("Snapshot %s (previous: %s)\n", current, strlen(previous) > 0 ? previous : "none");
+    }
+
+    if (the_config->dry_run == false && mkdir(current, 0777) == -1) {
+        fprintf(stderr, "Error creating snapshot directory %s\n", current);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*!
+ * @brief link_entry_to_snapshot hardlinks an unchanged file from the previous snapshot into the new one
+ * When the link cannot be made (e.g. too many links to the inode), the file is copied from the source instead.
+ * @param source_entry is the source entry of the unchanged file
+ * @param the_config is a pointer to the configuration (its source is used to compute the relative path)
+ * @param previous is the path to the previous snapshot
+ * @param current is the path to the new snapshot
+ * @return 0 in case of success, -1 else
+ */
+int link_entry_to_snapshot(files_list_entry_t *source_entry, configuration_t *the_config, char *previous, char *current) {
+    char previous_path[PATH_SIZE] = "";
+    char current_path[PATH_SIZE] = "";
+    char *relative_path = source_entry->path_and_name + strlen(the_config->source);
+
+    if (concat_path(previous_path, previous, relative_path) == NULL || concat_path(current_path, current, relative_path) == NULL) {
+        return -1;
+    }
+
+    if (the_config->dry_run == true) {
+        printf("%s linked to %s.\n", previous_path, current_path);
+        return 0;
+    }
+
+    if (make_parent_directories(current_path) == -1) {
+        fprintf(stderr, "Error creating parent directories of %s\n", current_path);
+        return -1;
+    }
+
+    if (link(previous_path, current_path) == -1) {
+        if (errno != EMLINK && errno != EXDEV) {
+            fprintf(stderr, "Error linking %s to %s\n", previous_path, current_path);
+            return -1;
+        }
+        configuration_t current_config = *the_config;
+        strcpy(current_config.destination, current);
+        return copy_entry_to_destination(source_entry, &current_config);
+    }
+
+    if (the_config->verbose == true) {
+        printf("%s linked to %s.\n", previous_path, current_path);
+    }
+
+    return 0;
+}
@@ -0,0 +1,400 @@
+#include <spill.h>
+#include <sync.h>
+#include <defines.h>
+#include <stats.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+    files_list_t batch;
+    size_t batch_count;
+    size_t batch_entries;
+    char *directory;
+    batch_analyzer_t analyzer;
+    void *context;
+    spill_runs_t *runs;
+    int error;
+} run_builder_t;
+
+/*!
+ * @brief spill_directory gets the directory where run files are written
+ * @param the_config is a pointer to the configuration
+ * @param directory is where the directory is written (PATH_SIZE bytes)
+ */
+void spill_directory(configuration_t *the_config, char *directory) {
+    char *tmpdir = getenv("TMPDIR");
+    if (strlen(the_config->spill_dir) > 0) {
+        strcpy(directory, the_config->spill_dir);
+    } else if (tmpdir != NULL && strlen(tmpdir) > 0 && strlen(tmpdir) < PATH_SIZE) {
+        strcpy(directory, tmpdir);
+    } else {
+        strcpy(directory, "/tmp");
+    }
+}
+
+/*!
+ * @brief spill_batch_entries computes how many entries a batch may hold
+ * @param memory_budget is the memory the batch may use, in bytes
+ * @return the number of entries of a batch
+ */
+size_t spill_batch_entries(uint64_t memory_budget) {
+    size_t batch_entries = memory_budget / (sizeof(files_list_entry_t) + 2 * sizeof(size_t));
+    return batch_entries < SPILL_MIN_BATCH_ENTRIES ? SPILL_MIN_BATCH_ENTRIES : batch_entries;
+}
+
+/*!
+ * @brief spill_add_run adds a run file to a set of runs
+ * @param runs is a pointer to the set of runs
+ * @param path is the path of the run file (copied)
+ * @return 0 in case of success, -1 else
+ */
+int spill_add_run(spill_runs_t *runs, char *path) {
+    char **paths = realloc(runs->paths, sizeof(char*) * (runs->count + 1));
+    if (paths == NULL) {
+        return -1;
+    }
+    runs->paths = paths;
+    runs->paths[runs->count] = strdup(path);
+    if (runs->paths[runs->count] == NULL) {
+        return -1;
+    }
+    runs->count++;
+    return 0;
+}
+
+/*!
+ * @brief spill_free_runs frees a set of runs
+ * @param runs is a pointer to the set of runs
+ * @param remove_files tells if the run files are removed too
+ */
+void spill_free_runs(spill_runs_t *runs, bool remove_files) {
+    for (size_t i = 0; i < runs->count; i++) {
+        if (remove_files == true) {
+            unlink(runs->paths[i]);
+        }
+        free(runs->paths[i]);
+    }
+    free(runs->paths);
+    runs->paths = NULL;
+    runs->count = 0;
+}
+
+/*!
+ * @brief write_record writes an entry into a run file
+ * @param run is the run file
+ * @param entry is a pointer to the entry to write
+ * @return 0 in case of success, -1 else
+ */
+static int write_record(FILE *run, files_list_entry_t *entry) {
+    spill_record_t record;
+    memset(&record, 0, sizeof(record));
+    record.path_length = strlen(entry->path_and_name);
+    record.mtime_sec = entry->mtime.tv_sec;
+    record.mtime_nsec = entry->mtime.tv_nsec;
+    record.size = entry->size;
+    memcpy(record.md5sum, entry->md5sum, sizeof(record.md5sum));
+    record.entry_type = entry->entry_type;
+    record.mode = entry->mode;
+
+    if (fwrite(&record, sizeof(record), 1, run) != 1 || fwrite(entry->path_and_name, 1, record.path_length, run) != record.path_length) {
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief read_record reads the next entry of a run file
+ * @param run is the run file
+ * @param entry is a pointer to the entry to fill
+ * @return 1 when an entry was read, 0 at the end of the run, -1 in case of error
+ */
+static int read_record(FILE *run, files_list_entry_t *entry) {
+    spill_record_t record;
+    if (fread(&record, sizeof(record), 1, run) != 1) {
+        return feof(run) ? 0 : -1;
+    }
+    if (record.path_length >= sizeof(entry->path_and_name) || fread(entry->path_and_name, 1, record.path_length, run) != record.path_length) {
+        return -1;
+    }
+    entry->path_and_name[record.path_length] = '\0';
+    entry->mtime.tv_sec = record.mtime_sec;
+    entry->mtime.tv_nsec = record.mtime_nsec;
+    entry->size = record.size;
+    memcpy(entry->md5sum, record.md5sum, sizeof(entry->md5sum));
+    entry->entry_type = record.entry_type;
+    entry->mode = record.mode;
+    entry->next = NULL;
+    entry->prev = NULL;
+    return 1;
+}
+
+/*!
+ * @brief create_run creates a new run file
+ * @param directory is the directory of the run file
+ * @param path is where the path of the run file is written (PATH_SIZE bytes)
+ * @return the run file opened for writing, NULL in case of error
+ */
+static FILE *create_run(char *directory, char *path) {
+    if (snprintf(path, PATH_SIZE, "%s/lp25_sync_run_XXXXXX", directory) >= PATH_SIZE) {
+        return NULL;
+    }
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        fprintf(stderr, "Error creating run file in %s\n", directory);
+        return NULL;
+    }
+    FILE *run = fdopen(fd, "w");
+    if (run == NULL) {
+        close(fd);
+        unlink(path);
+    }
+    return run;
+}
+
+/*!
+ * @brief compare_entries_paths orders entries by path (qsort callback)
+ * @param lhd is a pointer to a pointer to the first entry
+ * @param rhd is a pointer to a pointer to the second entry
+ * @return the result of strcmp on the paths
+ */
+static int compare_entries_paths(const void *lhd, const void *rhd) {
+    return strcmp((*(files_list_entry_t* const*) lhd)->path_and_name, (*(files_list_entry_t* const*) rhd)->path_and_name);
+}
+
+/*!
+ * @brief write_run sorts a batch by path and writes it into a new run file
+ * @param batch is a pointer to the batch
+ * @param directory is the directory of the run file
+ * @param runs is a pointer to the set of runs the new run is added to
+ * @return 0 in case of success, -1 else
+ */
+static int write_run(files_list_t *batch, char *directory, spill_runs_t *runs) {
+    size_t entries_count;
+    files_list_entry_t **entries = files_list_to_table(batch, &entries_count);
+    if (entries == NULL) {
+        return -1;
+    }
+    qsort(entries, entries_count, sizeof(files_list_entry_t*), compare_entries_paths);
+
+    char path[PATH_SIZE];
+    FILE *run = create_run(directory, path);
+    int result = run == NULL ? -1 : 0;
+    for (size_t i = 0; result == 0 && i < entries_count; i++) {
+        result = write_record(run, entries[i]);
+    }
+    if (run != NULL && fclose(run) != 0) {
+        result = -1;
+    }
+    if (result == 0) {
+        result = spill_add_run(runs, path);
+    } else if (run != NULL) {
+        fprintf(stderr, "Error writing run file %s\n", path);
+        unlink(path);
+    }
+
+    free(entries);
+    return result;
+}
+
+/*!
+ * @brief flush_batch analyzes the entries of the batch, writes them into a run and empties the batch
+ * @param builder is a pointer to the runs builder
+ */
+static void flush_batch(run_builder_t *builder) {
+    if (builder->batch_count == 0) {
+        return;
+    }
+    builder->analyzer(&builder->batch, builder->context);
+    if (write_run(&builder->batch, builder->directory, builder->runs) == -1) {
+        builder->error = -1;
+    }
+    clear_files_list(&builder->batch);
+    builder->batch.head = NULL;
+    builder->batch.tail = NULL;
+    builder->batch_count = 0;
+}
+
+/*!
+ * @brief add_path_to_batch adds a listed file to the current batch (walk_tree callback)
+ * @param path is the path of the file
+ * @param context is a pointer to the runs builder
+ * @return 0 in case of success, -1 else
+ */
+static int add_path_to_batch(char *path, void *context) {
+    run_builder_t *builder = context;
+    files_list_entry_t *entry = calloc(1, sizeof(files_list_entry_t));
+    if (entry == NULL || strlen(path) >= sizeof(entry->path_and_name)) {
+        free(entry);
+        return -1;
+    }
+    strcpy(entry->path_and_name, path);
+    add_entry_to_tail(&builder->batch, entry);
+    builder->batch_count++;
+
+    if (builder->batch_count >= builder->batch_entries) {
+        flush_batch(builder);
+    }
+    return builder->error;
+}
+
+/*!
+ * @brief merge_runs merges runs into a new run file
+ * @param group is a pointer to the runs to merge
+ * @param directory is the directory of the new run file
+ * @param runs is a pointer to the set of runs the new run is added to
+ * @return 0 in case of success, -1 else
+ */
+static int merge_runs(spill_runs_t *group, char *directory, spill_runs_t *runs) {
+    spill_merger_t merger;
+    if (spill_merger_open(&merger, group) == -1) {
+        return -1;
+    }
+
+    char path[PATH_SIZE];
+    FILE *run = create_run(directory, path);
+    int result = run == NULL ? -1 : 0;
+    files_list_entry_t *entry;
+    while (result == 0 && (entry = spill_merger_peek(&merger)) != NULL) {
+        result = write_record(run, entry);
+        spill_merger_next(&merger);
+    }
+    spill_merger_close(&merger);
+
+    if (run != NULL && fclose(run) != 0) {
+        result = -1;
+    }
+    if (result == 0) {
+        result = spill_add_run(runs, path);
+    } else if (run != NULL) {
+        unlink(path);
+    }
+    return result;
+}
+
+/*!
+ * @brief make_sorted_runs lists a tree into run files, each sorted by path, with a bounded number of entries in memory
+ * Files are gathered into batches while the tree is walked. Each full batch is analyzed, sorted and written
+ * into a run file. Runs are then merged until there are at most SPILL_MERGE_FANIN of them.
+ * @param target is the root of the tree
+ * @param batch_entries is the maximum number of entries of a batch
+ * @param directory is the directory of the run files
+ * @param analyzer is the function filling the properties of the entries of a batch
+ * @param context is passed to analyzer
+ * @param runs is a pointer to the set of runs that is built
+ * @return 0 in case of success, -1 else
+ */
+int make_sorted_runs(char *target, size_t batch_entries, char *directory, batch_analyzer_t analyzer, void *context, spill_runs_t *runs) {
+    run_builder_t builder = {
+        .batch = {NULL, NULL}, .batch_count = 0, .batch_entries = batch_entries, .directory = directory,
+        .analyzer = analyzer, .context = context, .runs = runs, .error = 0,
+    };
+
+    walk_tree(target, add_path_to_batch, &builder);
+    flush_batch(&builder);
+    clear_files_list(&builder.batch);
+    if (builder.error == -1) {
+        return -1;
+    }
+
+    while (runs->count > SPILL_MERGE_FANIN) {
+        spill_runs_t merged = {NULL, 0};
+        for (size_t first = 0; first < runs->count; first += SPILL_MERGE_FANIN) {
+            spill_runs_t group = {runs->paths + first, runs->count - first < SPILL_MERGE_FANIN ? runs->count - first : SPILL_MERGE_FANIN};
+            if (merge_runs(&group, directory, &merged) == -1) {
+                spill_free_runs(&merged, true);
+                return -1;
+            }
+        }
+        spill_free_runs(runs, true);
+        *runs = merged;
+    }
+    return 0;
+}
+
+/*!
+ * @brief select_smallest points the merger to the run whose head has the smallest path
+ * @param merger is a pointer to the merger
+ */
+static void select_smallest(spill_merger_t *merger) {
+    merger->current = merger->count;
+    for (size_t i = 0; i < merger->count; i++) {
+        if (merger->has_head[i] == true
+            && (merger->current == merger->count || strcmp(merger->heads[i].path_and_name, merger->heads[merger->current].path_and_name) < 0)) {
+            merger->current = i;
+        }
+    }
+}
+
+/*!
+ * @brief spill_merger_open starts a k-way merge of sorted runs
+ * @param merger is a pointer to the merger to open
+ * @param runs is a pointer to the runs to merge
+ * @return 0 in case of success, -1 else
+ */
+int spill_merger_open(spill_merger_t *merger, spill_runs_t *runs) {
+    merger->count = runs->count;
+    merger->files = calloc(runs->count + 1, sizeof(FILE*));
+    merger->heads = malloc(sizeof(files_list_entry_t) * (runs->count + 1));
+    merger->has_head = calloc(runs->count + 1, sizeof(bool));
+    if (merger->files == NULL || merger->heads == NULL || merger->has_head == NULL) {
+        spill_merger_close(merger);
+        return -1;
+    }
+
+    for (size_t i = 0; i < runs->count; i++) {
+        merger->files[i] = fopen(runs->paths[i], "r");
+        if (merger->files[i] == NULL) {
+            fprintf(stderr, "Error opening run file %s\n", runs->paths[i]);
+            spill_merger_close(merger);
+            return -1;
+        }
+        merger->has_head[i] = read_record(merger->files[i], &merger->heads[i]) == 1;
+    }
+    select_smallest(merger);
+    return 0;
+}
+
+/*!
+ * @brief spill_merger_peek gets the smallest entry not merged yet
+ * @param merger is a pointer to the merger
+ * @return a pointer to the entry (valid until spill_merger_next), NULL when all runs are exhausted
+ */
+files_list_entry_t *spill_merger_peek(spill_merger_t *merger) {
+    return merger->current < merger->count ? &merger->heads[merger->current] : NULL;
+}
+
+/*!
+ * @brief spill_merger_next moves to the next entry
+ * @param merger is a pointer to the merger
+ */
+void spill_merger_next(spill_merger_t *merger) {
+    if (merger->current < merger->count) {
+        int result = read_record(merger->files[merger->current], &merger->heads[merger->current]);
+        if (result == -1) {
+            fprintf(stderr, "Error reading run file\n");
+        }
+        merger->has_head[merger->current] = result == 1;
+        select_smallest(merger);
+    }
+}
+
+/*!
+ * @brief spill_merger_close closes the run files of a merger and frees it
+ * @param merger is a pointer to the merger
+ */
+void spill_merger_close(spill_merger_t *merger) {
+    for (size_t i = 0; merger->files != NULL && i < merger->count; i++) {
+        if (merger->files[i] != NULL) {
+            fclose(merger->files[i]);
+        }
+    }
+    free(merger->files);
+    free(merger->heads);
+    free(merger->has_head);
+    merger->files = NULL;
+    merger->heads = NULL;
+    merger->has_head = NULL;
+    merger->count = 0;
+    merger->current = 0;
+}
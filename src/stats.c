@@ -0,0 +1,230 @@
+#include <stats.h>
+#include <defines.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+// Run statistics shared by all processes, NULL when statistics are disabled.
+// The mapping is created before forking, so every process inherits the pointer.
+// Each job slot of --job-file has its own statistics (see message_type), run_stats points to the slot of the process.
+static run_stats_t *stats_slots = NULL;
+static run_stats_t *run_stats = NULL;
+
+static const char *phases_names[STATS_PHASES_COUNT] = {"listing", "analysis", "transfer", "diff", "copy"};
+static const char *counters_names[STATS_COUNTERS_COUNT] = {
+    "files_listed", "files_analyzed", "bytes_hashed", "bytes_compared", "files_copied", "bytes_copied",
+    "ipc_messages_sent", "ipc_messages_received", "stat_calls", "open_calls", "read_calls", "readdir_calls",
+    "directories_reused", "digests_reused", "files_excluded", "directories_excluded",
+    "throttle_wait_us", "copy_bytes_read", "copies_verified", "copies_mismatched",
+    "stream_bytes_sent", "stream_bytes_received",
+};
+static const char *histograms_names[STATS_HISTOGRAMS_COUNT] = {"hash_latency_us", "copy_latency_us"};
+
+/*!
+ * @brief stats_init maps the shared statistics of the run
+ * Must be called before the processes are forked.
+ * @return 0 in case of success, -1 else
+ */
+int stats_init(void) {
+    if (stats_slots != NULL) {
+        return 0;
+    }
+    stats_slots = mmap(NULL, sizeof(run_stats_t) * (MAX_PARALLEL_JOBS + 1), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (stats_slots == MAP_FAILED) {
+        stats_slots = NULL;
+        fprintf(stderr, "Error creating statistics\n");
+        return -1;
+    }
+    run_stats = stats_slots;
+    stats_reset();
+    return 0;
+}
+
+/*!
+ * @brief stats_release unmaps the shared statistics
+ */
+void stats_release(void) {
+    if (stats_slots != NULL) {
+        munmap(stats_slots, sizeof(run_stats_t) * (MAX_PARALLEL_JOBS + 1));
+        stats_slots = NULL;
+        run_stats = NULL;
+    }
+}
+
+/*!
+ * @brief stats_set_slot selects the statistics the process updates
+ * @param slot is the job slot, 0 outside of the job runners of --job-file
+ */
+void stats_set_slot(uint32_t slot) {
+    if (stats_slots != NULL && slot <= MAX_PARALLEL_JOBS) {
+        run_stats = &stats_slots[slot];
+    }
+}
+
+/*!
+ * @brief stats_enabled tells if statistics are collected
+ * @return true if statistics are collected, false else
+ */
+bool stats_enabled(void) {
+    return run_stats != NULL;
+}
+
+/*!
+ * @brief stats_reset clears all statistics and restarts the run clock
+ */
+void stats_reset(void) {
+    if (run_stats != NULL) {
+        memset(run_stats, 0, sizeof(run_stats_t));
+        run_stats->run_start_ns = stats_now_ns();
+    }
+}
+
+/*!
+ * @brief stats_now_ns gets the monotonic time, which is common to all processes
+ * @return the current time in nanoseconds
+ */
+uint64_t stats_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*!
+ * @brief stats_cpu_now_ns gets the CPU time consumed by the calling process
+ * @return the CPU time in nanoseconds
+ */
+uint64_t stats_cpu_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*!
+ * @brief stats_phase_begin starts timing a phase in the calling process
+ * @param timer is a pointer to the timer to start
+ */
+void stats_phase_begin(stats_timer_t *timer) {
+    if (run_stats != NULL) {
+        timer->start_ns = stats_now_ns();
+        timer->cpu_start_ns = stats_cpu_now_ns();
+    }
+}
+
+/*!
+ * @brief stats_phase_end stops timing a phase and accounts its wall and CPU times
+ * @param phase is the timed phase
+ * @param timer is a pointer to the timer started by stats_phase_begin
+ */
+void stats_phase_end(stats_phase_t phase, stats_timer_t *timer) {
+    if (run_stats == NULL) {
+        return;
+    }
+
+    uint64_t end_ns = stats_now_ns();
+    stats_phase_times_t *times = &run_stats->phases[phase];
+
+    __atomic_fetch_add(&times->wall_ns, end_ns - timer->start_ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&times->cpu_ns, stats_cpu_now_ns() - timer->cpu_start_ns, __ATOMIC_RELAXED);
+
+    uint64_t first = __atomic_load_n(&times->first_start_ns, __ATOMIC_RELAXED);
+    while ((first == 0 || timer->start_ns < first)
+           && !__atomic_compare_exchange_n(&times->first_start_ns, &first, timer->start_ns, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    uint64_t last = __atomic_load_n(&times->last_end_ns, __ATOMIC_RELAXED);
+    while (end_ns > last
+           && !__atomic_compare_exchange_n(&times->last_end_ns, &last, end_ns, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/*!
+ * @brief stats_phase_cpu_end accounts the CPU time of a timer to a phase, without its wall time
+ * Used by analyzers, whose work happens during phases timed by other processes.
+ * @param phase is the phase
+ * @param timer is a pointer to the timer started by stats_phase_begin
+ */
+void stats_phase_cpu_end(stats_phase_t phase, stats_timer_t *timer) {
+    if (run_stats != NULL) {
+        __atomic_fetch_add(&run_stats->phases[phase].cpu_ns, stats_cpu_now_ns() - timer->cpu_start_ns, __ATOMIC_RELAXED);
+    }
+}
+
+/*!
+ * @brief stats_add increments a counter
+ * @param counter is the counter to increment
+ * @param value is the increment
+ */
+void stats_add(stats_counter_t counter, uint64_t value) {
+    if (run_stats != NULL) {
+        __atomic_fetch_add(&run_stats->counters[counter], value, __ATOMIC_RELAXED);
+    }
+}
+
+/*!
+ * @brief stats_record_latency adds a latency to a histogram
+ * @param histogram is the histogram to update
+ * @param duration_ns is the measured latency
+ */
+void stats_record_latency(stats_histogram_t histogram, uint64_t duration_ns) {
+    if (run_stats == NULL) {
+        return;
+    }
+
+    uint64_t duration_us = duration_ns / 1000;
+    int bucket = 0;
+    while (bucket < STATS_HISTOGRAM_BUCKETS - 1 && duration_us >= (1ULL << bucket)) {
+        bucket++;
+    }
+    __atomic_fetch_add(&run_stats->histograms[histogram][bucket], 1, __ATOMIC_RELAXED);
+}
+
+/*!
+ * @brief stats_write_report writes the statistics of the run as a JSON document
+ * @param path is the path of the report, "-" for the standard output
+ * @return 0 in case of success, -1 else
+ */
+int stats_write_report(char *path) {
+    if (run_stats == NULL) {
+        return -1;
+    }
+
+    FILE *report = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (report == NULL) {
+        fprintf(stderr, "Error opening statistics report %s\n", path);
+        return -1;
+    }
+
+    fprintf(report, "{\n  \"elapsed_s\": %.6f,\n  \"phases\": {\n", (stats_now_ns() - run_stats->run_start_ns) / 1e9);
+    for (int phase = 0; phase < STATS_PHASES_COUNT; phase++) {
+        stats_phase_times_t *times = &run_stats->phases[phase];
+        fprintf(report, "    \"%s\": {\"elapsed_s\": %.6f, \"wall_s\": %.6f, \"cpu_s\": %.6f}%s\n", phases_names[phase],
+                (times->last_end_ns - times->first_start_ns) / 1e9, times->wall_ns / 1e9, times->cpu_ns / 1e9,
+                phase < STATS_PHASES_COUNT - 1 ? "," : "");
+    }
+
+    fprintf(report, "  },\n  \"counters\": {\n");
+    for (int counter = 0; counter < STATS_COUNTERS_COUNT; counter++) {
+        fprintf(report, "    \"%s\": %llu%s\n", counters_names[counter], (unsigned long long) run_stats->counters[counter],
+                counter < STATS_COUNTERS_COUNT - 1 ? "," : "");
+    }
+
+    // Histograms only list their non empty buckets, as upper bounds in microseconds
+    fprintf(report, "  },\n  \"histograms\": {\n");
+    for (int histogram = 0; histogram < STATS_HISTOGRAMS_COUNT; histogram++) {
+        bool first = true;
+        fprintf(report, "    \"%s\": {", histograms_names[histogram]);
+        for (int bucket = 0; bucket < STATS_HISTOGRAM_BUCKETS; bucket++) {
+            if (run_stats->histograms[histogram][bucket] > 0) {
+                fprintf(report, "%s\"%llu\": %llu", first ? "" : ", ", 1ULL << bucket, (unsigned long long) run_stats->histograms[histogram][bucket]);
+                first = false;
+            }
+        }
+        fprintf(report, "}%s\n", histogram < STATS_HISTOGRAMS_COUNT - 1 ? "," : "");
+    }
+    fprintf(report, "  }\n}\n");
+
+    if (report != stdout) {
+        fclose(report);
+    }
+    return 0;
+}
@@ -0,0 +1,301 @@
+#include <stream.h>
+#include <stats.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+/*!
+ * @brief stream_put_u32 encodes a 32 bits value, little endian
+ * @param cursor is where the value is written
+ * @param value is the value
+ * @return the position following the value
+ */
+uint8_t *stream_put_u32(uint8_t *cursor, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        *cursor++ = (uint8_t) (value >> (8 * i));
+    }
+    return cursor;
+}
+
+/*!
+ * @brief stream_put_u64 encodes a 64 bits value, little endian
+ * @param cursor is where the value is written
+ * @param value is the value
+ * @return the position following the value
+ */
+uint8_t *stream_put_u64(uint8_t *cursor, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        *cursor++ = (uint8_t) (value >> (8 * i));
+    }
+    return cursor;
+}
+
+/*!
+ * @brief stream_get_u32 decodes a 32 bits value written by stream_put_u32
+ * @param cursor is a pointer to the position of the value, moved after it
+ * @return the value
+ */
+uint32_t stream_get_u32(uint8_t **cursor) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value |= (uint32_t) (*cursor)[i] << (8 * i);
+    }
+    *cursor += 4;
+    return value;
+}
+
+/*!
+ * @brief stream_get_u64 decodes a 64 bits value written by stream_put_u64
+ * @param cursor is a pointer to the position of the value, moved after it
+ * @return the value
+ */
+uint64_t stream_get_u64(uint8_t **cursor) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value |= (uint64_t) (*cursor)[i] << (8 * i);
+    }
+    *cursor += 8;
+    return value;
+}
+
+/*!
+ * @brief stream_open makes a stream over file descriptors, which are switched to non blocking mode
+ * @param stream is a pointer to the stream
+ * @param input_fd is the descriptor frames are read from
+ * @param output_fd is the descriptor frames are written to (may be input_fd)
+ * @return 0 in case of success, -1 else
+ */
+int stream_open(stream_t *stream, int input_fd, int output_fd) {
+    memset(stream, 0, sizeof(stream_t));
+    stream->input_fd = input_fd;
+    stream->output_fd = output_fd;
+    stream->input_capacity = STREAM_BUFFER_SIZE;
+    stream->input = (uint8_t*) malloc(stream->input_capacity);
+    stream->output = (uint8_t*) malloc(STREAM_BUFFER_SIZE);
+    if (stream->input == NULL || stream->output == NULL
+        || fcntl(input_fd, F_SETFL, fcntl(input_fd, F_GETFL) | O_NONBLOCK) == -1
+        || fcntl(output_fd, F_SETFL, fcntl(output_fd, F_GETFL) | O_NONBLOCK) == -1) {
+        fprintf(stderr, "Error opening stream\n");
+        free(stream->input);
+        free(stream->output);
+        stream->input = NULL;
+        stream->output = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief stream_close closes the descriptors of a stream and frees its buffers (pending output is dropped)
+ * @param stream is a pointer to the stream
+ */
+void stream_close(stream_t *stream) {
+    close(stream->input_fd);
+    if (stream->output_fd != stream->input_fd) {
+        close(stream->output_fd);
+    }
+    free(stream->input);
+    free(stream->output);
+    stream->input = NULL;
+    stream->output = NULL;
+}
+
+/*!
+ * @brief fill_input reads the bytes available on the input of a stream, without blocking
+ * @param stream is a pointer to the stream
+ * @return the number of bytes read, -1 in case of error (the peer closing the stream sets closed)
+ */
+static ssize_t fill_input(stream_t *stream) {
+    ssize_t total = 0;
+    while (stream->closed == false) {
+        if (stream->input_end == stream->input_capacity) {
+            if (stream->input_start > 0) {
+                memmove(stream->input, stream->input + stream->input_start, stream->input_end - stream->input_start);
+                stream->input_end -= stream->input_start;
+                stream->input_start = 0;
+            } else {
+                uint8_t *input = (uint8_t*) realloc(stream->input, stream->input_capacity * 2);
+                if (input == NULL) {
+                    return -1;
+                }
+                stream->input = input;
+                stream->input_capacity *= 2;
+            }
+        }
+        ssize_t bytes_read = read(stream->input_fd, stream->input + stream->input_end, stream->input_capacity - stream->input_end);
+        if (bytes_read > 0) {
+            stream->input_end += bytes_read;
+            total += bytes_read;
+            stats_add(STATS_STREAM_BYTES_RECEIVED, bytes_read);
+        } else if (bytes_read == 0) {
+            stream->closed = true;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return total;
+}
+
+/*!
+ * @brief wait_stream waits until the output of a stream is writable or its input is readable
+ * @param stream is a pointer to the stream
+ * @param for_output tells if the output is waited for, else only the input is
+ * @return 0 when the stream is ready, -1 in case of error
+ */
+static int wait_stream(stream_t *stream, bool for_output) {
+    struct pollfd descriptors[2] = {
+        {.fd = stream->input_fd, .events = POLLIN},
+        {.fd = stream->output_fd, .events = POLLOUT},
+    };
+    // Input stays polled while writing, so that the peer never blocks on a full pipe while we block on ours
+    int count = (for_output == true) ? 2 : 1;
+    if (stream->closed == true) {
+        descriptors[0].fd = -1;
+    }
+    while (poll(descriptors, count, -1) == -1) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    if ((descriptors[0].revents & (POLLIN | POLLHUP)) != 0 && fill_input(stream) == -1) {
+        return -1;
+    }
+    if (for_output == true && (descriptors[1].revents & (POLLERR | POLLNVAL)) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief stream_flush writes all the buffered frames, reading incoming bytes while the output is full
+ * @param stream is a pointer to the stream
+ * @return 0 in case of success, -1 else
+ */
+int stream_flush(stream_t *stream) {
+    size_t sent = 0;
+    while (sent < stream->output_length) {
+        ssize_t bytes_written = write(stream->output_fd, stream->output + sent, stream->output_length - sent);
+        if (bytes_written > 0) {
+            sent += bytes_written;
+            stats_add(STATS_STREAM_BYTES_SENT, bytes_written);
+        } else if (bytes_written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (wait_stream(stream, true) == -1) {
+                return -1;
+            }
+        } else if (bytes_written == -1 && errno != EINTR) {
+            return -1;
+        }
+    }
+    stream->output_length = 0;
+    return 0;
+}
+
+/*!
+ * @brief stream_begin_frame reserves room for a frame in the output buffer, so that its payload is built in place
+ * @param stream is a pointer to the stream
+ * @param type is the type of the frame
+ * @param max_length is the largest payload that will be written
+ * @return a pointer to the payload, NULL in case of error
+ */
+uint8_t *stream_begin_frame(stream_t *stream, uint8_t type, uint32_t max_length) {
+    if (max_length > STREAM_MAX_PAYLOAD) {
+        return NULL;
+    }
+    if (stream->output_length + STREAM_HEADER_SIZE + max_length > STREAM_BUFFER_SIZE && stream_flush(stream) == -1) {
+        return NULL;
+    }
+    stream->frame_start = stream->output_length;
+    stream->output[stream->frame_start] = type;
+    return stream->output + stream->frame_start + STREAM_HEADER_SIZE;
+}
+
+/*!
+ * @brief stream_end_frame completes the frame begun by stream_begin_frame
+ * @param stream is a pointer to the stream
+ * @param length is the length of the payload that was written
+ * @return 0 in case of success, -1 else
+ */
+int stream_end_frame(stream_t *stream, uint32_t length) {
+    stream_put_u32(stream->output + stream->frame_start + 1, length);
+    stream->output_length = stream->frame_start + STREAM_HEADER_SIZE + length;
+    // Frames are sent once the buffer is full, or when we wait for the peer (see stream_receive)
+    return 0;
+}
+
+/*!
+ * @brief stream_send sends a frame (buffered)
+ * @param stream is a pointer to the stream
+ * @param type is the type of the frame
+ * @param payload is the payload
+ * @param length is the length of the payload
+ * @return 0 in case of success, -1 else
+ */
+int stream_send(stream_t *stream, uint8_t type, const void *payload, uint32_t length) {
+    uint8_t *frame = stream_begin_frame(stream, type, length);
+    if (frame == NULL) {
+        return -1;
+    }
+    memcpy(frame, payload, length);
+    return stream_end_frame(stream, length);
+}
+
+/*!
+ * @brief stream_receive gets the next frame of a stream
+ * Before waiting, the buffered frames are sent, as the peer may be waiting for them.
+ * @param stream is a pointer to the stream
+ * @param wait tells if the call waits for a frame, else it only takes a frame that already arrived
+ * @param type receives the type of the frame
+ * @param payload receives a pointer to the payload, valid until the next call on the stream
+ * @param length receives the length of the payload
+ * @return 1 when a frame was received, 0 when none arrived (without wait), -1 in case of error or end of stream
+ */
+int stream_receive(stream_t *stream, bool wait, uint8_t *type, uint8_t **payload, uint32_t *length) {
+    bool flushed = false;
+    while (true) {
+        size_t available = stream->input_end - stream->input_start;
+        if (available >= STREAM_HEADER_SIZE) {
+            uint8_t *cursor = stream->input + stream->input_start + 1;
+            uint32_t frame_length = stream_get_u32(&cursor);
+            if (frame_length > STREAM_MAX_PAYLOAD) {
+                fprintf(stderr, "Invalid frame of %u bytes in stream\n", frame_length);
+                return -1;
+            }
+            if (available >= STREAM_HEADER_SIZE + frame_length) {
+                *type = stream->input[stream->input_start];
+                *payload = cursor;
+                *length = frame_length;
+                stream->input_start += STREAM_HEADER_SIZE + frame_length;
+                return 1;
+            }
+        }
+        if (stream->closed == true) {
+            return -1;
+        }
+        if (wait == false) {
+            ssize_t bytes_read = fill_input(stream);
+            if (bytes_read == -1) {
+                return -1;
+            }
+            if (bytes_read == 0 && stream->closed == false) {
+                return 0;
+            }
+            continue;
+        }
+        if (flushed == false) {
+            if (stream_flush(stream) == -1) {
+                return -1;
+            }
+            flushed = true;
+            continue;
+        }
+        if (wait_stream(stream, false) == -1) {
+            return -1;
+        }
+    }
+}
@@ -5,78 +5,778 @@
 #include <utility.h>
 #include <messages.h>
 #include <file-properties.h>
+#include <snapshot.h>
+#include <stats.h>
+#include <trace.h>
+#include <progress.h>
+#include <pool.h>
+#include <schedule.h>
+#include <spill.h>
+#include <manifest.h>
+#include <scan-state.h>
+#include <filter.h>
+#include <throttle.h>
+#include <pack.h>
+#include <journal.h>
+#include <remote.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/sendfile.h>
+#include <openssl/evp.h>
 #include <unistd.h>
+#include <errno.h>
 #include <sys/msg.h>
 #include <utime.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 /*!
- * @brief synchronize is the main function for synchronization
- * It will build the lists (source and destination), then make a third list with differences, and apply differences to the destination
- * It must adapt to the parallel or not operation of the program.
+ * @brief analyze_files_list gets the properties of all files of a list in no parallel mode
+ * @param list is a pointer to the list
+ * @param digest_options tells if and how the MD5 sums of the files must be computed
+ * @param io_order tells in which order the files are analyzed, the list stays in path order
+ */
+static void analyze_files_list(files_list_t *list, digest_options_t *digest_options, io_order_t io_order) {
+    if (io_order == IO_ORDER_NONE) {
+        files_list_entry_t *p_entry = list->head;
+        while (p_entry != NULL) {
+            get_file_stats(p_entry, digest_options);
+            p_entry = p_entry->next;
+        }
+    } else {
+        size_t entries_count;
+        files_list_entry_t **entries = files_list_to_table(list, &entries_count);
+        size_t *order = (size_t*) malloc(sizeof(size_t) * (entries_count + 1));
+        make_physical_order(entries, entries_count, io_order, order);
+        for (size_t i = 0; i < entries_count; i++) {
+            get_file_stats(entries[order[i]], digest_options);
+        }
+        free(order);
+        free(entries);
+    }
+}
+
+typedef struct {
+    digest_options_t digest_options;
+    io_order_t io_order;
+} batch_options_t;
+
+/*!
+ * @brief analyze_batch gets the properties of the entries of a batch in no parallel mode (batch_analyzer_t)
+ * @param batch is a pointer to the batch
+ * @param context is a pointer to a batch_options_t
+ */
+static void analyze_batch(files_list_t *batch, void *context) {
+    batch_options_t *options = context;
+    analyze_files_list(batch, &options->digest_options, options->io_order);
+}
+
+/*!
+ * @brief open_trusted_manifest maps the manifest of the destination when it can replace its listing (--manifest)
+ * @param manifest is a pointer to the manifest to open
  * @param the_config is a pointer to the configuration
- * @param p_context is a pointer to the processes context
+ * @param destination is the directory that would be listed
+ * @return true when the manifest is used as the destination list, false when the destination must be listed
  */
-void synchronize(configuration_t *the_config, process_context_t *p_context) {
-    if (the_config == NULL || p_context == NULL) {
-        printf("Pointeur de configuration ou de contexte de processus non valide.\n");
+static bool open_trusted_manifest(manifest_t *manifest, configuration_t *the_config, char *destination) {
+    if (strlen(the_config->manifest_file) == 0 || strlen(destination) == 0) {
+        return false;
+    }
+
+    uint64_t trace_start = trace_begin();
+    bool trusted = (manifest_open(manifest, the_config->manifest_file, the_config, destination) == 0);
+    if (trusted == true && manifest_verify(manifest, the_config->manifest_verify_count) == false) {
+        manifest_close(manifest);
+        trusted = false;
+    }
+    trace_end("load_manifest", trace_start, trusted == true ? manifest->header->entries_count : 0);
+    return trusted;
+}
+
+/*!
+ * @brief drop_manifest removes the manifest when the destination no longer matches it
+ * @param the_config is a pointer to the configuration
+ */
+static void drop_manifest(configuration_t *the_config) {
+    if (strlen(the_config->manifest_file) > 0 && the_config->dry_run == false) {
+        fprintf(stderr, "Some files were not synchronized, manifest %s is removed\n", the_config->manifest_file);
+        unlink(the_config->manifest_file);
+    }
+}
+
+/*!
+ * @brief write_manifest writes the manifest of the destination after a run (--manifest)
+ * The manifest lists the source files as they now are in the destination.
+ * @param the_config is a pointer to the configuration
+ * @param source_list is a pointer to the source list, in path order
+ * @param root is the directory the files were synchronized into
+ */
+static void write_manifest(configuration_t *the_config, files_list_t *source_list, char *root) {
+    manifest_writer_t writer;
+    size_t source_root_length = strlen(the_config->source);
+
+    uint64_t trace_start = trace_begin();
+    if (manifest_writer_open(&writer, the_config->manifest_file) == -1) {
         return;
     }
+    for (files_list_entry_t *cursor = source_list->head; cursor != NULL; cursor = cursor->next) {
+        if (manifest_writer_add(&writer, cursor->path_and_name + source_root_length, cursor) == -1) {
+            fprintf(stderr, "Error writing manifest %s\n", the_config->manifest_file);
+            manifest_writer_abort(&writer);
+            return;
+        }
+    }
+    manifest_writer_commit(&writer, the_config, root);
+    trace_end("write_manifest", trace_start, writer.entries_count);
+}
 
-    files_list_t source_list = {NULL, NULL};
-    files_list_t dest_list = {NULL, NULL};
-    files_list_t diff_list = {NULL, NULL};
+/*!
+ * @brief synchronize_bounded synchronizes with a bounded memory (--max-memory)
+ * Both trees are listed into sorted runs on disk, which are merged while the diff is made: each source file
+ * is compared to its destination counterpart as they come out of the merges, and copied right away.
+ * @param the_config is a pointer to the configuration
+ * @param listing_config is a pointer to the configuration used to list the files
+ * @param target_config is a pointer to the configuration used to copy the files
+ * @param p_context is a pointer to the processes context
+ * @param previous_snapshot is the previous snapshot in snapshot mode
+ * @param current_snapshot is the new snapshot in snapshot mode
+ * @param manifest is a pointer to the trusted manifest of the destination, NULL when the destination is listed
+ * @return true if the source was synchronized, false else
+ */
+static bool synchronize_bounded(configuration_t *the_config, configuration_t *listing_config, configuration_t *target_config,
+                              process_context_t *p_context, char *previous_snapshot, char *current_snapshot, manifest_t *manifest) {
+    spill_runs_t source_runs = {NULL, 0};
+    spill_runs_t destination_runs = {NULL, 0};
+    stats_timer_t timer;
+    manifest_writer_t writer;
+    bool writes_manifest = (strlen(the_config->manifest_file) > 0 && the_config->dry_run == false);
+    bool synchronized = true;
 
     if (the_config->is_parallel == true) {
-        make_files_lists_parallel(&source_list, &dest_list, the_config, p_context->message_queue_id);
+        make_files_runs_parallel(&source_runs, &destination_runs, listing_config, p_context->message_queue_id);
     } else {
-        make_files_list(&source_list, the_config->source);
-        make_files_list(&dest_list, the_config->destination);
+        char directory[PATH_SIZE];
+        batch_options_t batch_options = {.io_order = the_config->io_order};
+        spill_directory(the_config, directory);
+        make_digest_options(the_config, p_context->digest_cache, &batch_options.digest_options);
+
+        stats_phase_begin(&timer);
+        size_t batch_entries = spill_batch_entries(the_config->max_memory);
+        if (make_sorted_runs(listing_config->source, batch_entries, directory, analyze_batch, &batch_options, &source_runs) == -1
+            || (strlen(listing_config->destination) > 0
+                && make_sorted_runs(listing_config->destination, batch_entries, directory, analyze_batch, &batch_options, &destination_runs) == -1)) {
+            fprintf(stderr, "Error listing files into runs\n");
+            spill_free_runs(&source_runs, true);
+            spill_free_runs(&destination_runs, true);
+            return false;
+        }
+        stats_phase_end(STATS_PHASE_ANALYSIS, &timer);
+    }
+
+    spill_merger_t source_merger, destination_merger;
+    if (spill_merger_open(&source_merger, &source_runs) == -1) {
+        spill_free_runs(&source_runs, true);
+        spill_free_runs(&destination_runs, true);
+        return false;
+    }
+    if (spill_merger_open(&destination_merger, &destination_runs) == -1) {
+        spill_merger_close(&source_merger);
+        spill_free_runs(&source_runs, true);
+        spill_free_runs(&destination_runs, true);
+        return false;
     }
 
-    files_list_entry_t *src_entry = source_list.head;
+    // The new manifest is written as the source entries come out of the merge
+    if (writes_manifest == true && manifest_writer_open(&writer, the_config->manifest_file) == -1) {
+        writes_manifest = false;
+    }
+
+    // The diff and the copies are interleaved: the diff phase includes the copy phase
+    progress_set_phase(PROGRESS_PHASE_COPY);
+    stats_phase_begin(&timer);
+    uint64_t trace_start = trace_begin();
+    size_t source_root_length = strlen(listing_config->source);
+    size_t destination_root_length = strlen(listing_config->destination);
+    files_list_entry_t *src_entry;
+    files_list_entry_t *dest_entry;
+    files_list_entry_t manifest_entry;
+    stats_timer_t copy_timer;
+
+    while ((src_entry = spill_merger_peek(&source_merger)) != NULL) {
+        int order = 1;
+        if (manifest != NULL) {
+            dest_entry = manifest_find(manifest, src_entry->path_and_name + source_root_length, &manifest_entry);
+            order = 0;
+        } else {
+            while ((dest_entry = spill_merger_peek(&destination_merger)) != NULL
+                   && (order = strcmp(dest_entry->path_and_name + destination_root_length, src_entry->path_and_name + source_root_length)) < 0) {
+                spill_merger_next(&destination_merger);
+            }
+        }
+
+        bool differ = (dest_entry == NULL || order != 0 || mismatch(src_entry, dest_entry, the_config->uses_md5) == true);
+        if (differ == false && the_config->compare_mode == COMPARE_BYTES) {
+            differ = (compare_files_content(src_entry->path_and_name, dest_entry->path_and_name) != 0);
+        }
+
+        if (differ == true) {
+            progress_add(PROGRESS_FILES_TO_COPY, 1);
+            progress_add(PROGRESS_BYTES_TO_COPY, src_entry->size);
+            stats_phase_begin(&copy_timer);
+            if (copy_entry_to_destination(src_entry, target_config) == -1) {
+                synchronized = false;
+            }
+            stats_phase_end(STATS_PHASE_COPY, &copy_timer);
+        } else if (the_config->snapshot == true) {
+            if (link_entry_to_snapshot(src_entry, the_config, previous_snapshot, current_snapshot) == -1) {
+                synchronized = false;
+            }
+        }
+        if (writes_manifest == true && manifest_writer_add(&writer, src_entry->path_and_name + source_root_length, src_entry) == -1) {
+            fprintf(stderr, "Error writing manifest %s\n", the_config->manifest_file);
+            manifest_writer_abort(&writer);
+            writes_manifest = false;
+        }
+        spill_merger_next(&source_merger);
+    }
+    trace_end("diff", trace_start, TRACE_NO_ARG);
+    stats_phase_end(STATS_PHASE_DIFF, &timer);
+
+    if (writes_manifest == true) {
+        if (synchronized == true) {
+            manifest_writer_commit(&writer, the_config, target_config->destination);
+        } else {
+            manifest_writer_abort(&writer);
+        }
+    }
+    if (synchronized == false) {
+        drop_manifest(the_config);
+    }
+
+    spill_merger_close(&source_merger);
+    spill_merger_close(&destination_merger);
+    spill_free_runs(&source_runs, true);
+    spill_free_runs(&destination_runs, true);
+    return synchronized;
+}
+
+/*!
+ * @brief find_differences tells which source entries must be copied to the destination
+ * With --compare=bytes, entries whose metadata match are first gathered into pairs, whose content is compared.
+ * @param the_config is a pointer to the configuration
+ * @param listing_config is a pointer to the configuration the lists were made with
+ * @param p_context is a pointer to the processes context
+ * @param source_list is a pointer to the source list
+ * @param dest_list is a pointer to the destination list (empty with a manifest)
+ * @param manifest is a pointer to the trusted manifest of the destination, NULL when the destination was listed
+ * @param entries_count receives the number of source entries
+ * @return a table telling for each source entry, in list order, if it differs from the destination (to free)
+ */
+static bool *find_differences(configuration_t *the_config, configuration_t *listing_config, process_context_t *p_context,
+                              files_list_t *source_list, files_list_t *dest_list, manifest_t *manifest, size_t *entries_count) {
+    *entries_count = 0;
+    for (files_list_entry_t *cursor = source_list->head; cursor != NULL; cursor = cursor->next) {
+        (*entries_count)++;
+    }
+
+    bool *differs = (bool*) malloc(sizeof(bool) * (*entries_count + 1));
+    entries_pair_t *pairs = (entries_pair_t*) malloc(sizeof(entries_pair_t) * (*entries_count + 1));
+    size_t pairs_count = 0;
+
+    files_list_entry_t *src_entry = source_list->head;
     files_list_entry_t *dest_entry = NULL;
     files_list_entry_t *new_entry;
-        
-    while (src_entry != NULL) {
-        dest_entry = find_entry_by_name(&dest_list, src_entry->path_and_name, strlen(the_config->source), strlen(the_config->destination));
-        if (dest_entry == NULL || mismatch(src_entry, dest_entry, the_config->uses_md5) == true) {
+    files_list_entry_t manifest_entry;
+
+    for (size_t i = 0; src_entry != NULL; i++, src_entry = src_entry->next) {
+        if (manifest != NULL) {
+            dest_entry = manifest_find(manifest, src_entry->path_and_name + strlen(listing_config->source), &manifest_entry);
+        } else {
+            dest_entry = find_entry_by_name(dest_list, src_entry->path_and_name, strlen(listing_config->source), strlen(listing_config->destination));
+        }
+        differs[i] = (dest_entry == NULL || mismatch(src_entry, dest_entry, the_config->uses_md5) == true);
+        if (differs[i] == false && the_config->compare_mode == COMPARE_BYTES) {
+            if (manifest != NULL) {
+                // Pairs are compared after the loop, so entries found in the manifest are kept in the destination list
+                new_entry = (files_list_entry_t*) malloc(sizeof(files_list_entry_t));
+                memcpy(new_entry, dest_entry, sizeof(files_list_entry_t));
+                add_entry_to_tail(dest_list, new_entry);
+                dest_entry = new_entry;
+            }
+            pairs[pairs_count].source = src_entry;
+            pairs[pairs_count].destination = dest_entry;
+            pairs[pairs_count].entry_index = i;
+            pairs_count++;
+        }
+    }
+
+    if (pairs_count > 0) {
+        compare_pairs_content(pairs, pairs_count, the_config, p_context);
+        for (size_t i = 0; i < pairs_count; i++) {
+            differs[pairs[i].entry_index] = pairs[i].differ;
+        }
+    }
+    free(pairs);
+    return differs;
+}
+
+/*!
+ * @brief copy_differences copies the files of a diff list to the destination
+ * With a journal, the plan is recorded before the first copy and each completed copy is recorded (--journal).
+ * @param the_config is a pointer to the configuration
+ * @param target_config is a pointer to the configuration used to copy the files
+ * @param diff_list is a pointer to the list of the files to copy
+ * @param journal is a pointer to the journal, NULL without --journal
+ * @param remote is a pointer to the session of the remote destination, NULL when the destination is local
+ * @return true if all files were copied, false else
+ */
+static bool copy_differences(configuration_t *the_config, configuration_t *target_config, files_list_t *diff_list, journal_t *journal,
+                             remote_session_t *remote) {
+    stats_timer_t timer;
+    bool synchronized = true;
+    size_t diff_count;
+    files_list_entry_t **diff_entries = files_list_to_table(diff_list, &diff_count);
+    size_t *order = (size_t*) malloc(sizeof(size_t) * (diff_count + 1));
+    files_list_entry_t **plan = (files_list_entry_t**) malloc(sizeof(files_list_entry_t*) * (diff_count + 1));
+
+    // Copies read the source files in their physical order
+    if (the_config->io_order == IO_ORDER_NONE) {
+        for (size_t i = 0; i < diff_count; i++) {
+            order[i] = i;
+        }
+    } else {
+        make_physical_order(diff_entries, diff_count, the_config->io_order, order);
+    }
+    for (size_t i = 0; i < diff_count; i++) {
+        plan[i] = diff_entries[order[i]];
+    }
+    if (journal != NULL && the_config->dry_run == false && journal_begin(journal, the_config, plan, diff_count) == -1) {
+        journal = NULL;
+    }
+
+    progress_set_phase(PROGRESS_PHASE_COPY);
+    stats_phase_begin(&timer);
+    if (remote != NULL) {
+        synchronized = remote_send_files(remote, target_config, plan, diff_count);
+    }
+    for (size_t i = 0; i < diff_count && remote == NULL; i++) {
+        if (copy_entry_to_destination(plan[i], target_config) == -1) {
+            synchronized = false;
+        } else if (journal != NULL) {
+            journal_complete(journal, i);
+        }
+    }
+    stats_phase_end(STATS_PHASE_COPY, &timer);
+
+    if (journal != NULL) {
+        journal_finish(journal);
+    }
+    free(plan);
+    free(order);
+    free(diff_entries);
+    return synchronized;
+}
+
+/*!
+ * @brief apply_differences diffs analyzed lists and copies the differences to the destination
+ * @param the_config is a pointer to the configuration
+ * @param listing_config is a pointer to the configuration the lists were made with
+ * @param target_config is a pointer to the configuration used to copy the files
+ * @param p_context is a pointer to the processes context
+ * @param source_list is a pointer to the source list
+ * @param dest_list is a pointer to the destination list (empty with a manifest)
+ * @param manifest is a pointer to the trusted manifest of the destination, NULL when the destination was listed
+ * @param previous_snapshot is the previous snapshot in snapshot mode
+ * @param current_snapshot is the new snapshot in snapshot mode
+ * @param journal is a pointer to the journal of the copies, NULL without --journal
+ * @param remote is a pointer to the session of the remote destination, NULL when the destination is local
+ * @return true if all differences were applied, false else
+ */
+static bool apply_differences(configuration_t *the_config, configuration_t *listing_config, configuration_t *target_config, process_context_t *p_context,
+                              files_list_t *source_list, files_list_t *dest_list, manifest_t *manifest, char *previous_snapshot, char *current_snapshot,
+                              journal_t *journal, remote_session_t *remote) {
+    files_list_t diff_list = {NULL, NULL};
+    stats_timer_t timer;
+    bool synchronized = true;
+
+    progress_set_phase(PROGRESS_PHASE_DIFF);
+    stats_phase_begin(&timer);
+    uint64_t trace_start = trace_begin();
+    size_t entries_count;
+    bool *differs = find_differences(the_config, listing_config, p_context, source_list, dest_list, manifest, &entries_count);
+    files_list_entry_t *src_entry = source_list->head;
+    files_list_entry_t *new_entry;
+
+    for (size_t i = 0; src_entry != NULL; i++, src_entry = src_entry->next) {
+        if (differs[i] == true) {
             new_entry = (files_list_entry_t*) malloc(sizeof(files_list_entry_t));
             memcpy(new_entry, src_entry, sizeof(files_list_entry_t));
             add_entry_to_tail(&diff_list, new_entry);
+            progress_add(PROGRESS_FILES_TO_COPY, 1);
+            progress_add(PROGRESS_BYTES_TO_COPY, new_entry->size);
+        } else if (the_config->snapshot == true) {
+            if (link_entry_to_snapshot(src_entry, the_config, previous_snapshot, current_snapshot) == -1) {
+                synchronized = false;
+            }
         }
-        src_entry = src_entry->next;
     }
 
+    free(differs);
+    trace_end("diff", trace_start, entries_count);
+    stats_phase_end(STATS_PHASE_DIFF, &timer);
+
     if (the_config->verbose == true) {
         puts("Source List :");
-        display_files_list(&source_list);
+        display_files_list(source_list);
         puts("\nDestination List :");
-        display_files_list(&dest_list);
+        display_files_list(dest_list);
         puts("\nDifference List:");
         display_files_list(&diff_list);
     }
 
-    files_list_entry_t *p_diff = diff_list.head;
-    while (p_diff != NULL) {
-        copy_entry_to_destination(p_diff, the_config);
-        p_diff = p_diff->next;
+    if (copy_differences(the_config, target_config, &diff_list, journal, remote) == false) {
+        synchronized = false;
+    }
+
+    clear_files_list(&diff_list);
+    return synchronized;
+}
+
+/*!
+ * @brief synchronize_fan_out synchronizes the source into several destinations (-d repeated)
+ * The source was listed and analyzed once. Each other destination is listed and diffed in turn, then each file
+ * to copy is read once and written to all the destinations it differs from.
+ * @param the_config is a pointer to the configuration
+ * @param p_context is a pointer to the processes context
+ * @param source_list is a pointer to the source list
+ * @param dest_list is a pointer to the list of the first destination
+ * @return true if all destinations were synchronized, false else
+ */
+static bool synchronize_fan_out(configuration_t *the_config, process_context_t *p_context, files_list_t *source_list, files_list_t *dest_list) {
+    size_t destinations_count = the_config->extra_destinations_count + 1;
+    char **destinations = (char**) malloc(sizeof(char*) * destinations_count);
+    bool **differs = (bool**) malloc(sizeof(bool*) * destinations_count);
+    size_t entries_count = 0;
+    stats_timer_t timer;
+    bool synchronized = true;
+
+    destinations[0] = the_config->destination;
+    for (size_t d = 0; d < destinations_count; d++) {
+        configuration_t listing_config = *the_config;
+        files_list_t other_list = {NULL, NULL};
+        if (d > 0) {
+            destinations[d] = the_config->extra_destinations[d - 1];
+            strcpy(listing_config.destination, destinations[d]);
+            if (the_config->is_parallel == true) {
+                strcpy(listing_config.source, "");
+                make_files_lists_parallel(&other_list, &other_list, &listing_config, p_context->message_queue_id);
+                strcpy(listing_config.source, the_config->source);
+            } else {
+                digest_options_t digest_options;
+                make_digest_options(the_config, p_context->digest_cache, &digest_options);
+                make_files_list(&other_list, destinations[d], &digest_options, the_config->io_order);
+            }
+        }
+
+        progress_set_phase(PROGRESS_PHASE_DIFF);
+        stats_phase_begin(&timer);
+        uint64_t trace_start = trace_begin();
+        differs[d] = find_differences(the_config, &listing_config, p_context, source_list, d == 0 ? dest_list : &other_list, NULL, &entries_count);
+        trace_end("diff", trace_start, entries_count);
+        stats_phase_end(STATS_PHASE_DIFF, &timer);
+
+        if (the_config->verbose == true) {
+            printf("Destination List of %s :\n", destinations[d]);
+            display_files_list(d == 0 ? dest_list : &other_list);
+        }
+        clear_files_list(&other_list);
+    }
+
+    // Files differing from at least one destination, each copied once to all of them
+    size_t source_count;
+    files_list_entry_t **source_entries = files_list_to_table(source_list, &source_count);
+    files_list_entry_t **copy_entries = (files_list_entry_t**) malloc(sizeof(files_list_entry_t*) * (source_count + 1));
+    size_t *copy_indices = (size_t*) malloc(sizeof(size_t) * (source_count + 1));
+    size_t copy_count = 0;
+    for (size_t i = 0; i < source_count; i++) {
+        bool copied = false;
+        for (size_t d = 0; d < destinations_count; d++) {
+            if (differs[d][i] == true) {
+                progress_add(PROGRESS_FILES_TO_COPY, 1);
+                progress_add(PROGRESS_BYTES_TO_COPY, source_entries[i]->size);
+                copied = true;
+            }
+        }
+        if (copied == true) {
+            copy_entries[copy_count] = source_entries[i];
+            copy_indices[copy_count++] = i;
+        }
+    }
+
+    if (the_config->verbose == true) {
+        puts("\nSource List :");
+        display_files_list(source_list);
+    }
+
+    progress_set_phase(PROGRESS_PHASE_COPY);
+    stats_phase_begin(&timer);
+    size_t *order = (size_t*) malloc(sizeof(size_t) * (copy_count + 1));
+    char **targets = (char**) malloc(sizeof(char*) * destinations_count);
+    if (the_config->io_order == IO_ORDER_NONE) {
+        for (size_t k = 0; k < copy_count; k++) {
+            order[k] = k;
+        }
+    } else {
+        make_physical_order(copy_entries, copy_count, the_config->io_order, order);
+    }
+    for (size_t k = 0; k < copy_count; k++) {
+        size_t targets_count = 0;
+        for (size_t d = 0; d < destinations_count; d++) {
+            if (differs[d][copy_indices[order[k]]] == true) {
+                targets[targets_count++] = destinations[d];
+            }
+        }
+        if (copy_entry_to_destinations(copy_entries[order[k]], the_config, targets, targets_count) == -1) {
+            synchronized = false;
+        }
+    }
+    stats_phase_end(STATS_PHASE_COPY, &timer);
+
+    for (size_t d = 0; d < destinations_count; d++) {
+        free(differs[d]);
+    }
+    free(targets);
+    free(order);
+    free(copy_indices);
+    free(copy_entries);
+    free(source_entries);
+    free(differs);
+    free(destinations);
+    return synchronized;
+}
+
+/*!
+ * @brief synchronize is the main function for synchronization
+ * It will build the lists (source and destination), then make a third list with differences, and apply differences to the destination
+ * It must adapt to the parallel or not operation of the program.
+ * @param the_config is a pointer to the configuration
+ * @param p_context is a pointer to the processes context
+ * @return 0 if the source was synchronized, -1 else
+ */
+int synchronize(configuration_t *the_config, process_context_t *p_context) {
+    if (the_config == NULL || p_context == NULL) {
+        printf("Pointeur de configuration ou de contexte de processus non valide.\n");
+        return -1;
+    }
+
+    files_list_t source_list = {NULL, NULL};
+    files_list_t dest_list = {NULL, NULL};
+
+    stats_reset();
+
+    // In snapshot mode, the source is compared to the previous snapshot (listing_config)
+    // and the differences are written into a new snapshot (target_config)
+    configuration_t listing_config = *the_config;
+    configuration_t target_config = *the_config;
+    char previous_snapshot[PATH_SIZE] = "";
+    char current_snapshot[PATH_SIZE] = "";
+
+    if (the_config->snapshot == true) {
+        if (prepare_snapshot(the_config, previous_snapshot, current_snapshot) == -1) {
+            return -1;
+        }
+        strcpy(listing_config.destination, previous_snapshot);
+        strcpy(target_config.destination, current_snapshot);
+    }
+
+    // After an interruption, the copies left in the journal are done without listing anything (--journal)
+    journal_t journal;
+    files_list_t plan = {NULL, NULL};
+    bool has_journal = (strlen(the_config->journal_file) > 0 && the_config->dry_run == false);
+    if (has_journal == true && journal_load(&journal, the_config, &plan) == 1) {
+        for (files_list_entry_t *cursor = plan.head; cursor != NULL; cursor = cursor->next) {
+            progress_add(PROGRESS_FILES_TO_COPY, 1);
+            progress_add(PROGRESS_BYTES_TO_COPY, cursor->size);
+        }
+        // The resumed copies were not analyzed by this run: --verify-copy has no digest to check them against
+        target_config.uses_md5 = false;
+        bool resumed = copy_differences(the_config, &target_config, &plan, &journal, NULL);
+        target_config.uses_md5 = the_config->uses_md5;
+        clear_files_list(&plan);
+        if (resumed == true) {
+            if (strlen(the_config->stats_file) > 0) {
+                stats_write_report(the_config->stats_file);
+            }
+            return 0;
+        }
+        // A copy that keeps failing must not stand for the whole run: the source is synchronized as without journal,
+        // and the new journal records the plan of this run
+        fprintf(stderr, "Copies of journal %s failed again, synchronizing the whole source\n", the_config->journal_file);
+    }
+
+    // With a trusted manifest or a pack store, the destination is neither listed nor analyzed (scan_config has no destination)
+    manifest_t manifest;
+    bool has_manifest = open_trusted_manifest(&manifest, the_config, listing_config.destination);
+    configuration_t scan_config = listing_config;
+    if (has_manifest == true || the_config->pack_threshold > 0) {
+        strcpy(scan_config.destination, "");
+    }
+
+    // A remote destination is listed and analyzed by the remote side, while the source is listed here
+    remote_session_t remote_session;
+    bool is_remote = (strlen(the_config->remote_command) > 0 || strlen(the_config->remote_socket) > 0);
+    if (is_remote == true) {
+        if (remote_connect(&remote_session, the_config) == -1) {
+            return -1;
+        }
+        strcpy(scan_config.destination, "");
+    }
+
+    if (the_config->max_memory > 0) {
+        bool synchronized = synchronize_bounded(the_config, &scan_config, &target_config, p_context, previous_snapshot, current_snapshot,
+                                                has_manifest == true ? &manifest : NULL);
+        if (has_manifest == true) {
+            manifest_close(&manifest);
+        }
+        if (strlen(the_config->stats_file) > 0) {
+            stats_write_report(the_config->stats_file);
+        }
+        return synchronized == true ? 0 : -1;
+    }
+
+    if (the_config->is_parallel == true) {
+        make_files_lists_parallel(&source_list, &dest_list, &scan_config, p_context->message_queue_id);
+    } else {
+        digest_options_t digest_options;
+        make_digest_options(the_config, p_context->digest_cache, &digest_options);
+        make_files_list(&source_list, scan_config.source, &digest_options, the_config->io_order);
+        if (strlen(scan_config.destination) > 0) {
+            make_files_list(&dest_list, scan_config.destination, &digest_options, the_config->io_order);
+        }
+    }
+
+    bool synchronized;
+    if (is_remote == true && remote_receive_list(&remote_session, the_config, &dest_list) == -1) {
+        synchronized = false;
+    } else if (the_config->pack_threshold > 0) {
+        synchronized = pack_synchronize(the_config, &source_list);
+    } else if (the_config->extra_destinations_count > 0) {
+        synchronized = synchronize_fan_out(the_config, p_context, &source_list, &dest_list);
+    } else {
+        synchronized = apply_differences(the_config, &listing_config, &target_config, p_context, &source_list, &dest_list,
+                                         has_manifest == true ? &manifest : NULL, previous_snapshot, current_snapshot,
+                                         has_journal == true ? &journal : NULL, is_remote == true ? &remote_session : NULL);
+    }
+    if (is_remote == true && remote_close(&remote_session) == -1) {
+        synchronized = false;
+    }
+
+    if (has_manifest == true) {
+        manifest_close(&manifest);
+    }
+    if (synchronized == false) {
+        drop_manifest(the_config);
+    } else if (strlen(the_config->manifest_file) > 0 && the_config->dry_run == false) {
+        write_manifest(the_config, &source_list, target_config.destination);
+    }
+
+    if (strlen(the_config->stats_file) > 0) {
+        stats_write_report(the_config->stats_file);
+    }
+
+    clear_files_list(&source_list);
+    clear_files_list(&dest_list);
+    return synchronized == true ? 0 : -1;
+}
+
+/*!
+ * @brief synchronize_paths synchronizes only some paths of the source (used by --watch)
+ * Directories are listed again with all their content, files are analyzed alone. Removed paths are ignored, as
+ * files missing from the source are never removed from the destination.
+ * @param the_config is a pointer to the configuration
+ * @param p_context is a pointer to the processes context
+ * @param relative_paths is the table of paths to synchronize, sorted, from the root of the source ("" for the whole source)
+ * @param paths_count is the number of paths
+ */
+void synchronize_paths(configuration_t *the_config, process_context_t *p_context, char **relative_paths, size_t paths_count) {
+    files_list_t source_list = {NULL, NULL};
+    files_list_t dest_list = {NULL, NULL};
+    digest_options_t digest_options;
+    char source_path[PATH_SIZE];
+    char destination_path[PATH_SIZE];
+    struct stat path_stats;
+
+    stats_reset();
+    make_digest_options(the_config, p_context->digest_cache, &digest_options);
+
+    for (size_t i = 0; i < paths_count; i++) {
+        source_path[0] = '\0';
+        destination_path[0] = '\0';
+        if (strlen(relative_paths[i]) == 0) {
+            strcpy(source_path, the_config->source);
+            strcpy(destination_path, the_config->destination);
+        } else if (concat_path(source_path, the_config->source, relative_paths[i]) == NULL
+                   || concat_path(destination_path, the_config->destination, relative_paths[i]) == NULL
+                   || strlen(source_path) >= sizeof(the_config->source)) {
+            fprintf(stderr, "Path %s is too long\n", relative_paths[i]);
+            continue;
+        }
+        if (lstat(source_path, &path_stats) == -1) {
+            continue;
+        }
+
+        if (S_ISREG(path_stats.st_mode)) {
+            if (filter_excludes_path(source_path) == true) {
+                continue;
+            }
+            add_file_entry(&source_list, source_path);
+            if (lstat(destination_path, &path_stats) == 0 && S_ISREG(path_stats.st_mode)) {
+                add_file_entry(&dest_list, destination_path);
+            }
+        } else if (S_ISDIR(path_stats.st_mode)) {
+            // The subtree is synchronized as a whole, with the source and destination moved to its root
+            configuration_t subtree_config = *the_config;
+            files_list_t subtree_source = {NULL, NULL};
+            files_list_t subtree_dest = {NULL, NULL};
+            strcpy(subtree_config.source, source_path);
+            strcpy(subtree_config.destination, directory_exists(destination_path) ? destination_path : "");
+            if (the_config->is_parallel == true) {
+                make_files_lists_parallel(&subtree_source, &subtree_dest, &subtree_config, p_context->message_queue_id);
+            } else {
+                make_files_list(&subtree_source, subtree_config.source, &digest_options, the_config->io_order);
+                if (strlen(subtree_config.destination) > 0) {
+                    make_files_list(&subtree_dest, subtree_config.destination, &digest_options, the_config->io_order);
+                }
+            }
+            strcpy(subtree_config.destination, destination_path);
+            apply_differences(the_config, &subtree_config, &subtree_config, p_context, &subtree_source, &subtree_dest, NULL, "", "", NULL, NULL);
+            clear_files_list(&subtree_source);
+            clear_files_list(&subtree_dest);
+        }
+    }
+
+    if (source_list.head != NULL) {
+        stats_timer_t timer;
+        stats_phase_begin(&timer);
+        analyze_files_list(&source_list, &digest_options, the_config->io_order);
+        analyze_files_list(&dest_list, &digest_options, the_config->io_order);
+        stats_phase_end(STATS_PHASE_ANALYSIS, &timer);
+        apply_differences(the_config, the_config, the_config, p_context, &source_list, &dest_list, NULL, "", "", NULL, NULL);
+    }
+
+    if (strlen(the_config->stats_file) > 0) {
+        stats_write_report(the_config->stats_file);
     }
 
     clear_files_list(&source_list);
     clear_files_list(&dest_list);
-    clear_files_list(&diff_list);
 }
 
 /*!
  * @brief mismatch tests if two files with the same name (one in source, one in destination) are equal
  * @param lhd a files list entry from the source
  * @param rhd a files list entry from the destination
- * @has_md5 a value to enable or disable MD5 sum check
+ * @has_md5 a value to enable or disable MD5 sum check (full or sampled, see make_digest_options)
  * @return true if both files are not equal, false else
  */
 bool mismatch(files_list_entry_t *lhd, files_list_entry_t *rhd, bool has_md5) {
@@ -96,23 +796,138 @@ bool mismatch(files_list_entry_t *lhd, files_list_entry_t *rhd, bool has_md5) {
 }
 
 
+/*!
+ * @brief compare_pairs_content compares the content of the files of each pair (--compare=bytes)
+ * In parallel mode, comparisons are dispatched to the (then idle) analyzers pool.
+ * @param pairs is the table of pairs to compare, whose differ field is set
+ * @param pairs_count is the number of pairs in the table
+ * @param the_config is a pointer to the configuration
+ * @param p_context is a pointer to the processes context
+ */
+void compare_pairs_content(entries_pair_t *pairs, size_t pairs_count, configuration_t *the_config, process_context_t *p_context) {
+    if (the_config->is_parallel == false) {
+        for (size_t i = 0; i < pairs_count; i++) {
+            pairs[i].differ = (compare_files_content(pairs[i].source->path_and_name, pairs[i].destination->path_and_name) != 0);
+        }
+        return;
+    }
+
+    int msg_queue = p_context->message_queue_id;
+    uint32_t pending_requests = 0;
+    size_t next_pair = 0;
+    any_message_t message;
+    uint64_t trace_start = trace_begin();
+
+    pool_join();
+    while (next_pair < pairs_count || pending_requests > 0) {
+        // Send requests as long as the analyzers pool gives slots
+        while (next_pair < pairs_count
+               && pool_try_acquire(pending_requests, compare_files_exchange_size(pairs[next_pair].source->path_and_name, pairs[next_pair].destination->path_and_name))) {
+            if (send_compare_files_command(msg_queue, MSG_TYPE_TO_ANALYZERS, next_pair, pairs[next_pair].source->path_and_name, pairs[next_pair].destination->path_and_name) == -1) {
+                // Paths too long for a message: compare locally
+                pool_complete(compare_files_exchange_size(pairs[next_pair].source->path_and_name, pairs[next_pair].destination->path_and_name), 0);
+                pairs[next_pair].differ = (compare_files_content(pairs[next_pair].source->path_and_name, pairs[next_pair].destination->path_and_name) != 0);
+            } else {
+                pending_requests++;
+            }
+            next_pair++;
+        }
+
+        if (pending_requests == 0) {
+            pool_wait();
+            continue;
+        }
+        if (msgrcv(msg_queue, &message, sizeof(any_message_t) - sizeof(long), message_type(MSG_TYPE_TO_MAIN), 0) == -1) {
+            continue;
+        }
+        stats_add(STATS_IPC_MESSAGES_RECEIVED, 1);
+        if (message.compare_files_command.op_code == COMMAND_CODE_FILES_COMPARED && message.compare_files_command.pair_index < pairs_count) {
+            entries_pair_t *pair = &pairs[message.compare_files_command.pair_index];
+            pair->differ = (message.compare_files_command.result != 0);
+            pool_complete(compare_files_exchange_size(pair->source->path_and_name, pair->destination->path_and_name), pair->source->size);
+            pending_requests--;
+        }
+    }
+    pool_leave();
+    trace_end("compare_pairs", trace_start, pairs_count);
+}
+
 /*!
  * @brief make_files_list buils a files list in no parallel mode
  * @param list is a pointer to the list that will be built
  * @param target_path is the path whose files to list
+ * @param digest_options tells if and how the MD5 sums of the files must be computed
+ * @param io_order tells in which order the files are analyzed, the list stays in path order
  */
-void make_files_list(files_list_t *list, char *target_path) {
+void make_files_list(files_list_t *list, char *target_path, digest_options_t *digest_options, io_order_t io_order) {
     if (list == NULL || target_path == NULL) {
         return;
     }
 
-    make_list(list, target_path);
-    
-    files_list_entry_t *p_entry = list->head;
-    while (p_entry != NULL) {
-        get_file_stats(p_entry);
-        p_entry = p_entry->next;
+    stats_timer_t timer;
+    files_list_t known = {NULL, NULL};
+    bool incremental = scan_state_covers(target_path);
+    stats_phase_begin(&timer);
+    if (incremental == true) {
+        scan_state_list(list, &known, target_path);
+    } else {
+        make_list(list, target_path);
+    }
+    stats_phase_end(STATS_PHASE_LISTING, &timer);
+
+    stats_phase_begin(&timer);
+    analyze_files_list(list, digest_options, io_order);
+    if (incremental == true) {
+        // Files taken from the scan state were not analyzed
+        if (merge_files_lists(list, &known) == -1) {
+            fprintf(stderr, "Error merging the files of the scan state\n");
+            clear_files_list(&known);
+        }
+        scan_state_save(list);
     }
+    stats_phase_end(STATS_PHASE_ANALYSIS, &timer);
+}
+
+/*!
+ * @brief post_list_command tries to send a lister its command, without waiting for room in the MQ
+ * The listers reply through the same MQ: waiting for room to send the second command while the first lister fills the
+ * MQ with its entries would never end, so the command is retried between the receptions of the replies.
+ * @param msg_queue is the id of the MQ used for communication
+ * @param recipient is the lister (mtype)
+ * @param target is the directory to list
+ * @param complete is a pointer to the completion of the list, set if the command cannot be sent at all
+ * @return true if the command is no longer pending, false if it must be retried
+ */
+static bool post_list_command(int msg_queue, int recipient, char *target, bool *complete) {
+    if (send_analyze_dir_command(msg_queue, recipient, target, IPC_NOWAIT) == 0) {
+        return true;
+    }
+    if (errno == EAGAIN || errno == EINTR) {
+        return false;
+    }
+    fprintf(stderr, "Cannot send the list command of %s: %s\n", target, strerror(errno));
+    *complete = true;
+    return true;
+}
+
+/*!
+ * @brief receive_list_message receives a message of the listers, while list commands may still be pending
+ * @param msg_queue is the id of the MQ used for communication
+ * @param message is a pointer to the message to receive
+ * @param commands_pending tells if a list command is still to send, so that the reception must not wait
+ * @return 0 if a message is received, -1 else
+ */
+static int receive_list_message(int msg_queue, any_message_t *message, bool commands_pending) {
+    if (msgrcv(msg_queue, message, sizeof(any_message_t) - sizeof(long), message_type(MSG_TYPE_TO_MAIN), commands_pending == true ? IPC_NOWAIT : 0) == -1) {
+        if (commands_pending == true && errno == ENOMSG) {
+            // The MQ is full of the messages of other jobs, wait a little for them to be received
+            struct timespec delay = {.tv_sec = 0, .tv_nsec = 1000000L};
+            nanosleep(&delay, NULL);
+        }
+        return -1;
+    }
+    stats_add(STATS_IPC_MESSAGES_RECEIVED, 1);
+    return 0;
 }
 
 /*!
@@ -123,18 +938,27 @@ void make_files_list(files_list_t *list, char *target_path) {
  * @param msg_queue is the id of the MQ used for communication
  */
 void make_files_lists_parallel(files_list_t *src_list, files_list_t *dst_list, configuration_t *the_config, int msg_queue) {
-    send_analyze_dir_command(msg_queue, MSG_TYPE_TO_SOURCE_LISTER, the_config->source);
-    send_analyze_dir_command(msg_queue, MSG_TYPE_TO_DESTINATION_LISTER, the_config->destination);
-
     any_message_t message;
 
-    bool src_complete = false;
-    bool dst_complete = false;
+    // An empty source (other destinations of a fan-out) or destination (e.g. first snapshot) has nothing to list
+    bool src_complete = strlen(the_config->source) == 0;
+    bool dst_complete = strlen(the_config->destination) == 0;
+    bool src_pending = !src_complete;
+    bool dst_pending = !dst_complete;
 
     files_list_entry_t *new_entry = NULL;
+    uint64_t trace_start = trace_begin();
 
     do {
-        msgrcv(msg_queue, &message, sizeof(any_message_t) - sizeof(long), MSG_TYPE_TO_MAIN, 0);
+        if (src_pending == true) {
+            src_pending = !post_list_command(msg_queue, message_type(MSG_TYPE_TO_SOURCE_LISTER), the_config->source, &src_complete);
+        }
+        if (dst_pending == true) {
+            dst_pending = !post_list_command(msg_queue, message_type(MSG_TYPE_TO_DESTINATION_LISTER), the_config->destination, &dst_complete);
+        }
+        if (receive_list_message(msg_queue, &message, src_pending || dst_pending) == -1) {
+            continue;
+        }
         switch (message.list_entry.op_code) {
             case COMMAND_CODE_SOURCE_FILE_ENTRY:
                 new_entry = (files_list_entry_t*) malloc(sizeof(files_list_entry_t));
@@ -161,31 +985,218 @@ void make_files_lists_parallel(files_list_t *src_list, files_list_t *dst_list, c
         }
     }
     while (src_complete == false || dst_complete == false);
+    trace_end("receive_lists", trace_start, TRACE_NO_ARG);
+}
+
+/*!
+ * @brief make_files_runs_parallel has the listers list both trees into sorted runs (--max-memory)
+ * @param src_runs is a pointer to the set of source runs to build
+ * @param dst_runs is a pointer to the set of destination runs to build
+ * @param the_config is a pointer to the program configuration
+ * @param msg_queue is the id of the MQ used for communication
+ */
+void make_files_runs_parallel(spill_runs_t *src_runs, spill_runs_t *dst_runs, configuration_t *the_config, int msg_queue) {
+    any_message_t message;
+
+    bool src_complete = false;
+    bool dst_complete = strlen(the_config->destination) == 0;
+    bool src_pending = true;
+    bool dst_pending = !dst_complete;
+
+    uint64_t trace_start = trace_begin();
+    do {
+        if (src_pending == true) {
+            src_pending = !post_list_command(msg_queue, message_type(MSG_TYPE_TO_SOURCE_LISTER), the_config->source, &src_complete);
+        }
+        if (dst_pending == true) {
+            dst_pending = !post_list_command(msg_queue, message_type(MSG_TYPE_TO_DESTINATION_LISTER), the_config->destination, &dst_complete);
+        }
+        if (receive_list_message(msg_queue, &message, src_pending || dst_pending) == -1) {
+            continue;
+        }
+        switch (message.analyze_dir_command.op_code) {
+            case COMMAND_CODE_SOURCE_LIST_RUN:
+                spill_add_run(src_runs, message.analyze_dir_command.target);
+                break;
+
+            case COMMAND_CODE_DESTINATION_LIST_RUN:
+                spill_add_run(dst_runs, message.analyze_dir_command.target);
+                break;
+
+            case COMMAND_CODE_SOURCE_LIST_COMPLETE:
+                src_complete = true;
+                break;
+
+            case COMMAND_CODE_DESTINATION_LIST_COMPLETE:
+                dst_complete = true;
+                break;
+
+            default:
+                break;
+        }
+    }
+    while (src_complete == false || dst_complete == false);
+    trace_end("receive_runs", trace_start, TRACE_NO_ARG);
+}
+
+/*!
+ * @brief write_buffer writes a whole buffer to a file, whatever the number of write calls it takes
+ * @param file is the file descriptor
+ * @param buffer is the buffer
+ * @param size is the number of bytes to write
+ * @return 0 in case of success, -1 else
+ */
+int write_buffer(int file, char *buffer, size_t size) {
+    while (size > 0) {
+        ssize_t bytes_written = write(file, buffer, size);
+        if (bytes_written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buffer += bytes_written;
+        size -= bytes_written;
+    }
+    return 0;
+}
+
+/*!
+ * @brief copy_file_data copies the content of a file into another, from their current offsets
+ * Without digest, the kernel copies the data (sendfile). With a digest, the data goes through a buffer and is
+ * hashed as it is written, so that the copy is checked without reading it again (--verify-copy).
+ * @param source_file is the source file descriptor
+ * @param destination_file is the destination file descriptor
+ * @param size is the number of bytes to copy
+ * @param digest receives the MD5 sum of the copied bytes, NULL when the copy is not hashed
+ * @return the number of bytes copied (less than size when the source got shorter), -1 on error
+ */
+int64_t copy_file_data(int source_file, int destination_file, uint64_t size, uint8_t *digest) {
+    // sendfile may send less than asked, and chunks are the unit of the copy limits (--copy-limit)
+    size_t chunk_size = throttle_limited(THROTTLE_COPY) ? THROTTLE_COPY_CHUNK : SENDFILE_MAX_SIZE;
+    int64_t bytes_copied = 0;
+    if (digest == NULL) {
+        while ((uint64_t) bytes_copied < size) {
+            uint64_t remaining = size - bytes_copied;
+            ssize_t bytes_sent = sendfile(destination_file, source_file, NULL, remaining < chunk_size ? remaining : chunk_size);
+            if (bytes_sent == -1) {
+                return -1;
+            }
+            if (bytes_sent == 0) {
+                break;
+            }
+            bytes_copied += bytes_sent;
+            stats_add(STATS_COPY_BYTES_READ, bytes_sent);
+            throttle_account(THROTTLE_COPY, bytes_sent);
+        }
+        return bytes_copied;
+    }
+
+    char *buffer = (char*) malloc(COPY_BUFFER_SIZE);
+    EVP_MD_CTX *context = EVP_MD_CTX_new();
+    if (buffer == NULL || context == NULL || EVP_DigestInit_ex(context, EVP_md5(), NULL) != 1) {
+        free(buffer);
+        EVP_MD_CTX_free(context);
+        return -1;
+    }
+    if (chunk_size > COPY_BUFFER_SIZE) {
+        chunk_size = COPY_BUFFER_SIZE;
+    }
+    while ((uint64_t) bytes_copied < size) {
+        uint64_t remaining = size - bytes_copied;
+        ssize_t bytes_read = read(source_file, buffer, remaining < chunk_size ? remaining : chunk_size);
+        if (bytes_read == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read == -1 || (bytes_read > 0 && write_buffer(destination_file, buffer, bytes_read) == -1)) {
+            bytes_copied = -1;
+            break;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+        EVP_DigestUpdate(context, buffer, bytes_read);
+        bytes_copied += bytes_read;
+        stats_add(STATS_COPY_BYTES_READ, bytes_read);
+        throttle_account(THROTTLE_COPY, bytes_read);
+    }
+    EVP_DigestFinal_ex(context, digest, NULL);
+    EVP_MD_CTX_free(context);
+    free(buffer);
+    return bytes_copied;
+}
+
+/*!
+ * @brief check_copied_digest compares the digest of the data written by a copy with the digest of its analysis
+ * Digests are only compared when the analysis hashed the whole file, as sampled digests cover other bytes.
+ * @param source_entry is the copied entry
+ * @param the_config is a pointer to the configuration
+ * @param digest is the MD5 sum of the written data
+ * @param bytes_copied is the number of bytes written
+ * @param path is the path of the copy
+ * @return 0 when the copy matches its analysis (or cannot be compared to it), -1 else
+ */
+int check_copied_digest(files_list_entry_t *source_entry, configuration_t *the_config, uint8_t *digest, uint64_t bytes_copied, char *path) {
+    if (has_whole_digest(the_config, source_entry) == false) {
+        return 0;
+    }
+    if (bytes_copied == source_entry->size && memcmp(digest, source_entry->md5sum, sizeof(source_entry->md5sum)) == 0) {
+        stats_add(STATS_COPIES_VERIFIED, 1);
+        return 0;
+    }
+    char written[2 * sizeof(source_entry->md5sum) + 1];
+    char analyzed[2 * sizeof(source_entry->md5sum) + 1];
+    for (size_t i = 0; i < sizeof(source_entry->md5sum); i++) {
+        sprintf(written + 2 * i, "%02x", digest[i]);
+        sprintf(analyzed + 2 * i, "%02x", source_entry->md5sum[i]);
+    }
+    fprintf(stderr, "Copy of %s to %s does not match its analysis (%llu bytes written of %llu, MD5 %s instead of %s): the source changed during the run\n",
+            source_entry->path_and_name, path, (unsigned long long) bytes_copied, (unsigned long long) source_entry->size, written, analyzed);
+    stats_add(STATS_COPIES_MISMATCHED, 1);
+    return -1;
 }
 
 /*!
  * @brief copy_entry_to_destination copies a file from the source to the destination
  * It keeps access modes and mtime (@see utimensat)
  * Pay attention to the path so that the prefixes are not repeated from the source to the destination
- * Use sendfile to copy the file, mkdir to create the directory
+ * Use sendfile to copy the file (read and write with --verify-copy), mkdir to create the directory
+ * @return 0 in case of success (or dry run), -1 else
  */
-void copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t *the_config) {
+int copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t *the_config) {
     char dest_entry_path[PATH_SIZE]  = "";
     concat_path(dest_entry_path, the_config->destination, source_entry->path_and_name + strlen(the_config->source));
+    // With a journal, an interrupted copy never leaves a truncated file in place: the file is renamed once complete
+    char final_path[PATH_SIZE];
+    bool renames = (strlen(the_config->journal_file) > 0);
+    strcpy(final_path, dest_entry_path);
+    if (renames == true && snprintf(dest_entry_path, sizeof(dest_entry_path), "%s%s", final_path, JOURNAL_PARTIAL_SUFFIX) >= (int) sizeof(dest_entry_path)) {
+        fprintf(stderr, "Path %s is too long\n", final_path);
+        return -1;
+    }
     
     if (the_config->dry_run == true) {
-        printf("%s copied to %s.\n", source_entry->path_and_name, dest_entry_path);
-        return;
+        printf("%s copied to %s.\n", source_entry->path_and_name, final_path);
+        return 0;
     }
 
+    if (make_parent_directories(dest_entry_path) == -1) {
+        fprintf(stderr, "Error creating parent directories of %s\n", dest_entry_path);
+        return -1;
+    }
+
+    uint64_t start_ns = stats_now_ns();
+    uint64_t trace_start = trace_begin();
+
     // open the source file for reading
     int source_file = open(source_entry->path_and_name, O_RDONLY);
     if (source_file == -1) {
         fprintf(stderr, "Error opening source file");
-        return;
+        return -1;
     }
 
     // open the destination file
+    int result = 0;
     int destination_file = open(dest_entry_path, O_WRONLY | O_CREAT | O_TRUNC, source_entry->mode);
     // O_WRONLY: fichier doit être ouvert en mode écriture seulement 
     // O_CREAT: crée le fichier s'il n'existe pas
@@ -193,18 +1204,30 @@ void copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t
     if (destination_file == -1) {
         fprintf(stderr, "Error opening destination file");
         close(source_file);
-        return;
+        return -1;
     }
 
     // copie des infos du fichier
-    off_t offset = 0;
-    ssize_t bytes_copied = sendfile(destination_file, source_file, &offset, source_entry->size);
+    // With --verify-copy, the written data is hashed and checked against the analysis of the source
+    uint8_t digest[sizeof(source_entry->md5sum)];
+    int64_t bytes_copied = copy_file_data(source_file, destination_file, source_entry->size, the_config->verify_copy == true ? digest : NULL);
+    bool verified = (bytes_copied == -1 || the_config->verify_copy == false
+                     || check_copied_digest(source_entry, the_config, digest, bytes_copied, final_path) == 0);
 
+    stats_add(STATS_OPEN_CALLS, 2);
     if (bytes_copied == -1) {
         fprintf(stderr, "Error copying file");
+        result = -1;
+    } else if (verified == false) {
+        // The copy keeps the time of the copy as mtime, so that the next run copies it again
+        result = -1;
     } else {
+        stats_add(STATS_FILES_COPIED, 1);
+        stats_add(STATS_BYTES_COPIED, bytes_copied);
+        progress_add(PROGRESS_FILES_COPIED, 1);
+        progress_add(PROGRESS_BYTES_COPIED, bytes_copied);
         if (the_config->verbose == true) {
-            printf("%s copied to %s.\n", source_entry->path_and_name, dest_entry_path);
+            printf("%s copied to %s.\n", source_entry->path_and_name, final_path);
         }
         struct timespec new_time[2];
         new_time[0].tv_nsec = UTIME_NOW;
@@ -213,6 +1236,7 @@ void copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t
         new_time[1].tv_sec = source_entry->mtime.tv_sec;
         if (utimensat(AT_FDCWD, dest_entry_path, new_time, 0) != 0) {
             fprintf(stderr, "Erreur lors de la modification de l'heure de modification");
+            result = -1;
         }
 
         chmod(dest_entry_path, source_entry->mode);
@@ -220,9 +1244,170 @@ void copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t
 
     close(source_file);
     close(destination_file);
+    if (renames == true && result == 0 && rename(dest_entry_path, final_path) == -1) {
+        fprintf(stderr, "Error renaming %s\n", dest_entry_path);
+        result = -1;
+    }
+    if (renames == true && result == -1) {
+        unlink(dest_entry_path);
+    }
+    stats_record_latency(STATS_HISTOGRAM_COPY, stats_now_ns() - start_ns);
+    trace_end("copy_file", trace_start, source_entry->size);
+    return result;
+}
+
 
+/*!
+ * @brief copy_entry_to_destinations copies a file from the source to several destinations, reading it once
+ * Each chunk read from the source is written to all destinations. A destination that fails is given up alone.
+ * With one destination, the file is copied by copy_entry_to_destination (sendfile).
+ * @param source_entry is the source entry
+ * @param the_config is a pointer to the configuration
+ * @param destinations is the table of destination roots
+ * @param destinations_count is the number of destinations
+ * @return 0 in case of success (or dry run), -1 if any destination was not written
+ */
+int copy_entry_to_destinations(files_list_entry_t *source_entry, configuration_t *the_config, char **destinations, size_t destinations_count) {
+    if (destinations_count == 1) {
+        configuration_t target_config = *the_config;
+        strcpy(target_config.destination, destinations[0]);
+        return copy_entry_to_destination(source_entry, &target_config);
+    }
+
+    char (*paths)[PATH_SIZE] = malloc(PATH_SIZE * destinations_count);
+    int *files = (int*) malloc(sizeof(int) * destinations_count);
+    int result = 0;
+    for (size_t d = 0; d < destinations_count; d++) {
+        paths[d][0] = '\0';
+        concat_path(paths[d], destinations[d], source_entry->path_and_name + strlen(the_config->source));
+        files[d] = -1;
+        if (the_config->dry_run == true) {
+            printf("%s copied to %s.\n", source_entry->path_and_name, paths[d]);
+        } else if (make_parent_directories(paths[d]) == -1) {
+            fprintf(stderr, "Error creating parent directories of %s\n", paths[d]);
+            result = -1;
+        } else if ((files[d] = open(paths[d], O_WRONLY | O_CREAT | O_TRUNC, source_entry->mode)) == -1) {
+            fprintf(stderr, "Error opening destination file %s\n", paths[d]);
+            result = -1;
+        } else {
+            stats_add(STATS_OPEN_CALLS, 1);
+        }
+    }
+    if (the_config->dry_run == true) {
+        free(files);
+        free(paths);
+        return 0;
+    }
+
+    uint64_t start_ns = stats_now_ns();
+    uint64_t trace_start = trace_begin();
+    int source_file = open(source_entry->path_and_name, O_RDONLY);
+    char *buffer = (char*) malloc(COPY_BUFFER_SIZE);
+    uint64_t bytes_copied = 0;
+    uint8_t digest[sizeof(source_entry->md5sum)];
+    EVP_MD_CTX *context = NULL;
+    if (the_config->verify_copy == true && (context = EVP_MD_CTX_new()) != NULL) {
+        EVP_DigestInit_ex(context, EVP_md5(), NULL);
+    }
+    bool read_failed = (source_file == -1 || buffer == NULL || (the_config->verify_copy == true && context == NULL));
+    if (read_failed == true) {
+        fprintf(stderr, "Error opening source file %s\n", source_entry->path_and_name);
+    } else {
+        stats_add(STATS_OPEN_CALLS, 1);
+    }
+
+    while (read_failed == false && bytes_copied < source_entry->size) {
+        ssize_t bytes_read = read(source_file, buffer, COPY_BUFFER_SIZE);
+        if (bytes_read == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read == -1) {
+            fprintf(stderr, "Error reading source file %s\n", source_entry->path_and_name);
+            read_failed = true;
+            break;
+        }
+        if (bytes_read == 0) {
+            // The source got shorter since it was analyzed
+            break;
+        }
+        stats_add(STATS_COPY_BYTES_READ, bytes_read);
+        if (context != NULL) {
+            EVP_DigestUpdate(context, buffer, bytes_read);
+        }
+        for (size_t d = 0; d < destinations_count; d++) {
+            if (files[d] == -1) {
+                continue;
+            }
+            if (write_buffer(files[d], buffer, bytes_read) == -1) {
+                fprintf(stderr, "Error copying file to %s\n", paths[d]);
+                close(files[d]);
+                files[d] = -1;
+                result = -1;
+            } else {
+                throttle_account(THROTTLE_COPY, bytes_read);
+            }
+        }
+        bytes_copied += bytes_read;
+    }
+
+    // All destinations were written the same data, hashed once (--verify-copy)
+    bool verified = true;
+    if (context != NULL) {
+        EVP_DigestFinal_ex(context, digest, NULL);
+        EVP_MD_CTX_free(context);
+        verified = (read_failed == true || check_copied_digest(source_entry, the_config, digest, bytes_copied, paths[0]) == 0);
+    }
+
+    for (size_t d = 0; d < destinations_count; d++) {
+        if (files[d] == -1) {
+            continue;
+        }
+        close(files[d]);
+        if (read_failed == true || verified == false) {
+            result = -1;
+            continue;
+        }
+        stats_add(STATS_FILES_COPIED, 1);
+        stats_add(STATS_BYTES_COPIED, bytes_copied);
+        progress_add(PROGRESS_FILES_COPIED, 1);
+        progress_add(PROGRESS_BYTES_COPIED, bytes_copied);
+        if (the_config->verbose == true) {
+            printf("%s copied to %s.\n", source_entry->path_and_name, paths[d]);
+        }
+        struct timespec new_time[2];
+        new_time[0].tv_nsec = UTIME_NOW;
+        new_time[0].tv_sec = UTIME_NOW;
+        new_time[1].tv_nsec = source_entry->mtime.tv_nsec;
+        new_time[1].tv_sec = source_entry->mtime.tv_sec;
+        if (utimensat(AT_FDCWD, paths[d], new_time, 0) != 0) {
+            fprintf(stderr, "Error setting the modification time of %s\n", paths[d]);
+            result = -1;
+        }
+        chmod(paths[d], source_entry->mode);
+    }
+
+    if (source_file != -1) {
+        close(source_file);
+    }
+    free(buffer);
+    free(files);
+    free(paths);
+    stats_record_latency(STATS_HISTOGRAM_COPY, stats_now_ns() - start_ns);
+    trace_end("copy_file", trace_start, source_entry->size);
+    return result;
 }
 
+/*!
+ * @brief add_path_to_list adds a listed file to a list (walk_tree callback)
+ * @param path is the path of the file
+ * @param context is a pointer to the list
+ * @return 0, the walk goes on
+ */
+static int add_path_to_list(char *path, void *context) {
+    // Entries that cannot be added (paths too long) are skipped, as before
+    add_file_entry((files_list_t*) context, path);
+    return 0;
+}
 
 /*!
  * @brief make_list lists files in a location (it recurses in directories)
@@ -235,33 +1420,68 @@ void make_list(files_list_t *list, char *target) {
     if (list == NULL || target == NULL) {
         return;
     }
+    walk_tree(target, add_path_to_list, list);
+}
 
+/*!
+ * @brief walk_directory calls a function on each regular file of a directory and its subdirectories (@see walk_tree)
+ * Excluded files are skipped and excluded directories are not opened (@see filter.h).
+ * @param target is the directory
+ * @param callback is the function called with the path of each file, which stops the walk when it returns -1
+ * @param context is passed to callback
+ * @return 0 when the whole directory was walked, -1 when callback stopped it
+ */
+static int walk_directory(char *target, walk_callback_t callback, void *context) {
+    uint64_t trace_start = trace_begin();
     DIR *dir = open_dir(target);
     
     if (!dir) {
         fprintf(stderr, "Error opening directory\n");
-        return;
+        return 0;
     }
 
     struct dirent *dp;
     char path[PATH_SIZE] = "";
+    int result = 0;
 
-    while ((dp = readdir(dir)) != NULL) {
+    while (result == 0 && (dp = readdir(dir)) != NULL) {
+        stats_add(STATS_READDIR_CALLS, 1);
         if (dp->d_type == DT_REG) {
-            if (concat_path(path, target, dp->d_name) != NULL) {
-                add_file_entry(list, path);
+            if (concat_path(path, target, dp->d_name) != NULL && filter_excludes_file(path, NULL) == false) {
+                result = callback(path, context);
+                stats_add(STATS_FILES_LISTED, 1);
+                progress_add(PROGRESS_FILES_DISCOVERED, 1);
             }
         } else if (dp->d_type == DT_DIR && strcmp(dp->d_name, ".") != 0 && strcmp(dp->d_name, "..") != 0) {
-            if (concat_path(path, target, dp->d_name) != NULL) {
-                make_list(list, path);
+            if (concat_path(path, target, dp->d_name) != NULL && filter_enter_directory(path) == true) {
+                result = walk_directory(path, callback, context);
+                filter_leave_directory();
             }
         }
         strcpy(path, "");
     }
 
     closedir(dir);
+    trace_end("read_dir", trace_start, TRACE_NO_ARG);
+    return result;
 }
 
+/*!
+ * @brief walk_tree calls a function on each regular file of a tree (it recurses in directories)
+ * Files are met in directory order, not in path order. Files and directories excluded by the filters are skipped.
+ * @param target is the root of the tree
+ * @param callback is the function called with the path of each file, which stops the walk when it returns -1
+ * @param context is passed to callback
+ * @return 0 when the whole tree was walked, -1 when callback stopped it
+ */
+int walk_tree(char *target, walk_callback_t callback, void *context) {
+    if (filter_begin_walk(target) == false) {
+        return 0;
+    }
+    int result = walk_directory(target, callback, context);
+    filter_end_walk();
+    return result;
+}
 
 /*!
  * @brief open_dir opens a dir
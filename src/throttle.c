@@ -0,0 +1,123 @@
+#include <throttle.h>
+#include <stats.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+
+// Shared buckets, NULL when no limit is set. The mapping is created before forking.
+static throttle_t *throttle = NULL;
+
+/*!
+ * @brief set_low_priority lowers the I/O and CPU priorities of main, inherited by the processes it forks
+ * @param the_config is a pointer to the configuration
+ */
+static void set_low_priority(configuration_t *the_config) {
+    if (the_config->idle_io == true
+        && syscall(SYS_ioprio_set, THROTTLE_IOPRIO_WHO_PROCESS, 0, THROTTLE_IOPRIO_CLASS_IDLE << THROTTLE_IOPRIO_CLASS_SHIFT) == -1) {
+        fprintf(stderr, "Error setting the idle I/O class: %s\n", strerror(errno));
+    }
+    if (the_config->nice_increment != 0) {
+        errno = 0;
+        if (nice(the_config->nice_increment) == -1 && errno != 0) {
+            fprintf(stderr, "Error setting the CPU priority: %s\n", strerror(errno));
+        }
+    }
+}
+
+/*!
+ * @brief throttle_init applies the priorities and maps the shared buckets of the rate limits
+ * Must be called before the processes are forked.
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else
+ */
+int throttle_init(configuration_t *the_config) {
+    set_low_priority(the_config);
+    if (throttle != NULL || (the_config->read_rate == 0 && the_config->read_iops == 0
+                             && the_config->copy_rate == 0 && the_config->copy_iops == 0)) {
+        return 0;
+    }
+
+    throttle = mmap(NULL, sizeof(throttle_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (throttle == MAP_FAILED) {
+        throttle = NULL;
+        fprintf(stderr, "Error creating rate limits\n");
+        return -1;
+    }
+    memset(throttle, 0, sizeof(throttle_t));
+    throttle->bytes[THROTTLE_READ].rate = the_config->read_rate;
+    throttle->operations[THROTTLE_READ].rate = the_config->read_iops;
+    throttle->bytes[THROTTLE_COPY].rate = the_config->copy_rate;
+    throttle->operations[THROTTLE_COPY].rate = the_config->copy_iops;
+    return 0;
+}
+
+/*!
+ * @brief throttle_release unmaps the shared buckets
+ */
+void throttle_release(void) {
+    if (throttle != NULL) {
+        munmap(throttle, sizeof(throttle_t));
+        throttle = NULL;
+    }
+}
+
+/*!
+ * @brief throttle_limited tells if a class of operations is rate limited
+ * @param io_class is the class of operations
+ * @return true if the bytes or the operations of the class are limited
+ */
+bool throttle_limited(throttle_class_t io_class) {
+    return throttle != NULL && (throttle->bytes[io_class].rate > 0 || throttle->operations[io_class].rate > 0);
+}
+
+/*!
+ * @brief reserve consumes tokens of a bucket
+ * An idle bucket holds at most THROTTLE_BURST_MS of tokens, so that idle periods are not made up by bursts.
+ * @param bucket is a pointer to the shared bucket
+ * @param units is the number of bytes or operations
+ * @param now_ns is the current time
+ * @return the time until which the caller must wait
+ */
+static uint64_t reserve(throttle_bucket_t *bucket, uint64_t units, uint64_t now_ns) {
+    if (bucket->rate == 0) {
+        return 0;
+    }
+    uint64_t cost_ns = units * 1000000000ULL / bucket->rate;
+    uint64_t burst_ns = (uint64_t) THROTTLE_BURST_MS * 1000000;
+    uint64_t next_ns = __atomic_load_n(&bucket->next_ns, __ATOMIC_RELAXED);
+    uint64_t start_ns, reserved_ns;
+    do {
+        start_ns = (next_ns + burst_ns < now_ns) ? now_ns - burst_ns : next_ns;
+        reserved_ns = start_ns + cost_ns;
+    } while (!__atomic_compare_exchange_n(&bucket->next_ns, &next_ns, reserved_ns, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return reserved_ns;
+}
+
+/*!
+ * @brief throttle_account accounts an operation against the limits of its class, and waits for its tokens
+ * Operations are accounted once done, so that short reads are accounted for what they actually read.
+ * @param io_class is the class of the operation
+ * @param bytes is the number of bytes read or copied by the operation
+ */
+void throttle_account(throttle_class_t io_class, uint64_t bytes) {
+    if (throttle_limited(io_class) == false) {
+        return;
+    }
+    uint64_t now_ns = stats_now_ns();
+    uint64_t bytes_ns = reserve(&throttle->bytes[io_class], bytes, now_ns);
+    uint64_t operations_ns = reserve(&throttle->operations[io_class], 1, now_ns);
+    uint64_t until_ns = bytes_ns > operations_ns ? bytes_ns : operations_ns;
+    if (until_ns <= now_ns) {
+        return;
+    }
+
+    struct timespec until = {.tv_sec = until_ns / 1000000000ULL, .tv_nsec = until_ns % 1000000000ULL};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR) {
+    }
+    stats_add(STATS_THROTTLE_WAIT_US, (until_ns - now_ns) / 1000);
+}
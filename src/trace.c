@@ -0,0 +1,205 @@
+#include <trace.h>
+#include <defines.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <libgen.h>
+
+// Each process records its events into its own buffer, which is appended as JSON fragments to a per
+// process part file (<trace>.<run>.<pid>.part) when full and when the process ends. trace_finish merges
+// the parts of the run into a single Chrome trace-event file: the run token (PID and start time of main)
+// keeps apart the parts left by crashed runs and those of other runs writing the same trace.
+// All this state is inherited by forked processes, which call trace_process_start to reset it.
+
+#define TRACE_PART_SUFFIX_SIZE 64
+
+static bool trace_enabled = false;
+static char trace_path[PATH_SIZE];
+static char trace_run_token[32];
+static const char *trace_process_name = "main";
+static trace_event_t *trace_events = NULL;
+static int trace_events_count = 0;
+static bool trace_name_written = false;
+
+/*!
+ * @brief trace_now_ns gets the monotonic time, which is common to all processes
+ * @return the current time in nanoseconds
+ */
+static uint64_t trace_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*!
+ * @brief trace_init enables tracing for the main process and the processes it will fork
+ * @param path is the path of the merged trace file
+ * @return 0 in case of success, -1 else
+ */
+int trace_init(char *path) {
+    if (strlen(path) + TRACE_PART_SUFFIX_SIZE >= PATH_SIZE) {
+        fprintf(stderr, "Trace file name is too long\n");
+        return -1;
+    }
+    strcpy(trace_path, path);
+    snprintf(trace_run_token, sizeof(trace_run_token), "%d-%llx", getpid(), (unsigned long long) trace_now_ns());
+    trace_events = malloc(sizeof(trace_event_t) * TRACE_BUFFER_EVENTS);
+    if (trace_events == NULL) {
+        return -1;
+    }
+    trace_enabled = true;
+    trace_process_start("main");
+    return 0;
+}
+
+/*!
+ * @brief trace_process_start resets the tracing state inherited from the parent process
+ * @param process_name is the name of the process in the trace (static string)
+ */
+void trace_process_start(const char *process_name) {
+    trace_process_name = process_name;
+    trace_events_count = 0;
+    trace_name_written = false;
+}
+
+/*!
+ * @brief trace_begin gets the start time of an event
+ * @return the current time, 0 when tracing is disabled
+ */
+uint64_t trace_begin(void) {
+    return trace_enabled ? trace_now_ns() : 0;
+}
+
+/*!
+ * @brief trace_end records a complete event
+ * @param name is the name of the event (static string)
+ * @param start_ns is the start time of the event, as returned by trace_begin
+ * @param arg is an optional value displayed with the event (e.g. a size), TRACE_NO_ARG if none
+ */
+void trace_end(const char *name, uint64_t start_ns, int64_t arg) {
+    if (trace_enabled == false) {
+        return;
+    }
+    if (trace_events_count == TRACE_BUFFER_EVENTS) {
+        trace_flush();
+    }
+    trace_event_t *event = &trace_events[trace_events_count++];
+    event->name = name;
+    event->start_ns = start_ns;
+    event->duration_ns = trace_now_ns() - start_ns;
+    event->arg = arg;
+}
+
+/*!
+ * @brief trace_flush appends the buffered events of the calling process to its part file
+ * Processes must flush before exiting.
+ */
+void trace_flush(void) {
+    if (trace_enabled == false) {
+        return;
+    }
+
+    char part_path[PATH_SIZE + TRACE_PART_SUFFIX_SIZE];
+    pid_t pid = getpid();
+    snprintf(part_path, sizeof(part_path), "%s.%s.%d.part", trace_path, trace_run_token, pid);
+    FILE *part = fopen(part_path, "a");
+    if (part == NULL) {
+        trace_events_count = 0;
+        return;
+    }
+
+    if (trace_name_written == false) {
+        fprintf(part, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}},\n", pid, trace_process_name);
+        trace_name_written = true;
+    }
+    for (int i = 0; i < trace_events_count; i++) {
+        trace_event_t *event = &trace_events[i];
+        fprintf(part, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f", event->name, pid, pid,
+                event->start_ns / 1e3, event->duration_ns / 1e3);
+        if (event->arg != TRACE_NO_ARG) {
+            fprintf(part, ",\"args\":{\"value\":%lld}", (long long) event->arg);
+        }
+        fprintf(part, "},\n");
+    }
+    fclose(part);
+    trace_events_count = 0;
+}
+
+/*!
+ * @brief trace_finish merges the part files of all processes of the run into the trace file, and removes them
+ * Must be called by the main process once all other processes have ended.
+ * @return 0 in case of success, -1 else
+ */
+int trace_finish(void) {
+    if (trace_enabled == false) {
+        return 0;
+    }
+    trace_flush();
+    trace_enabled = false;
+    free(trace_events);
+    trace_events = NULL;
+
+    char dir_path[PATH_SIZE];
+    char base_path[PATH_SIZE];
+    strcpy(dir_path, trace_path);
+    strcpy(base_path, trace_path);
+    char *dir_name = dirname(dir_path);
+    char *base_name = basename(base_path);
+    // Parts of the run start with <trace name>.<run token>.
+    char part_prefix[PATH_SIZE + TRACE_PART_SUFFIX_SIZE];
+    snprintf(part_prefix, sizeof(part_prefix), "%s.%s.", base_name, trace_run_token);
+    size_t prefix_length = strlen(part_prefix);
+
+    FILE *trace = fopen(trace_path, "w");
+    DIR *dir = opendir(dir_name);
+    if (trace == NULL || dir == NULL) {
+        fprintf(stderr, "Error writing trace file %s\n", trace_path);
+        if (trace != NULL) {
+            fclose(trace);
+        }
+        if (dir != NULL) {
+            closedir(dir);
+        }
+        return -1;
+    }
+
+    fprintf(trace, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first_event = true;
+    struct dirent *dp;
+    while ((dp = readdir(dir)) != NULL) {
+        size_t name_length = strlen(dp->d_name);
+        if (name_length <= prefix_length + 5 || strncmp(dp->d_name, part_prefix, prefix_length) != 0
+            || strcmp(dp->d_name + name_length - 5, ".part") != 0) {
+            continue;
+        }
+
+        char part_path[PATH_SIZE + TRACE_PART_SUFFIX_SIZE];
+        snprintf(part_path, sizeof(part_path), "%s/%s", dir_name, dp->d_name);
+        FILE *part = fopen(part_path, "r");
+        if (part != NULL) {
+            // One event per line, each ending with a comma that is only kept between events
+            char line[1024];
+            while (fgets(line, sizeof(line), part) != NULL) {
+                size_t line_length = strlen(line);
+                while (line_length > 0 && (line[line_length - 1] == '\n' || line[line_length - 1] == ',')) {
+                    line_length--;
+                }
+                if (line_length == 0) {
+                    continue;
+                }
+                fprintf(trace, "%s%.*s", first_event ? "" : ",\n", (int) line_length, line);
+                first_event = false;
+            }
+            fclose(part);
+        }
+        unlink(part_path);
+    }
+    closedir(dir);
+
+    fprintf(trace, "\n]}\n");
+    fclose(trace);
+    return 0;
+}
@@ -1,5 +1,7 @@
 #include <defines.h>
 #include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
 
 /*
  * @brief concat_path concatenates suffix to prefix into result
@@ -32,3 +34,30 @@ char *concat_path(char *result, char *prefix, char *suffix) {
 
 	return result;
 }
+
+/*!
+ * @brief make_parent_directories creates all the missing directories leading to a path (like mkdir -p on its dirname)
+ * @param path is the full path of a file whose parent directories must exist
+ * @return 0 when all parent directories exist, -1 else
+ */
+int make_parent_directories(char *path) {
+    if (path == NULL || strlen(path) >= PATH_SIZE) {
+        return -1;
+    }
+
+    char partial_path[PATH_SIZE];
+    strcpy(partial_path, path);
+
+    // Each '/' after the first character ends a parent directory name
+    for (char *cursor = partial_path + 1; *cursor != '\0'; cursor++) {
+        if (*cursor == '/') {
+            *cursor = '\0';
+            if (mkdir(partial_path, 0777) == -1 && errno != EEXIST) {
+                return -1;
+            }
+            *cursor = '/';
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,459 @@
+#define _GNU_SOURCE
+#include <watch.h>
+#include <sync.h>
+#include <stats.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+
+static volatile sig_atomic_t stop_requested = 0;
+
+/*!
+ * @brief request_stop is the handler of SIGINT and SIGTERM in watch mode
+ * @param signal_number is the received signal
+ */
+static void request_stop(int signal_number) {
+    stop_requested = 1;
+}
+
+/*!
+ * @brief watch_handle_signals makes SIGINT and SIGTERM stop watching instead of killing main
+ * Main then terminates the other processes, which ignore these signals in watch mode (see prepare).
+ */
+void watch_handle_signals(void) {
+    struct sigaction action = {.sa_handler = request_stop};
+    sigemptyset(&action.sa_mask);
+    // No SA_RESTART: the signal interrupts poll
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+}
+
+/*!
+ * @brief add_change records a changed path
+ * @param changes is a pointer to the changes
+ * @param relative_path is the changed path, relative to the source
+ */
+static void add_change(watch_changes_t *changes, char *relative_path) {
+    if (changes->count == 0 && changes->rescan_all == false) {
+        changes->first_change_ns = stats_now_ns();
+    }
+    if (changes->count == changes->capacity) {
+        size_t capacity = changes->capacity == 0 ? 64 : changes->capacity * 2;
+        char **paths = (char**) realloc(changes->paths, sizeof(char*) * capacity);
+        if (paths == NULL) {
+            // The change is not lost, the whole source will be synchronized
+            changes->rescan_all = true;
+            return;
+        }
+        changes->paths = paths;
+        changes->capacity = capacity;
+    }
+    changes->paths[changes->count] = strdup(relative_path);
+    if (changes->paths[changes->count] == NULL) {
+        changes->rescan_all = true;
+        return;
+    }
+    changes->count++;
+}
+
+/*!
+ * @brief lose_changes records that events were lost
+ * @param changes is a pointer to the changes
+ */
+static void lose_changes(watch_changes_t *changes) {
+    if (changes->count == 0 && changes->rescan_all == false) {
+        changes->first_change_ns = stats_now_ns();
+    }
+    changes->rescan_all = true;
+}
+
+/*!
+ * @brief clear_changes forgets the recorded changes
+ * @param changes is a pointer to the changes
+ */
+static void clear_changes(watch_changes_t *changes) {
+    for (size_t i = 0; i < changes->count; i++) {
+        free(changes->paths[i]);
+    }
+    changes->count = 0;
+    changes->rescan_all = false;
+}
+
+/*!
+ * @brief compare_paths orders the changed paths (qsort and bsearch callback)
+ * @param lhd is a pointer to a path
+ * @param rhd is a pointer to another path
+ * @return the comparison of the paths
+ */
+static int compare_paths(const void *lhd, const void *rhd) {
+    return strcmp(*(char**) lhd, *(char**) rhd);
+}
+
+/*!
+ * @brief reduce_changes sorts the changed paths and removes duplicates and paths inside another changed path
+ * A changed directory is synchronized with all its content.
+ * @param changes is a pointer to the changes
+ */
+static void reduce_changes(watch_changes_t *changes) {
+    qsort(changes->paths, changes->count, sizeof(char*), compare_paths);
+
+    // The ancestors are searched in the sorted table, which is only compacted afterwards
+    bool *covered = (bool*) calloc(changes->count + 1, sizeof(bool));
+    for (size_t i = 0; i < changes->count; i++) {
+        char *path = changes->paths[i];
+        if (i > 0 && strcmp(path, changes->paths[i - 1]) == 0) {
+            covered[i] = true;
+            continue;
+        }
+        char ancestor[PATH_SIZE];
+        strcpy(ancestor, path);
+        char *ancestor_key = ancestor;
+        for (char *separator = strrchr(ancestor, '/'); separator != NULL && covered[i] == false; separator = strrchr(ancestor, '/')) {
+            *separator = '\0';
+            covered[i] = (bsearch(&ancestor_key, changes->paths, changes->count, sizeof(char*), compare_paths) != NULL);
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < changes->count; i++) {
+        if (covered[i] == true) {
+            free(changes->paths[i]);
+        } else {
+            changes->paths[kept++] = changes->paths[i];
+        }
+    }
+    changes->count = kept;
+    free(covered);
+}
+
+/*!
+ * @brief add_inotify_watches watches a directory and all its subdirectories
+ * Directories already watched (e.g. moved inside the source) get their new path.
+ * @param watcher is a pointer to the watcher
+ * @param relative_path is the path of the directory, relative to the source
+ */
+static void add_inotify_watches(watcher_t *watcher, char *relative_path) {
+    char path[PATH_SIZE];
+    if (snprintf(path, sizeof(path), "%s%s", watcher->root, relative_path) >= (int) sizeof(path)) {
+        return;
+    }
+
+    int wd = inotify_add_watch(watcher->fd, path, WATCH_INOTIFY_MASK);
+    if (wd == -1) {
+        if (errno == ENOSPC && watcher->limit_reported == false) {
+            fprintf(stderr, "Limit of inotify watches reached, changes of some directories will be missed (see fs.inotify.max_user_watches)\n");
+            watcher->limit_reported = true;
+        }
+        return;
+    }
+    if ((size_t) wd >= watcher->directories_capacity) {
+        size_t capacity = watcher->directories_capacity == 0 ? 256 : watcher->directories_capacity;
+        while (capacity <= (size_t) wd) {
+            capacity *= 2;
+        }
+        char **directories = (char**) realloc(watcher->directories, sizeof(char*) * capacity);
+        if (directories == NULL) {
+            inotify_rm_watch(watcher->fd, wd);
+            return;
+        }
+        memset(directories + watcher->directories_capacity, 0, sizeof(char*) * (capacity - watcher->directories_capacity));
+        watcher->directories = directories;
+        watcher->directories_capacity = capacity;
+    }
+    free(watcher->directories[wd]);
+    watcher->directories[wd] = strdup(relative_path);
+
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    char child[PATH_SIZE];
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_type != DT_DIR || strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        if (snprintf(child, sizeof(child), "%s/%s", relative_path, entry->d_name) < (int) sizeof(child)) {
+            add_inotify_watches(watcher, child);
+        }
+    }
+    closedir(dir);
+}
+
+/*!
+ * @brief read_inotify_events records the changes of the pending inotify events
+ * New directories are watched and synchronized as a whole, since files may have been written before their watch.
+ * @param watcher is a pointer to the watcher
+ * @param changes is a pointer to the changes
+ */
+static void read_inotify_events(watcher_t *watcher, watch_changes_t *changes) {
+    char buffer[WATCH_EVENTS_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    char relative_path[PATH_SIZE];
+    ssize_t length;
+
+    while ((length = read(watcher->fd, buffer, sizeof(buffer))) > 0) {
+        for (char *cursor = buffer; cursor < buffer + length; cursor += sizeof(struct inotify_event) + ((struct inotify_event*) cursor)->len) {
+            struct inotify_event *event = (struct inotify_event*) cursor;
+            if (event->mask & IN_Q_OVERFLOW) {
+                lose_changes(changes);
+                continue;
+            }
+            if (event->wd < 0 || (size_t) event->wd >= watcher->directories_capacity || watcher->directories[event->wd] == NULL) {
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                free(watcher->directories[event->wd]);
+                watcher->directories[event->wd] = NULL;
+                continue;
+            }
+            // Events of the watched directory itself have no name
+            if (event->len == 0) {
+                continue;
+            }
+            if (snprintf(relative_path, sizeof(relative_path), "%s/%s", watcher->directories[event->wd], event->name) >= (int) sizeof(relative_path)) {
+                continue;
+            }
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    add_inotify_watches(watcher, relative_path);
+                    add_change(changes, relative_path);
+                }
+            } else {
+                add_change(changes, relative_path);
+            }
+        }
+    }
+}
+
+/*!
+ * @brief read_fanotify_events records the changes of the pending fanotify events inside the source
+ * Events carry the handle of the parent directory and the name of the entry.
+ * @param watcher is a pointer to the watcher
+ * @param changes is a pointer to the changes
+ */
+static void read_fanotify_events(watcher_t *watcher, watch_changes_t *changes) {
+    char buffer[WATCH_EVENTS_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct fanotify_event_metadata))));
+    char link[64];
+    char directory[PATH_SIZE];
+    char relative_path[PATH_SIZE];
+    size_t root_length = strlen(watcher->root);
+    ssize_t length;
+
+    while ((length = read(watcher->fd, buffer, sizeof(buffer))) > 0) {
+        struct fanotify_event_metadata *event = (struct fanotify_event_metadata*) buffer;
+        for (; FAN_EVENT_OK(event, length); event = FAN_EVENT_NEXT(event, length)) {
+            if (event->vers != FANOTIFY_METADATA_VERSION || (event->mask & FAN_Q_OVERFLOW)) {
+                lose_changes(changes);
+                continue;
+            }
+            struct fanotify_event_info_fid *info = (struct fanotify_event_info_fid*) (event + 1);
+            if ((char*) (info + 1) > (char*) event + event->event_len || info->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME) {
+                continue;
+            }
+            struct file_handle *handle = (struct file_handle*) info->handle;
+            char *name = (char*) handle->f_handle + handle->handle_bytes;
+
+            // The directory may have been removed since the event (ESTALE)
+            int directory_fd = open_by_handle_at(watcher->mount_fd, handle, O_PATH);
+            if (directory_fd == -1) {
+                continue;
+            }
+            snprintf(link, sizeof(link), "/proc/self/fd/%d", directory_fd);
+            ssize_t directory_length = readlink(link, directory, sizeof(directory) - 1);
+            close(directory_fd);
+            if (directory_length == -1) {
+                continue;
+            }
+            directory[directory_length] = '\0';
+
+            // Other events of the filesystem are dropped
+            if (strncmp(directory, watcher->root, root_length) != 0 || (directory[root_length] != '\0' && directory[root_length] != '/')) {
+                continue;
+            }
+            if (strcmp(name, ".") == 0) {
+                continue;
+            }
+            if (snprintf(relative_path, sizeof(relative_path), "%s/%s", directory + root_length, name) >= (int) sizeof(relative_path)) {
+                continue;
+            }
+            if (!(event->mask & FAN_ONDIR) || (event->mask & (FAN_CREATE | FAN_MOVED_TO))) {
+                add_change(changes, relative_path);
+            }
+        }
+    }
+}
+
+/*!
+ * @brief open_fanotify watches the filesystem of the source with fanotify
+ * It needs CAP_SYS_ADMIN (and CAP_DAC_READ_SEARCH to open the handles) and Linux 5.9.
+ * @param watcher is a pointer to the watcher
+ * @return 0 when the source is watched, -1 else
+ */
+static int open_fanotify(watcher_t *watcher) {
+    watcher->fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME, O_RDONLY | O_LARGEFILE);
+    if (watcher->fd == -1) {
+        return -1;
+    }
+    watcher->mount_fd = open(watcher->root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (watcher->mount_fd == -1 || fanotify_mark(watcher->fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, WATCH_FANOTIFY_MASK, AT_FDCWD, watcher->root) == -1) {
+        if (watcher->mount_fd != -1) {
+            close(watcher->mount_fd);
+        }
+        close(watcher->fd);
+        return -1;
+    }
+
+    // Handles can only be opened with CAP_DAC_READ_SEARCH, try it on the source itself
+    struct {
+        struct file_handle handle;
+        unsigned char bytes[MAX_HANDLE_SZ];
+    } root_handle;
+    int mount_id;
+    root_handle.handle.handle_bytes = MAX_HANDLE_SZ;
+    int root_fd = -1;
+    if (name_to_handle_at(AT_FDCWD, watcher->root, &root_handle.handle, &mount_id, 0) == 0) {
+        root_fd = open_by_handle_at(watcher->mount_fd, &root_handle.handle, O_PATH);
+    }
+    if (root_fd == -1) {
+        close(watcher->mount_fd);
+        close(watcher->fd);
+        return -1;
+    }
+    close(root_fd);
+    watcher->mode = WATCH_FANOTIFY;
+    return 0;
+}
+
+/*!
+ * @brief open_inotify watches all the directories of the source with inotify
+ * @param watcher is a pointer to the watcher
+ * @return 0 when the source is watched, -1 else
+ */
+static int open_inotify(watcher_t *watcher) {
+    watcher->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watcher->fd == -1) {
+        return -1;
+    }
+    watcher->mode = WATCH_INOTIFY;
+    add_inotify_watches(watcher, "");
+    return 0;
+}
+
+/*!
+ * @brief open_watcher starts watching the source
+ * @param watcher is a pointer to the watcher
+ * @param the_config is a pointer to the configuration
+ * @return 0 when the source is watched, -1 else
+ */
+static int open_watcher(watcher_t *watcher, configuration_t *the_config) {
+    memset(watcher, 0, sizeof(watcher_t));
+    watcher->mount_fd = -1;
+    if (realpath(the_config->source, watcher->root) == NULL) {
+        fprintf(stderr, "Error resolving source %s: %s\n", the_config->source, strerror(errno));
+        return -1;
+    }
+
+    if (the_config->watch_mode != WATCH_INOTIFY && open_fanotify(watcher) == 0) {
+        return 0;
+    }
+    if (the_config->watch_mode == WATCH_FANOTIFY) {
+        fprintf(stderr, "Error watching %s with fanotify: %s\n", the_config->source, strerror(errno));
+        return -1;
+    }
+    if (open_inotify(watcher) == -1) {
+        fprintf(stderr, "Error watching %s with inotify: %s\n", the_config->source, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief close_watcher stops watching the source
+ * @param watcher is a pointer to the watcher
+ */
+static void close_watcher(watcher_t *watcher) {
+    for (size_t i = 0; i < watcher->directories_capacity; i++) {
+        free(watcher->directories[i]);
+    }
+    free(watcher->directories);
+    if (watcher->mount_fd != -1) {
+        close(watcher->mount_fd);
+    }
+    close(watcher->fd);
+}
+
+/*!
+ * @brief watch_source synchronizes the changes of the source until SIGINT or SIGTERM
+ * Events are coalesced until no event came for the watch delay (or for WATCH_MAX_DELAY_FACTOR delays when events
+ * keep coming), then the changed paths are synchronized. When events are lost, the whole source is synchronized.
+ * @param the_config is a pointer to the configuration
+ * @param p_context is a pointer to the processes context
+ * @return 0 when stopped by a signal, -1 on error
+ */
+int watch_source(configuration_t *the_config, process_context_t *p_context) {
+    watcher_t watcher;
+    if (open_watcher(&watcher, the_config) == -1) {
+        return -1;
+    }
+    if (the_config->verbose == true) {
+        printf("Watching %s with %s\n", the_config->source, watcher.mode == WATCH_FANOTIFY ? "fanotify" : "inotify");
+    }
+
+    watch_changes_t changes = {NULL, 0, 0, false, 0};
+    uint64_t max_delay_ns = (uint64_t) the_config->watch_delay_ms * WATCH_MAX_DELAY_FACTOR * 1000000;
+    int status = 0;
+
+    while (stop_requested == 0) {
+        bool pending = (changes.count > 0 || changes.rescan_all == true);
+        bool flush = false;
+        if (pending == true && stats_now_ns() - changes.first_change_ns >= max_delay_ns) {
+            flush = true;
+        } else {
+            struct pollfd poll_fd = {.fd = watcher.fd, .events = POLLIN};
+            int ready = poll(&poll_fd, 1, pending == true ? (int) the_config->watch_delay_ms : -1);
+            if (ready == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fprintf(stderr, "Error waiting for changes: %s\n", strerror(errno));
+                status = -1;
+                break;
+            }
+            if (ready == 0) {
+                flush = true;
+            } else if (watcher.mode == WATCH_FANOTIFY) {
+                read_fanotify_events(&watcher, &changes);
+            } else {
+                read_inotify_events(&watcher, &changes);
+            }
+        }
+
+        if (flush == true) {
+            char *whole_source = "";
+            if (changes.rescan_all == true) {
+                synchronize_paths(the_config, p_context, &whole_source, 1);
+            } else {
+                reduce_changes(&changes);
+                synchronize_paths(the_config, p_context, changes.paths, changes.count);
+            }
+            if (the_config->verbose == true && changes.rescan_all == true) {
+                printf("Events were lost, synchronized the whole source\n");
+            } else if (the_config->verbose == true) {
+                printf("Synchronized %zu changed paths\n", changes.count);
+            }
+            clear_changes(&changes);
+        }
+    }
+
+    clear_changes(&changes);
+    free(changes.paths);
+    close_watcher(&watcher);
+    return status;
+}